@@ -54,7 +54,7 @@ void send_acknowledge(struct player *pl)
 	/* check we filled the whole packet */
 	assert((ptr - data) == data_size);
 
-	err = sendto(pl->in_chan->in_server->socket_desc, data, data_size, 0, (struct sockaddr *)pl->cli_addr, pl->cli_len);
+	err = server_sendto(pl->in_chan->in_server, data, data_size, &pl->cli_addr, pl->cli_len);
 	if (err == -1) {
 		logger(LOG_ERR, "send_acknowledge, sending data failed : %s.", strerror(errno));
 	}
@@ -0,0 +1,250 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Per-server allocator of the long-lived objects (see arena.h).
+ * A chunk is filled from its start, and the tail too small for the
+ * next block goes to the freelists : all the blocks are multiples of
+ * ARENA_ALIGN, so the tail always has the size of a class.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "arena.h"
+#include "log.h"
+
+struct arena_chunk
+{
+	struct arena_chunk *next;
+};
+
+struct arena_large
+{
+	struct arena_large *prev;
+	struct arena_large *next;
+	size_t size;
+};
+
+/* the blocks follow the headers, aligned */
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+#define ARENA_CHUNK_HDR ARENA_ROUND(sizeof(struct arena_chunk))
+#define ARENA_LARGE_HDR ARENA_ROUND(sizeof(struct arena_large))
+
+/* the freelist of the blocks of a (rounded) size */
+#define ARENA_CLASS(size) ((size) / ARENA_ALIGN - 1)
+
+/**
+ * Create an empty arena. Nothing is reserved before the first
+ * allocation.
+ *
+ * @return the arena, NULL if the allocation failed
+ */
+struct arena *arena_new(void)
+{
+	struct arena *a;
+
+	a = (struct arena *)calloc(1, sizeof(struct arena));
+	if (a == NULL) {
+		logger(LOG_ERR, "arena_new, calloc failed : %s.", strerror(errno));
+		return NULL;
+	}
+	pthread_mutex_init(&a->lock, NULL);
+	return a;
+}
+
+/**
+ * Release an arena and every block allocated in it, freed or not.
+ *
+ * @param a the arena
+ */
+void arena_destroy(struct arena *a)
+{
+	struct arena_chunk *c;
+	struct arena_large *l;
+
+	while (a->chunks != NULL) {
+		c = a->chunks;
+		a->chunks = c->next;
+		free(c);
+	}
+	while (a->large != NULL) {
+		l = a->large;
+		a->large = l->next;
+		free(l);
+	}
+	pthread_mutex_destroy(&a->lock);
+	free(a);
+}
+
+/* a block of a small (rounded) size, the lock held */
+static void *arena_alloc_small(struct arena *a, size_t size)
+{
+	struct arena_chunk *c;
+	size_t tail;
+	void *ptr;
+
+	ptr = a->free[ARENA_CLASS(size)];
+	if (ptr != NULL) {
+		a->free[ARENA_CLASS(size)] = *(void **)ptr;
+		return ptr;
+	}
+	if (a->chunks == NULL || a->chunk_used + size > ARENA_CHUNK_SIZE) {
+		c = (struct arena_chunk *)malloc(ARENA_CHUNK_SIZE);
+		if (c == NULL) {
+			logger(LOG_ERR, "arena_alloc, malloc failed : %s.", strerror(errno));
+			return NULL;
+		}
+		/* keep the tail of the current chunk */
+		if (a->chunks != NULL && a->chunk_used < ARENA_CHUNK_SIZE) {
+			tail = ARENA_CHUNK_SIZE - a->chunk_used;
+			ptr = (char *)a->chunks + a->chunk_used;
+			*(void **)ptr = a->free[ARENA_CLASS(tail)];
+			a->free[ARENA_CLASS(tail)] = ptr;
+		}
+		c->next = a->chunks;
+		a->chunks = c;
+		a->chunk_used = ARENA_CHUNK_HDR;
+		a->reserved += ARENA_CHUNK_SIZE;
+	}
+	ptr = (char *)a->chunks + a->chunk_used;
+	a->chunk_used += size;
+	return ptr;
+}
+
+/**
+ * Allocate a zeroed block in an arena.
+ *
+ * @param a the arena
+ * @param size the size of the block
+ *
+ * @return the block, NULL if the allocation failed
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_large *l;
+	void *ptr;
+
+	size = ARENA_ROUND(size == 0 ? 1 : size);
+	pthread_mutex_lock(&a->lock);
+	if (size <= ARENA_MAX_SMALL) {
+		ptr = arena_alloc_small(a, size);
+	} else {
+		l = (struct arena_large *)malloc(ARENA_LARGE_HDR + size);
+		if (l == NULL) {
+			logger(LOG_ERR, "arena_alloc, malloc failed : %s.", strerror(errno));
+			ptr = NULL;
+		} else {
+			l->size = size;
+			l->prev = NULL;
+			l->next = a->large;
+			if (a->large != NULL)
+				a->large->prev = l;
+			a->large = l;
+			a->reserved += ARENA_LARGE_HDR + size;
+			ptr = (char *)l + ARENA_LARGE_HDR;
+		}
+	}
+	if (ptr != NULL)
+		a->used += size;
+	pthread_mutex_unlock(&a->lock);
+	if (ptr != NULL)
+		bzero(ptr, size);
+	return ptr;
+}
+
+/**
+ * Give a block back to its arena, for the next block of its size.
+ *
+ * @param a the arena
+ * @param ptr the block (NULL does nothing)
+ * @param size the size it was allocated with
+ */
+void arena_free(struct arena *a, void *ptr, size_t size)
+{
+	struct arena_large *l;
+
+	if (ptr == NULL)
+		return;
+	size = ARENA_ROUND(size == 0 ? 1 : size);
+	pthread_mutex_lock(&a->lock);
+	a->used -= size;
+	if (size <= ARENA_MAX_SMALL) {
+		*(void **)ptr = a->free[ARENA_CLASS(size)];
+		a->free[ARENA_CLASS(size)] = ptr;
+	} else {
+		l = (struct arena_large *)((char *)ptr - ARENA_LARGE_HDR);
+		if (l->prev != NULL)
+			l->prev->next = l->next;
+		else
+			a->large = l->next;
+		if (l->next != NULL)
+			l->next->prev = l->prev;
+		a->reserved -= ARENA_LARGE_HDR + size;
+		free(l);
+	}
+	pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * Copy a string in an arena.
+ *
+ * @param a the arena
+ * @param str the string
+ *
+ * @return the copy, NULL if the allocation failed
+ */
+char *arena_strdup(struct arena *a, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy;
+
+	copy = (char *)arena_alloc(a, len);
+	if (copy != NULL)
+		memcpy(copy, str, len);
+	return copy;
+}
+
+/**
+ * Free a string copied by arena_strdup.
+ *
+ * @param a the arena
+ * @param str the string (NULL does nothing)
+ */
+void arena_strfree(struct arena *a, char *str)
+{
+	if (str != NULL)
+		arena_free(a, str, strlen(str) + 1);
+}
+
+/**
+ * The memory of an arena.
+ *
+ * @param a the arena
+ * @param reserved the bytes taken from the system
+ * @param used the bytes of the blocks in use
+ */
+void arena_usage(struct arena *a, size_t *reserved, size_t *used)
+{
+	pthread_mutex_lock(&a->lock);
+	*reserved = a->reserved;
+	*used = a->used;
+	pthread_mutex_unlock(&a->lock);
+}
@@ -0,0 +1,66 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * The long-lived state of a virtual server (channels and their
+ * strings, registrations, bans, channel privileges) is carved out of
+ * large chunks owned by the server, instead of being scattered in
+ * small mallocs. The blocks are rounded to ARENA_ALIGN and a freed
+ * block goes to the freelist of its size, where the next object of
+ * the same size (a channel created after one was deleted) takes it.
+ * Blocks bigger than ARENA_MAX_SMALL are allocated alone.
+ * The whole arena is released at once with the server.
+ */
+#define ARENA_ALIGN 16
+#define ARENA_MAX_SMALL 512
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_NB_CLASSES (ARENA_MAX_SMALL / ARENA_ALIGN)
+
+struct arena_chunk;
+struct arena_large;
+
+struct arena
+{
+	struct arena_chunk *chunks;	/* the current one first */
+	size_t chunk_used;		/* bytes given out of the current one */
+	void *free[ARENA_NB_CLASSES];	/* freed blocks, by size */
+	struct arena_large *large;	/* the big blocks */
+
+	size_t reserved;		/* bytes taken from the system */
+	size_t used;			/* bytes of the live blocks */
+
+	/* the packet sender frees the retired channels */
+	pthread_mutex_t lock;
+};
+
+struct arena *arena_new(void);
+void arena_destroy(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size);
+void arena_free(struct arena *a, void *ptr, size_t size);
+char *arena_strdup(struct arena *a, const char *str);
+void arena_strfree(struct arena *a, char *str);
+void arena_usage(struct arena *a, size_t *reserved, size_t *used);
+
+#endif
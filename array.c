@@ -16,13 +16,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <assert.h>
 #include <strings.h>
-#include <math.h>
 #include <limits.h>
 #include <errno.h>
 
@@ -30,24 +30,147 @@
 #include "log.h"
 #include "compat.h"
 
+#define AR_NO_SLOT UINT32_MAX
+
+/* the position of a pointer in the index */
+static size_t ar_hash(const struct array *a, void *el)
+{
+	uint64_t h = ((uintptr_t)el >> 3) * 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(h >> 32) & a->index_mask;
+}
+
+static void *ar_slot_elem(const struct array *a, uint32_t slot)
+{
+	return a->array[a->slots[slot].pos];
+}
+
 /**
- * Find the next available slot in the array.
+ * Find the position of an element.
  *
  * @param a the array
+ * @param el the element
  *
- * @return the first slot available, or -1 if the array is already full
+ * @return its position, or -1 if it is not in the array
  */
-static int ar_next_available(const struct array *a)
+static ssize_t ar_find(const struct array *a, void *el)
 {
 	size_t i;
 
-	for (i = 0 ; i < a->total_slots ; i++) {
-		if(a->array[i] == NULL)
-			return (int)i;
+	if (a->index != NULL) {
+		for (i = ar_hash(a, el) ; a->index[i] != 0 ; i = (i + 1) & a->index_mask) {
+			if (ar_slot_elem(a, a->index[i] - 1) == el)
+				return a->slots[a->index[i] - 1].pos;
+		}
+		return -1;
+	}
+	for (i = 0 ; i < a->used_slots ; i++) {
+		if (a->array[i] == el)
+			return i;
 	}
 	return -1;
 }
 
+static void ar_index_add(struct array *a, void *el, uint32_t slot)
+{
+	size_t i;
+
+	for (i = ar_hash(a, el) ; a->index[i] != 0 ; i = (i + 1) & a->index_mask)
+		;
+	a->index[i] = slot + 1;
+}
+
+/* linear probing : the following entries are moved back in the hole */
+static void ar_index_del(struct array *a, void *el)
+{
+	size_t i, j, h;
+
+	for (i = ar_hash(a, el) ; ar_slot_elem(a, a->index[i] - 1) != el ; i = (i + 1) & a->index_mask)
+		;
+	a->index[i] = 0;
+	for (j = (i + 1) & a->index_mask ; a->index[j] != 0 ; j = (j + 1) & a->index_mask) {
+		h = ar_hash(a, ar_slot_elem(a, a->index[j] - 1));
+		/* the entry stays if its hash is in ]i, j] (cyclically) */
+		if ((j > i && (h <= i || h > j)) || (j < i && h <= i && h > j)) {
+			a->index[i] = a->index[j];
+			a->index[j] = 0;
+			i = j;
+		}
+	}
+}
+
+/**
+ * Build the index of the pointers for the current size of the
+ * array (twice as many entries as slots), or drop it if the array
+ * is small enough to be scanned.
+ *
+ * @param a the array
+ *
+ * @return AR_OK on success, 0 if the index could not be allocated
+ */
+static int ar_index_build(struct array *a)
+{
+	size_t size = 1, i;
+	uint32_t *index;
+
+	if (a->total_slots <= AR_INDEX_MIN) {
+		free(a->index);
+		a->index = NULL;
+		return AR_OK;
+	}
+	while (size < a->total_slots * 2)
+		size <<= 1;
+	index = (uint32_t *)calloc(size, sizeof(uint32_t));
+	if (index == NULL) {
+		logger(LOG_ERR, "ar_index_build, calloc failed : %s", strerror(errno));
+		return 0;
+	}
+	free(a->index);
+	a->index = index;
+	a->index_mask = size - 1;
+	for (i = 0 ; i < a->used_slots ; i++)
+		ar_index_add(a, a->array[i], a->slot_of[i]);
+	return AR_OK;
+}
+
+/**
+ * Change the number of positions of an array.
+ *
+ * @param a the array
+ * @param size the new number of positions (at least used_slots)
+ *
+ * @return AR_OK on success, 0 on failure (the array is unchanged)
+ */
+static int ar_resize(struct array *a, size_t size)
+{
+	void **tmp_alloc;
+	uint32_t *tmp_slots;
+	size_t old_size = a->total_slots;
+
+	tmp_alloc = (void **)realloc(a->array, sizeof(void *) * size);
+	if (tmp_alloc == NULL) {
+		logger(LOG_ERR, "ar_resize, realloc failed : %s", strerror(errno));
+		return 0;
+	}
+	a->array = tmp_alloc;
+	tmp_slots = (uint32_t *)realloc(a->slot_of, sizeof(uint32_t) * size);
+	if (tmp_slots != NULL) {
+		a->slot_of = tmp_slots;
+	} else if (size > old_size) {
+		logger(LOG_ERR, "ar_resize, realloc failed : %s", strerror(errno));
+		return 0;
+	}	/* else the old, bigger, one is still fine */
+	/* realloc does not set to zero!! */
+	if (size > old_size)
+		bzero(a->array + old_size, (size - old_size) * sizeof(void *));
+	a->total_slots = size;
+	if (!ar_index_build(a)) {
+		a->total_slots = old_size;
+		return 0;
+	}
+	return AR_OK;
+}
+
 /**
  * Grow an array to twice its current size
  *
@@ -55,35 +178,69 @@ static int ar_next_available(const struct array *a)
  */
 static int ar_grow(struct array *a)
 {
-	size_t old_size, new_size;
-	void **tmp_alloc;
-
 	if (a == NULL || a->array == NULL) {
 		logger(LOG_WARN, "ar_grow : passed array is not allocated.");
 		return 0;
 	}
 
-	if (a->total_slots < a->max_slots) {
-		old_size = a->total_slots;
-		new_size = MIN(a->total_slots * 2, a->max_slots);
+	if (a->total_slots < a->max_slots)
+		return ar_resize(a, MIN(a->total_slots * 2, a->max_slots));
+	return 0;
+}
+
+/**
+ * Halve an array that is used at less than a quarter, down to
+ * its initial size. The slots of the elements are kept.
+ *
+ * @param a the array
+ */
+static void ar_shrink(struct array *a)
+{
+	if (a->total_slots > a->min_slots && a->used_slots <= a->total_slots / 4)
+		ar_resize(a, MAX(a->total_slots / 2, a->min_slots));
+}
+
+/**
+ * Take a free slot for a new element.
+ *
+ * @return the slot, or AR_NO_SLOT on failure
+ */
+static uint32_t ar_alloc_slot(struct array *a)
+{
+	struct ar_slot *tmp_alloc;
+	uint32_t slot, i, nb;
 
-		a->total_slots = new_size;
-		tmp_alloc = (void **)realloc(a->array, sizeof(void *) * (a->total_slots));
+	if (a->free_slot == AR_NO_SLOT) {
+		nb = MAX(a->nb_slots * 2, 2);
+		if (nb <= a->nb_slots || nb == AR_NO_SLOT) {
+			logger(LOG_ERR, "ar_alloc_slot : too many slots.");
+			return AR_NO_SLOT;
+		}
+		tmp_alloc = (struct ar_slot *)realloc(a->slots, sizeof(struct ar_slot) * nb);
 		if (tmp_alloc == NULL) {
-			logger(LOG_ERR, "ar_grow, realloc failed : %s", strerror(errno));
-			return 0;
+			logger(LOG_ERR, "ar_alloc_slot, realloc failed : %s", strerror(errno));
+			return AR_NO_SLOT;
 		}
-		a->array = tmp_alloc;
-
-		/* realloc does not set to zero!! */
-		bzero(a->array + old_size, (a->total_slots - old_size) * sizeof(void *));
-		return AR_OK;
+		a->slots = tmp_alloc;
+		for (i = a->nb_slots ; i < nb ; i++)
+			a->slots[i].pos = (i + 1 < nb) ? i + 1 : AR_NO_SLOT;
+		a->free_slot = a->nb_slots;
+		a->nb_slots = nb;
 	}
-	return 0;
+	slot = a->free_slot;
+	a->free_slot = a->slots[slot].pos;
+	return slot;
+}
+
+static void ar_free_slot(struct array *a, uint32_t slot)
+{
+	a->slots[slot].pos = a->free_slot;
+	a->free_slot = slot;
 }
 
 /**
- * Insert an element into the array, resizing if needed
+ * Insert an element into the array, resizing if needed.
+ * An element already in the array is not added twice.
  *
  * @param a the array
  * @param elem a generic pointer to an element
@@ -92,10 +249,14 @@ static int ar_grow(struct array *a)
  */
 int ar_insert(struct array *a, void *elem)
 {
-	int i;
+	uint32_t slot;
 	int err;
 
 	pthread_mutex_lock(&a->lock);
+	if (ar_find(a, elem) != -1) {
+		pthread_mutex_unlock(&a->lock);
+		return AR_OK;
+	}
 	if (a->used_slots == a->total_slots) {
 		err = ar_grow(a);
 		if (err != AR_OK) {
@@ -104,15 +265,19 @@ int ar_insert(struct array *a, void *elem)
 			return 0;
 		}
 	}
-	i = ar_next_available(a);
-	if (i != -1) {
-		a->array[i] = elem;
-		a->used_slots++;
+	slot = ar_alloc_slot(a);
+	if (slot == AR_NO_SLOT) {
 		pthread_mutex_unlock(&a->lock);
-		return AR_OK;
+		return 0;
 	}
+	a->array[a->used_slots] = elem;
+	a->slot_of[a->used_slots] = slot;
+	a->slots[slot].pos = a->used_slots;
+	a->used_slots++;
+	if (a->index != NULL)
+		ar_index_add(a, elem, slot);
 	pthread_mutex_unlock(&a->lock);
-	return 0;
+	return AR_OK;
 }
 
 /**
@@ -132,11 +297,16 @@ struct array *ar_new(size_t size)
 		return NULL;
 	}
 	a->total_slots = size;
+	a->min_slots = size;
 	a->used_slots = 0;
 	a->max_slots = (size_t) - 1;
+	a->free_slot = AR_NO_SLOT;
 	a->array = (void **)calloc(size, sizeof(void *));
-	if (a->array == NULL) {
+	a->slot_of = (uint32_t *)calloc(size, sizeof(uint32_t));
+	if (a->array == NULL || a->slot_of == NULL || !ar_index_build(a)) {
 		logger(LOG_ERR, "ar_new, a->array calloc failed : %s", strerror(errno));
+		free(a->array);
+		free(a->slot_of);
 		free(a);
 		return NULL;
 	}
@@ -145,26 +315,28 @@ struct array *ar_new(size_t size)
 }
 
 /**
- * Remove the entry at the given index in the array
- * and shrinks the array if necessary.
- * Shrinking is not implemented yet.
+ * Remove the entry at the given position in the array : the
+ * last element takes its place. Shrinks the array if necessary.
  *
  * @param a the array
- * @param index the index of the element that has to be removed
+ * @param idx the position of the element that has to be removed
  */
 static void ar_remove_index(struct array *a, size_t idx)
 {
-	if (a == NULL || a->array == NULL) {
-		logger(LOG_WARN, "ar_remove_index, passed array is unallocated.");
-		return;
-	}
-	if (a->array[idx] != NULL) {
-		a->array[idx] = NULL; /* clear the pointer */
-		a->used_slots--;
+	uint32_t slot = a->slot_of[idx];
+	size_t last = a->used_slots - 1;
+
+	if (a->index != NULL)
+		ar_index_del(a, a->array[idx]);
+	if (idx != last) {
+		a->array[idx] = a->array[last];
+		a->slot_of[idx] = a->slot_of[last];
+		a->slots[a->slot_of[idx]].pos = idx;
 	}
-	return;
-	/* Add some table shrinking logic 
-	 * if too many slots are unused */
+	a->array[last] = NULL;
+	a->used_slots--;
+	ar_free_slot(a, slot);
+	ar_shrink(a);
 }
 
 /**
@@ -177,21 +349,36 @@ static void ar_remove_index(struct array *a, size_t idx)
  */
 void ar_remove(struct array *a, void *el) 
 {
-	size_t i;
-	char found = 0;
+	ssize_t i;
 
 	pthread_mutex_lock(&a->lock);
+	i = ar_find(a, el);
+	if (i != -1)
+		ar_remove_index(a, i);
+	pthread_mutex_unlock(&a->lock);
+	if (i == -1)
+		logger(LOG_ERR, "ar_remove : pointer %p was not found in our array.\n", el);
+}	
 
-	for (i=0 ; i < a->total_slots ; i++) {
-		if (a->array[i] == el) {
-			ar_remove_index(a, i);
-			found = 1;
-		}
+/**
+ * Remove all the elements from the array, without
+ * freeing them.
+ *
+ * @param a the array
+ */
+void ar_clear(struct array *a)
+{
+	pthread_mutex_lock(&a->lock);
+	while (a->used_slots > 0) {
+		a->used_slots--;
+		ar_free_slot(a, a->slot_of[a->used_slots]);
+		a->array[a->used_slots] = NULL;
 	}
+	if (a->index != NULL)
+		bzero(a->index, (a->index_mask + 1) * sizeof(uint32_t));
+	ar_shrink(a);
 	pthread_mutex_unlock(&a->lock);
-	if (found == 0)
-		logger(LOG_ERR, "ar_remove : pointer 0x%x was not found in our array.\n", el);
-}	
+}
 
 /**
  * Retrieves a given number of elements, starting at a given index
@@ -206,32 +393,21 @@ void ar_remove(struct array *a, void *el)
  */
 int ar_get_n_elems_start_at(struct array *a, int max_elem, size_t start_at, void **res)
 {
-	size_t i=0;
-	size_t nb_elem = 0;
-	int el_counter = 0;
+	size_t nb_elem;
 
 	pthread_mutex_lock(&a->lock);
 	if (a->used_slots <= start_at) {
 		pthread_mutex_unlock(&a->lock);
 		return 0;
 	}
-
-	for (i=0 ; i < a->total_slots ; i++) {
-		if (a->array[i] != NULL) {
-			if (nb_elem >= start_at && nb_elem < (start_at + max_elem)) {
-				res[nb_elem - start_at] = a->array[i];
-				el_counter++;
-			}
-			nb_elem++;
-		}
-	}
+	nb_elem = MIN((size_t)max_elem, a->used_slots - start_at);
+	memcpy(res, a->array + start_at, nb_elem * sizeof(void *));
 	pthread_mutex_unlock(&a->lock);
-	return el_counter;
+	return (int)nb_elem;
 }
 
 int ar_free(struct array *a)
 {
-	size_t i;
 	pthread_mutex_lock(&a->lock);
 	/* if the array is not allocated, we cannot free it */
 	if (a == NULL || a->array == NULL) {
@@ -241,14 +417,15 @@ int ar_free(struct array *a)
 	}
 
 	/* if the array is not empty, we cannot free it */
-	for (i = 0 ; i < a->total_slots ; i++) {
-		if (a->array[i] != NULL) {
-			logger(LOG_ERR, "ar_free : Trying to free an array that is not empty.");
-			pthread_mutex_unlock(&a->lock);
-			return 0;
-		}
+	if (a->used_slots != 0) {
+		logger(LOG_ERR, "ar_free : Trying to free an array that is not empty.");
+		pthread_mutex_unlock(&a->lock);
+		return 0;
 	}
 	free(a->array);
+	free(a->slot_of);
+	free(a->slots);
+	free(a->index);
 	pthread_mutex_unlock(&a->lock);
 	pthread_mutex_destroy(&a->lock);
 	free(a);
@@ -257,12 +434,37 @@ int ar_free(struct array *a)
 
 int ar_has(struct array *a, void *el)
 {
-	size_t iter;
-	void *tmp_el;
+	return ar_find(a, el) != -1;
+}
+
+/**
+ * Copy the elements of an array, under its lock, to walk them
+ * with ar_snapshot_each while the array changes.
+ *
+ * @param a the array
+ * @param snap the snapshot, freed with ar_snapshot_free
+ *
+ * @return AR_OK on success, 0 on failure (the snapshot is empty)
+ */
+int ar_snapshot(struct array *a, struct ar_snapshot *snap)
+{
+	pthread_mutex_lock(&a->lock);
+	snap->nb = a->used_slots;
+	snap->el = (void **)malloc(sizeof(void *) * (snap->nb + 1));
+	if (snap->el == NULL) {
+		logger(LOG_ERR, "ar_snapshot, malloc failed : %s", strerror(errno));
+		snap->nb = 0;
+		pthread_mutex_unlock(&a->lock);
+		return 0;
+	}
+	memcpy(snap->el, a->array, sizeof(void *) * snap->nb);
+	pthread_mutex_unlock(&a->lock);
+	return AR_OK;
+}
 
-	ar_each(void *, tmp_el, iter, a)
-		if (tmp_el == el)
-			return 1;
-	ar_end_each;
-	return 0;
+void ar_snapshot_free(struct ar_snapshot *snap)
+{
+	free(snap->el);
+	snap->el = NULL;
+	snap->nb = 0;
 }
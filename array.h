@@ -16,36 +16,77 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #ifndef __ARRAY_H__
 #define __ARRAY_H__
 
 #include <pthread.h>
+#include <stdint.h>
+
+/*
+ * The elements are kept dense in array[0 .. used_slots[ : a removal
+ * moves the last element in the hole. Each element also owns a slot,
+ * that still finds it when it moves.
+ * Beyond AR_INDEX_MIN slots, an index of the slots makes ar_has
+ * and ar_remove constant time.
+ */
+struct ar_slot {
+	uint32_t pos;	/* position of the element, or next free slot */
+};
 
 struct array {
 	void **array;
 	size_t used_slots;
 	size_t total_slots;
 	size_t max_slots;
+	size_t min_slots;	/* the array does not shrink below */
+
+	uint32_t *slot_of;	/* slot of the element at each position */
+	struct ar_slot *slots;
+	uint32_t nb_slots;
+	uint32_t free_slot;
+
+	uint32_t *index;	/* slot + 1 of the pointers, by hash, or NULL */
+	size_t index_mask;
 
 	pthread_mutex_t lock;
 };
 
+/* a copy of the elements, to walk an array that may change meanwhile */
+struct ar_snapshot {
+	void **el;
+	size_t nb;
+};
 
 #define AR_OK 1
+#define AR_INDEX_MIN 16
 
+/* The elements are walked from the last one, so the current element
+ * can be removed (the last one, already seen, takes its place) */
 #define ar_each(type, el_ptr, iter, a)\
-for(iter=0 ; iter < a->total_slots ; iter++) {\
-	if(a->array[iter] != NULL) {\
+for(iter = a->used_slots ; iter-- > 0 ; ) {\
+	if(iter < a->used_slots) {\
 		el_ptr = (type) a->array[iter];
 
 #define ar_end_each }}
 
+#define ar_snapshot_each(type, el_ptr, iter, snap)\
+for(iter = 0 ; iter < (snap)->nb ; iter++) {\
+	{\
+		el_ptr = (type) (snap)->el[iter];
+
+#define ar_snapshot_end_each }}
+
 
 struct array *ar_new(size_t size);
 int ar_insert(struct array *a, void *elem);
 void ar_remove(struct array *a, void *el);
+void ar_clear(struct array *a);
 int ar_has(struct array *a, void *el);
 int ar_get_n_elems_start_at(struct array *a, int max_elem, size_t start_at, void **res);
 int ar_free(struct array *a);
 
+int ar_snapshot(struct array *a, struct ar_snapshot *snap);
+void ar_snapshot_free(struct ar_snapshot *snap);
+
 #endif
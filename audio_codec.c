@@ -0,0 +1,31 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "audio_packet.h"
+
+#include <stddef.h>
+
+/* Codec tables, kept apart from audio_packet.c so the benchmark
+ * clients can build audio blocks without the whole server. */
+
+/** The size of the raw audio block (in bytes) */
+size_t codec_audio_size[13] = {153, 51, 165, 132, 0, 27, 50, 75, 100, 138, 188, 228, 308};
+/** The number of frames contained in one block */
+size_t codec_nb_frames[13] = { 9, 3, 5, 4,	0, 5, 5, 5, 5, 5, 5, 5, 5};
+/** The offset of the audio block after the 16 bytes of header */
+size_t codec_offset[13] = {6, 6, 6, 6, 0, 1, 1, 1, 1, 1, 1, 1, 1};
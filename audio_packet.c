@@ -23,9 +23,17 @@
 #include "channel.h"
 #include "array.h"
 #include "server_stat.h"
+#include "player_stat.h"
+#include "compat.h"
 #include "log.h"
+#include "mclock.h"
+#include "trace.h"
+#include "latency.h"
 
 #include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,13 +41,37 @@
 #include <errno.h>
 #include <assert.h>
 
-/** The size of the raw audio block (in bytes) */
-size_t codec_audio_size[13] = {153, 51, 165, 132, 0, 27, 50, 75, 100, 138, 188, 228, 308};
-/** The number of frames contained in one block */
-size_t codec_nb_frames[13] = { 9, 3, 5, 4,	0, 5, 5, 5, 5, 5, 5, 5, 5};
-/** The offset of the audio block after the 16 bytes of header */
-size_t codec_offset[13] = {6, 6, 6, 6, 0, 1, 1, 1, 1, 1, 1, 1, 1};
+/**
+ * Build the packet forwarded to the other players of the channel,
+ * (the ids of the destination are written later at data + 4).
+ *
+ * @param data the packet to fill (16 + 6 + audio_block_size bytes)
+ * @param in the received audio packet
+ * @param audio_block_size the size of the audio block
+ * @param codec the codec of the channel
+ * @param sender_id the public id of the sender
+ */
+static void audio_build_forward(char *data, char *in, size_t audio_block_size,
+		uint8_t codec, uint32_t sender_id)
+{
+	char *ptr = data;
+
+	wu16(0xbef3, &ptr); 			/* function code */
+	/* 1 byte empty */				ptr += 1;		/* NULL */
+	wu8(codec, &ptr);			/* codec */
+	/* private ID */				ptr += 4;		/* empty yet */
+	/* public ID */					ptr += 4;		/* empty yet */
+	wu16(0, &ptr);				/* unknown, maybe server conversation ID? */
+	wu16(*(uint16_t *)(in + 14), &ptr);	/* counter */
+	wu32(sender_id, &ptr);			/* ID of sender */
+	wu16(*(uint16_t *)(in + 12), &ptr);	/* conversation counter */
+	/* audio data */
+	memcpy(ptr, in + 16, audio_block_size);
+	ptr += audio_block_size;
 
+	/* assert we filled the whole packet */
+	assert((ptr - data) == 16 + 6 + audio_block_size);
+}
 
 /**
  * Handle a received audio packet by sending its audio
@@ -57,12 +89,12 @@ int audio_received(char *in, size_t len, struct server *s)
 
 	struct player *sender;
 	struct channel *ch_in;
-	struct player *tmp_pl;
+	struct player *tmp_pl, *next;
 
 	size_t data_size, audio_block_size, expected_size;
 	ssize_t err;
-	size_t iter;
 	char *data, *ptr, *ptrin;
+	int receivers = 0;
 	
 	ptrin = in;
 	ptrin += 3;
@@ -73,11 +105,12 @@ int audio_received(char *in, size_t len, struct server *s)
 	sender = get_player_by_ids(s, pub_id, priv_id);
 
 	if (sender != NULL) {
-		sender->stats->activ_time = time(NULL);	/* update */
+		sender->stats.activ_time = mclock_seconds();	/* update */
 		ch_in = sender->in_chan;
 		/* Security checks */
 		if (data_codec != ch_in->codec) {
 			logger(LOG_ERR, "Player sent a wrong codec ID : %" PRIu8 ", expected : %" PRIu8 ".", data_codec, ch_in->codec);
+			TRACE(s, TRACE_AUDIO, in, len, TRACE_BAD_CODEC, 0);
 			return -1;
 		}
 
@@ -86,6 +119,7 @@ int audio_received(char *in, size_t len, struct server *s)
 		if (len != expected_size) {
 			logger(LOG_ERR, "Audio packet's size is incorrect : %zu bytes, expected : %zu.", len,
 					expected_size);
+			TRACE(s, TRACE_AUDIO, in, len, TRACE_BAD_SIZE, 0);
 			return -1;
 		}
 
@@ -94,41 +128,523 @@ int audio_received(char *in, size_t len, struct server *s)
 		data = (char *)calloc(data_size, sizeof(char));
 		if (data == NULL) {
 			logger(LOG_WARN, "audio_received, could not allocate packet : %s.", strerror(errno));
+			TRACE(s, TRACE_AUDIO, in, len, TRACE_ERROR, 0);
 			return -1;
 		}
-		ptr = data;
-		wu16(0xbef3, &ptr); 			/* function code */
-		/* 1 byte empty */				ptr += 1;		/* NULL */
-		wu8(ch_in->codec, &ptr);		/* codec */
-		/* private ID */				ptr += 4;		/* empty yet */
-		/* public ID */					ptr += 4;		/* empty yet */
-		wu16(0, &ptr);				/* unknown, maybe server conversation ID? */
-		wu16(*(uint16_t *)(in + 14), &ptr);	/* counter */
-		wu32(sender->public_id, &ptr);		/* ID of sender */
-		wu16(*(uint16_t *)(in + 12), &ptr);	/* conversation counter */
-		/* audio data */
-		memcpy(ptr, in + 16, audio_block_size);
-		ptr += audio_block_size;
-
-		/* assert we filled the whole packet */
-		assert((ptr - data) == data_size);
-
-		ar_each(struct player *, tmp_pl, iter, ch_in->players)
+		audio_build_forward(data, in, audio_block_size, ch_in->codec, sender->public_id);
+
+		il_each(tmp_pl, next, &ch_in->players, chan_link)
 			if (tmp_pl != sender && !ar_has(tmp_pl->muted, sender)) {
 				ptr = data + 4;
 				wu32(tmp_pl->private_id, &ptr);
 				wu32(tmp_pl->public_id, &ptr);
-				err = sendto(sender->in_chan->in_server->socket_desc, data, data_size, 0,
-						(struct sockaddr *)tmp_pl->cli_addr, tmp_pl->cli_len);
+				err = server_sendto(s, data, data_size, &tmp_pl->cli_addr, tmp_pl->cli_len);
 				if (err == -1) {
 					logger(LOG_WARN, "audio_received, could not send packet : %s.", strerror(errno));
 				}
+				receivers++;
 			}
-		ar_end_each;
+		il_end_each;
 		free(data);
+		METRIC_ADD(s, audio_forwarded, receivers);
+		TRACE(s, TRACE_AUDIO, in, len, TRACE_OK, receivers);
 		return 0;
 	} else {
 		logger(LOG_ERR, "Wrong public/private ID pair : %x/%x.", pub_id, priv_id);
+		TRACE(s, TRACE_AUDIO, in, len, TRACE_NO_PLAYER, 0);
 		return -1;
 	}
 }
+
+/*
+ * Dedicated audio path : the receiving threads push the audio packets
+ * in a lock-free queue, and one thread per server forwards them using
+ * a snapshot of the channels (members, codecs, mutes). The snapshot is
+ * rebuilt by the threads that change the server (under the exclusive
+ * server lock), only when the channels, their members or the mutes
+ * changed, and swapped atomically, so forwarding never waits for
+ * commands or the database.
+ * Old snapshots (and the players that left) are only freed once the
+ * audio thread has picked a newer snapshot.
+ */
+
+#define AUDIO_QUEUE_SIZE 1024	/* power of 2 */
+#define AUDIO_MAX_PKT 512
+
+struct audio_cell {
+	unsigned int seq;
+	unsigned short len;
+	char data[AUDIO_MAX_PKT];
+};
+
+struct audio_member {
+	uint32_t public_id;
+	uint32_t private_id;
+	struct sockaddr_in addr;
+	unsigned int addr_len;
+	struct player_stat *stats;
+	uint32_t *muted;	/* public ids of the players he muted */
+	int nb_muted;
+	int chan;
+};
+
+struct audio_chan {
+	uint8_t codec;
+	int first;		/* members of the channel are contiguous */
+	int count;
+};
+
+/* the members sorted by public id, to find the sender */
+struct audio_id {
+	uint32_t public_id;
+	int member;
+};
+
+struct audio_snapshot {
+	uint32_t gen;
+	int nb_members;
+	int nb_chans;
+	struct audio_member *members;
+	struct audio_chan *chans;
+	struct audio_id *by_id;
+	uint32_t *muted;
+	struct audio_snapshot *next_retired;
+};
+
+struct audio_path {
+	struct audio_cell *cells;
+	unsigned int enqueue_pos;
+	unsigned int dequeue_pos;
+	sem_t wakeup;
+
+	struct audio_snapshot *current;
+	uint32_t seen_gen;	/* last generation used by the audio thread */
+	uint64_t dropped;	/* packets dropped because the queue was full */
+	uint32_t last_gen;
+	int changed;		/* current is out of date */
+	struct audio_snapshot *retired;
+
+	pthread_t thread;
+};
+
+static int audio_id_cmp(const void *a, const void *b)
+{
+	uint32_t id_a = ((const struct audio_id *)a)->public_id;
+	uint32_t id_b = ((const struct audio_id *)b)->public_id;
+
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+static void audio_snapshot_free(struct audio_snapshot *snap)
+{
+	free(snap->members);
+	free(snap->chans);
+	free(snap->by_id);
+	free(snap->muted);
+	free(snap);
+}
+
+/**
+ * Copy what the audio thread needs to know about the channels.
+ * Called with the server lock held exclusively.
+ *
+ * @param s the server
+ * @param gen the generation of the snapshot
+ *
+ * @return the snapshot, NULL on failure
+ */
+static struct audio_snapshot *audio_snapshot_build(struct server *s, uint32_t gen)
+{
+	struct audio_snapshot *snap;
+	struct audio_member *m;
+	struct channel *ch;
+	struct player *pl, *next, *muted;
+	size_t iter, iter2;
+	int nb_muted = 0, nb_members = 0, c = 0, i = 0, k = 0;
+
+	ar_each(struct channel *, ch, iter, s->chans)
+		nb_members += ch->players.count;
+		il_each(pl, next, &ch->players, chan_link)
+			nb_muted += pl->muted->used_slots;
+		il_end_each;
+	ar_end_each;
+
+	snap = (struct audio_snapshot *)calloc(1, sizeof(struct audio_snapshot));
+	if (snap == NULL) {
+		logger(LOG_WARN, "audio_snapshot_build, calloc failed : %s.", strerror(errno));
+		return NULL;
+	}
+	snap->gen = gen;
+	snap->members = (struct audio_member *)calloc(nb_members + 1, sizeof(struct audio_member));
+	snap->chans = (struct audio_chan *)calloc(s->chans->used_slots + 1, sizeof(struct audio_chan));
+	snap->by_id = (struct audio_id *)calloc(nb_members + 1, sizeof(struct audio_id));
+	snap->muted = (uint32_t *)calloc(nb_muted + 1, sizeof(uint32_t));
+	if (snap->members == NULL || snap->chans == NULL || snap->by_id == NULL || snap->muted == NULL) {
+		logger(LOG_WARN, "audio_snapshot_build, calloc failed : %s.", strerror(errno));
+		audio_snapshot_free(snap);
+		return NULL;
+	}
+
+	ar_each(struct channel *, ch, iter, s->chans)
+		snap->chans[c].codec = ch->codec;
+		snap->chans[c].first = i;
+		il_each(pl, next, &ch->players, chan_link)
+			snap->by_id[i].public_id = pl->public_id;
+			snap->by_id[i].member = i;
+			m = &snap->members[i++];
+			m->public_id = pl->public_id;
+			m->private_id = pl->private_id;
+			m->addr_len = MIN(pl->cli_len, sizeof(struct sockaddr_in));
+			memcpy(&m->addr, &pl->cli_addr, m->addr_len);
+			m->stats = &pl->stats;
+			m->chan = c;
+			m->muted = snap->muted + k;
+			ar_each(struct player *, muted, iter2, pl->muted)
+				snap->muted[k++] = muted->public_id;
+				m->nb_muted++;
+			ar_end_each;
+		il_end_each;
+		snap->chans[c].count = i - snap->chans[c].first;
+		c++;
+	ar_end_each;
+	snap->nb_members = i;
+	snap->nb_chans = c;
+	qsort(snap->by_id, i, sizeof(struct audio_id), &audio_id_cmp);
+	return snap;
+}
+
+/**
+ * Free the snapshots the audio thread does not use anymore.
+ */
+static void audio_path_reclaim(struct audio_path *ap)
+{
+	struct audio_snapshot *snap, **prev;
+	uint32_t seen = __atomic_load_n(&ap->seen_gen, __ATOMIC_ACQUIRE);
+
+	prev = &ap->retired;
+	while ((snap = *prev) != NULL) {
+		if (snap->gen < seen) {
+			*prev = snap->next_retired;
+			audio_snapshot_free(snap);
+		} else {
+			prev = &snap->next_retired;
+		}
+	}
+}
+
+/**
+ * Tell the audio path that the channels, their members or the mutes
+ * changed : the next audio_path_update publishes a new snapshot.
+ * Must be called with the server lock held exclusively.
+ *
+ * @param s the server
+ */
+void audio_path_changed(struct server *s)
+{
+	if (s->audio != NULL)
+		s->audio->changed = 1;
+}
+
+/**
+ * Publish a new snapshot of the channels for the audio thread,
+ * if they changed since the last one.
+ * Must be called with the server lock held exclusively.
+ *
+ * @param s the server
+ */
+void audio_path_update(struct server *s)
+{
+	struct audio_path *ap = s->audio;
+	struct audio_snapshot *snap, *old;
+	struct player *pl;
+	size_t iter;
+
+	if (ap == NULL || !ap->changed)
+		return;
+	/* on failure, the next update tries again */
+	snap = audio_snapshot_build(s, ap->last_gen + 1);
+	if (snap == NULL)
+		return;
+	ap->changed = 0;
+	ap->last_gen++;
+	old = __atomic_exchange_n(&ap->current, snap, __ATOMIC_ACQ_REL);
+	old->next_retired = ap->retired;
+	ap->retired = old;
+
+	/* the players that left are not in this snapshot */
+	ar_each(struct player *, pl, iter, s->leaving_players)
+		if (pl->audio_gen == 0)
+			pl->audio_gen = snap->gen;
+	ar_end_each;
+	audio_path_reclaim(ap);
+}
+
+/**
+ * Periodic work of the audio path, run by the packet sender
+ * with the server lock held exclusively : publish the players
+ * that left and free the old snapshots.
+ *
+ * @param s the server
+ */
+void audio_path_sweep(struct server *s)
+{
+	struct player *pl;
+	size_t iter;
+
+	if (s->audio == NULL)
+		return;
+	ar_each(struct player *, pl, iter, s->leaving_players)
+		if (pl->audio_gen == 0) {
+			s->audio->changed = 1;
+			audio_path_update(s);
+			return;
+		}
+	ar_end_each;
+	audio_path_reclaim(s->audio);
+}
+
+/**
+ * Check that the audio thread cannot use a player that left anymore.
+ *
+ * @param s the server
+ * @param pl the leaving player
+ *
+ * @return 1 if the player can be destroyed
+ */
+int audio_path_released(struct server *s, struct player *pl)
+{
+	if (s->audio == NULL)
+		return 1;
+	return pl->audio_gen != 0
+		&& pl->audio_gen <= __atomic_load_n(&s->audio->seen_gen, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Queue an audio packet for the audio thread. Several receiving
+ * threads can push at the same time. If the queue is full, the
+ * packet is dropped.
+ *
+ * @param s the server
+ * @param data the packet
+ * @param len the size of the packet
+ *
+ * @return 0 on success, -1 if the packet was dropped
+ */
+int audio_path_push(struct server *s, char *data, size_t len)
+{
+	struct audio_path *ap = s->audio;
+	struct audio_cell *cell;
+	unsigned int pos, seq;
+	int dif;
+
+	if (len > AUDIO_MAX_PKT)
+		return -1;
+	pos = __atomic_load_n(&ap->enqueue_pos, __ATOMIC_RELAXED);
+	while (1) {
+		cell = &ap->cells[pos & (AUDIO_QUEUE_SIZE - 1)];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif = (int)(seq - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&ap->enqueue_pos, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			/* queue full (no log, we are overloaded already) */
+			__atomic_add_fetch(&ap->dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		} else {
+			pos = __atomic_load_n(&ap->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(cell->data, data, len);
+	cell->len = len;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&ap->wakeup);
+	return 0;
+}
+
+static int audio_member_muted(struct audio_member *m, uint32_t public_id)
+{
+	int i;
+
+	for (i = 0 ; i < m->nb_muted ; i++) {
+		if (m->muted[i] == public_id)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Forward an audio packet using a snapshot of the channels.
+ *
+ * @param s the server
+ * @param snap the snapshot
+ * @param in the received packet
+ * @param len the size of the packet
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int audio_forward(struct server *s, struct audio_snapshot *snap, char *in, size_t len)
+{
+	struct audio_member *sender = NULL, *m;
+	struct audio_id key, *id;
+	struct audio_chan *ch;
+	uint32_t pub_id, priv_id;
+	uint8_t data_codec;
+	size_t audio_block_size;
+	char data[AUDIO_MAX_PKT + 6];
+	char *ptr;
+	int i, receivers = 0;
+
+	if (len < 16) {
+		TRACE(s, TRACE_AUDIO, in, len, TRACE_BAD_SIZE, 0);
+		return -1;
+	}
+	ptr = in + 3;
+	data_codec = ru8(&ptr);
+	priv_id = ru32(&ptr);
+	pub_id = ru32(&ptr);
+	key.public_id = pub_id;
+	id = (struct audio_id *)bsearch(&key, snap->by_id, snap->nb_members,
+			sizeof(struct audio_id), &audio_id_cmp);
+	if (id != NULL && snap->members[id->member].private_id == priv_id)
+		sender = &snap->members[id->member];
+	if (sender == NULL) {
+		logger(LOG_ERR, "Wrong public/private ID pair : %x/%x.", pub_id, priv_id);
+		TRACE(s, TRACE_AUDIO, in, len, TRACE_NO_PLAYER, 0);
+		return -1;
+	}
+	sender->stats->activ_time = mclock_seconds();
+	sender->stats->pkt_sent++;
+	sender->stats->size_sent += len;
+	ch = &snap->chans[sender->chan];
+	if (data_codec != ch->codec) {
+		logger(LOG_ERR, "Player sent a wrong codec ID : %" PRIu8 ", expected : %" PRIu8 ".", data_codec, ch->codec);
+		TRACE(s, TRACE_AUDIO, in, len, TRACE_BAD_CODEC, 0);
+		return -1;
+	}
+	audio_block_size = codec_offset[(int)data_codec] + codec_audio_size[(int)data_codec];
+	if (len != 16 + audio_block_size) {
+		logger(LOG_ERR, "Audio packet's size is incorrect : %zu bytes, expected : %zu.", len,
+				16 + audio_block_size);
+		TRACE(s, TRACE_AUDIO, in, len, TRACE_BAD_SIZE, 0);
+		return -1;
+	}
+	audio_build_forward(data, in, audio_block_size, ch->codec, sender->public_id);
+
+	for (i = ch->first ; i < ch->first + ch->count ; i++) {
+		m = &snap->members[i];
+		if (m != sender && !audio_member_muted(m, sender->public_id)) {
+			ptr = data + 4;
+			wu32(m->private_id, &ptr);
+			wu32(m->public_id, &ptr);
+			if (server_sendto(s, data, len + 6, &m->addr, m->addr_len) == -1)
+				logger(LOG_WARN, "audio_forward, could not send packet : %s.", strerror(errno));
+			receivers++;
+		}
+	}
+	METRIC_ADD(s, audio_forwarded, receivers);
+	TRACE(s, TRACE_AUDIO, in, len, TRACE_OK, receivers);
+	return 0;
+}
+
+static void *audio_path_run(void *args)
+{
+	struct server *s = (struct server *)args;
+	struct audio_path *ap = s->audio;
+	struct audio_snapshot *snap;
+	struct audio_cell *cell;
+	struct timespec ts;
+	uint64_t start;
+
+	while (1) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 50000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		sem_timedwait(&ap->wakeup, &ts);
+
+		/* from now on, the older snapshots are not used anymore */
+		snap = __atomic_load_n(&ap->current, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&ap->seen_gen, snap->gen, __ATOMIC_RELEASE);
+
+		while (1) {
+			cell = &ap->cells[ap->dequeue_pos & (AUDIO_QUEUE_SIZE - 1)];
+			if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != ap->dequeue_pos + 1)
+				break;
+			start = mclock_ns();
+			audio_forward(s, snap, cell->data, cell->len);
+			latency_record(LATENCY_AUDIO, mclock_ns() - start);
+			__atomic_store_n(&cell->seq, ap->dequeue_pos + AUDIO_QUEUE_SIZE, __ATOMIC_RELEASE);
+			ap->dequeue_pos++;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start the audio thread of a server.
+ *
+ * @param s the server (channels already loaded)
+ *
+ * @return 1 on success, 0 on failure
+ */
+int audio_path_start(struct server *s)
+{
+	struct audio_path *ap;
+	unsigned int i;
+
+	ap = (struct audio_path *)calloc(1, sizeof(struct audio_path));
+	if (ap == NULL) {
+		logger(LOG_WARN, "audio_path_start, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	ap->cells = (struct audio_cell *)calloc(AUDIO_QUEUE_SIZE, sizeof(struct audio_cell));
+	if (ap->cells == NULL) {
+		logger(LOG_WARN, "audio_path_start, calloc failed : %s.", strerror(errno));
+		free(ap);
+		return 0;
+	}
+	for (i = 0 ; i < AUDIO_QUEUE_SIZE ; i++)
+		ap->cells[i].seq = i;
+	ap->last_gen = 1;
+	ap->current = audio_snapshot_build(s, ap->last_gen);
+	if (ap->current == NULL) {
+		free(ap->cells);
+		free(ap);
+		return 0;
+	}
+	sem_init(&ap->wakeup, 0, 0);
+	s->audio = ap;
+	pthread_create(&ap->thread, NULL, &audio_path_run, (void *)s);
+	return 1;
+}
+
+/**
+ * Stop the audio thread of a server and free its snapshots.
+ *
+ * @param s the server
+ */
+void audio_path_stop(struct server *s)
+{
+	struct audio_path *ap = s->audio;
+	struct audio_snapshot *snap;
+
+	if (ap == NULL)
+		return;
+	pthread_cancel(ap->thread);
+	pthread_join(ap->thread, NULL);
+	s->audio = NULL;
+	if (ap->dropped != 0)
+		logger(LOG_INFO, "Audio thread of server %i dropped %" PRIu64 " packets.", s->id, ap->dropped);
+	while ((snap = ap->retired) != NULL) {
+		ap->retired = snap->next_retired;
+		audio_snapshot_free(snap);
+	}
+	audio_snapshot_free(ap->current);
+	sem_destroy(&ap->wakeup);
+	free(ap->cells);
+	free(ap);
+}
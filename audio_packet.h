@@ -35,8 +35,22 @@
 #define CODEC_SPEEX_19_6  11
 #define CODEC_SPEEX_25_9  12
 
+extern size_t codec_audio_size[13];
+extern size_t codec_nb_frames[13];
+extern size_t codec_offset[13];
+
 struct server;
 
 int audio_received(char *in, size_t len, struct server *s);
 
+struct player;
+
+int audio_path_start(struct server *s);
+void audio_path_stop(struct server *s);
+int audio_path_push(struct server *s, char *data, size_t len);
+void audio_path_changed(struct server *s);
+void audio_path_update(struct server *s);
+void audio_path_sweep(struct server *s);
+int audio_path_released(struct server *s, struct player *pl);
+
 #endif
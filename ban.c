@@ -18,6 +18,7 @@
 
 #include "ban.h"
 #include "log.h"
+#include "arena.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -29,39 +30,39 @@
 
 void destroy_ban(struct ban *b)
 {
-	free(b->ip);
-	free(b->reason);
-	free(b);
+	arena_strfree(b->arena, b->ip);
+	arena_strfree(b->arena, b->reason);
+	arena_free(b->arena, b, sizeof(struct ban));
 }
 
 /**
  * Create and initialize a new ban.
  * The ID is assigned only when the ban is added to the server.
  *
+ * @param a the arena of the server
  * @param duration the duration of the ban (0 = unlimited)
  * @param ip the ip of the banned player
  * @param reason the reason/description of the ban
  *
  * @return the new ban
  */
-struct ban *new_ban(uint16_t duration, struct in_addr ip, char *reason)
+struct ban *new_ban(struct arena *a, uint16_t duration, struct in_addr ip, char *reason)
 {
-	struct ban *b = (struct ban *)calloc(1, sizeof(struct ban));
+	struct ban *b = (struct ban *)arena_alloc(a, sizeof(struct ban));
 
 	if (b == NULL) {
-		logger(LOG_ERR, "new_ban, calloc failed : %s.", strerror(errno));
+		logger(LOG_ERR, "new_ban, arena_alloc failed.");
 		return NULL;
 	}
 	
+	b->arena = a;
 	b->duration = duration;
-	b->ip = strdup(inet_ntoa(ip));
-	b->reason = strdup(reason);
+	b->ip = arena_strdup(a, inet_ntoa(ip));
+	b->reason = arena_strdup(a, reason);
 	if (b->ip == NULL || b->reason == NULL) {
-		if (b->ip != NULL)
-			free(b->ip);
-		if (b->reason != NULL)
-			free(b->reason);
-		free(b);
+		arena_strfree(a, b->ip);
+		arena_strfree(a, b->reason);
+		arena_free(a, b, sizeof(struct ban));
 		return NULL;
 	}
 
@@ -28,9 +28,10 @@ struct ban
 	uint16_t duration;
 	char *ip;
 	char *reason;
+	struct arena *arena;	/* of its server, with its strings */
 };
 
-struct ban *new_ban(uint16_t duration, struct in_addr ip, char *reason);
+struct ban *new_ban(struct arena *a, uint16_t duration, struct in_addr ip, char *reason);
 struct ban *test_ban(int x);
 void destroy_ban(struct ban *b);
 
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Run the loopback benchmark against the server with the poll
+# and the io_uring backends (network.io) and print one line per run.
+# Usage : bench/io_backend_compare.sh [port] [clients] [seconds]
+# The server must have been built with ./waf configure --with-bench
+PORT=${1:-8767}
+CLIENTS=${2:-32}
+DURATION=${3:-5}
+BIN=./output/default
+CFG=`mktemp /tmp/sol-bench.XXXXXX`
+
+for io in poll io_uring; do
+	sed -e 's/level: [0-9];/level: 1;/' \
+	    -e 's/mode: "[a-z]*";/mode: "threads";/' \
+	    -e "s/io: \"[a-z_]*\";/io: \"$io\";/" sol-server.cfg > $CFG
+	$BIN/soliloque-server -c $CFG &
+	PID=$!
+	sleep 1
+	printf "io=%s " $io
+	$BIN/bench/loopback_bench -p $PORT -n $CLIENTS -t 4 -d $DURATION
+	kill $PID
+	wait $PID 2>/dev/null
+done
+rm -f $CFG
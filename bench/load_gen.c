@@ -0,0 +1,368 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Load generator : N simulated clients on a running server, speaking
+ * the whole protocol. Each client connects, asks for the channel and
+ * player lists, answers the reliable packets, sends its keepalives
+ * and switches channels now and then. Some of them talk, sending
+ * audio at the packet rate of the codec of their channel. We print
+ * the throughput and the loss of the forwarded audio, its latency
+ * (each block carries the time it was sent) and the delay of the
+ * channel switches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include "ts2_client.h"
+#include "audio_packet.h"
+#include "channel.h"
+#include "latency.h"
+#include "compat.h"
+#include "log.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+/* bit rates of the codecs (bit/s), the packet rate follows codec_audio_size */
+static const double codec_bitrate[13] = {5100, 6300, 14800, 16400, 5200, 3400,
+	5200, 7200, 9300, 12300, 16300, 19500, 25900};
+
+/* players in each channel (index in the channel list) */
+static int members[TS2_MAX_CHANS];
+
+struct load_client
+{
+	struct ts2_client cl;
+	int talker;
+	uint64_t next_audio;
+	uint64_t next_keepalive;
+	uint64_t next_switch;
+	uint64_t next_list;
+};
+
+struct load_thread
+{
+	pthread_t thread;
+	struct load_client *clients;
+	int nb_clients;
+	uint64_t end;
+	unsigned int seed;
+
+	/* options */
+	double switch_interval;	/* mean seconds between two switches, 0 = never */
+	int list_interval;	/* seconds between two channel lists, 0 = once */
+	int max_chans;		/* only use the first channels */
+
+	uint64_t expected;	/* audio packets the other players should receive */
+	uint64_t switch_requests;
+	struct latency_histogram audio_latency;
+	struct latency_histogram switch_latency;
+};
+
+static uint64_t audio_interval(int codec)
+{
+	return (uint64_t)(codec_audio_size[codec] * 8 / codec_bitrate[codec] * NS_PER_SEC);
+}
+
+/* a random delay between 0 and twice the mean */
+static uint64_t random_delay(struct load_thread *t, double mean)
+{
+	return (uint64_t)(2.0 * mean * rand_r(&t->seed) / RAND_MAX * NS_PER_SEC);
+}
+
+static int usable_chan(struct ts2_channel *ch)
+{
+	return !(ch->flags & CHANNEL_FLAG_PASSWORD) && ch->codec <= 12 && codec_audio_size[ch->codec] != 0;
+}
+
+/* a random channel we can talk in, other than the current one */
+static int random_chan(struct load_thread *t, struct ts2_client *c)
+{
+	int nb = MIN(c->nb_chans, t->max_chans);
+	int i, start;
+
+	if (nb < 2)
+		return -1;
+	start = rand_r(&t->seed) % nb;
+	for (i = 0 ; i < nb ; i++) {
+		if ((start + i) % nb != c->chan && usable_chan(&c->chans[(start + i) % nb]))
+			return (start + i) % nb;
+	}
+	return -1;
+}
+
+/* keep members[] up to date with the channel the server put us in */
+static void load_client_moved(int from, int to)
+{
+	if (from == to)
+		return;
+	if (from >= 0)
+		__atomic_fetch_sub(&members[from], 1, __ATOMIC_RELAXED);
+	if (to >= 0)
+		__atomic_fetch_add(&members[to], 1, __ATOMIC_RELAXED);
+}
+
+static void load_client_step(struct load_thread *t, struct load_client *lc, uint64_t now)
+{
+	struct ts2_client *c = &lc->cl;
+	int to, others;
+
+	if (lc->talker && c->chan >= 0 && now >= lc->next_audio) {
+		others = __atomic_load_n(&members[c->chan], __ATOMIC_RELAXED) - 1;
+		if (ts2_client_send_audio(c) == 0 && others > 0)
+			t->expected += others;
+		lc->next_audio += audio_interval(c->codec);
+		/* do not catch up after a stall, talk at the codec rate */
+		if (lc->next_audio < now)
+			lc->next_audio = now + audio_interval(c->codec);
+	}
+	if (now >= lc->next_keepalive) {
+		ts2_client_keepalive(c);
+		lc->next_keepalive = now + NS_PER_SEC;
+	}
+	if (t->switch_interval > 0 && now >= lc->next_switch) {
+		/* one switch at a time */
+		if (c->switch_sent == 0 && (to = random_chan(t, c)) != -1) {
+			ts2_client_switch_channel(c, to);
+			t->switch_requests++;
+		}
+		lc->next_switch = now + random_delay(t, t->switch_interval);
+	}
+	if (t->list_interval > 0 && now >= lc->next_list) {
+		ts2_client_request_chans(c);
+		lc->next_list = now + (uint64_t)t->list_interval * NS_PER_SEC;
+	}
+}
+
+static void *load_run(void *args)
+{
+	struct load_thread *t = (struct load_thread *)args;
+	struct load_client *lc;
+	struct pollfd *pfds;
+	uint64_t now, next;
+	int i, chan, timeout;
+
+	pfds = (struct pollfd *)calloc(t->nb_clients, sizeof(struct pollfd));
+	if (pfds == NULL)
+		return NULL;
+	now = mclock_ns();
+	for (i = 0 ; i < t->nb_clients ; i++) {
+		lc = &t->clients[i];
+		pfds[i].fd = lc->cl.sd;
+		pfds[i].events = POLLIN;
+		lc->cl.audio_latency = &t->audio_latency;
+		lc->cl.switch_latency = &t->switch_latency;
+		/* spread the clients over the first period */
+		lc->next_audio = now + rand_r(&t->seed) % audio_interval(lc->cl.codec);
+		lc->next_keepalive = now + rand_r(&t->seed) % NS_PER_SEC;
+		lc->next_switch = now + random_delay(t, t->switch_interval);
+		lc->next_list = now + (uint64_t)t->list_interval * NS_PER_SEC;
+	}
+	while ((now = mclock_ns()) < t->end) {
+		next = t->end;
+		for (i = 0 ; i < t->nb_clients ; i++) {
+			lc = &t->clients[i];
+			load_client_step(t, lc, now);
+			if (lc->talker && lc->next_audio < next)
+				next = lc->next_audio;
+			if (lc->next_keepalive < next)
+				next = lc->next_keepalive;
+		}
+		timeout = (next > now) ? (int)((next - now) / 1000000) : 0;
+		if (poll(pfds, t->nb_clients, MIN(timeout, 10)) <= 0)
+			continue;
+		for (i = 0 ; i < t->nb_clients ; i++) {
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+			lc = &t->clients[i];
+			chan = lc->cl.chan;
+			ts2_client_poll(&lc->cl, 0);
+			load_client_moved(chan, lc->cl.chan);
+		}
+	}
+	/* collect what is still in flight */
+	for (i = 0 ; i < t->nb_clients ; i++)
+		while (ts2_client_poll(&t->clients[i].cl, 100) > 0);
+	free(pfds);
+	return NULL;
+}
+
+static void hist_merge(struct latency_histogram *dst, struct latency_histogram *src)
+{
+	int i;
+
+	for (i = 0 ; i < LATENCY_BUCKETS ; i++)
+		dst->counts[i] += src->counts[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+static void print_latency(const char *what, struct latency_histogram *h)
+{
+	if (h->count == 0) {
+		printf("%s : none\n", what);
+		return;
+	}
+	printf("%s (us) : mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", what,
+			h->sum / 1e3 / h->count,
+			latency_histogram_quantile(h, 0.5) / 1e3, latency_histogram_quantile(h, 0.9) / 1e3,
+			latency_histogram_quantile(h, 0.99) / 1e3, latency_histogram_quantile(h, 0.999) / 1e3,
+			h->max / 1e3);
+}
+
+static void print_help(char *progname)
+{
+	printf("Usage : %s [-h host] [-p port] [-n clients] [-t threads] [-d seconds]\n"
+			"\t[-a talking%%] [-s switch_seconds] [-l list_seconds] [-c channels]\n", progname);
+	printf(" -a <pct> share of the clients that talk (default 25)\n");
+	printf(" -s <sec> mean time between two channel switches of a client, 0 = never (default 30)\n");
+	printf(" -l <sec> ask for the channel list again every sec seconds, 0 = only once (default 0)\n");
+	printf(" -c <nb> only use the first nb channels (default 16)\n");
+}
+
+int main(int argc, char **argv)
+{
+	char *host = "127.0.0.1";
+	int port = 8767, nb_clients = 32, nb_threads = 2, duration = 10, talking = 25;
+	int list_interval = 0, max_chans = 16;
+	double switch_interval = 30;
+	struct load_client *clients;
+	struct load_thread *threads;
+	struct latency_histogram *audio_lat, *switch_lat;
+	char nick[30];
+	int i, opt, per_thread, ready, talkers = 0;
+	uint64_t start, stop, sent = 0, rec = 0, expected = 0, cmds = 0, acks = 0, ctl = 0;
+	uint64_t switch_req = 0, switches = 0;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "h:p:n:t:d:a:s:l:c:")) != -1) {
+		switch (opt) {
+		case 'h': host = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'n': nb_clients = atoi(optarg); break;
+		case 't': nb_threads = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		case 'a': talking = atoi(optarg); break;
+		case 's': switch_interval = atof(optarg); break;
+		case 'l': list_interval = atoi(optarg); break;
+		case 'c': max_chans = atoi(optarg); break;
+		default:
+			print_help(argv[0]);
+			return 1;
+		}
+	}
+	if (nb_clients < 1 || nb_threads < 1 || nb_threads > nb_clients || talking < 0 || talking > 100
+			|| switch_interval < 0 || list_interval < 0 || max_chans < 1) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	clients = (struct load_client *)calloc(nb_clients, sizeof(struct load_client));
+	threads = (struct load_thread *)calloc(nb_threads, sizeof(struct load_thread));
+	audio_lat = (struct latency_histogram *)calloc(1, sizeof(struct latency_histogram));
+	switch_lat = (struct latency_histogram *)calloc(1, sizeof(struct latency_histogram));
+	if (clients == NULL || threads == NULL || audio_lat == NULL || switch_lat == NULL) {
+		logger(LOG_ERR, "load_gen, calloc failed.");
+		return 1;
+	}
+	/* connect, then learn the channels and the one we are in */
+	for (i = 0 ; i < nb_clients ; i++) {
+		snprintf(nick, 30, "load%i", i);
+		if (ts2_client_init(&clients[i].cl, host, port) != 0
+				|| ts2_client_connect(&clients[i].cl, nick, 2000) != 0
+				|| ts2_client_request_chans(&clients[i].cl) != 0) {
+			logger(LOG_ERR, "load_gen, client %i could not connect (is the default channel full ?).", i);
+			return 1;
+		}
+		/* the first ones talk */
+		clients[i].talker = (i * 100 < talking * nb_clients);
+		talkers += clients[i].talker;
+	}
+	start = mclock_ns();
+	do {
+		ready = 0;
+		for (i = 0 ; i < nb_clients ; i++) {
+			while (ts2_client_poll(&clients[i].cl, 0) > 0);
+			ready += (clients[i].cl.chan != -1);
+		}
+		usleep(10000);
+	} while (ready < nb_clients && mclock_ns() - start < 5 * NS_PER_SEC);
+	if (ready < nb_clients) {
+		logger(LOG_ERR, "load_gen, %i clients did not get the channel list.", nb_clients - ready);
+		return 1;
+	}
+	for (i = 0 ; i < nb_clients ; i++) {
+		load_client_moved(-1, clients[i].cl.chan);
+		clients[i].cl.audio_rec = 0;
+	}
+
+	start = mclock_ns();
+	per_thread = nb_clients / nb_threads;
+	for (i = 0 ; i < nb_threads ; i++) {
+		threads[i].clients = clients + i * per_thread;
+		threads[i].nb_clients = (i == nb_threads - 1) ? nb_clients - i * per_thread : per_thread;
+		threads[i].end = start + (uint64_t)duration * NS_PER_SEC;
+		threads[i].seed = i + 1;
+		threads[i].switch_interval = switch_interval;
+		threads[i].list_interval = list_interval;
+		threads[i].max_chans = max_chans;
+		pthread_create(&threads[i].thread, NULL, &load_run, &threads[i]);
+	}
+	for (i = 0 ; i < nb_threads ; i++) {
+		pthread_join(threads[i].thread, NULL);
+		expected += threads[i].expected;
+		switch_req += threads[i].switch_requests;
+		hist_merge(audio_lat, &threads[i].audio_latency);
+		hist_merge(switch_lat, &threads[i].switch_latency);
+	}
+	stop = mclock_ns();
+	secs = (stop - start) / 1e9;
+
+	for (i = 0 ; i < nb_clients ; i++) {
+		sent += clients[i].cl.audio_sent;
+		rec += clients[i].cl.audio_rec;
+		cmds += clients[i].cl.cmd_sent;
+		acks += clients[i].cl.acks_rec;
+		ctl += clients[i].cl.ctl_rec;
+		switches += clients[i].cl.switches;
+		ts2_client_close(&clients[i].cl);
+	}
+	printf("clients=%i talkers=%i seconds=%.1f\n", nb_clients, talkers, secs);
+	printf("audio : sent=%.0f/s forwarded=%.0f/s expected=%.0f/s loss=%.2f%%\n",
+			sent / secs, rec / secs, expected / secs,
+			expected ? 100.0 * (expected - MIN(rec, expected)) / expected : 0.0);
+	print_latency("audio forward latency", audio_lat);
+	printf("switches : requested=%" PRIu64 " done=%" PRIu64 "\n", switch_req, switches);
+	print_latency("switch delay", switch_lat);
+	printf("commands : sent=%" PRIu64 " acked=%" PRIu64 " control packets received=%" PRIu64 "\n",
+			cmds, acks, ctl);
+
+	free(switch_lat);
+	free(audio_lat);
+	free(threads);
+	free(clients);
+	return 0;
+}
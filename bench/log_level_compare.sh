@@ -0,0 +1,27 @@
+#!/bin/sh
+# Run the loopback benchmark against the server with the logs off
+# (errors only) and with the debug logs written to a file, and
+# print one line per run.
+# Usage : bench/log_level_compare.sh [port] [clients] [seconds]
+# The server must have been built with ./waf configure --with-bench
+PORT=${1:-8767}
+CLIENTS=${2:-32}
+DURATION=${3:-5}
+BIN=${BIN:-./output/default}
+CFG=`mktemp /tmp/sol-bench.XXXXXX`
+LOG=`mktemp /tmp/sol-bench-log.XXXXXX`
+
+for level in 1 4; do
+	sed -e "s/level: [0-9];/level: $level;/" \
+	    -e "s#output: \"[^\"]*\";#output: \"$LOG\";#" sol-server.cfg > $CFG
+	$BIN/soliloque-server -c $CFG &
+	PID=$!
+	sleep 1
+	printf "level=%s " $level
+	$BIN/bench/loopback_bench -p $PORT -n $CLIENTS -t 4 -d $DURATION
+	kill $PID
+	wait $PID 2>/dev/null
+	printf "  log : %s bytes\n" `wc -c < $LOG`
+	: > $LOG
+done
+rm -f $CFG $LOG
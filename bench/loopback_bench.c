@@ -0,0 +1,154 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loopback benchmark : N clients connect to a running server and
+ * flood audio in the default channel. We print how many audio
+ * packets per second the server received and forwarded.
+ * bench/reuseport_sweep.sh runs it for 1..N receiving threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "ts2_client.h"
+#include "compat.h"
+#include "log.h"
+
+struct bench_thread
+{
+	pthread_t thread;
+	struct ts2_client *clients;
+	int nb_clients;
+	struct timeval end;
+};
+
+static void *bench_run(void *args)
+{
+	struct bench_thread *t = (struct bench_thread *)args;
+	struct timeval now, last_ka;
+	int i;
+
+	gettimeofday(&last_ka, NULL);
+	do {
+		for (i = 0 ; i < t->nb_clients ; i++) {
+			ts2_client_send_audio(&t->clients[i]);
+			ts2_client_poll(&t->clients[i], 0);
+		}
+		gettimeofday(&now, NULL);
+		if (now.tv_sec != last_ka.tv_sec) {
+			for (i = 0 ; i < t->nb_clients ; i++)
+				ts2_client_keepalive(&t->clients[i]);
+			last_ka = now;
+		}
+	} while (timercmp(&now, &t->end, <));
+	/* collect what is still in flight */
+	for (i = 0 ; i < t->nb_clients ; i++)
+		while (ts2_client_poll(&t->clients[i], 100) > 0);
+	return NULL;
+}
+
+static void print_help(char *progname)
+{
+	printf("Usage : %s [-h host] [-p port] [-n clients] [-t threads] [-d seconds] [-k codec]\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+	char *host = "127.0.0.1";
+	int port = 8767, nb_clients = 16, nb_threads = 4, duration = 5, codec = 10;
+	struct ts2_client *clients;
+	struct bench_thread *threads;
+	char nick[30];
+	int i, opt, per_thread;
+	uint64_t sent = 0, rec = 0, expected;
+	struct timeval start, stop, diff;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "h:p:n:t:d:k:")) != -1) {
+		switch (opt) {
+		case 'h': host = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'n': nb_clients = atoi(optarg); break;
+		case 't': nb_threads = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		case 'k': codec = atoi(optarg); break;
+		default:
+			print_help(argv[0]);
+			return 1;
+		}
+	}
+	if (nb_clients < 2 || nb_threads < 1 || nb_threads > nb_clients || codec < 0 || codec > 12) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	clients = (struct ts2_client *)calloc(nb_clients, sizeof(struct ts2_client));
+	threads = (struct bench_thread *)calloc(nb_threads, sizeof(struct bench_thread));
+	if (clients == NULL || threads == NULL) {
+		logger(LOG_ERR, "loopback_bench, calloc failed.");
+		return 1;
+	}
+	for (i = 0 ; i < nb_clients ; i++) {
+		snprintf(nick, 30, "bench%i", i);
+		if (ts2_client_init(&clients[i], host, port) != 0
+				|| ts2_client_connect(&clients[i], nick, 2000) != 0) {
+			logger(LOG_ERR, "loopback_bench, client %i could not connect.", i);
+			return 1;
+		}
+		clients[i].codec = codec;
+	}
+	/* drop the player list / arrival notifications */
+	for (i = 0 ; i < nb_clients ; i++)
+		while (ts2_client_poll(&clients[i], 50) > 0);
+	for (i = 0 ; i < nb_clients ; i++)
+		clients[i].audio_rec = 0;
+
+	gettimeofday(&start, NULL);
+	per_thread = nb_clients / nb_threads;
+	for (i = 0 ; i < nb_threads ; i++) {
+		threads[i].clients = clients + i * per_thread;
+		threads[i].nb_clients = (i == nb_threads - 1) ? nb_clients - i * per_thread : per_thread;
+		threads[i].end = start;
+		threads[i].end.tv_sec += duration;
+		pthread_create(&threads[i].thread, NULL, &bench_run, &threads[i]);
+	}
+	for (i = 0 ; i < nb_threads ; i++)
+		pthread_join(threads[i].thread, NULL);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	for (i = 0 ; i < nb_clients ; i++) {
+		sent += clients[i].audio_sent;
+		rec += clients[i].audio_rec;
+		ts2_client_close(&clients[i]);
+	}
+	expected = sent * (nb_clients - 1);
+	printf("clients=%i sent=%.0f/s forwarded=%.0f/s loss=%.2f%%\n", nb_clients,
+			sent / secs, rec / secs,
+			expected ? 100.0 * (expected - MIN(rec, expected)) / expected : 0.0);
+
+	free(threads);
+	free(clients);
+	return 0;
+}
@@ -0,0 +1,737 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the primitives on the packet path, in isolation :
+ * crc, arrays, queues, server statistics, player and registration
+ * lookups, serialization, audio fan-out and disabled logs.
+ *
+ * Each benchmark is calibrated to last at least min_time, then run
+ * several times, and the minimum, median and maximum time per
+ * operation are written as JSON. The data sets are built from a
+ * fixed seed so two builds measure the same thing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <inttypes.h>
+#include <openssl/sha.h>
+
+#include "config.h"
+#include "compat.h"
+#include "configuration.h"
+#include "log.h"
+#include "crc.h"
+#include "packet_tools.h"
+#include "array.h"
+#include "queue.h"
+#include "server.h"
+#include "server_stat.h"
+#include "channel.h"
+#include "player.h"
+#include "registration.h"
+#include "audio_packet.h"
+#include "latency.h"
+#include "mclock.h"
+
+#define MB_SEED 42
+#define MB_MAX_RUNS 32
+
+/* a benchmark runs n operations */
+typedef void (*mb_func)(void *arg, uint64_t n);
+
+struct micro_bench
+{
+	FILE *out;
+	const char *filter;
+	uint64_t min_time;	/* ns */
+	int runs;
+	int nb_results;
+};
+
+/* keeps the results alive */
+static volatile uint64_t mb_sink;
+
+static int mb_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Calibrate a benchmark, run it and write its result.
+ *
+ * @param mb the benchmark suite
+ * @param name the name of the benchmark (and its parameters)
+ * @param f the function running n operations
+ * @param arg the argument of the function
+ */
+static void mb_run(struct micro_bench *mb, const char *name, mb_func f, void *arg)
+{
+	double ns_op[MB_MAX_RUNS];
+	uint64_t n = 1, t;
+	int i;
+
+	if (mb->filter != NULL && strstr(name, mb->filter) == NULL)
+		return;
+	/* the number of operations that last at least min_time */
+	f(arg, 1);
+	while (1) {
+		t = mclock_ns();
+		f(arg, n);
+		t = mclock_ns() - t;
+		if (t >= mb->min_time || n >= (1ULL << 40))
+			break;
+		if (t < mb->min_time / 100)
+			n *= 10;
+		else
+			n = n * mb->min_time / t + 1;
+	}
+	for (i = 0 ; i < mb->runs ; i++) {
+		t = mclock_ns();
+		f(arg, n);
+		t = mclock_ns() - t;
+		ns_op[i] = (double)t / n;
+	}
+	qsort(ns_op, mb->runs, sizeof(double), &mb_cmp);
+
+	fprintf(mb->out, "%s\n    {\"name\": \"%s\", \"iterations\": %"PRIu64", \"runs\": %i, "
+			"\"ns_per_op_min\": %.2f, \"ns_per_op_median\": %.2f, \"ns_per_op_max\": %.2f}",
+			(mb->nb_results > 0) ? "," : "", name, n, mb->runs,
+			ns_op[0], ns_op[mb->runs / 2], ns_op[mb->runs - 1]);
+	fflush(mb->out);
+	mb->nb_results++;
+}
+
+/* crc */
+
+struct mb_crc
+{
+	char *data;
+	size_t len;
+};
+
+static void mb_crc_32(void *arg, uint64_t n)
+{
+	struct mb_crc *b = (struct mb_crc *)arg;
+	uint32_t crc = 0;
+
+	while (n--)
+		crc ^= crc_32(b->data, b->len, 0xEDB88320);
+	mb_sink += crc;
+}
+
+static void mb_check_crc(void *arg, uint64_t n)
+{
+	struct mb_crc *b = (struct mb_crc *)arg;
+	int ok = 0;
+
+	while (n--)
+		ok += packet_check_crc_d(b->data, b->len);
+	mb_sink += ok;
+}
+
+static void bench_crc(struct micro_bench *mb)
+{
+	size_t sizes[] = {24, 180, 500};
+	char name[64];
+	char data[500];
+	struct mb_crc b;
+	size_t i;
+
+	for (i = 0 ; i < sizeof(data) ; i++)
+		data[i] = random();
+	b.data = data;
+	for (i = 0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++) {
+		b.len = sizes[i];
+		snprintf(name, sizeof(name), "crc_32/len=%zu", b.len);
+		mb_run(mb, name, &mb_crc_32, &b);
+		packet_add_crc_d(data, b.len);
+		snprintf(name, sizeof(name), "packet_check_crc/len=%zu", b.len);
+		mb_run(mb, name, &mb_check_crc, &b);
+	}
+}
+
+/* arrays */
+
+struct mb_array
+{
+	struct array *a;
+	void **kept;		/* the elements in the array */
+	size_t nb_kept;
+	void *extra;		/* an element not in the array */
+};
+
+static void mb_ar_insert_remove(void *arg, uint64_t n)
+{
+	struct mb_array *b = (struct mb_array *)arg;
+
+	while (n--) {
+		ar_insert(b->a, b->extra);
+		ar_remove(b->a, b->extra);
+	}
+}
+
+static void mb_ar_has(void *arg, uint64_t n)
+{
+	struct mb_array *b = (struct mb_array *)arg;
+	size_t i = 0;
+	int found = 0;
+
+	while (n--) {
+		found += ar_has(b->a, b->kept[i]);
+		if (++i == b->nb_kept)
+			i = 0;
+	}
+	mb_sink += found;
+}
+
+static void mb_ar_has_miss(void *arg, uint64_t n)
+{
+	struct mb_array *b = (struct mb_array *)arg;
+	int found = 0;
+
+	while (n--)
+		found += ar_has(b->a, b->extra);
+	mb_sink += found;
+}
+
+static void mb_ar_each(void *arg, uint64_t n)
+{
+	struct mb_array *b = (struct mb_array *)arg;
+	uintptr_t sum = 0;
+	size_t iter;
+	void *el;
+
+	while (n--) {
+		ar_each(void *, el, iter, b->a)
+			sum += (uintptr_t)el;
+		ar_end_each;
+	}
+	mb_sink += sum;
+}
+
+static void bench_array(struct micro_bench *mb)
+{
+	size_t sizes[] = {16, 256, 4096};
+	int fills[] = {25, 50, 90};
+	char name[64];
+	struct mb_array b;
+	size_t i, j, k;
+	char *elems;
+
+	for (i = 0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++) {
+		for (j = 0 ; j < sizeof(fills) / sizeof(fills[0]) ; j++) {
+			/* fill the array, then make holes at random */
+			elems = (char *)calloc(sizes[i] + 1, 1);
+			b.kept = (void **)calloc(sizes[i], sizeof(void *));
+			b.a = ar_new(sizes[i]);
+			if (elems == NULL || b.kept == NULL || b.a == NULL) {
+				logger(LOG_ERR, "bench_array, allocation failed.");
+				exit(1);
+			}
+			for (k = 0 ; k < sizes[i] ; k++)
+				ar_insert(b.a, &elems[k]);
+			b.nb_kept = 0;
+			for (k = 0 ; k < sizes[i] ; k++) {
+				if (random() % 100 < fills[j])
+					b.kept[b.nb_kept++] = &elems[k];
+				else
+					ar_remove(b.a, &elems[k]);
+			}
+			b.extra = &elems[sizes[i]];
+			if (b.nb_kept == 0)
+				b.kept[b.nb_kept++] = &elems[0];
+
+			snprintf(name, sizeof(name), "ar_insert_remove/size=%zu/fill=%i", sizes[i], fills[j]);
+			mb_run(mb, name, &mb_ar_insert_remove, &b);
+			snprintf(name, sizeof(name), "ar_has/size=%zu/fill=%i", sizes[i], fills[j]);
+			mb_run(mb, name, &mb_ar_has, &b);
+			snprintf(name, sizeof(name), "ar_has_miss/size=%zu/fill=%i", sizes[i], fills[j]);
+			mb_run(mb, name, &mb_ar_has_miss, &b);
+			snprintf(name, sizeof(name), "ar_each/size=%zu/fill=%i", sizes[i], fills[j]);
+			mb_run(mb, name, &mb_ar_each, &b);
+
+			ar_clear(b.a);
+			ar_free(b.a);
+			free(b.kept);
+			free(elems);
+		}
+	}
+}
+
+/* queues */
+
+struct mb_queue
+{
+	struct queue *q;
+	uint64_t n;		/* elements sent by the producer */
+};
+
+static void mb_queue_single(void *arg, uint64_t n)
+{
+	struct mb_queue *b = (struct mb_queue *)arg;
+	uintptr_t sum = 0;
+
+	while (n--) {
+		add_to_queue(b->q, b, 16);
+		pthread_mutex_lock(&b->q->mutex);
+		sum += (uintptr_t)get_from_queue(b->q);
+		pthread_mutex_unlock(&b->q->mutex);
+	}
+	mb_sink += sum;
+}
+
+static void *mb_queue_producer(void *arg)
+{
+	struct mb_queue *b = (struct mb_queue *)arg;
+	uint64_t i;
+
+	for (i = 0 ; i < b->n ; i++)
+		add_to_queue(b->q, b, 16);
+	return NULL;
+}
+
+static void mb_queue_cross(void *arg, uint64_t n)
+{
+	struct mb_queue *b = (struct mb_queue *)arg;
+	pthread_t producer;
+	void *el;
+
+	b->n = n;
+	if (pthread_create(&producer, NULL, &mb_queue_producer, b) != 0) {
+		logger(LOG_ERR, "mb_queue_cross, pthread_create failed.");
+		exit(1);
+	}
+	while (n > 0) {
+		pthread_mutex_lock(&b->q->mutex);
+		el = get_from_queue(b->q);
+		pthread_mutex_unlock(&b->q->mutex);
+		if (el != NULL)
+			n--;
+	}
+	pthread_join(producer, NULL);
+}
+
+static void bench_queue(struct micro_bench *mb)
+{
+	struct mb_queue b;
+
+	b.q = new_queue();
+	mb_run(mb, "queue_add_get/single_thread", &mb_queue_single, &b);
+	mb_run(mb, "queue_add_get/cross_thread", &mb_queue_cross, &b);
+	destroy_queue(b.q);
+}
+
+/* server statistics */
+
+struct mb_sstat
+{
+	struct server_stat *st;
+	long free_slot;		/* where the new packets are inserted */
+};
+
+static void mb_sstat_add(void *arg, uint64_t n)
+{
+	struct mb_sstat *b = (struct mb_sstat *)arg;
+
+	while (n--) {
+		sstat_add_packet(b->st, 180, 0);
+		/* keep the same number of packets in the last minute */
+		b->st->pkt_sizes[b->free_slot] = 0;
+	}
+}
+
+static void mb_sstat_compute(void *arg, uint64_t n)
+{
+	struct mb_sstat *b = (struct mb_sstat *)arg;
+	uint32_t stats[4] = {0, 0, 0, 0};
+
+	while (n--)
+		compute_timed_stats(b->st, stats);
+	mb_sink += stats[0];
+}
+
+static void bench_sstat(struct micro_bench *mb)
+{
+	int windows[] = {16, 256, 4096};
+	char name[64];
+	struct mb_sstat b;
+	size_t i;
+	int k;
+
+	for (i = 0 ; i < sizeof(windows) / sizeof(windows[0]) ; i++) {
+		/* about windows[i] packets in the last minute, the new
+		 * ones always go to the first free slot */
+		b.st = new_sstat();
+		for (k = 0 ; k <= windows[i] ; k++)
+			sstat_add_packet(b.st, 180, k & 1);
+		for (b.free_slot = 0 ; b.st->pkt_sizes[b.free_slot] != 0 ; b.free_slot++);
+		for (k = b.free_slot ; k < b.st->pkt_max ; k++)
+			b.st->pkt_sizes[k] = 0;
+
+		snprintf(name, sizeof(name), "sstat_add_packet/window=%i", windows[i]);
+		mb_run(mb, name, &mb_sstat_add, &b);
+		snprintf(name, sizeof(name), "compute_timed_stats/window=%i", windows[i]);
+		mb_run(mb, name, &mb_sstat_compute, &b);
+		destroy_sstat(b.st);
+	}
+}
+
+/* lookups and serialization */
+
+struct mb_server
+{
+	struct server *s;
+	struct player **players;
+	int nb_players;
+	char **logins;
+	char **passwords;
+	int nb_regs;
+	struct channel *chan;
+	char data[512];
+};
+
+static void mb_get_player(void *arg, uint64_t n)
+{
+	struct mb_server *b = (struct mb_server *)arg;
+	struct player *pl;
+	uintptr_t sum = 0;
+	int i = 0;
+
+	while (n--) {
+		pl = b->players[i];
+		sum += (uintptr_t)get_player_by_ids(b->s, pl->public_id, pl->private_id);
+		if (++i == b->nb_players)
+			i = 0;
+	}
+	mb_sink += sum;
+}
+
+static void mb_get_registration(void *arg, uint64_t n)
+{
+	struct mb_server *b = (struct mb_server *)arg;
+	uintptr_t sum = 0;
+	int i = 0;
+
+	while (n--) {
+		sum += (uintptr_t)get_registration(b->s, b->logins[i], b->passwords[i]);
+		if (++i == b->nb_regs)
+			i = 0;
+	}
+	mb_sink += sum;
+}
+
+static void mb_player_to_data(void *arg, uint64_t n)
+{
+	struct mb_server *b = (struct mb_server *)arg;
+	int size = 0, i = 0;
+
+	while (n--) {
+		size += player_to_data(b->players[i], b->data);
+		if (++i == b->nb_players)
+			i = 0;
+	}
+	mb_sink += size;
+}
+
+static void mb_channel_to_data(void *arg, uint64_t n)
+{
+	struct mb_server *b = (struct mb_server *)arg;
+	int size = 0;
+
+	while (n--)
+		size += channel_to_data(b->chan, b->data);
+	mb_sink += size;
+}
+
+/* a channel created and deleted, as by c_req_create_channel */
+static void mb_channel_churn(void *arg, uint64_t n)
+{
+	struct mb_server *b = (struct mb_server *)arg;
+	struct channel *ch;
+	uintptr_t sum = 0;
+
+	while (n--) {
+		ch = new_channel(b->s->arena, "Channel", "The topic", "The description",
+				0, CODEC_SPEEX_19_6, 0, 16);
+		sum += (uintptr_t)ch;
+		destroy_channel(ch);
+	}
+	mb_sink += sum;
+}
+
+/**
+ * A server with a default channel, nb players in it and
+ * nb registrations.
+ */
+static void mb_server_new(struct mb_server *b, int nb)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	struct registration *r;
+	char *hex;
+	char nick[30], pass[30];
+	int i;
+
+	b->s = new_server();
+	b->chan = (b->s == NULL) ? NULL : new_channel(b->s->arena, "Default", "The default channel", "Where everybody arrives",
+			CHANNEL_FLAG_DEFAULT, CODEC_SPEEX_19_6, 0, nb);
+	b->players = (struct player **)calloc(nb, sizeof(struct player *));
+	b->logins = (char **)calloc(nb, sizeof(char *));
+	b->passwords = (char **)calloc(nb, sizeof(char *));
+	if (b->s == NULL || b->chan == NULL || b->players == NULL
+			|| b->logins == NULL || b->passwords == NULL) {
+		logger(LOG_ERR, "mb_server_new, allocation failed.");
+		exit(1);
+	}
+	add_channel(b->s, b->chan);
+	for (i = 0 ; i < nb ; i++) {
+		snprintf(nick, sizeof(nick), "player%i", i);
+		b->players[i] = new_player(nick, "Login", "Test Machine 0.0");
+		if (b->players[i] == NULL || !add_player(b->s, b->players[i])) {
+			logger(LOG_ERR, "mb_server_new, could not add a player.");
+			exit(1);
+		}
+
+		r = new_registration(b->s->arena);
+		snprintf(pass, sizeof(pass), "password%i", i);
+		b->logins[i] = strdup(nick);
+		b->passwords[i] = strdup(pass);
+		if (r == NULL || b->logins[i] == NULL || b->passwords[i] == NULL) {
+			logger(LOG_ERR, "mb_server_new, could not add a registration.");
+			exit(1);
+		}
+		strcpy(r->name, nick);
+		SHA256((unsigned char *)b->passwords[i], strlen(b->passwords[i]), digest);
+		hex = ustrtohex(digest, SHA256_DIGEST_LENGTH);
+		strcpy(r->password, hex);
+		free(hex);
+		add_registration(b->s, r);
+	}
+	b->nb_players = b->nb_regs = nb;
+}
+
+static void mb_server_free(struct mb_server *b)
+{
+	int i;
+
+	for (i = 0 ; i < b->nb_players ; i++) {
+		ar_remove(b->s->players, b->players[i]);
+		pl_hash_remove(&b->s->players_by_id, b->players[i]);
+		pl_list_remove(&b->chan->players, b->players[i]);
+		destroy_player(b->players[i]);
+		free(b->logins[i]);
+		free(b->passwords[i]);
+	}
+	free(b->players);
+	free(b->logins);
+	free(b->passwords);
+	destroy_server(b->s);
+}
+
+static void bench_server(struct micro_bench *mb)
+{
+	int sizes[] = {8, 64, 512};
+	char name[64];
+	struct mb_server b;
+	size_t i;
+
+	for (i = 0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++) {
+		mb_server_new(&b, sizes[i]);
+		snprintf(name, sizeof(name), "get_player_by_ids/players=%i", sizes[i]);
+		mb_run(mb, name, &mb_get_player, &b);
+		snprintf(name, sizeof(name), "get_registration/registrations=%i", sizes[i]);
+		mb_run(mb, name, &mb_get_registration, &b);
+		if (i == 0) {
+			mb_run(mb, "player_to_data", &mb_player_to_data, &b);
+			mb_run(mb, "channel_to_data", &mb_channel_to_data, &b);
+			mb_run(mb, "channel_new_destroy", &mb_channel_churn, &b);
+		}
+		mb_server_free(&b);
+	}
+}
+
+/* audio fan-out */
+
+struct mb_audio
+{
+	struct mb_server srv;
+	char packet[512];
+	size_t len;
+	uint64_t sent;
+};
+
+static void mb_audio_output(struct server *s, const void *buf, size_t len, struct sockaddr_in *to, void *arg)
+{
+	struct mb_audio *b = (struct mb_audio *)arg;
+
+	b->sent += len;
+}
+
+static void mb_audio_received(void *arg, uint64_t n)
+{
+	struct mb_audio *b = (struct mb_audio *)arg;
+	struct player *pl;
+	char *ptr;
+	int i = 0;
+
+	while (n--) {
+		pl = b->srv.players[i];
+		ptr = b->packet + 4;
+		wu32(pl->private_id, &ptr);
+		wu32(pl->public_id, &ptr);
+		audio_received(b->packet, b->len, b->srv.s);
+		if (++i == b->srv.nb_players)
+			i = 0;
+	}
+	mb_sink += b->sent;
+}
+
+/**
+ * Forward the audio of each player in turn to the others, on a
+ * server that sends nowhere (the cost of the sends is not measured).
+ */
+static void bench_audio(struct micro_bench *mb)
+{
+	int sizes[] = {8, 64, 512};
+	char name[64];
+	struct mb_audio b;
+	size_t i;
+	char *ptr;
+
+	for (i = 0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++) {
+		mb_server_new(&b.srv, sizes[i]);
+		b.srv.s->output = &mb_audio_output;
+		b.srv.s->output_arg = &b;
+		b.sent = 0;
+		b.len = 16 + codec_offset[CODEC_SPEEX_19_6] + codec_audio_size[CODEC_SPEEX_19_6];
+		memset(b.packet, 0x5a, sizeof(b.packet));
+		ptr = b.packet;
+		wu16(0xbef2, &ptr);
+		wu8(0, &ptr);
+		wu8(CODEC_SPEEX_19_6, &ptr);
+		snprintf(name, sizeof(name), "audio_received/receivers=%i", sizes[i] - 1);
+		mb_run(mb, name, &mb_audio_received, &b);
+		b.srv.s->output = NULL;
+		mb_server_free(&b.srv);
+	}
+}
+
+/* logs */
+
+static void mb_logger_disabled(void *arg, uint64_t n)
+{
+	uint64_t i;
+
+	for (i = 0 ; i < n ; i++)
+		logger(LOG_DBG, "mb_logger_disabled : message %"PRIu64".", i);
+}
+
+static void bench_logger(struct micro_bench *mb)
+{
+	mb_run(mb, "logger/disabled", &mb_logger_disabled, NULL);
+}
+
+static void print_help(char *progname)
+{
+	printf("Usage : %s [-t min_time_ms] [-r runs] [-f filter] [-c cpu] [-o output]\n", progname);
+	printf(" -t <ms> minimum duration of a run (default 200)\n");
+	printf(" -r <nb> number of runs of each benchmark (default 5)\n");
+	printf(" -f <str> only run the benchmarks whose name contains str\n");
+	printf(" -c <cpu> pin the benchmark to a cpu\n");
+	printf(" -o <file> write the results to a file instead of stdout\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct micro_bench mb;
+	struct config *c;
+	cpu_set_t cpus;
+	char date[32];
+	time_t now;
+	int opt, cpu = -1;
+
+	mb.out = stdout;
+	mb.filter = NULL;
+	mb.min_time = 200 * 1000000ULL;
+	mb.runs = 5;
+	mb.nb_results = 0;
+	while ((opt = getopt(argc, argv, "t:r:f:c:o:")) != -1) {
+		switch (opt) {
+		case 't': mb.min_time = strtoull(optarg, NULL, 10) * 1000000ULL; break;
+		case 'r': mb.runs = atoi(optarg); break;
+		case 'f': mb.filter = optarg; break;
+		case 'c': cpu = atoi(optarg); break;
+		case 'o':
+			mb.out = fopen(optarg, "w");
+			if (mb.out == NULL) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			print_help(argv[0]);
+			return 1;
+		}
+	}
+	if (mb.runs < 1 || mb.runs > MB_MAX_RUNS) {
+		fprintf(stderr, "The number of runs must be between 1 and %i.\n", MB_MAX_RUNS);
+		return 1;
+	}
+	if (cpu != -1) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+			perror("sched_setaffinity");
+	}
+
+	/* only the errors are logged */
+	c = (struct config *)calloc(1, sizeof(struct config));
+	if (c == NULL)
+		return 1;
+	c->log.level = LOG_ERR;
+	c->log.output = stderr;
+	set_config(c);
+	srandom(MB_SEED);
+
+	now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	fprintf(mb.out, "{\n  \"version\": \"%s\",\n  \"date\": \"%s\",\n  \"cpu\": %i,\n"
+			"  \"min_time_ms\": %"PRIu64",\n  \"benchmarks\": [",
+			VERSION, date, cpu, mb.min_time / 1000000);
+	bench_crc(&mb);
+	bench_array(&mb);
+	bench_queue(&mb);
+	bench_sstat(&mb);
+	bench_server(&mb);
+	bench_audio(&mb);
+	bench_logger(&mb);
+	fprintf(mb.out, "\n  ]\n}\n");
+
+	if (mb.out != stdout)
+		fclose(mb.out);
+	set_config(NULL);
+	free(c);
+	return 0;
+}
@@ -0,0 +1,32 @@
+#!/usr/bin/env python
+# Compare two outputs of bench/micro_bench and print the median time
+# per operation of each benchmark, before and after.
+# Usage : bench/micro_compare.py before.json after.json [threshold %]
+# Exits with 1 if a benchmark is slower than the threshold (default 10%).
+
+import sys
+import json
+
+def load(filename):
+  f = open(filename)
+  results = json.load(f)
+  f.close()
+  return dict((b['name'], b['ns_per_op_median']) for b in results['benchmarks'])
+
+if len(sys.argv) < 3:
+  print('Usage : %s before.json after.json [threshold]' % sys.argv[0])
+  sys.exit(2)
+before = load(sys.argv[1])
+after = load(sys.argv[2])
+threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 10.0
+regressions = 0
+for name in sorted(set(before) & set(after)):
+  change = (after[name] - before[name]) * 100.0 / before[name] if before[name] > 0 else 0.0
+  mark = ''
+  if change > threshold:
+    mark = '  <- slower'
+    regressions += 1
+  print('%-45s %12.2f %12.2f %+8.1f%%%s' % (name, before[name], after[name], change, mark))
+for name in sorted(set(before) ^ set(after)):
+  print('%-45s only in %s' % (name, sys.argv[1] if name in before else sys.argv[2]))
+sys.exit(1 if regressions > 0 else 0)
@@ -0,0 +1,527 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replay a capture (pcap or pcapng) of the traffic of a server at
+ * full speed, in memory, through the whole protocol stack (see
+ * inject.c). The servers are loaded from the configuration and the
+ * database like the real ones, the datagrams sent to their ports
+ * are injected and those they send are counted.
+ *
+ * The private and public ids are given by the server that replays,
+ * so the ids of the clients are rewritten with those it gave to
+ * their address (and the crc computed again). The clock of the
+ * servers is simulated and follows the capture time (see mclock.c),
+ * so the reliable packets are sent again and the players time out
+ * as they did when the traffic was captured.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "configuration.h"
+#include "database.h"
+#include "inject.h"
+#include "packet_tools.h"
+#include "compat.h"
+#include "log.h"
+#include "latency.h"
+#include "mclock.h"
+
+#define REPLAY_SWEEP_US 50000
+#define REPLAY_HASH_SIZE 4096
+
+/* the ids the server gave to a client address */
+struct replay_client
+{
+	struct server *s;
+	struct sockaddr_in addr;
+	uint32_t private_id;
+	uint32_t public_id;
+	struct replay_client *next;
+};
+
+struct replay
+{
+	struct array *ss;
+	struct replay_client *clients[REPLAY_HASH_SIZE];
+	uint64_t last_sweep;	/* capture time (us) */
+	uint64_t clock_base;	/* mclock time of the first datagram */
+
+	uint64_t frames;	/* read in the capture */
+	uint64_t injected;
+	uint64_t by_type[5];	/* 0xbef0 .. 0xbef4 */
+	uint64_t unmatched;	/* from a client that connected before the capture */
+	uint64_t sent;
+	uint64_t sent_bytes;
+	uint64_t first_ts, last_ts;
+};
+
+static unsigned int replay_hash(struct sockaddr_in *addr, struct server *s)
+{
+	return (addr->sin_addr.s_addr * 31 + addr->sin_port * 7 + s->port) % REPLAY_HASH_SIZE;
+}
+
+static struct replay_client *replay_find_client(struct replay *r, struct sockaddr_in *addr,
+		struct server *s)
+{
+	struct replay_client *cl;
+
+	for (cl = r->clients[replay_hash(addr, s)] ; cl != NULL ; cl = cl->next)
+		if (cl->s == s && cl->addr.sin_addr.s_addr == addr->sin_addr.s_addr
+				&& cl->addr.sin_port == addr->sin_port)
+			return cl;
+	return NULL;
+}
+
+/* the datagrams sent by the servers, the accepted connections give the ids */
+static void replay_output(struct server *s, const void *buf, size_t len,
+		struct sockaddr_in *to, void *arg)
+{
+	struct replay *r = (struct replay *)arg;
+	struct replay_client *cl;
+	char *ptr = (char *)buf;
+	unsigned int h;
+
+	r->sent++;
+	r->sent_bytes += len;
+	if (len != 436 || ru32(&ptr) != 0x0004bef4)
+		return;
+	ptr = (char *)buf + 88;
+	if (ru32(&ptr) != 1)	/* refused */
+		return;
+	cl = replay_find_client(r, to, s);
+	if (cl == NULL) {
+		cl = (struct replay_client *)calloc(1, sizeof(struct replay_client));
+		if (cl == NULL)
+			return;
+		cl->s = s;
+		cl->addr = *to;
+		h = replay_hash(to, s);
+		cl->next = r->clients[h];
+		r->clients[h] = cl;
+	}
+	ptr = (char *)buf + 4;
+	cl->private_id = ru32(&ptr);
+	cl->public_id = ru32(&ptr);
+}
+
+static struct server *replay_find_server(struct replay *r, uint16_t port)
+{
+	struct server *s;
+	size_t iter;
+
+	ar_each(struct server *, s, iter, r->ss)
+		if (s->port == port)
+			return s;
+	ar_end_each;
+	return NULL;
+}
+
+/**
+ * Inject a datagram sent by a client to one of the servers.
+ */
+static void replay_datagram(struct replay *r, uint64_t ts, struct sockaddr_in *from,
+		uint16_t port, const unsigned char *payload, size_t len)
+{
+	char buf[1024];
+	struct replay_client *cl;
+	struct server *s;
+	uint16_t type, code;
+	size_t iter;
+	char *ptr;
+
+	s = replay_find_server(r, port);
+	if (s == NULL || len < 12 || len > sizeof(buf))
+		return;
+	if (r->injected == 0)
+		r->first_ts = r->last_sweep = ts;
+	r->last_ts = ts;
+	mclock_set(r->clock_base + (ts - r->first_ts));
+	/* run the packet sender as often as the real one */
+	if (ts - r->last_sweep >= REPLAY_SWEEP_US) {
+		ar_each(struct server *, s, iter, r->ss)
+			inject_sweep(s);
+		ar_end_each;
+		r->last_sweep = ts;
+		s = replay_find_server(r, port);
+	}
+
+	memcpy(buf, payload, len);
+	ptr = buf;
+	type = ru16(&ptr);
+	code = ru16(&ptr);
+	if (type >= 0xbef0 && type <= 0xbef4)
+		r->by_type[type - 0xbef0]++;
+	/* the ids of the server that replays */
+	if (!(type == 0xbef4 && code == 3)) {
+		cl = replay_find_client(r, from, s);
+		if (cl != NULL) {
+			ptr = buf + 4;
+			wu32(cl->private_id, &ptr);
+			wu32(cl->public_id, &ptr);
+			if (type == 0xbef0 && len >= 24)
+				packet_add_crc_d(buf, len);
+			else if (type == 0xbef4 && len >= 20)
+				packet_add_crc(buf, len, 16);
+		} else {
+			r->unmatched++;
+		}
+	}
+	inject_packet(s, buf, len, from);
+	r->injected++;
+}
+
+/**
+ * Find the UDP datagram in a captured frame.
+ *
+ * @param r the replay
+ * @param ts the capture time (us)
+ * @param linktype the link type of the interface
+ * @param frame the frame
+ * @param len its captured size
+ */
+static void replay_frame(struct replay *r, uint64_t ts, uint32_t linktype,
+		const unsigned char *frame, size_t len)
+{
+	struct sockaddr_in from;
+	size_t off = 0, ihl, ip_len, udp_len;
+	uint16_t proto, frag;
+
+	r->frames++;
+	switch (linktype) {
+	case 0:		/* BSD loopback, host byte order */
+	case 108:	/* OpenBSD loopback, network byte order */
+		if (len < 4 || (frame[0] != 2 && frame[3] != 2))
+			return;
+		off = 4;
+		break;
+	case 1:		/* ethernet */
+		if (len < 14)
+			return;
+		off = 12;
+		proto = (frame[off] << 8) | frame[off + 1];
+		/* VLAN tags */
+		while ((proto == 0x8100 || proto == 0x88a8) && len >= off + 6) {
+			off += 4;
+			proto = (frame[off] << 8) | frame[off + 1];
+		}
+		if (proto != 0x0800)
+			return;
+		off += 2;
+		break;
+	case 12:	/* raw IP */
+	case 14:
+	case 101:
+	case 228:	/* IPv4 */
+		break;
+	case 113:	/* linux cooked */
+		if (len < 16 || frame[14] != 0x08 || frame[15] != 0x00)
+			return;
+		off = 16;
+		break;
+	case 276:	/* linux cooked v2 */
+		if (len < 20 || frame[0] != 0x08 || frame[1] != 0x00)
+			return;
+		off = 20;
+		break;
+	default:
+		return;
+	}
+
+	/* IPv4, not fragmented, UDP */
+	if (len < off + 20 || (frame[off] >> 4) != 4 || frame[off + 9] != 17)
+		return;
+	ihl = (frame[off] & 0x0f) * 4;
+	ip_len = (frame[off + 2] << 8) | frame[off + 3];
+	frag = (frame[off + 6] << 8) | frame[off + 7];
+	if ((frag & 0x3fff) != 0 || ihl < 20 || ip_len < ihl + 8)
+		return;
+	if (len > off + ip_len)
+		len = off + ip_len;
+	if (len < off + ihl + 8)
+		return;
+	memset(&from, 0, sizeof(from));
+	from.sin_family = AF_INET;
+	memcpy(&from.sin_addr.s_addr, frame + off + 12, 4);
+	memcpy(&from.sin_port, frame + off + ihl, 2);
+	off += ihl;
+	udp_len = (frame[off + 4] << 8) | frame[off + 5];
+	if (udp_len < 8)
+		return;
+	if (len > off + udp_len)
+		len = off + udp_len;
+	replay_datagram(r, ts, &from, (frame[off + 2] << 8) | frame[off + 3],
+			frame + off + 8, len - off - 8);
+}
+
+static uint32_t rd32(const unsigned char *p, int swap)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t rd16(const unsigned char *p, int swap)
+{
+	uint16_t v;
+
+	memcpy(&v, p, 2);
+	return swap ? __builtin_bswap16(v) : v;
+}
+
+/**
+ * Read a classic pcap file.
+ *
+ * @return 1 if the file is a pcap file, 0 if not
+ */
+static int replay_pcap(struct replay *r, const unsigned char *f, size_t size)
+{
+	uint32_t magic, linktype, caplen;
+	int swap, nano;
+	size_t pos;
+	uint64_t ts;
+
+	if (size < 24)
+		return 0;
+	memcpy(&magic, f, 4);
+	swap = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+	nano = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+	if (!swap && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d)
+		return 0;
+	linktype = rd32(f + 20, swap) & 0x0fffffff;
+	for (pos = 24 ; pos + 16 <= size ; pos += 16 + caplen) {
+		caplen = rd32(f + pos + 8, swap);
+		if (pos + 16 + caplen > size)
+			break;
+		ts = (uint64_t)rd32(f + pos, swap) * 1000000
+			+ rd32(f + pos + 4, swap) / (nano ? 1000 : 1);
+		replay_frame(r, ts, linktype, f + pos + 16, caplen);
+	}
+	return 1;
+}
+
+/* capture time in microseconds, tsresol is the if_tsresol option */
+static uint64_t pcapng_time(uint64_t t, uint8_t tsresol)
+{
+	uint64_t div = 1;
+	int i;
+
+	if (tsresol & 0x80) {
+		tsresol &= 0x7f;
+		return (t >> tsresol) * 1000000 + (((t & ((1ULL << tsresol) - 1)) * 1000000) >> tsresol);
+	}
+	if (tsresol <= 6) {
+		for (i = tsresol ; i < 6 ; i++)
+			t *= 10;
+		return t;
+	}
+	for (i = 6 ; i < tsresol ; i++)
+		div *= 10;
+	return t / div;
+}
+
+/**
+ * Read a pcapng file (section headers, interface descriptions,
+ * enhanced and simple packets).
+ *
+ * @return 1 if the file is a pcapng file, 0 if not
+ */
+static int replay_pcapng(struct replay *r, const unsigned char *f, size_t size)
+{
+	uint32_t linktypes[64];
+	uint8_t tsresol[64];
+	uint32_t type, len, magic, iface, caplen;
+	int swap = 0, nb_ifaces = 0;
+	size_t pos, opt;
+	uint64_t t;
+
+	if (size < 28 || rd32(f, 0) != 0x0a0d0d0a)
+		return 0;
+	for (pos = 0 ; pos + 12 <= size ; pos += len) {
+		type = rd32(f + pos, swap);
+		if (type == 0x0a0d0d0a) {
+			/* a new section, maybe of another byte order */
+			memcpy(&magic, f + pos + 8, 4);
+			swap = (magic == 0x4d3c2b1a);
+			nb_ifaces = 0;
+		}
+		len = rd32(f + pos + 4, swap);
+		if (len < 12 || len % 4 != 0 || pos + len > size)
+			break;
+		switch (type) {
+		case 1:		/* interface description */
+			if (nb_ifaces == 64 || len < 20)
+				break;
+			linktypes[nb_ifaces] = rd16(f + pos + 8, swap);
+			tsresol[nb_ifaces] = 6;
+			for (opt = pos + 16 ; opt + 4 <= pos + len - 4 ; ) {
+				if (rd16(f + opt, swap) == 0)
+					break;
+				if (rd16(f + opt, swap) == 9 && rd16(f + opt + 2, swap) == 1)
+					tsresol[nb_ifaces] = f[opt + 4];
+				opt += 4 + ((rd16(f + opt + 2, swap) + 3) & ~3);
+			}
+			nb_ifaces++;
+			break;
+		case 6:		/* enhanced packet */
+			iface = rd32(f + pos + 8, swap);
+			caplen = rd32(f + pos + 20, swap);
+			if (len < 32 || iface >= (uint32_t)nb_ifaces || caplen > len - 32)
+				break;
+			t = ((uint64_t)rd32(f + pos + 12, swap) << 32) | rd32(f + pos + 16, swap);
+			replay_frame(r, pcapng_time(t, tsresol[iface]), linktypes[iface],
+					f + pos + 28, caplen);
+			break;
+		case 3:		/* simple packet, no time */
+			if (len < 16 || nb_ifaces == 0)
+				break;
+			caplen = rd32(f + pos + 8, swap);
+			if (caplen > len - 16)
+				caplen = len - 16;
+			replay_frame(r, r->last_ts, linktypes[0], f + pos + 12, caplen);
+			break;
+		}
+	}
+	return 1;
+}
+
+static void print_help(char *progname)
+{
+	printf("Usage : %s [-c config] [-l] capture_file\n", progname);
+	printf(" -c <file> configuration of the servers (default sol-server.cfg)\n");
+	printf(" -l print the latency of the handlers\n");
+	printf("The database may be modified, use a copy.\n");
+}
+
+int main(int argc, char **argv)
+{
+	char *conf_file = "sol-server.cfg";
+	struct config *c;
+	struct replay *r;
+	struct server *s;
+	struct stat st;
+	unsigned char *f;
+	uint64_t start, elapsed;
+	size_t iter;
+	int opt, fd, latencies = 0, ok;
+	struct replay_client *cl, *next;
+	int i;
+
+	while ((opt = getopt(argc, argv, "c:l")) != -1) {
+		switch (opt) {
+		case 'c': conf_file = optarg; break;
+		case 'l': latencies = 1; break;
+		default:
+			print_help(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		perror(argv[optind]);
+		return 1;
+	}
+	f = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	/* the servers, as main() loads them, without sockets, and
+	 * with a clock that only moves with the capture */
+	mclock_simulate(0);
+	c = config_parse(conf_file);
+	if (c == NULL) {
+		fprintf(stderr, "Unable to read the configuration file %s.\n", conf_file);
+		return 1;
+	}
+	set_config(c);
+	init_db(c);
+	if (!connect_db(c) || !db_writer_start(c)) {
+		fprintf(stderr, "Unable to connect to the database.\n");
+		return 1;
+	}
+	r = (struct replay *)calloc(1, sizeof(struct replay));
+	if (r == NULL)
+		return 1;
+	r->clock_base = mclock_now();
+	r->ss = ar_new(2);
+	db_create_servers(c, c->conn, r->ss);
+	if (!db_create_all(c->conn, r->ss))
+		logger(LOG_WARN, "The servers could not be loaded completely.");
+	ar_each(struct server *, s, iter, r->ss)
+		inject_start(s, &replay_output, r);
+	ar_end_each;
+
+	start = mclock_ns();
+	ok = replay_pcap(r, f, st.st_size) || replay_pcapng(r, f, st.st_size);
+	elapsed = mclock_ns() - start;
+	munmap(f, st.st_size);
+	if (!ok) {
+		fprintf(stderr, "%s : not a pcap or pcapng file.\n", argv[optind]);
+		return 1;
+	}
+
+	printf("frames=%"PRIu64" injected=%"PRIu64" (commands=%"PRIu64" acks=%"PRIu64" audio=%"PRIu64
+			" connections and keepalives=%"PRIu64") unmatched=%"PRIu64"\n",
+			r->frames, r->injected, r->by_type[0], r->by_type[1], r->by_type[2],
+			r->by_type[4], r->unmatched);
+	printf("replayed in %.3f s (captured in %.3f s) : %.0f packets/s, %.2f us/packet\n",
+			elapsed / 1e9, (r->last_ts - r->first_ts) / 1e6,
+			(elapsed > 0) ? r->injected * 1e9 / elapsed : 0.0,
+			(r->injected > 0) ? elapsed / 1e3 / r->injected : 0.0);
+	printf("sent=%"PRIu64" datagrams, %"PRIu64" bytes\n", r->sent, r->sent_bytes);
+	if (latencies)
+		latency_write(stdout);
+
+	ar_each(struct server *, s, iter, r->ss)
+		inject_stop(s);
+		server_join(s);
+		ar_remove(r->ss, s);
+		free(s);
+	ar_end_each;
+	ar_free(r->ss);
+	for (i = 0 ; i < REPLAY_HASH_SIZE ; i++) {
+		for (cl = r->clients[i] ; cl != NULL ; cl = next) {
+			next = cl->next;
+			free(cl);
+		}
+	}
+	free(r);
+	db_writer_stop(c);
+	dbi_conn_close(c->conn);
+	dbi_shutdown();
+	destroy_config(c);
+	return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Run the loopback benchmark against the server for 1..MAX receiving
+# threads (network.receive_threads) and print one line per run.
+# Usage : bench/reuseport_sweep.sh [max_threads] [port] [clients]
+# The server must have been built with ./waf configure --with-bench
+MAX=${1:-4}
+PORT=${2:-8767}
+CLIENTS=${3:-32}
+BIN=./output/default
+CFG=`mktemp /tmp/sol-bench.XXXXXX`
+
+n=1
+while [ $n -le $MAX ]; do
+	sed -e 's/level: [0-9];/level: 1;/' \
+	    -e "s/receive_threads: [0-9]*;/receive_threads: $n;/" sol-server.cfg > $CFG
+	$BIN/soliloque-server -c $CFG &
+	PID=$!
+	sleep 1
+	printf "receive_threads=%i " $n
+	$BIN/bench/loopback_bench -p $PORT -n $CLIENTS -t 4 -d 5
+	kill $PID
+	wait $PID 2>/dev/null
+	n=`expr $n + 1`
+done
+rm -f $CFG
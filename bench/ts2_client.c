@@ -0,0 +1,383 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ts2_client.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "compat.h"
+#include "packet_tools.h"
+#include "audio_packet.h"
+#include "control_packet.h"
+#include "channel.h"
+#include "log.h"
+
+#define TS2_MAX_MSG 16384
+
+/**
+ * Open the socket of a client.
+ *
+ * @param c the client
+ * @param host the address of the server
+ * @param port the port of the server
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ts2_client_init(struct ts2_client *c, const char *host, int port)
+{
+	struct hostent *he;
+
+	bzero(c, sizeof(struct ts2_client));
+	c->chan = -1;
+	he = gethostbyname(host);
+	if (he == NULL) {
+		logger(LOG_ERR, "ts2_client_init, unknown host %s.", host);
+		return -1;
+	}
+	c->serv_addr.sin_family = AF_INET;
+	c->serv_addr.sin_port = htons(port);
+	memcpy(&c->serv_addr.sin_addr, he->h_addr_list[0], sizeof(struct in_addr));
+
+	c->sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (c->sd < 0) {
+		logger(LOG_ERR, "ts2_client_init, socket : %s.", strerror(errno));
+		return -1;
+	}
+	/* each client has its own source port */
+	if (connect(c->sd, (struct sockaddr *)&c->serv_addr, sizeof(c->serv_addr)) < 0) {
+		logger(LOG_ERR, "ts2_client_init, connect : %s.", strerror(errno));
+		close(c->sd);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Send an ACK for a reliable (0xbef0) packet.
+ *
+ * @param c the client
+ * @param in the packet we received
+ */
+static void ts2_client_ack(struct ts2_client *c, char *in)
+{
+	char data[16];
+	char *ptr = data;
+	char *in_ptr = in + 12;
+	uint32_t counter = ru32(&in_ptr);
+	uint16_t version = ru16(&in_ptr);
+
+	wu16(0xbef1, &ptr);
+	wu16(version, &ptr);
+	wu32(c->private_id, &ptr);
+	wu32(c->public_id, &ptr);
+	wu32(counter, &ptr);
+	send(c->sd, data, 16, 0);
+}
+
+/**
+ * Send a connection request (0xf4be0003) and wait for the answer
+ * of the server. The client then is in the default channel.
+ *
+ * @param c the client
+ * @param nickname the nickname of the client
+ * @param timeout_ms how long we wait for the server
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ts2_client_connect(struct ts2_client *c, const char *nickname, int timeout_ms)
+{
+	char data[180];
+	char in[TS2_MAX_MSG];
+	char *ptr = data;
+	struct pollfd pfd;
+	ssize_t n;
+
+	bzero(data, 180);
+	wu32(0x0003bef4, &ptr);
+	wu32(0, &ptr);			/* private ID */
+	wu32(0, &ptr);			/* public ID */
+	wu32(c->f4_counter++, &ptr);	/* counter */
+	ptr += 4;			/* checksum */
+	wstaticstring("TeamSpeak", 29, &ptr);
+	wstaticstring("Linux", 29, &ptr);
+	wu16(2, &ptr);			/* version */
+	wu16(0, &ptr);
+	wu16(20, &ptr);
+	wu16(1, &ptr);
+	ptr += 2;
+	wstaticstring("", 29, &ptr);	/* login : anonymous */
+	wstaticstring("", 29, &ptr);	/* password */
+	wstaticstring((char *)nickname, 29, &ptr);
+	packet_add_crc(data, 180, 16);
+
+	if (send(c->sd, data, 180, 0) != 180)
+		return -1;
+
+	pfd.fd = c->sd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, timeout_ms) > 0) {
+		n = recv(c->sd, in, TS2_MAX_MSG, 0);
+		if (n == 436 && GUINT32_FROM_LE(*(uint32_t *)in) == 0x0004bef4) {
+			ptr = in + 4;
+			c->private_id = ru32(&ptr);
+			c->public_id = ru32(&ptr);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Send a keepalive (0xf4be0001) so the server does not time us out.
+ *
+ * @param c the client
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ts2_client_keepalive(struct ts2_client *c)
+{
+	char data[20];
+	char *ptr = data;
+
+	wu32(0x0001bef4, &ptr);
+	wu32(c->private_id, &ptr);
+	wu32(c->public_id, &ptr);
+	wu32(c->f4_counter++, &ptr);
+	wu32(0, &ptr);			/* checksum */
+	packet_add_crc(data, 20, 16);
+	return send(c->sd, data, 20, 0) == 20 ? 0 : -1;
+}
+
+/**
+ * Send one audio block (0xbef2) with the codec of the client,
+ * the size follows codec_offset and codec_audio_size. The block
+ * starts with the time it was sent, to measure the forward latency.
+ *
+ * @param c the client
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ts2_client_send_audio(struct ts2_client *c)
+{
+	char data[TS2_MAX_MSG];
+	char *ptr = data;
+	size_t len = 16 + codec_offset[c->codec] + codec_audio_size[c->codec];
+	uint64_t now;
+
+	bzero(data, len);
+	wu16(0xbef2, &ptr);
+	wu8(0, &ptr);
+	wu8(c->codec, &ptr);
+	wu32(c->private_id, &ptr);
+	wu32(c->public_id, &ptr);
+	wu16(0, &ptr);			/* conversation counter */
+	wu16(c->audio_counter++, &ptr);
+	now = mclock_ns();
+	memcpy(ptr, &now, sizeof(now));
+	if (send(c->sd, data, len, 0) != (ssize_t)len)
+		return -1;
+	c->audio_sent++;
+	return 0;
+}
+
+/* the header of a command, the checksum is added once it is filled */
+static void ts2_client_command(struct ts2_client *c, char *data, size_t len, uint16_t code)
+{
+	char *ptr = data;
+
+	bzero(data, len);
+	wu16(PKT_TYPE_CTL, &ptr);
+	wu16(code, &ptr);
+	wu32(c->private_id, &ptr);
+	wu32(c->public_id, &ptr);
+	wu32(c->f0_counter++, &ptr);
+}
+
+/**
+ * Ask for the list of channels and players (0xbef0 0x0005).
+ *
+ * @param c the client
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ts2_client_request_chans(struct ts2_client *c)
+{
+	char data[120];
+
+	ts2_client_command(c, data, 120, 0x0005);
+	packet_add_crc_d(data, 120);
+	if (send(c->sd, data, 120, 0) != 120)
+		return -1;
+	c->cmd_sent++;
+	return 0;
+}
+
+/**
+ * Ask to switch to another channel (0xbef0 0x012f). The client
+ * takes the codec of the channel once the server confirms.
+ *
+ * @param c the client
+ * @param chan the index of the channel in the channel list
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ts2_client_switch_channel(struct ts2_client *c, int chan)
+{
+	char data[58];
+	char *ptr = data + 24;
+
+	if (chan < 0 || chan >= c->nb_chans)
+		return -1;
+	ts2_client_command(c, data, 58, 0x012f);
+	wu32(c->chans[chan].id, &ptr);
+	wstaticstring("", 29, &ptr);	/* password */
+	packet_add_crc_d(data, 58);
+	if (send(c->sd, data, 58, 0) != 58)
+		return -1;
+	c->cmd_sent++;
+	c->switch_sent = mclock_ns();
+	return 0;
+}
+
+static int ts2_client_find_chan(struct ts2_client *c, uint32_t id)
+{
+	int i;
+
+	for (i = 0 ; i < c->nb_chans ; i++) {
+		if (c->chans[i].id == id)
+			return i;
+	}
+	return -1;
+}
+
+/* remember the channels (the first TS2_MAX_CHANS), we start in the default one */
+static void ts2_client_read_chans(struct ts2_client *c, char *in, ssize_t n)
+{
+	char *ptr = in + 24, *end = in + n;
+	struct ts2_channel *ch;
+	uint32_t nb, i;
+	int str;
+
+	if (n < 28)
+		return;
+	nb = ru32(&ptr);
+	c->nb_chans = 0;
+	for (i = 0 ; i < nb && ptr + 16 <= end && c->nb_chans < TS2_MAX_CHANS ; i++) {
+		ch = &c->chans[c->nb_chans++];
+		ch->id = ru32(&ptr);
+		ch->flags = ru16(&ptr);
+		ch->codec = ru16(&ptr);
+		ptr += 4 + 2 + 2;		/* parent, order, max users */
+		/* name, topic and description */
+		for (str = 0 ; str < 3 ; str++) {
+			while (ptr < end && *ptr != '\0')
+				ptr++;
+			ptr++;
+		}
+		if (c->chan == -1 && (ch->flags & CHANNEL_FLAG_DEFAULT)) {
+			c->chan = c->nb_chans - 1;
+			c->codec = ch->codec;
+		}
+	}
+}
+
+/* a player switched channels, maybe us */
+static void ts2_client_read_switch(struct ts2_client *c, char *in, ssize_t n)
+{
+	char *ptr = in + 24;
+	uint32_t pub_id, to_id;
+	int to;
+
+	if (n < 38)
+		return;
+	pub_id = ru32(&ptr);
+	ptr += 4;			/* previous channel */
+	to_id = ru32(&ptr);
+	if (pub_id != c->public_id || (to = ts2_client_find_chan(c, to_id)) == -1)
+		return;
+	c->chan = to;
+	c->codec = c->chans[to].codec;
+	c->switches++;
+	if (c->switch_latency != NULL && c->switch_sent != 0)
+		latency_histogram_add(c->switch_latency, mclock_ns() - c->switch_sent);
+	c->switch_sent = 0;
+}
+
+/**
+ * Read everything the server sent us, ACK the reliable packets,
+ * follow the channel list and our channel switches, and count
+ * the forwarded audio packets (and their latency).
+ *
+ * @param c the client
+ * @param timeout_ms how long we wait for a first packet
+ *
+ * @return the number of packets read
+ */
+int ts2_client_poll(struct ts2_client *c, int timeout_ms)
+{
+	char in[TS2_MAX_MSG];
+	struct pollfd pfd;
+	ssize_t n;
+	uint64_t sent;
+	int nb = 0;
+
+	pfd.fd = c->sd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return 0;
+	while ((n = recv(c->sd, in, TS2_MAX_MSG, MSG_DONTWAIT)) >= 4) {
+		nb++;
+		switch (GUINT16_FROM_LE(*(uint16_t *)in)) {
+		case 0xbef0:
+			c->ctl_rec++;
+			if (n < 20)
+				break;
+			ts2_client_ack(c, in);
+			if (GUINT16_FROM_LE(((uint16_t *)in)[1]) == CTL_LIST_CH)
+				ts2_client_read_chans(c, in, n);
+			else if (GUINT16_FROM_LE(((uint16_t *)in)[1]) == CTL_SWITCHCHAN)
+				ts2_client_read_switch(c, in, n);
+			break;
+		case 0xbef1:
+			c->acks_rec++;
+			break;
+		case 0xbef3:
+			c->audio_rec++;
+			/* the block starts at 22, with the time it was sent */
+			if (c->audio_latency != NULL && n >= 30) {
+				memcpy(&sent, in + 22, sizeof(sent));
+				latency_histogram_add(c->audio_latency, mclock_ns() - sent);
+			}
+			break;
+		}
+	}
+	return nb;
+}
+
+void ts2_client_close(struct ts2_client *c)
+{
+	close(c->sd);
+}
@@ -0,0 +1,85 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TS2_CLIENT_H__
+#define __TS2_CLIENT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "latency.h"
+#include "mclock.h"
+
+/* channels remembered from the channel list */
+#define TS2_MAX_CHANS 128
+
+struct ts2_channel
+{
+	uint32_t id;
+	uint16_t flags;
+	uint16_t codec;
+};
+
+/**
+ * A minimal TeamSpeak 2 client, used to put some load on a server.
+ */
+struct ts2_client
+{
+	int sd;
+	struct sockaddr_in serv_addr;
+
+	uint32_t private_id;
+	uint32_t public_id;
+
+	uint32_t f0_counter;	/* commands */
+	uint32_t f4_counter;	/* connection and keepalives */
+	uint16_t audio_counter;
+	uint8_t codec;
+
+	/* the channel list (ts2_client_request_chans)
+	 * and the channel we are in, -1 if unknown */
+	struct ts2_channel chans[TS2_MAX_CHANS];
+	int nb_chans;
+	int chan;
+	uint64_t switch_sent;	/* mclock_ns() of the last switch request */
+
+	/* forward latency of the audio (timestamped by the sender)
+	 * and delay of the channel switches, NULL if not measured */
+	struct latency_histogram *audio_latency;
+	struct latency_histogram *switch_latency;
+
+	/* statistics */
+	uint64_t audio_sent;
+	uint64_t audio_rec;
+	uint64_t ctl_rec;
+	uint64_t cmd_sent;
+	uint64_t acks_rec;
+	uint64_t switches;
+};
+
+int ts2_client_init(struct ts2_client *c, const char *host, int port);
+int ts2_client_connect(struct ts2_client *c, const char *nickname, int timeout_ms);
+int ts2_client_keepalive(struct ts2_client *c);
+int ts2_client_send_audio(struct ts2_client *c);
+int ts2_client_request_chans(struct ts2_client *c);
+int ts2_client_switch_channel(struct ts2_client *c, int chan);
+int ts2_client_poll(struct ts2_client *c, int timeout_ms);
+void ts2_client_close(struct ts2_client *c);
+
+#endif
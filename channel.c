@@ -20,6 +20,7 @@
 #include "array.h"
 #include "log.h"
 #include "database.h"
+#include "arena.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +28,36 @@
 #include <errno.h>
 #include <assert.h>
 
+IL_GENERATE(pl_list, player, chan_link);
+IL_GENERATE(ch_list, channel, sub_link);
+
+/**
+ * Detach a channel from the others : its privileges are destroyed,
+ * its subchannels and its parent forget it.
+ *
+ * @param chan the channel
+ */
+void channel_unlink(struct channel *chan)
+{
+	struct player_channel_privilege *priv, *next_priv;
+	struct channel *sub, *next_sub;
+
+	/* destroy privileges */
+	il_each(priv, next_priv, &chan->pl_privileges, ch_link)
+		priv_list_remove(&chan->pl_privileges, priv);
+		destroy_player_channel_privilege(priv);
+	il_end_each;
+	/* the list links are in the channels : detach the
+	 * subchannels, and this channel from its parent */
+	il_each(sub, next_sub, &chan->subchannels, sub_link)
+		ch_list_remove(&chan->subchannels, sub);
+		sub->parent = NULL;
+	il_end_each;
+	if (chan->parent != NULL)
+		ch_list_remove(&chan->parent->subchannels, chan);
+	chan->parent = NULL;
+}
+
 /**
  * Destroys a channel and all its fields
  *
@@ -36,33 +67,18 @@
  */
 int destroy_channel(struct channel *chan)
 {
-	size_t iter;
-	void *el;
-
-	free(chan->name);
-	free(chan->topic);
-	free(chan->desc);
-	ar_free(chan->players);
-
-	/* destroy privileges */
-	ar_each(void *, el, iter, chan->pl_privileges)
-		ar_remove(chan->pl_privileges, el);
-		destroy_player_channel_privilege(el);
-	ar_end_each;
-	ar_free(chan->pl_privileges);
-	/* destroy subchannels */
-	ar_each(void *, el, iter, chan->subchannels)
-		ar_remove(chan->subchannels, el);
-	ar_end_each;
-	ar_free(chan->subchannels);
-
-	free(chan);
+	channel_unlink(chan);
+	arena_strfree(chan->arena, chan->name);
+	arena_strfree(chan->arena, chan->topic);
+	arena_strfree(chan->arena, chan->desc);
+	arena_free(chan->arena, chan, sizeof(struct channel));
 	return 1;
 }
 
 /**
  * Initialize a new channel.
  * 
+ * @param a the arena of the server the channel will be in
  * @param name the name of the channel
  * @param topic the topic of the channel
  * @param desc the description of the channel
@@ -73,42 +89,40 @@ int destroy_channel(struct channel *chan)
  *
  * @return the newly allocated and initialized channel
  */
-struct channel *new_channel(char *name, char *topic, char *desc, uint16_t flags,
+struct channel *new_channel(struct arena *a, char *name, char *topic, char *desc, uint16_t flags,
 		uint16_t codec, uint16_t sort_order, uint16_t max_users)
 {
 	struct channel *chan;
-	chan = (struct channel *)calloc(1, sizeof(struct channel));
+	chan = (struct channel *)arena_alloc(a, sizeof(struct channel));
 	if (chan == NULL) {
-		logger(LOG_ERR, "new_channel, calloc failed : %s.", strerror(errno));
+		logger(LOG_ERR, "new_channel, arena_alloc failed.");
 		return NULL;
 	}
 	
+	chan->arena = a;
 	bzero(chan->password, 30);
-	chan->players = ar_new(4);
-	chan->players->max_slots = max_users;
+	pl_list_init(&chan->players);
+	chan->max_users = max_users;
 	/* subchannels */
-	chan->subchannels = ar_new(4);
+	ch_list_init(&chan->subchannels);
 	chan->parent = NULL;
 	/* player privileges */
-	chan->pl_privileges = ar_new(4);
+	priv_list_init(&chan->pl_privileges);
 
 	/* strdup : input strings are secure */
-	chan->name = strdup(name);
-	chan->topic = strdup(topic);
-	chan->desc = strdup(desc);
+	chan->name = arena_strdup(a, name);
+	chan->topic = arena_strdup(a, topic);
+	chan->desc = arena_strdup(a, desc);
 
 	chan->flags = flags;
 	chan->codec = codec;
 	chan->sort_order = sort_order;
 
 	if (chan->name == NULL || chan->topic == NULL || chan->desc == NULL) {
-		if (chan->name != NULL)
-			free(chan->name);
-		if (chan->topic != NULL)
-			free(chan->topic);
-		if (chan->desc != NULL)
-			free(chan->desc);
-		free(chan);
+		arena_strfree(a, chan->name);
+		arena_strfree(a, chan->topic);
+		arena_strfree(a, chan->desc);
+		arena_free(a, chan, sizeof(struct channel));
 		return NULL;
 	}
 	
@@ -119,12 +133,14 @@ struct channel *new_channel(char *name, char *topic, char *desc, uint16_t flags,
  * Initialize a default channel for testing.
  * This will not give a channel it's ID (determined at insertion)
  *
+ * @param a the arena of the server
+ *
  * @return a test channel.
  */
-struct channel *new_predef_channel()
+struct channel *new_predef_channel(struct arena *a)
 {
 	uint16_t flags = (0 & ~CHANNEL_FLAG_UNREGISTERED);
-	return new_channel("Channel name", "Channel topic", "Channel description", flags, CODEC_SPEEX_19_6, 0, 16);
+	return new_channel(a, "Channel name", "Channel topic", "Channel description", flags, CODEC_SPEEX_19_6, 0, 16);
 }
 
 
@@ -161,8 +177,9 @@ int add_player_to_channel(struct channel *chan, struct player *pl)
 	if (ch_isfull(chan))
 		return 0;
 
-	if (ar_insert(chan->players, pl) == AR_OK) {
+	if (pl_list_insert(&chan->players, pl)) {
 		pl->in_chan = chan;
+		audio_path_changed(chan->in_server);
 		return 1;
 	}
 	return 0;
@@ -196,7 +213,7 @@ int channel_to_data(struct channel *ch, char *data)
 		wu32(ch->parent->id, &ptr);
 	}
 	wu16(ch->sort_order, &ptr);
-	wu16(ch->players->max_slots, &ptr);
+	wu16(ch->max_users, &ptr);
 	strcpy(ptr, ch->name);			ptr += (strlen(ch->name) +1);
 	strcpy(ptr, ch->topic);			ptr += (strlen(ch->topic) +1);
 	strcpy(ptr, ch->desc);			ptr += (strlen(ch->desc) +1);
@@ -223,7 +240,7 @@ int channel_to_data_size(struct channel *ch)
 }
 
 
-size_t channel_from_data(char *data, int len, struct channel **dst)
+size_t channel_from_data(struct arena *a, char *data, int len, struct channel **dst)
 {
 	uint16_t flags;
 	uint16_t codec;
@@ -253,7 +270,12 @@ size_t channel_from_data(char *data, int len, struct channel **dst)
 		logger(LOG_WARN, "channel_from_data, allocation failed : %s.", strerror(errno));
 		return 0;
 	}
-	*dst = new_channel(name, topic, desc, flags, codec, sort_order, max_users);
+	*dst = new_channel(a, name, topic, desc, flags, codec, sort_order, max_users);
+	free(name);
+	free(topic);
+	free(desc);
+	if (*dst == NULL)
+		return 0;
 
 	if (parent_id != 0xFFFFFFFF)
 		(*dst)->parent_id = parent_id;
@@ -271,7 +293,7 @@ int channel_remove_subchannel(struct channel *ch, struct channel *subchannel)
 		logger(LOG_WARN, "channel_remove_subchannel, parent is null.");
 		return 0;
 	}
-	ar_remove(ch->subchannels, subchannel);
+	ch_list_remove(&ch->subchannels, subchannel);
 	subchannel->parent = NULL;
 
 	return 1;
@@ -286,7 +308,7 @@ int channel_add_subchannel(struct channel *ch, struct channel *subchannel)
 	if (subchannel->parent != NULL)
 		channel_remove_subchannel(subchannel->parent, subchannel);
 	subchannel->parent = ch;
-	ar_insert(ch->subchannels, subchannel);
+	ch_list_insert(&ch->subchannels, subchannel);
 	return 1;
 }
 
@@ -346,12 +368,8 @@ char *ch_getpass(struct channel *ch)
  */
 char ch_isfull(struct channel *ch)
 {
-	/* Max number of players in default channel is maximum
-	 * number of element in the array */
-	if (ch->flags & CHANNEL_FLAG_DEFAULT)
-		return ch->players->used_slots == (size_t) -1;
-	/* Else it is specified */
-	return ch->players->used_slots >= ch->players->max_slots;
+	/* the default channel is bounded by max_users too */
+	return ch->players.count >= ch->max_users;
 }
 
 /**
@@ -365,23 +383,22 @@ char ch_isfull(struct channel *ch)
 struct player_channel_privilege *get_player_channel_privilege(struct player *pl, struct channel *ch)
 {
 	struct channel *tmp_ch;
-	struct player_channel_privilege *tmp_priv;
-	size_t iter;
+	struct player_channel_privilege *tmp_priv, *next;
 
 	tmp_ch = ch;
 	if (ch->parent != NULL)
 		tmp_ch = ch->parent;
 
-	ar_each(struct player_channel_privilege *, tmp_priv, iter, tmp_ch->pl_privileges)
+	il_each(tmp_priv, next, &tmp_ch->pl_privileges, ch_link)
 		if (tmp_priv->reg == PL_CH_PRIV_REGISTERED && tmp_priv->pl_or_reg.reg == pl->reg)
 			return tmp_priv;
 		if (tmp_priv->reg == PL_CH_PRIV_UNREGISTERED && tmp_priv->pl_or_reg.pl == pl)
 			return tmp_priv;
-	ar_end_each;
+	il_end_each;
 
 	logger(LOG_INFO, "Could not find privileges for this channel-player couple... Creating a new one");
 	/* if there is no existing privileges, we create them */
-	tmp_priv = new_player_channel_privilege();
+	tmp_priv = new_player_channel_privilege(tmp_ch->arena);
 	tmp_priv->ch = tmp_ch;
 	if (pl->global_flags & GLOBAL_FLAG_REGISTERED) {
 		tmp_priv->reg = PL_CH_PRIV_REGISTERED;
@@ -392,8 +409,7 @@ struct player_channel_privilege *get_player_channel_privilege(struct player *pl,
 			db_add_pl_chan_priv(tmp_ch->in_server->conf, tmp_priv);
 		}
 	} else {
-		tmp_priv->reg = PL_CH_PRIV_UNREGISTERED;
-		tmp_priv->pl_or_reg.pl = pl;
+		pl_chan_priv_set_player(tmp_priv, pl);
 	}
 	add_player_channel_privilege(tmp_ch, tmp_priv);
 
@@ -402,5 +418,5 @@ struct player_channel_privilege *get_player_channel_privilege(struct player *pl,
 
 void add_player_channel_privilege(struct channel *ch, struct player_channel_privilege *priv)
 {
-	ar_insert(ch->pl_privileges, priv);
+	priv_list_insert(&ch->pl_privileges, priv);
 }
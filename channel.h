@@ -24,6 +24,8 @@
 #include "compat.h"
 #include "audio_packet.h"
 #include "player_channel_privilege.h"
+#include "intrusive.h"
+#include "qsbr.h"
 
 
 #define CHANNEL_FLAG_UNREGISTERED 1
@@ -33,6 +35,13 @@
 #define CHANNEL_FLAG_DEFAULT    16
 
 
+/* the players of a channel, linked by their chan_link */
+IL_HEAD(pl_list, player);
+IL_PROTOTYPE(pl_list, player);
+/* the subchannels of a channel, linked by their sub_link */
+IL_HEAD(ch_list, channel);
+IL_PROTOTYPE(ch_list, channel);
+
 struct channel {
 	uint32_t id;
 	uint16_t flags;
@@ -44,26 +53,32 @@ struct channel {
 	char *desc;
 	char password[30];
 
-	struct array *players;
+	struct pl_list players;
+	uint16_t max_users;
 	struct server *in_server;
 	/* channel tree */
-	struct array *subchannels;
+	struct ch_list subchannels;
+	IL_ENTRY(channel) sub_link;	/* in parent->subchannels */
 	/* player privileges */
-	struct array *pl_privileges;
+	struct priv_list pl_privileges;
 
 	struct channel *parent;
 	uint32_t parent_id;
 
 	uint32_t db_id;
+
+	struct arena *arena;	/* of its server, with its strings */
+	struct qsbr_node retired;	/* once removed from its server */
 };
 
 
 
 /* Channel functions */
-struct channel *new_channel(char *name, char *topic, char *desc, uint16_t flags,
+struct channel *new_channel(struct arena *a, char *name, char *topic, char *desc, uint16_t flags,
 		uint16_t codec, uint16_t sort_order, uint16_t max_users);
-struct channel *new_predef_channel(void);
+struct channel *new_predef_channel(struct arena *a);
 int destroy_channel(struct channel *chan);
+void channel_unlink(struct channel *chan);
 
 int add_player_to_channel(struct channel *chan, struct player *player);
 
@@ -71,7 +86,7 @@ void print_channel(struct channel *chan);
 
 int channel_to_data(struct channel *ch, char *data);
 int channel_to_data_size(struct channel *ch);
-size_t channel_from_data(char *data, int len, struct channel **dst);
+size_t channel_from_data(struct arena *a, char *data, int len, struct channel **dst);
 /* subchannels */
 int channel_remove_subchannel(struct channel *ch, struct channel *subchannel);
 int channel_add_subchannel(struct channel *ch, struct channel *subchannel);
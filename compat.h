@@ -49,6 +49,8 @@
 #include "config.h"
 
 
+#undef MAX
+#define MAX(a, b)  (((a) > (b)) ? (a) : (b))
 
 #undef MIN
 #define MIN(a, b)  (((a) < (b)) ? (a) : (b))
@@ -48,9 +48,15 @@ void destroy_config(struct config *c)
 				free(c->db.connection.pass);
 			if (c->db.connection.user != NULL)
 				free(c->db.connection.user);
+			if (c->db.connection.db != NULL)
+				free(c->db.connection.db);
 		}
 		free(c->db_type);
 	}
+	free(c->db_snapshot);
+	free(c->log.trace);
+	free(c->net.handoff);
+	free(c->net.metrics);
 	free(c);
 }
 
@@ -83,6 +89,93 @@ static int config_parse_log(config_setting_t *log, struct config *cfg)
 		cfg->log.level = 3;
 	else
 		cfg->log.level = config_setting_get_int(curr);
+
+	/* default : no trace, 1M records (32 MB) if there is one */
+	curr = config_setting_get_member(log, "trace");
+	if (curr != NULL)
+		cfg->log.trace = strdup(config_setting_get_string(curr));
+	curr = config_setting_get_member(log, "trace_records");
+	if (curr == NULL)
+		cfg->log.trace_records = 1048576;
+	else
+		cfg->log.trace_records = config_setting_get_int(curr);
+	if (cfg->log.trace_records < 1) {
+		logger(LOG_WARN, "config_parse_log : trace_records must be at least 1, using 1.");
+		cfg->log.trace_records = 1;
+	}
+	return 1;
+}
+
+static int config_parse_net(config_setting_t *net, struct config *cfg)
+{
+	config_setting_t *curr;
+
+	/* default : one socket and one receiving thread per server */
+	cfg->net.recv_threads = 1;
+	cfg->net.mode = NET_MODE_THREADS;
+	cfg->net.reactor_threads = 1;
+	cfg->net.io = NET_IO_POLL;
+	cfg->net.audio_thread = -1;
+	if (net == NULL) {
+		cfg->net.audio_thread = 1;
+		return 1;
+	}
+
+	curr = config_setting_get_member(net, "mode");
+	if (curr != NULL) {
+		if (strcmp(config_setting_get_string(curr), "reactor") == 0) {
+#ifdef HAVE_EPOLL
+			cfg->net.mode = NET_MODE_REACTOR;
+#else
+			logger(LOG_WARN, "config_parse_net : reactor mode needs epoll, using threads.");
+#endif
+		} else if (strcmp(config_setting_get_string(curr), "threads") != 0) {
+			logger(LOG_WARN, "config_parse_net : unknown mode %s, using threads.",
+					config_setting_get_string(curr));
+		}
+	}
+	curr = config_setting_get_member(net, "io");
+	if (curr != NULL) {
+		if (strcmp(config_setting_get_string(curr), "io_uring") == 0) {
+#ifdef HAVE_IO_URING
+			cfg->net.io = NET_IO_URING;
+#else
+			logger(LOG_WARN, "config_parse_net : io_uring support not compiled in, using poll.");
+#endif
+		} else if (strcmp(config_setting_get_string(curr), "poll") != 0) {
+			logger(LOG_WARN, "config_parse_net : unknown io %s, using poll.",
+					config_setting_get_string(curr));
+		}
+	}
+	curr = config_setting_get_member(net, "audio_thread");
+	if (curr != NULL)
+		cfg->net.audio_thread = config_setting_get_bool(curr);
+	/* by default, the reactor mode saves threads */
+	if (cfg->net.audio_thread == -1)
+		cfg->net.audio_thread = (cfg->net.mode == NET_MODE_THREADS);
+	curr = config_setting_get_member(net, "reactor_threads");
+	if (curr != NULL)
+		cfg->net.reactor_threads = config_setting_get_int(curr);
+	if (cfg->net.reactor_threads < 1) {
+		logger(LOG_WARN, "config_parse_net : reactor_threads must be at least 1, using 1.");
+		cfg->net.reactor_threads = 1;
+	}
+
+	curr = config_setting_get_member(net, "receive_threads");
+	if (curr != NULL)
+		cfg->net.recv_threads = config_setting_get_int(curr);
+	if (cfg->net.recv_threads < 1) {
+		logger(LOG_WARN, "config_parse_net : receive_threads must be at least 1, using 1.");
+		cfg->net.recv_threads = 1;
+	}
+	/* default : no handoff to a new process */
+	curr = config_setting_get_member(net, "handoff_socket");
+	if (curr != NULL)
+		cfg->net.handoff = strdup(config_setting_get_string(curr));
+	/* default : no metrics exporter */
+	curr = config_setting_get_member(net, "metrics");
+	if (curr != NULL)
+		cfg->net.metrics = strdup(config_setting_get_string(curr));
 	return 1;
 }
 
@@ -93,13 +186,13 @@ static int config_parse_db_sqlite(config_setting_t *db, struct config *cfg)
 	/* sqlite 2.x or 3.x use a filename to connect */
 	curr = config_setting_get_member(db, "dir");
 	if (curr == NULL)
-		cfg->db.file.path = "./";
+		cfg->db.file.path = strdup("./");
 	else
 		cfg->db.file.path = strdup(config_setting_get_string(curr));
 
 	curr = config_setting_get_member(db, "db");
 	if (curr == NULL)
-		cfg->db.file.db = "soliloque.sqlite3";
+		cfg->db.file.db = strdup("soliloque.sqlite3");
 	else
 		cfg->db.file.db = strdup(config_setting_get_string(curr));
 
@@ -115,7 +208,7 @@ static int config_parse_db_other(config_setting_t *db, struct config *cfg)
 	/* get the hostname */
 	curr = config_setting_get_member(db, "host");
 	if (curr == NULL)
-		cfg->db.connection.host = "localhost";
+		cfg->db.connection.host = strdup("localhost");
 	else
 		cfg->db.connection.host = strdup(config_setting_get_string(curr));
 	/* get the port */
@@ -127,19 +220,19 @@ static int config_parse_db_other(config_setting_t *db, struct config *cfg)
 	/* get the username */
 	curr = config_setting_get_member(db, "user");
 	if (curr == NULL)
-		cfg->db.connection.user = "root";
+		cfg->db.connection.user = strdup("root");
 	else
 		cfg->db.connection.user = strdup(config_setting_get_string(curr));
 	/* get the password */
 	curr = config_setting_get_member(db, "pass");
 	if (curr == NULL)
-		cfg->db.connection.pass = "";
+		cfg->db.connection.pass = strdup("");
 	else
 		cfg->db.connection.pass = strdup(config_setting_get_string(curr));
 	/* get the database */
 	curr = config_setting_get_member(db, "db");
 	if (curr == NULL)
-		cfg->db.connection.db = "soliloque";
+		cfg->db.connection.db = strdup("soliloque");
 	else
 		cfg->db.connection.db = strdup(config_setting_get_string(curr));
 
@@ -153,10 +246,48 @@ static int config_parse_db(config_setting_t *db, struct config *cfg)
 	/* get the database type */
 	curr = config_setting_get_member(db, "type");
 	if (curr == NULL) /* default : sqlite3 */
-		cfg->db_type = "sqlite3";
+		cfg->db_type = strdup("sqlite3");
 	else
 		cfg->db_type = strdup(config_setting_get_string(curr));
 
+	/* default : writes are done asynchronously, 64 per transaction */
+	curr = config_setting_get_member(db, "async");
+	if (curr == NULL)
+		cfg->db_async = 1;
+	else
+		cfg->db_async = config_setting_get_bool(curr);
+	curr = config_setting_get_member(db, "batch");
+	if (curr == NULL)
+		cfg->db_batch = 64;
+	else
+		cfg->db_batch = config_setting_get_int(curr);
+	if (cfg->db_batch < 1) {
+		logger(LOG_WARN, "config_parse_db : batch must be at least 1, using 1.");
+		cfg->db_batch = 1;
+	}
+	curr = config_setting_get_member(db, "load_threads");
+	if (curr == NULL)
+		cfg->db_load_threads = 4;
+	else
+		cfg->db_load_threads = config_setting_get_int(curr);
+	if (cfg->db_load_threads < 1) {
+		logger(LOG_WARN, "config_parse_db : load_threads must be at least 1, using 1.");
+		cfg->db_load_threads = 1;
+	}
+	/* default : no snapshot, or one every 5 minutes and on exit */
+	curr = config_setting_get_member(db, "snapshot");
+	if (curr != NULL)
+		cfg->db_snapshot = strdup(config_setting_get_string(curr));
+	curr = config_setting_get_member(db, "snapshot_interval");
+	if (curr == NULL)
+		cfg->db_snapshot_interval = 300;
+	else
+		cfg->db_snapshot_interval = config_setting_get_int(curr);
+	if (cfg->db_snapshot_interval < 0) {
+		logger(LOG_WARN, "config_parse_db : snapshot_interval can not be negative, using 0.");
+		cfg->db_snapshot_interval = 0;
+	}
+
 	if (strcmp(cfg->db_type, "sqlite") == 0 || strcmp(cfg->db_type, "sqlite3") == 0)
 		return config_parse_db_sqlite(db, cfg);
 	else
@@ -175,6 +306,7 @@ struct config *config_parse(char *cfg_file)
 	config_t cfg;
 	config_setting_t *db;
 	config_setting_t *log;
+	config_setting_t *net;
 	struct config *cfg_s;
 
 	config_init(&cfg);
@@ -214,6 +346,14 @@ struct config *config_parse(char *cfg_file)
 		return 0;
 	}
 
+	/* the network section is optional */
+	net = config_lookup(&cfg, "network");
+	if (config_parse_net(net, cfg_s) == 0) {
+		logger(LOG_ERR, "config_parse_net failed.");
+		config_destroy(&cfg);
+		return 0;
+	}
+
 	config_destroy(&cfg);
 	return cfg_s;
 }
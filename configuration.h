@@ -23,9 +23,26 @@
 #include <dbi/dbi.h>
 #include <stdio.h>
 
+/* threads : two threads per server (receiving, packet sender)
+ * reactor : a pool of epoll threads shared by all the servers */
+#define NET_MODE_THREADS 0
+#define NET_MODE_REACTOR 1
+
+/* how the receiving threads read and send packets */
+#define NET_IO_POLL 0
+#define NET_IO_URING 1
+
+struct db_writer;
+struct db_stmt_cache;
+
 struct config
 {
 	char *db_type;
+	int db_async;		/* write to the db from a dedicated thread */
+	int db_batch;		/* max. number of writes per transaction */
+	int db_load_threads;	/* threads loading the servers at startup */
+	char *db_snapshot;	/* snapshot file, NULL if disabled */
+	int db_snapshot_interval;	/* seconds between two snapshots, 0 = only on exit */
 	union {
 		struct {
 			char *path;
@@ -42,8 +59,21 @@ struct config
 	struct {
 		FILE *output;
 		int level;
+		char *trace;		/* binary packet trace, NULL if disabled */
+		int trace_records;	/* size of its ring */
 	} log;
+	struct {
+		int recv_threads;	/* SO_REUSEPORT sockets/threads per server */
+		int mode;		/* NET_MODE_THREADS or NET_MODE_REACTOR */
+		int reactor_threads;	/* size of the reactor pool */
+		int io;			/* NET_IO_POLL or NET_IO_URING */
+		int audio_thread;	/* forward audio from a dedicated thread */
+		char *handoff;		/* unix socket to hand the servers off, NULL if disabled */
+		char *metrics;		/* [host:]port or unix socket of the exporter, NULL if disabled */
+	} net;
 	dbi_conn conn;
+	struct db_writer *writer;
+	struct db_stmt_cache *stmts;	/* prepared statements */
 };
 
 void destroy_config(struct config *c);
@@ -34,6 +34,7 @@
 #include "registration.h"
 #include "server_privileges.h"
 #include "log.h"
+#include "mclock.h"
 
 
 /**
@@ -58,7 +59,8 @@ static void server_accept_connection(struct player *pl)
 	wu32(0x0004bef4, &ptr);		/* Function field */
 	wu32(pl->private_id, &ptr);	/* Private ID */
 	wu32(pl->public_id, &ptr);	/* Public ID */
-	wu32(pl->f4_s_counter, &ptr);	/* Packet counter */
+	/* the keepalives are answered without the server lock */
+	wu32(__atomic_fetch_add(&pl->f4_s_counter, 1, __ATOMIC_RELAXED), &ptr);	/* Packet counter */
 	ptr += 4;			/* Checksum initialize at the end */	
 	
 	wstaticstring(s->server_name, 29, &ptr);/* Server name */
@@ -89,8 +91,7 @@ static void server_accept_connection(struct player *pl)
 	packet_add_crc(data, 436, 16);
 	/* Send packet */
 	/*send_to(pl->in_chan->in_server, data, 436, 0, pl);*/
-	sendto(pl->in_chan->in_server->socket_desc, data, 436, 0, (struct sockaddr *)pl->cli_addr, pl->cli_len);
-	pl->f4_s_counter++;
+	server_sendto(pl->in_chan->in_server, data, 436, &pl->cli_addr, pl->cli_len);
 	free(data);
 }
 
@@ -140,7 +141,7 @@ static void server_refuse_connection_ban(struct sockaddr_in *cli_addr, int cli_l
 	/* Add CRC */
 	packet_add_crc(data, 436, 16);
 	/* Send packet */
-	sendto(s->socket_desc, data, 436, 0, (struct sockaddr *)cli_addr, cli_len);
+	server_sendto(s, data, 436, cli_addr, cli_len);
 	free(data);
 }
 
@@ -203,8 +204,11 @@ void handle_player_connect(char *data, unsigned int len, struct sockaddr_in *cli
 		pl->reg = r;
 	}
 
-	/* Add player to the pool */
-	add_player(s, pl);
+	/* Add player to the pool (no answer if the default channel is full) */
+	if (!add_player(s, pl)) {
+		destroy_player(pl);
+		return;
+	}
 	/* Send a message to the client indicating he has been accepted */
 
 	/* Send server information to the player (0xf4be0400) */
@@ -225,7 +229,7 @@ void handle_player_connect(char *data, unsigned int len, struct sockaddr_in *cli
  * @param pl the player to send this to
  * @param ka_id the counter of the keepalived we received
  */
-static void s_resp_keepalive(struct player *pl, uint32_t ka_id)
+static void s_resp_keepalive(struct server *s, struct player *pl, uint32_t ka_id)
 {
 	char *data, *ptr;
 	int data_size = 24;
@@ -240,7 +244,7 @@ static void s_resp_keepalive(struct player *pl, uint32_t ka_id)
 	wu32(0x0002bef4, &ptr);		/* Function field */
 	wu32(pl->private_id, &ptr);	/* Private ID */
 	wu32(pl->public_id, &ptr);	/* Public ID */
-	wu32(pl->f4_s_counter, &ptr);	/* Packet counter */
+	wu32(__atomic_fetch_add(&pl->f4_s_counter, 1, __ATOMIC_RELAXED), &ptr);	/* Packet counter */
 	/* Checksum initialize at the end */		ptr += 4;
 	wu32(ka_id, &ptr);		/* ID of the keepalive to confirm */
 
@@ -250,8 +254,7 @@ static void s_resp_keepalive(struct player *pl, uint32_t ka_id)
 	/* Add CRC */
 	packet_add_crc(data, 24, 16);
 
-	sendto(pl->in_chan->in_server->socket_desc, data, 24, 0, (struct sockaddr *)pl->cli_addr, pl->cli_len);
-	pl->f4_s_counter++;
+	server_sendto(s, data, 24, &pl->cli_addr, pl->cli_len);
 	free(data);
 }
 
@@ -278,13 +281,14 @@ void handle_player_keepalive(char *data, unsigned int len, struct server *s)
 	priv_id = ru32(&ptr);
 	pub_id = ru32(&ptr);
 	ka_id = ru32(&ptr); 	/* Get the counter */
-	pl = get_player_by_ids(s, pub_id, priv_id);
+	/* handled without the server lock */
+	pl = get_player_lockless(s, pub_id, priv_id, 0);
 	if (pl == NULL) {
 		logger(LOG_WARN, "handle_player_keepalive : pl == NULL. Why????");
 		return;
 	}
 	/* Send the keepalive response */
-	s_resp_keepalive(pl, ka_id);
-	/* Update the last_ping field */
-	gettimeofday(&pl->last_ping, NULL);
+	s_resp_keepalive(s, pl, ka_id);
+	/* Update the last_ping field (read by the packet sender) */
+	__atomic_store_n(&pl->last_ping, mclock_now(), __ATOMIC_RELAXED);
 }
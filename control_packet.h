@@ -82,6 +82,14 @@ void *c_req_change_chan_pass(char *data, unsigned int len, struct player *pl);
 void *c_req_change_chan_order(char *data, unsigned int len, struct player *pl);
 void *c_req_change_chan_max_users(char *data, unsigned int len, struct player *pl);
 void *c_req_create_channel(char *data, unsigned int len, struct player *pl);
+void s_notify_channel_created(struct channel *ch, uint32_t creator_id);
+void s_notify_channel_deleted(struct server *s, uint32_t del_id);
+void s_resp_chan_name_changed(uint32_t changer_id, struct channel *ch, char *name);
+void s_resp_chan_topic_changed(uint32_t changer_id, struct channel *ch, char *topic);
+void s_resp_chan_desc_changed(uint32_t changer_id, struct channel *ch, char *desc);
+void s_notify_channel_flags_codec_changed(uint32_t changer_id, struct channel *ch);
+void s_notify_channel_order_changed(uint32_t changer_id, struct channel *ch);
+void s_notify_channel_max_users_changed(uint32_t changer_id, struct channel *ch);
 void *c_req_player_stats(char *data, unsigned int len, struct player *pl);
 void *c_req_create_registration(char *data, unsigned int len, struct player *pl);
 void *c_req_register_player(char *data, unsigned int len, struct player *pl);
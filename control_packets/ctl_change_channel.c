@@ -26,6 +26,7 @@
 #include "server_stat.h"
 #include "acknowledge_packet.h"
 #include "database.h"
+#include "arena.h"
 
 #include <errno.h>
 #include <string.h>
@@ -34,15 +35,15 @@
  * Send a notification to all  players indicating that
  * a channel's name has changed
  *
- * @param pl the player who changed it
+ * @param changer_id the public id of the player who changed it (0 for the server)
  * @param ch the channel changed
  * @param name the new name
  */
-static void s_resp_chan_name_changed(struct player *pl, struct channel *ch, char *name)
+void s_resp_chan_name_changed(uint32_t changer_id, struct channel *ch, char *name)
 {
 	char *data, *ptr;
 	int data_size;
-	struct server *s = pl->in_chan->in_server;
+	struct server *s = ch->in_server;
 	struct player *tmp_pl;
 	size_t iter;
 
@@ -63,7 +64,7 @@ static void s_resp_chan_name_changed(struct player *pl, struct channel *ch, char
 	ptr += 4;				/* packet version */
 	ptr += 4;				/* empty checksum */
 	wu32(ch->id, &ptr);			/* channel changed */
-	wu32(pl->public_id, &ptr);		/* player who changed */
+	wu32(changer_id, &ptr);		/* player who changed */
 	strcpy(ptr, name);
 
 	ar_each(struct player *, tmp_pl, iter, s->players)
@@ -99,14 +100,14 @@ void *c_req_change_chan_name(char *data, unsigned int len, struct player *pl)
 
 	if (ch != NULL) {
 		if (player_has_privilege(pl, SP_CHA_CHANGE_NAME, ch)) {
-			name = strdup(data + 28);
-			free(ch->name);
+			name = arena_strdup(ch->arena, data + 28);
+			arena_strfree(ch->arena, ch->name);
 			ch->name = name;
 			/* Update the channel in the db if it is registered */
 			if ((ch_getflags(ch) & CHANNEL_FLAG_UNREGISTERED) == 0) {
 				db_update_channel(ch->in_server->conf, ch);
 			}
-			s_resp_chan_name_changed(pl, ch, name);
+			s_resp_chan_name_changed(pl->public_id, ch, name);
 		}
 	}
 	return NULL;
@@ -116,15 +117,15 @@ void *c_req_change_chan_name(char *data, unsigned int len, struct player *pl)
  * Send a notification to all players indicating that
  * a channel's topic has changed
  *
- * @param pl the player who changed it
+ * @param changer_id the public id of the player who changed it (0 for the server)
  * @param ch the channel changed
  * @param topic the new topic
  */
-static void s_resp_chan_topic_changed(struct player *pl, struct channel *ch, char *topic)
+void s_resp_chan_topic_changed(uint32_t changer_id, struct channel *ch, char *topic)
 {
 	char *data, *ptr;
 	int data_size;
-	struct server *s = pl->in_chan->in_server;
+	struct server *s = ch->in_server;
 	struct player *tmp_pl;
 	size_t iter;
 
@@ -145,7 +146,7 @@ static void s_resp_chan_topic_changed(struct player *pl, struct channel *ch, cha
 	ptr += 4;				/* packet version */
 	ptr += 4;				/* empty checksum */
 	wu32(ch->id, &ptr);			/* channel changed */
-	wu32(pl->public_id, &ptr);		/* player who changed */
+	wu32(changer_id, &ptr);		/* player who changed */
 	strcpy(ptr, topic);
 
 	ar_each(struct player *, tmp_pl, iter, s->players)
@@ -181,14 +182,14 @@ void *c_req_change_chan_topic(char *data, unsigned int len, struct player *pl)
 
 	if (ch != NULL) {
 		if (player_has_privilege(pl, SP_CHA_CHANGE_TOPIC, ch)) {
-			topic = strdup(data + 28); /* FIXME : possible exploit */
-			free(ch->topic);
+			topic = arena_strdup(ch->arena, data + 28); /* FIXME : possible exploit */
+			arena_strfree(ch->arena, ch->topic);
 			ch->topic = topic;
 			/* Update the channel in the db if it is registered */
 			if ((ch_getflags(ch) & CHANNEL_FLAG_UNREGISTERED) == 0) {
 				db_update_channel(ch->in_server->conf, ch);
 			}
-			s_resp_chan_topic_changed(pl, ch, topic);
+			s_resp_chan_topic_changed(pl->public_id, ch, topic);
 		}
 	}
 	return NULL;
@@ -198,15 +199,15 @@ void *c_req_change_chan_topic(char *data, unsigned int len, struct player *pl)
  * Send a notification to all  players indicating that
  * a channel's description has changed
  *
- * @param pl the player who changed it
+ * @param changer_id the public id of the player who changed it (0 for the server)
  * @param ch the channel changed
  * @param desc the new description
  */
-static void s_resp_chan_desc_changed(struct player *pl, struct channel *ch, char *desc)
+void s_resp_chan_desc_changed(uint32_t changer_id, struct channel *ch, char *desc)
 {
 	char *data, *ptr;
 	int data_size;
-	struct server *s = pl->in_chan->in_server;
+	struct server *s = ch->in_server;
 	struct player *tmp_pl;
 	size_t iter;
 
@@ -227,7 +228,7 @@ static void s_resp_chan_desc_changed(struct player *pl, struct channel *ch, char
 	ptr += 4;				/* packet version */
 	ptr += 4;				/* empty checksum */
 	wu32(ch->id, &ptr);			/* channel changed */
-	wu32(pl->public_id, &ptr);		/* player who changed */
+	wu32(changer_id, &ptr);		/* player who changed */
 	strcpy(ptr, desc);
 
 	ar_each(struct player *, tmp_pl, iter, s->players)
@@ -264,24 +265,30 @@ void *c_req_change_chan_desc(char *data, unsigned int len, struct player *pl)
 
 	if (ch != NULL) {
 		if (player_has_privilege(pl, SP_CHA_CHANGE_DESC, ch)) {
-			desc = strdup(data + 28);	/* FIXME : possible exploit */
-			free(ch->desc);
+			desc = arena_strdup(ch->arena, data + 28);	/* FIXME : possible exploit */
+			arena_strfree(ch->arena, ch->desc);
 			ch->desc = desc;
 			/* Update the channel in the db if it is registered */
 			if ((ch_getflags(ch) & CHANNEL_FLAG_UNREGISTERED) == 0) {
 				db_update_channel(ch->in_server->conf, ch);
 			}
-			s_resp_chan_desc_changed(pl, ch, desc);
+			s_resp_chan_desc_changed(pl->public_id, ch, desc);
 		}
 	}
 	return NULL;
 }
 
-static void s_notify_channel_flags_codec_changed(struct player *pl, struct channel *ch)
+/**
+ * Notify all players that the flags or the codec of a channel changed.
+ *
+ * @param changer_id the public id of the player who changed it (0 for the server)
+ * @param ch the channel changed
+ */
+void s_notify_channel_flags_codec_changed(uint32_t changer_id, struct channel *ch)
 {
 	char *data, *ptr;
 	int data_size;
-	struct server *s = pl->in_chan->in_server;
+	struct server *s = ch->in_server;
 	struct player *tmp_pl;
 	size_t iter;
 
@@ -304,7 +311,7 @@ static void s_notify_channel_flags_codec_changed(struct player *pl, struct chann
 	wu32(ch->id, &ptr);			/* channel changed */
 	wu16(ch->flags, &ptr);			/* new channel flags */
 	wu16(ch->codec, &ptr);			/* new codec */
-	wu32(pl->public_id, &ptr);		/* player who changed */
+	wu32(changer_id, &ptr);		/* player who changed */
 
 	/* check we filled all the packet */
 	assert((ptr - data) == data_size);
@@ -393,6 +400,7 @@ void *c_req_change_chan_flag_codec(char *data, unsigned int len, struct player *
 				bzero(ch_getpass(ch), 30 * sizeof(char));
 		}
 		ch->codec = new_codec;
+		audio_path_changed(s);
 		/* If the channel changed registered or unregistered */
 		if ( (flags & CHANNEL_FLAG_UNREGISTERED) != (new_flags & CHANNEL_FLAG_UNREGISTERED)) {
 			if (new_flags & CHANNEL_FLAG_UNREGISTERED) {
@@ -406,7 +414,7 @@ void *c_req_change_chan_flag_codec(char *data, unsigned int len, struct player *
 			/* update the channel in the database */
 			db_update_channel(s->conf, ch);
 		}
-		s_notify_channel_flags_codec_changed(pl, ch);
+		s_notify_channel_flags_codec_changed(pl->public_id, ch);
 	}
 	return NULL;
 }
@@ -453,7 +461,7 @@ void *c_req_change_chan_pass(char *data, unsigned int len, struct player *pl)
 		/* If we change the password when there is already one, the channel
 		 * flags do not change, no need to notify. */
 		if (old_flags != ch_getflags(ch)) {
-			s_notify_channel_flags_codec_changed(pl, ch);
+			s_notify_channel_flags_codec_changed(pl->public_id, ch);
 		}
 		/* Update the channel in the db if it is registered */
 		if ((ch_getflags(ch) & CHANNEL_FLAG_UNREGISTERED) == 0) {
@@ -466,14 +474,14 @@ void *c_req_change_chan_pass(char *data, unsigned int len, struct player *pl)
 /**
  * Notify all players that the sort order for a channel changed.
  *
- * @param pl the player who changed the max users
+ * @param changer_id the public id of the player who changed it (0 for the server)
  * @param ch the channel whose max users changed
  */
-static void s_notify_channel_order_changed(struct player *pl, struct channel *ch)
+void s_notify_channel_order_changed(uint32_t changer_id, struct channel *ch)
 {
 	char *data, *ptr;
 	int data_size;
-	struct server *s = pl->in_chan->in_server;
+	struct server *s = ch->in_server;
 	struct player *tmp_pl;
 	size_t iter;
 
@@ -495,7 +503,7 @@ static void s_notify_channel_order_changed(struct player *pl, struct channel *ch
 	ptr += 4;				/* empty checksum */
 	wu32(ch->id, &ptr);			/* channel changed */
 	wu16(ch->sort_order, &ptr);		/* new sort order */
-	wu32(pl->public_id, &ptr);		/* player who changed */
+	wu32(changer_id, &ptr);		/* player who changed */
 
 	/* check we filled all the packet */
 	assert((ptr - data) == data_size);
@@ -540,7 +548,7 @@ void *c_req_change_chan_order(char *data, unsigned int len, struct player *pl)
 		if ((ch_getflags(ch) & CHANNEL_FLAG_UNREGISTERED) == 0) {
 			db_update_channel(s->conf, ch);
 		}
-		s_notify_channel_order_changed(pl, ch);
+		s_notify_channel_order_changed(pl->public_id, ch);
 	}
 	return NULL;
 }
@@ -548,14 +556,14 @@ void *c_req_change_chan_order(char *data, unsigned int len, struct player *pl)
 /**
  * Notify all players that the number of max users for a channel changed.
  *
- * @param pl the player who changed the max users
+ * @param changer_id the public id of the player who changed it (0 for the server)
  * @param ch the channel whose max users changed
  */
-static void s_notify_channel_max_users_changed(struct player *pl, struct channel *ch)
+void s_notify_channel_max_users_changed(uint32_t changer_id, struct channel *ch)
 {
 	char *data, *ptr;
 	int data_size;
-	struct server *s = pl->in_chan->in_server;
+	struct server *s = ch->in_server;
 	struct player *tmp_pl;
 	size_t iter;
 
@@ -576,8 +584,8 @@ static void s_notify_channel_max_users_changed(struct player *pl, struct channel
 	ptr += 4;				/* packet version */
 	ptr += 4;				/* empty checksum */
 	wu32(ch->id, &ptr);			/* channel changed */
-	wu16(ch->players->max_slots, &ptr);	/* new channel flags */
-	wu32(pl->public_id, &ptr);		/* player who changed */
+	wu16(ch->max_users, &ptr);	/* new channel flags */
+	wu32(changer_id, &ptr);		/* player who changed */
 
 	/* check we filled all the packet */
 	assert((ptr - data) == data_size);
@@ -618,11 +626,11 @@ void *c_req_change_chan_max_users(char *data, unsigned int len, struct player *p
 	ch = get_channel_by_id(s, ch_id);
 	send_acknowledge(pl);
 	if (ch != NULL && player_has_privilege(pl, SP_CHA_CHANGE_MAXUSERS, ch)) {
-		ch->players->max_slots = max_users;
+		ch->max_users = max_users;
 		if ((ch_getflags(ch) & CHANNEL_FLAG_UNREGISTERED) == 0) {
 			db_update_channel(s->conf, ch);
 		}
-		s_notify_channel_max_users_changed(pl, ch);
+		s_notify_channel_max_users_changed(pl->public_id, ch);
 	}
 	return NULL;
 }
@@ -351,8 +351,8 @@ void *c_req_change_player_sv_right(char *data, unsigned int len, struct player *
 	char on_off, right;
 	int priv_required;
 	struct channel *ch;
-	struct player_channel_privilege *priv;
-	size_t iter, iter2;
+	struct player_channel_privilege *priv, *next;
+	size_t iter;
 	char *ptr;
 
 	send_acknowledge(pl);		/* ACK */
@@ -386,12 +386,10 @@ void *c_req_change_player_sv_right(char *data, unsigned int len, struct player *
 				db_del_registration(tgt->in_chan->in_server->conf, tgt->in_chan->in_server, tgt->reg);
 				/* associate the player privileges to the player instead of the registration */
 				ar_each(struct channel *, ch, iter, tgt->in_chan->in_server->chans)
-					ar_each(struct player_channel_privilege *, priv, iter2, ch->pl_privileges)
-						if (priv->reg == PL_CH_PRIV_REGISTERED && priv->pl_or_reg.reg == tgt->reg) {
-							priv->reg = PL_CH_PRIV_UNREGISTERED;
-							priv->pl_or_reg.pl = tgt;
-						}
-					ar_end_each;
+					il_each(priv, next, &ch->pl_privileges, ch_link)
+						if (priv->reg == PL_CH_PRIV_REGISTERED && priv->pl_or_reg.reg == tgt->reg)
+							pl_chan_priv_set_player(priv, tgt);
+					il_end_each;
 				ar_end_each;
 				free(tgt->reg);
 				tgt->reg = NULL;
@@ -565,6 +563,8 @@ void *c_req_mute_player(char *data, unsigned int len, struct player *pl)
 		/* MUTE */
 		if (!ar_has(pl->muted, tgt)) {
 			ar_insert(pl->muted, tgt);
+			ar_insert(tgt->muted_by, pl);
+			audio_path_changed(s);
 			s_resp_player_muted(pl, tgt, on_off);
 		} else {
 			logger(LOG_WARN, "player tried to mute a player he already muted!");
@@ -573,6 +573,8 @@ void *c_req_mute_player(char *data, unsigned int len, struct player *pl)
 		/* UNMUTE */
 		if (ar_has(pl->muted, tgt)) {
 			ar_remove(pl->muted, tgt);
+			ar_remove(tgt->muted_by, pl);
+			audio_path_changed(s);
 			s_resp_player_muted(pl, tgt, on_off);
 		} else {
 			logger(LOG_WARN, "player tried to unmute a player he did not mute!");
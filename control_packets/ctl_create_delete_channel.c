@@ -32,7 +32,7 @@
  * @param s the server
  * @param del_id the id of the deleted channel
  */
-static void s_notify_channel_deleted(struct server *s, uint32_t del_id)
+void s_notify_channel_deleted(struct server *s, uint32_t del_id)
 {
 	char *data, *ptr;
 	struct player *tmp_pl;
@@ -135,7 +135,7 @@ void *c_req_delete_channel(char *data, unsigned int len, struct player *pl)
 
 	send_acknowledge(pl);
 	if (player_has_privilege(pl, SP_CHA_DELETE, del)) {
-		if (del == NULL || del->players->used_slots > 0) {
+		if (del == NULL || del->players.count > 0) {
 			s_resp_cannot_delete_channel(pl, pkt_cnt);
 		} else {
 			/* if the channel is registered, remove it from the db */
@@ -153,9 +153,9 @@ void *c_req_delete_channel(char *data, unsigned int len, struct player *pl)
  * Notify all players on a server that a new channel has been created
  *
  * @param ch the new channel
- * @param creator the player who created the channel
+ * @param creator_id the public id of the player who created the channel (0 for the server)
  */
-static void s_notify_channel_created(struct channel *ch, struct player *creator)
+void s_notify_channel_created(struct channel *ch, uint32_t creator_id)
 {
 	char *data, *ptr;
 	int data_size;
@@ -181,7 +181,7 @@ static void s_notify_channel_created(struct channel *ch, struct player *creator)
 	ptr += 4;			/* packet counter */
 	ptr += 4;			/* packet version */
 	ptr += 4;			/* empty checksum */
-	wu32(creator->public_id, &ptr);	/* id of creator */
+	wu32(creator_id, &ptr);	/* id of creator */
 	channel_to_data(ch, ptr);
 
 	ar_each(struct player *, tmp_pl, iter, s->players)
@@ -217,7 +217,9 @@ void *c_req_create_channel(char *data, unsigned int len, struct player *pl)
 	send_acknowledge(pl);
 
 	ptr = data + 24;
-	bytes_read = channel_from_data(ptr, len - (ptr - data), &ch);
+	bytes_read = channel_from_data(s->arena, ptr, len - (ptr - data), &ch);
+	if (bytes_read == 0)
+		return NULL;
 	ptr += bytes_read;
 	pass = rstaticstring(29, &ptr);
 	strcpy(ch->password, pass);
@@ -260,7 +262,9 @@ void *c_req_create_channel(char *data, unsigned int len, struct player *pl)
 		if (! (ch_getflags(ch) & CHANNEL_FLAG_UNREGISTERED))
 			db_register_channel(s->conf, ch);
 		print_channel(ch);
-		s_notify_channel_created(ch, pl);
+		s_notify_channel_created(ch, pl->public_id);
+	} else {
+		destroy_channel(ch);
 	}
 	return NULL;
 }
@@ -282,7 +282,7 @@ void *c_req_ban(char *data, unsigned int len, struct player *pl)
 		send_acknowledge(pl);		/* ACK */
 		if(player_has_privilege(pl, SP_ADM_BAN_IP, target->in_chan)) {
 			reason = rstaticstring(29, &ptr);
-			add_ban(s, new_ban(0, target->cli_addr->sin_addr, reason));
+			add_ban(s, new_ban(s->arena, 0, target->cli_addr.sin_addr, reason));
 			logger(LOG_INFO, "Reason for banning player %s : %s", target->name, reason);
 			s_notify_ban(pl, target, duration, reason);
 			remove_player(s, target);
@@ -402,7 +402,7 @@ void *c_req_ip_ban(char *data, unsigned int len, struct player *pl)
 		ptr = data + 24;
 		duration = ru16(&ptr);
 		inet_aton(ptr, &ip);
-		add_ban(s, new_ban(duration, ip, "IP BAN"));
+		add_ban(s, new_ban(s->arena, duration, ip, "IP BAN"));
 	}
 	return NULL;
 }
@@ -88,10 +88,9 @@ void send_message_to_all(struct player *pl, uint32_t color, char *msg)
 static void send_message_to_channel(struct player *pl, struct channel *ch, uint32_t color, char *msg)
 {
 	char *data, *ptr;
-	struct player *tmp_pl;
+	struct player *tmp_pl, *next;
 	int data_size;
 	struct server *s = pl->in_chan->in_server;
-	size_t iter;
 
 	/* header size (24) + color (4) + type (1) + name size (1) + name (29) + msg (?) */
 	data_size = 24 + 4 + 1 + 1 + 29 + (strlen(msg) + 1);
@@ -114,7 +113,7 @@ static void send_message_to_channel(struct player *pl, struct channel *ch, uint3
 	wstaticstring(pl->name, 29, &ptr);
 	strcpy(ptr, msg);
 
-	ar_each(struct player *, tmp_pl, iter, ch->players)
+	il_each(tmp_pl, next, &ch->players, chan_link)
 		ptr = data + 4;
 		wu32(tmp_pl->private_id, &ptr);
 		wu32(tmp_pl->public_id, &ptr);
@@ -122,7 +121,7 @@ static void send_message_to_channel(struct player *pl, struct channel *ch, uint3
 		packet_add_crc_d(data, data_size);
 		send_to(s, data, data_size, 0, tmp_pl);
 		tmp_pl->f0_s_counter++;
-	ar_end_each;
+	il_end_each;
 	free(data);
 }
 
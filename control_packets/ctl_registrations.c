@@ -61,7 +61,7 @@ void *c_req_create_registration(char *data, unsigned int len, struct player *pl)
 				free(pass);
 			return NULL;
 		}
-		reg = new_registration();
+		reg = new_registration(s->arena);
 		strcpy(reg->name, name);
 		/* hash the password */
 		SHA256((unsigned char *)pass, strlen(pass), digest);
@@ -97,8 +97,8 @@ void *c_req_register_player(char *data, unsigned int len, struct player *pl)
 	unsigned char digest[SHA256_DIGEST_LENGTH];
 	char *digest_readable, *ptr;
 	struct channel *ch;
-	struct player_channel_privilege *priv;
-	size_t iter, iter2;
+	struct player_channel_privilege *priv, *next;
+	size_t iter;
 
 	s = pl->in_chan->in_server;
 
@@ -119,7 +119,7 @@ void *c_req_register_player(char *data, unsigned int len, struct player *pl)
 				free(pass);
 			return NULL;
 		}
-		reg = new_registration();
+		reg = new_registration(s->arena);
 		strcpy(reg->name, name);
 		/* hash the password */
 		SHA256((unsigned char *)pass, strlen(pass), digest);
@@ -132,12 +132,10 @@ void *c_req_register_player(char *data, unsigned int len, struct player *pl)
 		pl->reg = reg;
 		ar_each(struct channel *, ch, iter, s->chans)
 			if (!(ch->flags & CHANNEL_FLAG_UNREGISTERED)) {
-				ar_each(struct player_channel_privilege *, priv, iter2, ch->pl_privileges)
-					if (priv->reg == PL_CH_PRIV_UNREGISTERED && priv->pl_or_reg.pl == pl) {
-						priv->reg = PL_CH_PRIV_REGISTERED;
-						priv->pl_or_reg.reg = reg;
-					}
-				ar_end_each;
+				il_each(priv, next, &ch->pl_privileges, ch_link)
+					if (priv->reg == PL_CH_PRIV_UNREGISTERED && priv->pl_or_reg.pl == pl)
+						pl_chan_priv_set_registration(priv, reg);
+				il_end_each;
 			}
 		ar_end_each;
 		/* database callback to insert a new registration */
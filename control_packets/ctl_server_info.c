@@ -139,8 +139,8 @@ static void s_resp_players(struct player *pl)
 		pl->f0_s_counter++;
 		/* decrement the number of players to send */
 		nb_players -= MIN(10, nb_players);
-		free(data);
 	}
+	free(data);
 }
 
 static void s_resp_unknown(struct player *pl)
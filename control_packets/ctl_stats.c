@@ -18,6 +18,7 @@
 
 #include "control_packet.h"
 #include "log.h"
+#include "mclock.h"
 #include "packet_tools.h"
 #include "server_stat.h"
 #include "acknowledge_packet.h"
@@ -53,7 +54,7 @@ static void s_resp_server_stats(struct player *pl)
 	wu32(pl->f0_s_counter, &ptr);			/* packet counter */
 	ptr += 4;					/* packet version */
 	ptr += 4;					/* empty checksum */
-	wu64(time(NULL) - s->stats->start_time, &ptr);	/* server uptime */
+	wu64(mclock_seconds() - s->stats->start_time, &ptr);	/* server uptime */
 	wu16(501, &ptr);				/* server version */
 	wu16(0, &ptr);					/* server version */
 	wu16(2, &ptr);					/* server version */
@@ -112,7 +113,7 @@ static void s_res_player_stats(struct player *pl, struct player *tgt)
 		return;
 	}
 	ptr = data;
-	ip = inet_ntoa(tgt->cli_addr->sin_addr);
+	ip = inet_ntoa(tgt->cli_addr.sin_addr);
 
 	wu16(PKT_TYPE_CTL, &ptr);
 	wu16(CTL_PLAYERSTATS, &ptr);
@@ -123,18 +124,18 @@ static void s_res_player_stats(struct player *pl, struct player *tgt)
 	ptr += 4;					/* empty checksum */
 
 	wu32(tgt->public_id, &ptr);			/* player we get the info of */
-	wu32(time(NULL) - tgt->stats->start_time, &ptr);/* time connected */
-	wu16(tgt->stats->pkt_lost * 100 / (tgt->stats->pkt_sent + 1 + tgt->stats->pkt_rec), &ptr);
+	wu32(mclock_seconds() - tgt->stats.start_time, &ptr);/* time connected */
+	wu16(tgt->stats.pkt_lost * 100 / (tgt->stats.pkt_sent + 1 + tgt->stats.pkt_rec), &ptr);
 	wu32(12, &ptr);					/* ping */
-	wu16(time(NULL) - tgt->stats->activ_time, &ptr);/* time iddle */
+	wu16(mclock_seconds() - tgt->stats.activ_time, &ptr);/* time iddle */
 	wu16(pl->version[0], &ptr);			/* client version */
 	wu16(pl->version[1], &ptr);			/* client version */
 	wu16(pl->version[2], &ptr);			/* client version */
 	wu16(pl->version[3], &ptr);			/* client version */
-	wu32(tgt->stats->pkt_sent, &ptr);		/* packets sent */
-	wu32(tgt->stats->pkt_rec, &ptr);		/* packets received */
-	wu32(tgt->stats->size_sent, &ptr);		/* bytes sent */
-	wu32(tgt->stats->size_rec, &ptr);		/* bytes received */
+	wu32(tgt->stats.pkt_sent, &ptr);		/* packets sent */
+	wu32(tgt->stats.pkt_rec, &ptr);		/* packets received */
+	wu32(tgt->stats.size_sent, &ptr);		/* bytes sent */
+	wu32(tgt->stats.size_rec, &ptr);		/* bytes received */
 	wstaticstring(ip, 29, &ptr);			/* ip of client */
 	wu16(0, &ptr);					/* port of client */
 	wstaticstring(tgt->login, 29, &ptr);		/* login */
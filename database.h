@@ -22,15 +22,83 @@
 #include "server.h"
 #include "configuration.h"
 #include "player_channel_privilege.h"
+#include "metrics.h"
+
+#include <stdint.h>
+
+/* tables whose ids are given by the server (see db_alloc_id) */
+#define DB_TABLE_CHANNELS 0
+#define DB_TABLE_REGISTRATIONS 1
+#define DB_NB_TABLES 2
+
+/* the flags of a channel and of a channel privilege the database stores */
+#define DB_CHANNEL_FLAGS (CHANNEL_FLAG_MODERATED | CHANNEL_FLAG_SUBCHANNELS | CHANNEL_FLAG_DEFAULT)
+#define DB_PRIV_FLAGS (CHANNEL_PRIV_CHANADMIN | CHANNEL_PRIV_OP | CHANNEL_PRIV_VOICE \
+		| CHANNEL_PRIV_AUTOOP | CHANNEL_PRIV_AUTOVOICE)
+
+/* A write waiting for the database writer. Everything it needs is
+ * copied, so the entity can be modified or destroyed before the
+ * write is done. */
+struct db_op
+{
+	int (*exec)(struct config *c, struct db_op *op);
+	uint32_t id;		/* row of the entity */
+	union {
+		struct {
+			uint32_t server_id;
+			uint32_t parent_id;
+			int codec;
+			int maxusers;
+			int order;
+			int flag_default;
+			int flag_hierar;
+			int flag_mod;
+		} ch;
+		struct {
+			uint32_t server_id;
+			int serveradmin;
+		} reg;
+		struct {
+			uint32_t player_id;
+			uint32_t channel_id;
+			int flags;
+		} priv;
+	} u;
+	char *str[4];
+	uint64_t submitted;	/* mclock_ns() when given to the writer */
+	struct db_op *next;
+};
+
+/* A statement executed many times. The parameters are written ?
+ * in the query, types has one letter per parameter : 'i' for an
+ * int, 's' for a string. */
+struct db_stmt
+{
+	const char *sql;
+	const char *types;
+	int slot;		/* in the statement caches, given on first use */
+};
+#define DB_STMT(sql, types) {sql, types, -1}
+/* maximum number of different statements */
+#define DB_STMT_MAX 32
+
+struct db_writer_stats
+{
+	uint64_t submitted;	/* writes queued since the start */
+	uint64_t written;	/* writes executed */
+	uint64_t failed;	/* writes that returned an error */
+	uint64_t batches;	/* transactions */
+	int depth;		/* writes waiting */
+	int max_depth;
+	struct metrics_histogram latency;	/* from db_submit to the execution */
+};
 
 int init_db(struct config *c);
 int connect_db(struct config *c);
+dbi_conn db_connect_new(struct config *c);
 
-void db_create_servers(struct config *c, struct array *ss);
-int db_create_channels(struct config *c, struct server *s);
-int db_create_subchannels(struct config *c, struct server *s);
-int db_create_registrations(struct config *c, struct server *s);
-int db_create_sv_privileges(struct config *c, struct server *s);
+void db_create_servers(struct config *c, dbi_conn conn, struct array *ss);
+int db_create_all(dbi_conn conn, struct array *ss);
 int db_add_registration(struct config *c, struct server *s, struct registration *r);
 int db_del_registration(struct config *c, struct server *s, struct registration *r);
 
@@ -38,8 +106,26 @@ int db_unregister_channel(struct config *c, struct channel *ch);
 int db_register_channel(struct config *c, struct channel *ch);
 int db_update_channel(struct config *c, struct channel *ch);
 void db_update_pl_chan_priv(struct config *c, struct player_channel_privilege *tmp_priv);
-void db_create_pl_ch_privileges(struct config *c, struct server *s);
 void db_del_pl_chan_priv(struct config *c, struct player_channel_privilege *priv);
 void db_add_pl_chan_priv(struct config *c, struct player_channel_privilege *priv);
 
+/* read one row of a result */
+struct channel *db_channel_from_row(struct arena *a, dbi_result res, int subchannel);
+int db_link_subchannel(struct server *s, struct channel *parent, uint32_t parent_db_id, struct channel *ch);
+struct registration *db_registration_from_row(struct arena *a, dbi_result res);
+void db_sv_privileges_from_row(dbi_result res, struct server_privileges *sp);
+struct player_channel_privilege *db_pl_chan_priv_from_row(struct arena *a, dbi_result res);
+
+int db_stmt_open(struct config *c);
+void db_stmt_close(struct config *c);
+int db_stmt_exec(struct config *c, struct db_stmt *st, ...);
+
+struct db_op *db_op_new(int (*exec)(struct config *c, struct db_op *op));
+void db_op_set_str(struct db_op *op, int i, const char *str);
+void db_submit(struct config *c, struct db_op *op);
+uint32_t db_alloc_id(struct config *c, int table);
+int db_writer_start(struct config *c);
+void db_writer_stop(struct config *c);
+void db_writer_get_stats(struct config *c, struct db_writer_stats *st);
+
 #endif
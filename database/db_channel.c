@@ -21,6 +21,54 @@
 
 #include <dbi/dbi.h>
 
+/**
+ * Copy the fields of a channel in a database operation.
+ *
+ * @param op the operation
+ * @param ch the channel
+ */
+static void db_op_set_channel(struct db_op *op, struct channel *ch)
+{
+	op->id = ch->db_id;
+	op->u.ch.server_id = ch->in_server->id;
+	op->u.ch.codec = ch->codec;
+	op->u.ch.maxusers = ch->max_users;
+	op->u.ch.order = ch->sort_order;
+	/* better here than in the query function */
+	op->u.ch.flag_default = (ch->flags & CHANNEL_FLAG_DEFAULT);
+	op->u.ch.flag_hierar = (ch->flags & CHANNEL_FLAG_SUBCHANNELS);
+	op->u.ch.flag_mod = (ch->flags & CHANNEL_FLAG_MODERATED);
+	/* Add the ID of the parent or -1 */
+	if (ch->parent == NULL)
+		op->u.ch.parent_id = 0xFFFFFFFF;
+	else
+		op->u.ch.parent_id = ch->parent->db_id;
+	db_op_set_str(op, 0, ch->name);
+	db_op_set_str(op, 1, ch->topic);
+	db_op_set_str(op, 2, ch->desc);
+	db_op_set_str(op, 3, ch->password);
+}
+
+static int db_exec_register_channel(struct config *c, struct db_op *op)
+{
+	static struct db_stmt st = DB_STMT("INSERT INTO channels \
+		   (id, server_id, name, topic, description, \
+		    codec, maxusers, ordr, \
+		    flag_default, flag_hierarchical, flag_moderated, \
+		    parent_id, password) \
+		   VALUES \
+		   (?, ?, ?, ?, ?, \
+		    ?, ?, ?, \
+		    ?, ?, ?, \
+		    ?, ?);", "iisssiiiiiiis");
+
+	return db_stmt_exec(c, &st, op->id,
+			op->u.ch.server_id, op->str[0], op->str[1], op->str[2],
+			op->u.ch.codec, op->u.ch.maxusers, op->u.ch.order,
+			op->u.ch.flag_default, op->u.ch.flag_hierar, op->u.ch.flag_mod,
+			op->u.ch.parent_id, op->str[3]);
+}
+
 /**
  * Make a channel persistent by inserting it into the database
  *
@@ -31,79 +79,48 @@
  */
 int db_register_channel(struct config *c, struct channel *ch)
 {
-	char *q = "INSERT INTO channels \
-		   (server_id, name, topic, description, \
-		    codec, maxusers, ordr, \
-		    flag_default, flag_hierarchical, flag_moderated, \
-		    parent_id, password) \
-		   VALUES \
-		   (%i, %s, %s, %s, \
-		    %i, %i, %i, \
-		    %i, %i, %i, \
-		    %i, %s);";
-	char *name_clean, *topic_clean, *desc_clean, *pass_clean;
-	int flag_default, flag_hierar, flag_mod;
-	int insert_id, parent_id;
-	size_t iter;
-	struct channel *tmp_ch;
-	struct player_channel_privilege *priv;
-	dbi_result res;
+	struct channel *tmp_ch, *next_ch;
+	struct player_channel_privilege *priv, *next_priv;
+	struct db_op *op;
 
 	if (ch->db_id != 0) /* already exists in the db */
 		return 0;
 
-	/* Secure the input before inserting */
-	dbi_conn_quote_string_copy(c->conn, ch->name, &name_clean);
-	dbi_conn_quote_string_copy(c->conn, ch->topic, &topic_clean);
-	dbi_conn_quote_string_copy(c->conn, ch->desc, &desc_clean);
-	dbi_conn_quote_string_copy(c->conn, ch->password, &pass_clean);
-
-	/* better here than in the query function */
-	flag_default = (ch->flags & CHANNEL_FLAG_DEFAULT);
-	flag_hierar = (ch->flags & CHANNEL_FLAG_SUBCHANNELS);
-	flag_mod = (ch->flags & CHANNEL_FLAG_MODERATED);
-	
-	/* Add the ID of the parent or -1 */
-	if (ch->parent == NULL)
-		parent_id = 0xFFFFFFFF;
-	else
-		parent_id = ch->parent->db_id;
-
-	res = dbi_conn_queryf(c->conn, q,
-			ch->in_server->id, name_clean, topic_clean, desc_clean,
-			ch->codec, ch->players->max_slots, ch->sort_order,
-			flag_default, flag_hierar, flag_mod,
-			parent_id, pass_clean);
-	if (res == NULL) {
-		logger(LOG_ERR, "Insertion request failed : ");
-		logger(LOG_ERR, q, ch->in_server->id, name_clean, topic_clean, desc_clean,
-			ch->codec, ch->players->max_slots, ch->sort_order,
-			flag_default, flag_hierar, flag_mod,
-			parent_id, pass_clean);
-	}
-
-	insert_id = dbi_conn_sequence_last(c->conn, NULL);
-	ch->db_id = insert_id;
+	op = db_op_new(&db_exec_register_channel);
+	if (op == NULL)
+		return 0;
+	/* the id is known now, the insertion is done later */
+	ch->db_id = db_alloc_id(c, DB_TABLE_CHANNELS);
+	db_op_set_channel(op, ch);
+	db_submit(c, op);
 
 	/* Register all the subchannels */
 	if (ch_getflags(ch) & CHANNEL_FLAG_SUBCHANNELS) {
-		ar_each(struct channel *, tmp_ch, iter, ch->subchannels)
+		il_each(tmp_ch, next_ch, &ch->subchannels, sub_link)
 			db_register_channel(c, tmp_ch);
-		ar_end_each;	
+		il_end_each;	
 	}
 
 	/* add all the player privileges for this channel */
-	ar_each(struct player_channel_privilege *, priv, iter, ch->pl_privileges)
+	il_each(priv, next_priv, &ch->pl_privileges, ch_link)
 		if (priv->reg == PL_CH_PRIV_REGISTERED)
 			db_add_pl_chan_priv(c, priv);
-	ar_end_each;
-
-	/* free allocated data */
-	free(name_clean); free(topic_clean); free(desc_clean); free(pass_clean);
+	il_end_each;
 
 	return 1;
 }
 
+static int db_exec_unregister_channel(struct config *c, struct db_op *op)
+{
+	static struct db_stmt st = DB_STMT("DELETE FROM channels WHERE id = ?;", "i");
+	static struct db_stmt st2 = DB_STMT("DELETE FROM player_channel_privileges WHERE channel_id = ?;", "i");
+	int ret;
+
+	ret = db_stmt_exec(c, &st, op->id);
+	/* remove all the player privileges for this channel */
+	ret &= db_stmt_exec(c, &st2, op->id);
+	return ret;
+}
 
 /**
  * Unregister by removing it from the database
@@ -115,26 +132,41 @@ int db_register_channel(struct config *c, struct channel *ch)
  */
 int db_unregister_channel(struct config *c, struct channel *ch)
 {
-	char *q = "DELETE FROM channels WHERE id = %i;";
-	char *q2 = "DELETE FROM player_channel_privileges WHERE channel_id = %i;";
-	size_t iter;
-	struct channel *tmp_ch;
+	struct channel *tmp_ch, *next_ch;
+	struct db_op *op;
 
-	dbi_conn_queryf(c->conn, q, ch->db_id);
-	/* remove all the player privileges for this channel */
-	dbi_conn_queryf(c->conn, q2, ch->db_id);
+	op = db_op_new(&db_exec_unregister_channel);
+	if (op == NULL)
+		return 0;
+	op->id = ch->db_id;
+	db_submit(c, op);
 
 	/* unregister all the subchannels */
 	if (ch_getflags(ch) & CHANNEL_FLAG_SUBCHANNELS) {
-		ar_each(struct channel *, tmp_ch, iter, ch->subchannels)
+		il_each(tmp_ch, next_ch, &ch->subchannels, sub_link)
 			db_unregister_channel(c, tmp_ch);
-		ar_end_each;	
+		il_end_each;	
 	}
 	ch->db_id = 0;
 
 	return 1;
 }
 
+static int db_exec_update_channel(struct config *c, struct db_op *op)
+{
+	static struct db_stmt st = DB_STMT("UPDATE channels SET name = ?, topic = ?, description = ?, \
+		    codec = ?, maxusers = ?, ordr = ?, \
+		    flag_default = ?, flag_hierarchical = ?, flag_moderated = ?, \
+		    password = ? \
+		    WHERE id = ?;", "sssiiiiiisi");
+
+	return db_stmt_exec(c, &st,
+			op->str[0], op->str[1], op->str[2],
+			op->u.ch.codec, op->u.ch.maxusers, op->u.ch.order,
+			op->u.ch.flag_default, op->u.ch.flag_hierar, op->u.ch.flag_mod,
+			op->str[3], op->id);
+}
+
 /**
  * Update a registered channel's fields.
  *
@@ -145,144 +177,87 @@ int db_unregister_channel(struct config *c, struct channel *ch)
  */
 int db_update_channel(struct config *c, struct channel *ch)
 {
-	char *q = "UPDATE channels SET name = %s, topic = %s, description = %s, \
-		    codec = %i, maxusers = %i, ordr = %i, \
-		    flag_default = %i, flag_hierarchical = %i, flag_moderated = %i, \
-		    password = %s \
-		    WHERE id = %i;";
-	char *name_clean, *topic_clean, *desc_clean, *pass_clean;
-	int flag_default, flag_hierar, flag_mod;
-	dbi_result res;
+	struct db_op *op;
 
 	if (ch->db_id == 0) /* does not exist in the db */
 		return 0;
 
-	/* Secure the input before inserting */
-	dbi_conn_quote_string_copy(c->conn, ch->name, &name_clean);
-	dbi_conn_quote_string_copy(c->conn, ch->topic, &topic_clean);
-	dbi_conn_quote_string_copy(c->conn, ch->desc, &desc_clean);
-	dbi_conn_quote_string_copy(c->conn, ch->password, &pass_clean);
-
-	/* better here than in the query function */
-	flag_default = (ch->flags & CHANNEL_FLAG_DEFAULT);
-	flag_hierar = (ch->flags & CHANNEL_FLAG_SUBCHANNELS);
-	flag_mod = (ch->flags & CHANNEL_FLAG_MODERATED);
-	
-	res = dbi_conn_queryf(c->conn, q,
-			name_clean, topic_clean, desc_clean,
-			ch->codec, ch->players->max_slots, ch->sort_order,
-			flag_default, flag_hierar, flag_mod,
-			pass_clean, ch->db_id);
-	if (res == NULL) {
-		logger(LOG_ERR, "Insertion request failed : ");
-		logger(LOG_ERR, q, name_clean, topic_clean, desc_clean,
-			ch->codec, ch->players->max_slots, ch->sort_order,
-			flag_default, flag_hierar, flag_mod,
-			pass_clean, ch->db_id);
-	}
-	free(name_clean); free(topic_clean); free(desc_clean); free(pass_clean);
+	op = db_op_new(&db_exec_update_channel);
+	if (op == NULL)
+		return 0;
+	db_op_set_channel(op, ch);
+	db_submit(c, op);
 
 	return 1;
 }
 
 /**
- * Go through the database, read and add to the server all the channels
- * stored.
+ * Create a channel from the current row of a result.
  *
- * @param c the configuration file containing the database connection
- * @param s the server
+ * @param a the arena of the server
+ * @param res the result of a query on channels
+ * @param subchannel 1 if the channel is a subchannel (no flags)
+ *
+ * @return the channel
  */
-int db_create_channels(struct config *c, struct server *s)
+struct channel *db_channel_from_row(struct arena *a, dbi_result res, int subchannel)
 {
-	char *q = "SELECT * FROM channels WHERE server_id = %i AND parent_id = -1;";
 	struct channel *ch;
-	dbi_result res;
 	char *name, *topic, *desc;
-	int flags;
-
-	res = dbi_conn_queryf(c->conn, q, s->id);
-
-	if (dbi_result_get_numrows(res) == 0) {
-		ch = new_channel("Default", "", "", CHANNEL_FLAG_DEFAULT | CHANNEL_FLAG_UNREGISTERED,
-				CODEC_SPEEX_12_3, 0, 128);
-		add_channel(s, ch);
+	int flags = 0;
+
+	/* temporary variables to be readable */
+	name = dbi_result_get_string_copy(res, "name");
+	topic = dbi_result_get_string_copy(res, "topic");
+	desc = dbi_result_get_string_copy(res, "description");
+	if (!subchannel) {
+		logger(LOG_DBG, "flag_hierarchical = %i", dbi_result_get_uint(res, "flag_hierarchical"));
+		flags = (0 & ~CHANNEL_FLAG_UNREGISTERED);
+		if (dbi_result_get_uint(res, "flag_moderated"))
+			flags |= CHANNEL_FLAG_MODERATED;
+		if (dbi_result_get_uint(res, "flag_hierarchical"))
+			flags |= CHANNEL_FLAG_SUBCHANNELS;
+		if (dbi_result_get_uint(res, "flag_default"))
+			flags |= CHANNEL_FLAG_DEFAULT;
 	}
-	if (res) {
-		while (dbi_result_next_row(res)) {
-			/* temporary variables to be readable */
-			name = dbi_result_get_string_copy(res, "name");
-			topic = dbi_result_get_string_copy(res, "topic");
-			desc = dbi_result_get_string_copy(res, "description");
-			logger(LOG_DBG, "flag_hierarchical = %i", dbi_result_get_uint(res, "flag_hierarchical"));
-			flags = (0 & ~CHANNEL_FLAG_UNREGISTERED);
-			if (dbi_result_get_uint(res, "flag_moderated"))
-				flags |= CHANNEL_FLAG_MODERATED;
-			if (dbi_result_get_uint(res, "flag_hierarchical"))
-				flags |= CHANNEL_FLAG_SUBCHANNELS;
-			if (dbi_result_get_uint(res, "flag_default"))
-				flags |= CHANNEL_FLAG_DEFAULT;
-			/* create the channel */
-			ch = new_channel(name, topic, desc, flags,
-					dbi_result_get_uint(res, "codec"),
-					dbi_result_get_int(res, "ordr"),
-					dbi_result_get_uint(res, "maxusers"));
-			ch->db_id = dbi_result_get_uint(res, "id");
-
-			add_channel(s, ch);
-			/* free temporary variables */
-			free(name); free(topic); free(desc);
-		}
-		dbi_result_free(res);
-	}
-	return 1;
+	/* create the channel */
+	ch = new_channel(a, name, topic, desc, flags,
+			dbi_result_get_uint(res, "codec"),
+			dbi_result_get_int(res, "ordr"),
+			dbi_result_get_uint(res, "maxusers"));
+	ch->db_id = dbi_result_get_uint(res, "id");
+	/* free temporary variables */
+	free(name); free(topic); free(desc);
+
+	return ch;
 }
 
-int db_create_subchannels(struct config *c, struct server *s)
+/**
+ * Add a subchannel read from the database to its parent, or destroy
+ * it if the parent can not have it.
+ *
+ * @param s the server
+ * @param parent the parent (NULL if it was not found)
+ * @param parent_db_id the id of the parent in the database
+ * @param ch the subchannel
+ *
+ * @return 1 if the subchannel was added
+ */
+int db_link_subchannel(struct server *s, struct channel *parent, uint32_t parent_db_id, struct channel *ch)
 {
-	char *q = "SELECT * FROM channels WHERE server_id = %i AND parent_id != -1;";
-	struct channel *ch, *parent;
-	dbi_result res;
-	char *name, *topic, *desc;
-	int parent_db_id;
-
-	res = dbi_conn_queryf(c->conn, q, s->id);
-
-	if (res) {
-		while (dbi_result_next_row(res)) {
-			/* temporary variables to be readable */
-			name = dbi_result_get_string_copy(res, "name");
-			topic = dbi_result_get_string_copy(res, "topic");
-			desc = dbi_result_get_string_copy(res, "description");
-			/* create the sub channel */
-			ch = new_channel(name, topic, desc, 0x00,
-					dbi_result_get_uint(res, "codec"),
-					dbi_result_get_int(res, "ordr"),
-					dbi_result_get_uint(res, "maxusers"));
-			ch->db_id = dbi_result_get_uint(res, "id");
-
-			parent_db_id = dbi_result_get_uint(res, "parent_id");
-
-			parent = get_channel_by_db_id(s, parent_db_id);
-			if (parent == NULL) {
-				logger(LOG_WARN, "db_create_subchannels, channel with db_id %i does not exist.",
-						parent_db_id);
-				destroy_channel(ch);
-			} else if (parent->parent != NULL) {
-				logger(LOG_WARN, "db_create_subchannels, a subchannel can not have subchannels.");
-				destroy_channel(ch);
-			} else if ((parent->flags & CHANNEL_FLAG_SUBCHANNELS) == 0) {
-				logger(LOG_WARN, "db_create_subchannels, channel %s can not have subchannel.",
-						parent->name);
-				destroy_channel(ch);
-			} else {
-				add_channel(s, ch);
-				channel_add_subchannel(parent, ch);
-			}
-			/* free temporary variables */
-			free(name); free(topic); free(desc);
-		}
-		dbi_result_free(res);
+	if (parent == NULL) {
+		logger(LOG_WARN, "db_link_subchannel, channel with db_id %i does not exist.",
+				parent_db_id);
+	} else if (parent->parent != NULL) {
+		logger(LOG_WARN, "db_link_subchannel, a subchannel can not have subchannels.");
+	} else if ((parent->flags & CHANNEL_FLAG_SUBCHANNELS) == 0) {
+		logger(LOG_WARN, "db_link_subchannel, channel %s can not have subchannel.",
+				parent->name);
+	} else {
+		add_channel(s, ch);
+		channel_add_subchannel(parent, ch);
+		return 1;
 	}
-	return 1;
-
+	destroy_channel(ch);
+	return 0;
 }
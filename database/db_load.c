@@ -0,0 +1,342 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bulk loading of servers at startup : one query per table for a
+ * group of servers, instead of a few queries per server and one per
+ * channel. The rows are linked to their server, channel or
+ * registration with hash tables indexed by database id.
+ */
+
+#include "database.h"
+#include "log.h"
+#include "server_privileges.h"
+#include "registration.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dbi/dbi.h>
+
+struct db_hash_entry
+{
+	uint32_t key;
+	void *value;
+	struct server *s;	/* the server the value belongs to */
+	int used;
+};
+
+/* open addressing, the size is a power of two */
+struct db_hash
+{
+	struct db_hash_entry *entries;
+	size_t size;
+	size_t nb;
+};
+
+/* a subchannel waiting for all the channels to be read */
+struct db_pending_sub
+{
+	struct channel *ch;
+	struct server *s;
+	uint32_t parent_db_id;
+};
+
+static size_t db_hash_index(struct db_hash *h, uint32_t key)
+{
+	/* Knuth's multiplicative hash */
+	return (key * 2654435761u) & (h->size - 1);
+}
+
+static int db_hash_init(struct db_hash *h, size_t expected)
+{
+	h->size = 16;
+	while (h->size < expected * 2)
+		h->size *= 2;
+	h->nb = 0;
+	h->entries = (struct db_hash_entry *)calloc(h->size, sizeof(struct db_hash_entry));
+	if (h->entries == NULL) {
+		logger(LOG_ERR, "db_hash_init, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+static void db_hash_free(struct db_hash *h)
+{
+	free(h->entries);
+	h->entries = NULL;
+}
+
+static int db_hash_insert(struct db_hash *h, uint32_t key, void *value, struct server *s);
+
+static int db_hash_grow(struct db_hash *h)
+{
+	struct db_hash old = *h;
+	size_t i;
+
+	h->entries = (struct db_hash_entry *)calloc(old.size * 2, sizeof(struct db_hash_entry));
+	if (h->entries == NULL) {
+		logger(LOG_ERR, "db_hash_grow, calloc failed : %s.", strerror(errno));
+		*h = old;
+		return 0;
+	}
+	h->size = old.size * 2;
+	h->nb = 0;
+	for (i = 0 ; i < old.size ; i++) {
+		if (old.entries[i].used)
+			db_hash_insert(h, old.entries[i].key, old.entries[i].value, old.entries[i].s);
+	}
+	free(old.entries);
+	return 1;
+}
+
+static int db_hash_insert(struct db_hash *h, uint32_t key, void *value, struct server *s)
+{
+	size_t i;
+
+	if ((h->nb + 1) * 2 > h->size && !db_hash_grow(h))
+		return 0;
+	for (i = db_hash_index(h, key) ; h->entries[i].used ; i = (i + 1) & (h->size - 1)) {
+		if (h->entries[i].key == key)
+			break;
+	}
+	if (!h->entries[i].used)
+		h->nb++;
+	h->entries[i].key = key;
+	h->entries[i].value = value;
+	h->entries[i].s = s;
+	h->entries[i].used = 1;
+	return 1;
+}
+
+static struct db_hash_entry *db_hash_find(struct db_hash *h, uint32_t key)
+{
+	size_t i;
+
+	for (i = db_hash_index(h, key) ; h->entries[i].used ; i = (i + 1) & (h->size - 1)) {
+		if (h->entries[i].key == key)
+			return &h->entries[i];
+	}
+	return NULL;
+}
+
+static struct server *db_find_server(struct db_hash *servers, uint32_t server_id)
+{
+	struct db_hash_entry *e = db_hash_find(servers, server_id);
+
+	return (e == NULL) ? NULL : e->s;
+}
+
+/**
+ * Read the channels of all the servers. The subchannels are linked
+ * once all the channels are known.
+ */
+static int db_load_channels(dbi_conn conn, const char *ids, struct db_hash *servers, struct db_hash *chans)
+{
+	char *q = "SELECT * FROM channels WHERE server_id IN (%s) ORDER BY id;";
+	struct db_pending_sub *subs;
+	struct db_hash_entry *e;
+	struct channel *ch;
+	struct server *s;
+	size_t nb_subs = 0, i;
+	dbi_result res;
+	char *has_chan;
+
+	res = dbi_conn_queryf(conn, q, ids);
+	if (res == NULL) {
+		logger(LOG_ERR, "db_load_channels : SQL query failed.");
+		return 0;
+	}
+	subs = (struct db_pending_sub *)calloc(dbi_result_get_numrows(res) + 1, sizeof(struct db_pending_sub));
+	has_chan = (char *)calloc(servers->size, 1);
+	if (subs == NULL || has_chan == NULL || !db_hash_init(chans, dbi_result_get_numrows(res))) {
+		logger(LOG_ERR, "db_load_channels, calloc failed : %s.", strerror(errno));
+		free(subs);
+		free(has_chan);
+		dbi_result_free(res);
+		return 0;
+	}
+
+	while (dbi_result_next_row(res)) {
+		s = db_find_server(servers, dbi_result_get_uint(res, "server_id"));
+		if (s == NULL)	/* inactive server */
+			continue;
+		if (dbi_result_get_int(res, "parent_id") == -1) {
+			ch = db_channel_from_row(s->arena, res, 0);
+			add_channel(s, ch);
+			has_chan[db_hash_find(servers, s->id) - servers->entries] = 1;
+		} else {
+			ch = db_channel_from_row(s->arena, res, 1);
+			subs[nb_subs].ch = ch;
+			subs[nb_subs].s = s;
+			subs[nb_subs].parent_db_id = dbi_result_get_uint(res, "parent_id");
+			nb_subs++;
+		}
+		db_hash_insert(chans, ch->db_id, ch, s);
+	}
+	dbi_result_free(res);
+
+	/* a server always has a channel */
+	for (i = 0 ; i < servers->size ; i++) {
+		if (servers->entries[i].used && !has_chan[i]) {
+			ch = new_channel(servers->entries[i].s->arena, "Default", "", "",
+					CHANNEL_FLAG_DEFAULT | CHANNEL_FLAG_UNREGISTERED, CODEC_SPEEX_12_3, 0, 128);
+			add_channel(servers->entries[i].s, ch);
+		}
+	}
+	for (i = 0 ; i < nb_subs ; i++) {
+		e = db_hash_find(chans, subs[i].parent_db_id);
+		if (e != NULL && e->s != subs[i].s)	/* parent in another server */
+			e = NULL;
+		if (!db_link_subchannel(subs[i].s, (e == NULL) ? NULL : e->value,
+					subs[i].parent_db_id, subs[i].ch))
+			db_hash_insert(chans, subs[i].ch->db_id, NULL, NULL);
+	}
+	free(has_chan);
+	free(subs);
+	return 1;
+}
+
+static int db_load_registrations(dbi_conn conn, const char *ids, struct db_hash *servers, struct db_hash *regs)
+{
+	char *q = "SELECT * FROM registrations WHERE server_id IN (%s);";
+	struct registration *r;
+	struct server *s;
+	dbi_result res;
+
+	res = dbi_conn_queryf(conn, q, ids);
+	if (res == NULL) {
+		logger(LOG_ERR, "db_load_registrations : SQL query failed.");
+		return 0;
+	}
+	if (!db_hash_init(regs, dbi_result_get_numrows(res))) {
+		dbi_result_free(res);
+		return 0;
+	}
+	while (dbi_result_next_row(res)) {
+		s = db_find_server(servers, dbi_result_get_uint(res, "server_id"));
+		if (s == NULL)
+			continue;
+		r = db_registration_from_row(s->arena, res);
+		add_registration(s, r);
+		db_hash_insert(regs, r->db_id, r, s);
+	}
+	dbi_result_free(res);
+	return 1;
+}
+
+static int db_load_sv_privileges(dbi_conn conn, const char *ids, struct db_hash *servers)
+{
+	char *q = "SELECT * FROM server_privileges WHERE server_id IN (%s);";
+	struct server *s;
+	dbi_result res;
+
+	res = dbi_conn_queryf(conn, q, ids);
+	if (res == NULL) {
+		logger(LOG_ERR, "db_load_sv_privileges : SQL query failed.");
+		return 0;
+	}
+	while (dbi_result_next_row(res)) {
+		s = db_find_server(servers, dbi_result_get_uint(res, "server_id"));
+		if (s != NULL)
+			db_sv_privileges_from_row(res, s->privileges);
+	}
+	dbi_result_free(res);
+	return 1;
+}
+
+static int db_load_pl_ch_privileges(dbi_conn conn, const char *ids, struct db_hash *chans, struct db_hash *regs)
+{
+	char *q = "SELECT p.* FROM player_channel_privileges p, channels c \
+		   WHERE p.channel_id = c.id AND c.server_id IN (%s);";
+	struct player_channel_privilege *priv;
+	struct db_hash_entry *ch_e, *reg_e;
+	struct channel *ch;
+	dbi_result res;
+
+	res = dbi_conn_queryf(conn, q, ids);
+	if (res == NULL) {
+		logger(LOG_WARN, "db_load_pl_ch_privileges : SQL query failed.");
+		return 0;
+	}
+	while (dbi_result_next_row(res)) {
+		ch_e = db_hash_find(chans, dbi_result_get_uint(res, "channel_id"));
+		reg_e = db_hash_find(regs, dbi_result_get_uint(res, "player_id"));
+		/* the channel and the registration must be in the same server */
+		if (ch_e == NULL || ch_e->value == NULL || reg_e == NULL || ch_e->s != reg_e->s)
+			continue;
+		ch = (struct channel *)ch_e->value;
+		if (ch->flags & CHANNEL_FLAG_UNREGISTERED)
+			continue;
+		priv = db_pl_chan_priv_from_row(ch->arena, res);
+		priv->ch = ch;
+		priv->pl_or_reg.reg = (struct registration *)reg_e->value;
+		add_player_channel_privilege(ch, priv);
+	}
+	dbi_result_free(res);
+	return 1;
+}
+
+/**
+ * Read the channels, registrations, server privileges and player
+ * channel privileges of some servers, with one query per table.
+ *
+ * @param conn the connection to use
+ * @param ss the servers (created by db_create_servers)
+ *
+ * @return 1 on success, 0 on failure
+ */
+int db_create_all(dbi_conn conn, struct array *ss)
+{
+	struct db_hash servers, chans, regs;
+	struct server *s;
+	size_t iter;
+	char *ids, *ptr;
+	int ret = 0;
+
+	/* the ids of the servers, for the IN clauses */
+	ids = (char *)calloc(ss->used_slots + 1, 11);
+	if (ids == NULL) {
+		logger(LOG_ERR, "db_create_all, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	bzero(&chans, sizeof(chans));
+	bzero(&regs, sizeof(regs));
+	if (!db_hash_init(&servers, ss->used_slots)) {
+		free(ids);
+		return 0;
+	}
+	ptr = ids;
+	ar_each(struct server *, s, iter, ss)
+		db_hash_insert(&servers, s->id, s, s);
+		ptr += sprintf(ptr, "%s%i", (ptr == ids) ? "" : ",", s->id);
+	ar_end_each;
+
+	if (db_load_channels(conn, ids, &servers, &chans)
+			&& db_load_registrations(conn, ids, &servers, &regs)
+			&& db_load_sv_privileges(conn, ids, &servers)
+			&& db_load_pl_ch_privileges(conn, ids, &chans, &regs))
+		ret = 1;
+
+	db_hash_free(&servers);
+	db_hash_free(&chans);
+	db_hash_free(&regs);
+	free(ids);
+	return ret;
+}
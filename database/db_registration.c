@@ -24,37 +24,37 @@
 #include <dbi/dbi.h>
 
 /**
- * Go through the database, read and add to the server all
- * the registrations stored.
+ * Create a registration from the current row of a result.
  *
- * @param c the configuration of the db
- * @param s the server
+ * @param a the arena of the server
+ * @param res the result of a query on registrations
+ *
+ * @return the registration
  */
-int db_create_registrations(struct config *c, struct server *s)
+struct registration *db_registration_from_row(struct arena *a, dbi_result res)
 {
-	char *q = "SELECT * FROM registrations WHERE server_id = %i;";
 	struct registration *r;
 	char *name, *pass;
-	dbi_result res;
 
-	res = dbi_conn_queryf(c->conn, q, s->id);
+	r = new_registration(a);
+	r->db_id = dbi_result_get_uint(res, "id");
+	r->global_flags = dbi_result_get_uint(res, "serveradmin");
+	name = dbi_result_get_string_copy(res, "name");
+	strncpy(r->name, name, MIN(29, strlen(name)));
+	pass = dbi_result_get_string_copy(res, "password");
+	strcpy(r->password, pass);
+	/* free temporary variables */
+	free(pass); free(name);
+	return r;
+}
+
+static int db_exec_add_registration(struct config *c, struct db_op *op)
+{
+	static struct db_stmt st = DB_STMT("INSERT INTO registrations (id, server_id, serveradmin, name, password) \
+			VALUES (?, ?, ?, ?, ?);", "iiiss");
 
-	if (res) {
-		while (dbi_result_next_row(res)) {
-			r = new_registration();
-			r->db_id = dbi_result_get_uint(res, "id");
-			r->global_flags = dbi_result_get_uint(res, "serveradmin");
-			name = dbi_result_get_string_copy(res, "name");
-			strncpy(r->name, name, MIN(29, strlen(name)));
-			pass = dbi_result_get_string_copy(res, "password");
-			strcpy(r->password, pass);
-			add_registration(s, r);
-			/* free temporary variables */
-			free(pass); free(name);
-		}
-		dbi_result_free(res);
-	}
-	return 1;
+	return db_stmt_exec(c, &st, op->id, op->u.reg.server_id, op->u.reg.serveradmin,
+			op->str[0], op->str[1]);
 }
 
 /**
@@ -68,53 +68,53 @@ int db_create_registrations(struct config *c, struct server *s)
  */
 int db_add_registration(struct config *c, struct server *s, struct registration *r)
 {
-	char *req = "INSERT INTO registrations (server_id, serveradmin, name, password) VALUES (%i, %i, %s, %s);";
-	char *quoted_name, *quoted_pass;
-	dbi_result res;
+	struct db_op *op;
 	struct channel *ch;
-	struct player_channel_privilege *priv;
-	size_t iter, iter2;
+	struct player_channel_privilege *priv, *next;
+	size_t iter;
 
-	dbi_conn_quote_string_copy(c->conn, r->name, &quoted_name);
-	dbi_conn_quote_string_copy(c->conn, r->password, &quoted_pass);
-
-	res = dbi_conn_queryf(c->conn, req, s->id, r->global_flags, quoted_name, quoted_pass);
-	if (res == NULL) {
-		logger(LOG_WARN, "db_add_registration : SQL query failed");
-	} else {
-		r->db_id = dbi_conn_sequence_last(c->conn, NULL);
-		dbi_result_free(res);
-	}
-	free(quoted_pass);
-	free(quoted_name);
+	op = db_op_new(&db_exec_add_registration);
+	if (op == NULL)
+		return 0;
+	/* the id is known now, the insertion is done later */
+	r->db_id = db_alloc_id(c, DB_TABLE_REGISTRATIONS);
+	op->id = r->db_id;
+	op->u.reg.server_id = s->id;
+	op->u.reg.serveradmin = r->global_flags;
+	db_op_set_str(op, 0, r->name);
+	db_op_set_str(op, 1, r->password);
+	db_submit(c, op);
 
 	ar_each(struct channel *, ch, iter, s->chans)
-		ar_each(struct player_channel_privilege *, priv, iter2, ch->pl_privileges)
+		il_each(priv, next, &ch->pl_privileges, ch_link)
 			if (priv->reg == PL_CH_PRIV_REGISTERED && priv->pl_or_reg.reg == r) {
 				logger(LOG_INFO, "db_add_registration : adding a new pl_chan_priv");
 				db_add_pl_chan_priv(c, priv);
 			}
-		ar_end_each;
+		il_end_each;
 	ar_end_each;
 	return 1;
 }
 
-int db_del_registration(struct config *c, struct server *s, struct registration *r)
+static int db_exec_del_registration(struct config *c, struct db_op *op)
 {
-	char *q = "DELETE FROM registrations WHERE id = %i;";
-	char *q2 = "DELETE FROM player_channel_privileges WHERE player_id = %i;";
-	dbi_result res;
+	static struct db_stmt st = DB_STMT("DELETE FROM registrations WHERE id = ?;", "i");
+	static struct db_stmt st2 = DB_STMT("DELETE FROM player_channel_privileges WHERE player_id = ?;", "i");
+	int ret;
+
+	ret = db_stmt_exec(c, &st, op->id);
+	ret &= db_stmt_exec(c, &st2, op->id);
+	return ret;
+}
 
-	res = dbi_conn_queryf(c->conn, q, r->db_id);
-	if (res == NULL)
-		logger(LOG_WARN, "db_del_registration : SQL query failed");
-	else
-		dbi_result_free(res);
+int db_del_registration(struct config *c, struct server *s, struct registration *r)
+{
+	struct db_op *op;
 
-	res = dbi_conn_queryf(c->conn, q2, r->db_id);
-	if (res == NULL)
-		logger(LOG_WARN, "db_del_registration : SQL query failed (2)");
-	else
-		dbi_result_free(res);
+	op = db_op_new(&db_exec_del_registration);
+	if (op == NULL)
+		return 0;
+	op->id = r->db_id;
+	db_submit(c, op);
 	return 1;
 }
@@ -27,18 +27,18 @@
 /**
  * Create servers from a database
  *
- * @param c the config containing the connection info
- *
- * @return the servers followed by a NULL pointer
+ * @param c the config of the servers
+ * @param conn the connection to use
+ * @param ss the array the servers are added to
  */
-void db_create_servers(struct config *c, struct array *ss)
+void db_create_servers(struct config *c, dbi_conn conn, struct array *ss)
 {
 	dbi_result res;
 	char *q = "SELECT * FROM servers WHERE active = 1;";
 	int nb_serv;
 	struct server *s;
 
-	res = dbi_conn_query(c->conn, q);
+	res = dbi_conn_query(conn, q);
 	nb_serv = dbi_result_get_numrows(res);
 	if (nb_serv == 0) {
 		return;
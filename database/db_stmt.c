@@ -0,0 +1,278 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Prepared statements.
+ *
+ * libdbi has no prepared statements, so with sqlite3 the writes go
+ * through a native connection to the same file : each statement is
+ * prepared the first time it is used and then only reset and bound
+ * again. With the other drivers, the parameters are quoted and put
+ * in the query text, as before.
+ */
+
+#include "database.h"
+#include "config.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <dbi/dbi.h>
+
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+
+#define DB_STMT_MAX_PARAMS 16
+
+struct db_stmt_cache
+{
+	pthread_mutex_t lock;
+#ifdef HAVE_SQLITE3
+	sqlite3 *db;
+	sqlite3_stmt *prepared[DB_STMT_MAX];
+#endif
+};
+
+#ifdef HAVE_SQLITE3
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static int nb_slots = 0;
+
+/**
+ * Give a slot in the caches to a statement the first time
+ * it is used.
+ *
+ * @param st the statement
+ *
+ * @return the slot, or -1 if there is no slot left
+ */
+static int db_stmt_slot(struct db_stmt *st)
+{
+	int slot = __atomic_load_n(&st->slot, __ATOMIC_ACQUIRE);
+
+	if (slot != -1)
+		return slot;
+	pthread_mutex_lock(&slot_lock);
+	if (st->slot == -1 && nb_slots < DB_STMT_MAX)
+		__atomic_store_n(&st->slot, nb_slots++, __ATOMIC_RELEASE);
+	slot = st->slot;
+	pthread_mutex_unlock(&slot_lock);
+	if (slot == -1)
+		logger(LOG_WARN, "db_stmt_slot : more than %i statements, %s is not cached.", DB_STMT_MAX, st->sql);
+	return slot;
+}
+#endif
+
+/**
+ * Open the statement cache of a connection. With sqlite3, this
+ * opens the native connection.
+ *
+ * @param c the configuration of the db
+ *
+ * @return 1 on success, 0 on failure
+ */
+int db_stmt_open(struct config *c)
+{
+	struct db_stmt_cache *sc;
+#ifdef HAVE_SQLITE3
+	char *filename;
+#endif
+
+	sc = (struct db_stmt_cache *)calloc(1, sizeof(struct db_stmt_cache));
+	if (sc == NULL) {
+		logger(LOG_ERR, "db_stmt_open, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	pthread_mutex_init(&sc->lock, NULL);
+#ifdef HAVE_SQLITE3
+	if (strcmp(c->db_type, "sqlite3") == 0) {
+		if (asprintf(&filename, "%s/%s", c->db.file.path, c->db.file.db) == -1) {
+			logger(LOG_ERR, "db_stmt_open, asprintf failed.");
+			pthread_mutex_destroy(&sc->lock);
+			free(sc);
+			return 0;
+		}
+		if (sqlite3_open_v2(filename, &sc->db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+			logger(LOG_WARN, "db_stmt_open : could not open %s (%s), statements will not be prepared.",
+					filename, sqlite3_errmsg(sc->db));
+			sqlite3_close(sc->db);
+			sc->db = NULL;
+		} else {
+			/* the libdbi connection may be reading */
+			sqlite3_busy_timeout(sc->db, 5000);
+		}
+		free(filename);
+	}
+#endif
+	c->stmts = sc;
+	return 1;
+}
+
+/**
+ * Free the prepared statements and close the native connection.
+ *
+ * @param c the configuration of the db
+ */
+void db_stmt_close(struct config *c)
+{
+	struct db_stmt_cache *sc = c->stmts;
+#ifdef HAVE_SQLITE3
+	int i;
+#endif
+
+	if (sc == NULL)
+		return;
+#ifdef HAVE_SQLITE3
+	if (sc->db != NULL) {
+		for (i = 0 ; i < DB_STMT_MAX ; i++) {
+			if (sc->prepared[i] != NULL)
+				sqlite3_finalize(sc->prepared[i]);
+		}
+		sqlite3_close(sc->db);
+	}
+#endif
+	c->stmts = NULL;
+	pthread_mutex_destroy(&sc->lock);
+	free(sc);
+}
+
+#ifdef HAVE_SQLITE3
+static int db_stmt_exec_sqlite3(struct db_stmt_cache *sc, struct db_stmt *st, int slot, va_list ap)
+{
+	sqlite3_stmt *stmt;
+	int i, ret;
+
+	pthread_mutex_lock(&sc->lock);
+	stmt = sc->prepared[slot];
+	if (stmt == NULL) {
+		if (sqlite3_prepare_v2(sc->db, st->sql, -1, &stmt, NULL) != SQLITE_OK) {
+			logger(LOG_ERR, "db_stmt_exec : could not prepare %s (%s).", st->sql, sqlite3_errmsg(sc->db));
+			pthread_mutex_unlock(&sc->lock);
+			return 0;
+		}
+		sc->prepared[slot] = stmt;
+	}
+	for (i = 0 ; st->types[i] != '\0' ; i++) {
+		if (st->types[i] == 'i')
+			sqlite3_bind_int(stmt, i + 1, va_arg(ap, int));
+		else
+			sqlite3_bind_text(stmt, i + 1, va_arg(ap, const char *), -1, SQLITE_STATIC);
+	}
+	ret = sqlite3_step(stmt);
+	if (ret != SQLITE_DONE && ret != SQLITE_ROW)
+		logger(LOG_ERR, "db_stmt_exec : %s failed (%s).", st->sql, sqlite3_errmsg(sc->db));
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	pthread_mutex_unlock(&sc->lock);
+
+	return (ret == SQLITE_DONE || ret == SQLITE_ROW);
+}
+#endif
+
+/**
+ * Execute a statement through libdbi : the parameters are quoted
+ * and replace the ? of the query.
+ */
+static int db_stmt_exec_dbi(struct config *c, struct db_stmt *st, va_list ap)
+{
+	char *values[DB_STMT_MAX_PARAMS];
+	char *q, *ptr;
+	const char *sql;
+	size_t size;
+	int i, nb = 0, ret = 0;
+	dbi_result res;
+
+	size = strlen(st->sql) + 1;
+	for (nb = 0 ; st->types[nb] != '\0' && nb < DB_STMT_MAX_PARAMS ; nb++) {
+		if (st->types[nb] == 'i') {
+			if (asprintf(&values[nb], "%i", va_arg(ap, int)) == -1)
+				values[nb] = NULL;
+		} else if (dbi_conn_quote_string_copy(c->conn, va_arg(ap, const char *), &values[nb]) == 0) {
+			values[nb] = NULL;
+		}
+		if (values[nb] == NULL) {
+			logger(LOG_ERR, "db_stmt_exec : could not convert parameter %i of %s.", nb, st->sql);
+			goto free_values;
+		}
+		size += strlen(values[nb]);
+	}
+
+	q = (char *)malloc(size);
+	if (q == NULL) {
+		logger(LOG_ERR, "db_stmt_exec, malloc failed : %s.", strerror(errno));
+		goto free_values;
+	}
+	i = 0;
+	ptr = q;
+	for (sql = st->sql ; *sql != '\0' ; sql++) {
+		if (*sql == '?' && i < nb) {
+			strcpy(ptr, values[i]);
+			ptr += strlen(values[i++]);
+		} else {
+			*ptr++ = *sql;
+		}
+	}
+	*ptr = '\0';
+
+	res = dbi_conn_query(c->conn, q);
+	if (res == NULL) {
+		logger(LOG_ERR, "db_stmt_exec : %s failed.", q);
+	} else {
+		dbi_result_free(res);
+		ret = 1;
+	}
+	free(q);
+
+free_values:
+	for (i = 0 ; i < nb ; i++)
+		free(values[i]);
+	return ret;
+}
+
+/**
+ * Execute a statement that does not return rows.
+ * The parameters follow the types of the statement : an int
+ * for 'i', a char * for 's'. Strings must not be quoted.
+ *
+ * @param c the configuration of the db
+ * @param st the statement
+ *
+ * @return 1 on success, 0 on failure
+ */
+int db_stmt_exec(struct config *c, struct db_stmt *st, ...)
+{
+	va_list ap;
+	int ret;
+#ifdef HAVE_SQLITE3
+	int slot;
+#endif
+
+	va_start(ap, st);
+#ifdef HAVE_SQLITE3
+	if (c->stmts != NULL && c->stmts->db != NULL && (slot = db_stmt_slot(st)) != -1)
+		ret = db_stmt_exec_sqlite3(c->stmts, st, slot, ap);
+	else
+#endif
+		ret = db_stmt_exec_dbi(c, st, ap);
+	va_end(ap);
+	return ret;
+}
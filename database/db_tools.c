@@ -23,35 +23,78 @@
 #include <dbi/dbi.h>
 
 /**
- * Initialize the database from a configuration
+ * Create a connection (not connected yet) with the options
+ * of a configuration.
  *
  * @param c the config of the db
  *
- * @return 1 on success
+ * @return the connection
  */
-int init_db(struct config *c)
+static dbi_conn db_conn_new(struct config *c)
 {
-	dbi_initialize(NULL);
-	c->conn = dbi_conn_new(c->db_type);
+	dbi_conn conn;
+
+	conn = dbi_conn_new(c->db_type);
+	if (conn == NULL)
+		return NULL;
 
 	if (strcmp(c->db_type, "sqlite") == 0 || strcmp(c->db_type, "sqlite3") == 0) {
 		if (strcmp(c->db_type, "sqlite") == 0)
-			dbi_conn_set_option(c->conn, "sqlite_dbdir", c->db.file.path);
+			dbi_conn_set_option(conn, "sqlite_dbdir", c->db.file.path);
 		else
-			dbi_conn_set_option(c->conn, "sqlite3_dbdir", c->db.file.path);
+			dbi_conn_set_option(conn, "sqlite3_dbdir", c->db.file.path);
 
-		dbi_conn_set_option(c->conn, "dbname", c->db.file.db);
+		dbi_conn_set_option(conn, "dbname", c->db.file.db);
 	} else {
-		dbi_conn_set_option(c->conn, "host", c->db.connection.host);
-		dbi_conn_set_option(c->conn, "username", c->db.connection.user);
-		dbi_conn_set_option(c->conn, "password", c->db.connection.pass);
-		dbi_conn_set_option(c->conn, "dbname", c->db.connection.db);
-		dbi_conn_set_option_numeric(c->conn, "port", c->db.connection.port);
+		dbi_conn_set_option(conn, "host", c->db.connection.host);
+		dbi_conn_set_option(conn, "username", c->db.connection.user);
+		dbi_conn_set_option(conn, "password", c->db.connection.pass);
+		dbi_conn_set_option(conn, "dbname", c->db.connection.db);
+		dbi_conn_set_option_numeric(conn, "port", c->db.connection.port);
 	}
+	return conn;
+}
+
+/**
+ * Initialize the database from a configuration
+ *
+ * @param c the config of the db
+ *
+ * @return 1 on success
+ */
+int init_db(struct config *c)
+{
+	dbi_initialize(NULL);
+	c->conn = db_conn_new(c);
 
 	return 1;
 }
 
+/**
+ * Open one more connection to the database, for a thread that
+ * can not share the main one. Close it with dbi_conn_close.
+ *
+ * @param c the config of the db
+ *
+ * @return the connection, NULL on failure
+ */
+dbi_conn db_connect_new(struct config *c)
+{
+	dbi_conn conn;
+
+	conn = db_conn_new(c);
+	if (conn == NULL) {
+		logger(LOG_ERR, "db_connect_new : could not create a connection.");
+		return NULL;
+	}
+	if (dbi_conn_connect(conn) < 0) {
+		logger(LOG_ERR, "db_connect_new : could not connect.");
+		dbi_conn_close(conn);
+		return NULL;
+	}
+	return conn;
+}
+
 /**
  * Connect to the database before executing a query
  *
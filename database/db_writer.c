@@ -0,0 +1,334 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Write-behind database layer.
+ *
+ * The packet handlers do not write to the database themselves : they
+ * build a db_op with a copy of the data and give it to db_submit.
+ * A single writer thread executes the ops in the order they were
+ * submitted, so the writes concerning one entity (insert, updates,
+ * delete) always reach the database in order. The ops waiting when
+ * the thread wakes up are grouped in one transaction.
+ *
+ * The rows inserted by the server get their id from db_alloc_id
+ * instead of the auto increment of the database, so the id is known
+ * immediately and the following writes can use it.
+ *
+ * Without the thread (db.async = false), db_submit executes the op
+ * immediately, like before.
+ *
+ * The ops use prepared statements (see db_stmt.c).
+ */
+
+#include "database.h"
+#include "log.h"
+#include "mclock.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dbi/dbi.h>
+
+/* warn every time this many writes are waiting */
+#define DB_WRITER_HIGH_WATER 1000
+
+struct db_writer
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct db_op *first;
+	struct db_op *last;
+	pthread_t thread;
+	int running;
+	int stop;
+
+	struct db_writer_stats stats;
+	uint32_t next_id[DB_NB_TABLES];
+};
+
+static char *db_tables[DB_NB_TABLES] = {"channels", "registrations"};
+
+/**
+ * Allocate a new database operation.
+ *
+ * @param exec the function writing it to the database
+ *
+ * @return the operation, or NULL
+ */
+struct db_op *db_op_new(int (*exec)(struct config *c, struct db_op *op))
+{
+	struct db_op *op;
+
+	op = (struct db_op *)calloc(1, sizeof(struct db_op));
+	if (op == NULL) {
+		logger(LOG_ERR, "db_op_new, calloc failed : %s.", strerror(errno));
+		return NULL;
+	}
+	op->exec = exec;
+	return op;
+}
+
+/**
+ * Copy a string parameter of an operation.
+ *
+ * @param op the operation
+ * @param i the index of the string
+ * @param str the string (NULL is stored as an empty string)
+ */
+void db_op_set_str(struct db_op *op, int i, const char *str)
+{
+	op->str[i] = strdup(str != NULL ? str : "");
+}
+
+static void db_op_free(struct db_op *op)
+{
+	int i;
+
+	for (i = 0 ; i < 4 ; i++)
+		free(op->str[i]);
+	free(op);
+}
+
+/**
+ * Write a batch of operations in one transaction.
+ *
+ * @param c the configuration of the db
+ * @param ops the first operation, linked by next
+ * @param nb the number of operations
+ */
+static void db_writer_flush(struct config *c, struct db_op *ops, int nb)
+{
+	struct db_writer *w = c->writer;
+	static struct db_stmt begin = DB_STMT("BEGIN;", "");
+	static struct db_stmt commit = DB_STMT("COMMIT;", "");
+	struct db_op *op, *next;
+	struct metrics_histogram latency;
+	uint64_t now;
+	int failed = 0, i;
+
+	bzero(&latency, sizeof(latency));
+
+	if (nb > 1 && !db_stmt_exec(c, &begin))
+		logger(LOG_WARN, "db_writer_flush : could not begin a transaction.");
+	for (op = ops ; op != NULL ; op = next) {
+		next = op->next;
+		now = mclock_ns();
+		metrics_observe(&latency, MCLOCK_SINCE(now, op->submitted) / 1000);
+		if (!op->exec(c, op))
+			failed++;
+		db_op_free(op);
+	}
+	if (nb > 1 && !db_stmt_exec(c, &commit))
+		logger(LOG_ERR, "db_writer_flush : could not commit %i writes.", nb);
+
+	pthread_mutex_lock(&w->lock);
+	w->stats.written += nb;
+	w->stats.failed += failed;
+	w->stats.batches++;
+	for (i = 0 ; i < METRICS_BUCKETS ; i++)
+		w->stats.latency.buckets[i] += latency.buckets[i];
+	w->stats.latency.sum += latency.sum;
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void *db_writer_run(void *args)
+{
+	struct config *c = (struct config *)args;
+	struct db_writer *w = c->writer;
+	struct db_op *batch, *op;
+	int nb;
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		while (w->first == NULL && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		/* only leave once everything is written */
+		if (w->first == NULL)
+			break;
+		/* take at most db_batch writes */
+		batch = w->first;
+		nb = 1;
+		for (op = batch ; op->next != NULL && nb < c->db_batch ; op = op->next)
+			nb++;
+		w->first = op->next;
+		if (w->first == NULL)
+			w->last = NULL;
+		op->next = NULL;
+		w->stats.depth -= nb;
+		pthread_mutex_unlock(&w->lock);
+
+		db_writer_flush(c, batch, nb);
+
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/**
+ * Give an operation to the database writer. It is freed once
+ * written.
+ *
+ * @param c the configuration of the db
+ * @param op the operation
+ */
+void db_submit(struct config *c, struct db_op *op)
+{
+	struct db_writer *w = c->writer;
+
+	if (op == NULL)
+		return;
+	if (w == NULL || !w->running) {
+		op->exec(c, op);
+		db_op_free(op);
+		return;
+	}
+	op->submitted = mclock_ns();
+	pthread_mutex_lock(&w->lock);
+	if (w->last == NULL)
+		w->first = op;
+	else
+		w->last->next = op;
+	w->last = op;
+	w->stats.submitted++;
+	w->stats.depth++;
+	if (w->stats.depth > w->stats.max_depth)
+		w->stats.max_depth = w->stats.depth;
+	if (w->stats.depth % DB_WRITER_HIGH_WATER == 0)
+		logger(LOG_WARN, "db_submit : %i writes are waiting for the database.", w->stats.depth);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Give an id to a new row.
+ *
+ * @param c the configuration of the db
+ * @param table DB_TABLE_CHANNELS or DB_TABLE_REGISTRATIONS
+ *
+ * @return the id
+ */
+uint32_t db_alloc_id(struct config *c, int table)
+{
+	return __atomic_add_fetch(&c->writer->next_id[table], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Read the last ids of the tables, prepare the statements and start
+ * the writer thread if the writes are asynchronous. The database must
+ * be connected.
+ *
+ * @param c the configuration of the db
+ *
+ * @return 1 on success, 0 on failure
+ */
+int db_writer_start(struct config *c)
+{
+	struct db_writer *w;
+	char *q = "SELECT id FROM %s ORDER BY id DESC LIMIT 1;";
+	dbi_result res;
+	int i;
+
+	w = (struct db_writer *)calloc(1, sizeof(struct db_writer));
+	if (w == NULL) {
+		logger(LOG_ERR, "db_writer_start, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	for (i = 0 ; i < DB_NB_TABLES ; i++) {
+		res = dbi_conn_queryf(c->conn, q, db_tables[i]);
+		if (res == NULL) {
+			logger(LOG_ERR, "db_writer_start : could not read the last id of %s.", db_tables[i]);
+			free(w);
+			return 0;
+		}
+		if (dbi_result_next_row(res))
+			w->next_id[i] = dbi_result_get_uint(res, "id");
+		dbi_result_free(res);
+	}
+	if (!db_stmt_open(c)) {
+		free(w);
+		return 0;
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	c->writer = w;
+
+	if (c->db_async) {
+		if (pthread_create(&w->thread, NULL, &db_writer_run, c) != 0) {
+			logger(LOG_WARN, "db_writer_start : could not start the thread, writing synchronously.");
+			return 1;
+		}
+		w->running = 1;
+		logger(LOG_INFO, "Database writer started.");
+	}
+	return 1;
+}
+
+/**
+ * Write all the pending operations, stop the writer thread
+ * and free the writer.
+ *
+ * @param c the configuration of the db
+ */
+void db_writer_stop(struct config *c)
+{
+	struct db_writer *w = c->writer;
+
+	if (w == NULL)
+		return;
+	if (w->running) {
+		pthread_mutex_lock(&w->lock);
+		if (w->stats.depth > 0)
+			logger(LOG_INFO, "Flushing %i database writes.", w->stats.depth);
+		w->stop = 1;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+		logger(LOG_INFO, "Database writer : %" PRIu64 " writes in %" PRIu64
+				" transactions, %" PRIu64 " failed, at most %i waiting.",
+				w->stats.written, w->stats.batches, w->stats.failed,
+				w->stats.max_depth);
+	}
+	c->writer = NULL;
+	db_stmt_close(c);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	free(w);
+}
+
+/**
+ * Get the counters of the database writer.
+ *
+ * @param c the configuration of the db
+ * @param st where to copy them
+ */
+void db_writer_get_stats(struct config *c, struct db_writer_stats *st)
+{
+	struct db_writer *w = c->writer;
+
+	if (w == NULL) {
+		bzero(st, sizeof(struct db_writer_stats));
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	*st = w->stats;
+	pthread_mutex_unlock(&w->lock);
+}
@@ -0,0 +1,989 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Handoff of the running servers to a new process (binary upgrade).
+ *
+ * The running process listens on the unix socket network.handoff_socket.
+ * A new process started with -u connects to it, then the old one :
+ *   - writes a last snapshot and freezes its servers (write locks),
+ *   - flushes the database writes, so the new process starts its
+ *     writer with the right ids,
+ *   - sends the state of each server : channels with their ids,
+ *     registrations, bans, players with their ids, address, packet
+ *     counters, channel, mutes, privileges and pending reliable
+ *     packets, along with the receiving sockets of the server
+ *     (SCM_RIGHTS),
+ *   - exits once the new process has started the servers, without
+ *     notifying the players : they keep talking to the same sockets.
+ * If anything fails, the old process resumes its servers.
+ *
+ * Stream format (little endian) :
+ *   new -> old : magic (8 bytes), version (u32)
+ *   old -> new : magic (8 bytes), version (u32), number of servers (u32)
+ *   for each server : size of its section (u32) and number of sockets
+ *   (u32), sent with the sockets, then the section
+ *   new -> old : 'K' once the servers are started
+ *
+ * The players leaving the servers are not handed off, and the packets
+ * the old process has already read but not handled are lost (the
+ * clients resend the reliable ones).
+ */
+
+#include "handoff.h"
+#include "server.h"
+#include "channel.h"
+#include "player.h"
+#include "registration.h"
+#include "ban.h"
+#include "player_channel_privilege.h"
+#include "server_stat.h"
+#include "server_privileges.h"
+#include "database.h"
+#include "snapshot.h"
+#include "queue.h"
+#include "compat.h"
+#include "serial.h"
+#include "metrics.h"
+#include "arena.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+/* the listening side (old process) */
+static struct
+{
+	struct config *c;
+	struct array *ss;
+	int sd;
+	pthread_t thread;
+	int running;
+} hoff;
+
+/* the connection to the old process (new process) */
+static int hoff_peer = -1;
+
+static int handoff_write(int sd, const void *data, size_t len)
+{
+	const char *ptr = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(sd, ptr, len, MSG_NOSIGNAL);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			logger(LOG_WARN, "handoff_write, send failed : %s.", strerror(errno));
+			return 0;
+		}
+		ptr += n;
+		len -= n;
+	}
+	return 1;
+}
+
+static int handoff_read(int sd, void *data, size_t len)
+{
+	char *ptr = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = recv(sd, ptr, len, 0);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == 0) {
+			logger(LOG_WARN, "handoff_read, connection closed.");
+			return 0;
+		}
+		if (n == -1) {
+			logger(LOG_WARN, "handoff_read, recv failed : %s.", strerror(errno));
+			return 0;
+		}
+		ptr += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/**
+ * Send the header of a section with the sockets of its server.
+ *
+ * @param sd the connection
+ * @param len the size of the section
+ * @param fds the sockets
+ * @param nb_fds the number of sockets (at least 1)
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int handoff_send_fds(int sd, uint32_t len, int *fds, int nb_fds)
+{
+	char hdr[8], *ptr = hdr;
+	char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	wu32(len, &ptr);
+	wu32(nb_fds, &ptr);
+	bzero(&msg, sizeof(msg));
+	bzero(control, sizeof(control));
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nb_fds);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nb_fds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nb_fds);
+
+	do {
+		n = sendmsg(sd, &msg, MSG_NOSIGNAL);
+	} while (n == -1 && errno == EINTR);
+	if (n <= 0) {
+		logger(LOG_WARN, "handoff_send_fds, sendmsg failed : %s.", strerror(errno));
+		return 0;
+	}
+	/* the sockets went with the first byte */
+	return handoff_write(sd, hdr + n, sizeof(hdr) - n);
+}
+
+/**
+ * Receive the header of a section with the sockets of its server.
+ *
+ * @param sd the connection
+ * @param len where to store the size of the section
+ * @param fds where to store the sockets (HANDOFF_MAX_FDS)
+ * @param nb_fds where to store the number of sockets
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int handoff_recv_fds(int sd, uint32_t *len, int *fds, int *nb_fds)
+{
+	char hdr[8], *ptr = hdr;
+	char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	bzero(&msg, sizeof(msg));
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	do {
+		n = recvmsg(sd, &msg, 0);
+	} while (n == -1 && errno == EINTR);
+	if (n <= 0) {
+		logger(LOG_WARN, "handoff_recv_fds, recvmsg failed : %s.", n == 0 ? "connection closed" : strerror(errno));
+		return 0;
+	}
+	*nb_fds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg) ; cmsg != NULL ; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			*nb_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nb_fds);
+		}
+	}
+	if (!handoff_read(sd, hdr + n, sizeof(hdr) - n))
+		goto fail;
+	*len = ru32(&ptr);
+	if (ru32(&ptr) != (uint32_t)*nb_fds || *nb_fds == 0 || (msg.msg_flags & MSG_CTRUNC)) {
+		logger(LOG_WARN, "handoff_recv_fds : the sockets of the server were not received.");
+		goto fail;
+	}
+	return 1;
+
+fail:
+	while (*nb_fds > 0)
+		close(fds[--(*nb_fds)]);
+	return 0;
+}
+
+static void handoff_write_player(struct serial_buf *b, struct player *pl)
+{
+	struct player_stat *st = &pl->stats;
+	struct q_elem *q_e;
+	uint32_t nb = 0;
+	int i;
+
+	sb_u32(b, pl->public_id);
+	sb_u32(b, pl->private_id);
+	sb_str(b, pl->client);
+	sb_str(b, pl->machine);
+	sb_str(b, pl->name);
+	sb_str(b, pl->login);
+	sb_str(b, pl->voice_request);
+	for (i = 0 ; i < 4 ; i++)
+		sb_u16(b, pl->version[i]);
+	sb_u16(b, pl->global_flags);
+	sb_u16(b, pl->player_attributes);
+	sb_u32(b, pl->in_chan->id);
+	sb_u32(b, (pl->reg == NULL) ? 0 : pl->reg->db_id);
+	/* the address, in network order */
+	sb_bytes(b, &pl->cli_addr.sin_addr.s_addr, 4);
+	sb_bytes(b, &pl->cli_addr.sin_port, 2);
+	sb_u32(b, pl->f0_c_counter);
+	sb_u32(b, pl->f0_s_counter);
+	sb_u32(b, pl->f1_c_counter);
+	sb_u32(b, pl->f1_s_counter);
+	sb_u32(b, pl->f4_c_counter);
+	sb_u32(b, __atomic_load_n(&pl->f4_s_counter, __ATOMIC_RELAXED));
+
+	sb_u64(b, st->start_time);
+	sb_u64(b, st->activ_time);
+	sb_u32(b, st->ping);
+	sb_u32(b, st->pkt_rec);
+	sb_u32(b, st->pkt_sent);
+	sb_u32(b, st->size_rec);
+	sb_u32(b, st->size_sent);
+	sb_u32(b, st->pkt_lost);
+	sb_u32(b, st->bytes_send);
+	sb_u32(b, st->bytes_received);
+	sb_str(b, (st->ip == NULL) ? "" : st->ip);
+
+	/* the reliable packets waiting for an ack */
+	pthread_mutex_lock(&pl->packets->mutex);
+	for (q_e = pl->packets->first ; q_e != NULL ; q_e = q_e->next)
+		nb++;
+	sb_u32(b, nb);
+	for (q_e = pl->packets->first ; q_e != NULL ; q_e = q_e->next) {
+		sb_u32(b, q_e->size);
+		sb_bytes(b, q_e->elem, q_e->size);
+	}
+	pthread_mutex_unlock(&pl->packets->mutex);
+}
+
+/**
+ * Write the section of a server.
+ *
+ * @param b the buffer to write to
+ * @param s the server (locked)
+ */
+static void handoff_write_server(struct serial_buf *b, struct server *s)
+{
+	struct channel *ch;
+	struct registration *r;
+	struct ban *ban;
+	struct player *pl, *tgt;
+	struct player_channel_privilege *priv, *next_priv;
+	size_t iter, iter2;
+	uint32_t nb_privs = 0;
+	int i, pass;
+
+	sb_u32(b, s->id);
+	sb_u32(b, s->port);
+	sb_u32(b, s->codecs);
+	sb_str(b, s->server_name);
+	sb_str(b, s->password);
+	sb_str(b, s->machine);
+	sb_str(b, s->welcome_msg);
+	for (i = 0 ; i < 4 ; i++)
+		sb_u16(b, s->version[i]);
+	sb_u32(b, sizeof(s->privileges->priv));
+	sb_bytes(b, s->privileges->priv, sizeof(s->privileges->priv));
+	sb_u64(b, s->stats->pkt_sent);
+	sb_u64(b, s->stats->pkt_rec);
+	sb_u64(b, s->stats->size_sent);
+	sb_u64(b, s->stats->size_rec);
+	sb_u64(b, s->stats->start_time);
+	sb_u64(b, s->stats->total_logins);
+
+	/* the channels keep their ids : top channels, then subchannels */
+	sb_u32(b, s->chan_id_bound);
+	sb_u32(b, s->chans->used_slots);
+	for (pass = 0 ; pass < 2 ; pass++) {
+		ar_each(struct channel *, ch, iter, s->chans)
+			if ((ch->parent != NULL) != pass)
+				continue;
+			sb_u32(b, ch->id);
+			sb_u32(b, ch->db_id);
+			sb_u32(b, (ch->parent == NULL) ? 0 : ch->parent->id);
+			sb_u16(b, ch->flags);
+			sb_u8(b, ch->codec);
+			sb_u16(b, ch->sort_order);
+			sb_u16(b, ch->max_users);
+			sb_str(b, ch->name);
+			sb_str(b, ch->topic);
+			sb_str(b, ch->desc);
+			sb_str(b, ch->password);
+			nb_privs += ch->pl_privileges.count;
+		ar_end_each;
+	}
+
+	sb_u32(b, s->regs->used_slots);
+	ar_each(struct registration *, r, iter, s->regs)
+		sb_u32(b, r->db_id);
+		sb_u8(b, r->global_flags);
+		sb_str(b, r->name);
+		sb_str(b, r->password);
+	ar_end_each;
+
+	sb_u32(b, s->bans->used_slots);
+	ar_each(struct ban *, ban, iter, s->bans)
+		sb_u16(b, ban->id);
+		sb_u16(b, ban->duration);
+		sb_str(b, ban->ip);
+		sb_str(b, ban->reason);
+	ar_end_each;
+
+	/* the players, then who they muted (all the players exist) */
+	sb_u32(b, s->players->used_slots);
+	ar_each(struct player *, pl, iter, s->players)
+		handoff_write_player(b, pl);
+	ar_end_each;
+	ar_each(struct player *, pl, iter, s->players)
+		sb_u32(b, pl->public_id);
+		sb_u32(b, pl->muted->used_slots);
+		ar_each(struct player *, tgt, iter2, pl->muted)
+			sb_u32(b, tgt->public_id);
+		ar_end_each;
+	ar_end_each;
+
+	/* channel privileges of the registrations and of the players */
+	sb_u32(b, nb_privs);
+	ar_each(struct channel *, ch, iter, s->chans)
+		il_each(priv, next_priv, &ch->pl_privileges, ch_link)
+			sb_u32(b, ch->id);
+			sb_u32(b, priv->db_id);
+			sb_u8(b, priv->reg);
+			if (priv->reg == PL_CH_PRIV_REGISTERED)
+				sb_u32(b, priv->pl_or_reg.reg->db_id);
+			else
+				sb_u32(b, priv->pl_or_reg.pl->public_id);
+			sb_u16(b, priv->flags);
+		il_end_each;
+	ar_end_each;
+}
+
+static struct registration *handoff_find_registration(struct server *s, uint32_t db_id)
+{
+	struct registration *r;
+	size_t iter;
+
+	ar_each(struct registration *, r, iter, s->regs)
+		if ((uint32_t)r->db_id == db_id)
+			return r;
+	ar_end_each;
+	return NULL;
+}
+
+/**
+ * Destroy a server built from a section, with its players. Their
+ * privileges go with the arena of the server.
+ *
+ * @param s the server
+ */
+static void handoff_destroy_server(struct server *s)
+{
+	struct player *pl;
+	size_t iter;
+
+	ar_each(struct player *, pl, iter, s->players)
+		ar_clear(pl->muted);
+		ar_clear(pl->muted_by);
+		pl_hash_remove(&s->players_by_id, pl);
+		destroy_player(pl);
+	ar_end_each;
+	ar_clear(s->players);
+	destroy_server(s);
+}
+
+static struct player *handoff_read_player(struct serial_reader *r, struct server *s)
+{
+	struct player *pl;
+	struct player_stat *st;
+	struct channel *ch;
+	uint32_t chan_id, reg_id, nb, size, i;
+	void *elem;
+
+	pl = new_player("", "", "");
+	if (pl == NULL)
+		return NULL;
+	st = &pl->stats;
+	pl->cli_len = sizeof(struct sockaddr_in);
+	pl->public_id = sr_u32(r);
+	pl->private_id = sr_u32(r);
+	sr_str(r, pl->client, sizeof(pl->client));
+	sr_str(r, pl->machine, sizeof(pl->machine));
+	sr_str(r, pl->name, sizeof(pl->name));
+	sr_str(r, pl->login, sizeof(pl->login));
+	sr_str(r, pl->voice_request, sizeof(pl->voice_request));
+	for (i = 0 ; i < 4 ; i++)
+		pl->version[i] = sr_u16(r);
+	pl->global_flags = sr_u16(r);
+	pl->player_attributes = sr_u16(r);
+	chan_id = sr_u32(r);
+	reg_id = sr_u32(r);
+	pl->cli_addr.sin_family = AF_INET;
+	if (sr_check(r, 6)) {
+		memcpy(&pl->cli_addr.sin_addr.s_addr, r->ptr, 4);
+		memcpy(&pl->cli_addr.sin_port, r->ptr + 4, 2);
+		r->ptr += 6;
+	}
+	pl->f0_c_counter = sr_u32(r);
+	pl->f0_s_counter = sr_u32(r);
+	pl->f1_c_counter = sr_u32(r);
+	pl->f1_s_counter = sr_u32(r);
+	pl->f4_c_counter = sr_u32(r);
+	pl->f4_s_counter = sr_u32(r);
+
+	st->start_time = sr_u64(r);
+	st->activ_time = sr_u64(r);
+	st->ping = sr_u32(r);
+	st->pkt_rec = sr_u32(r);
+	st->pkt_sent = sr_u32(r);
+	st->size_rec = sr_u32(r);
+	st->size_sent = sr_u32(r);
+	st->pkt_lost = sr_u32(r);
+	st->bytes_send = sr_u32(r);
+	st->bytes_received = sr_u32(r);
+	st->ip = sr_strdup(r);
+	memcpy(st->version, pl->version, sizeof(st->version));
+
+	nb = sr_u32(r);
+	for (i = 0 ; i < nb && !r->err ; i++) {
+		size = sr_u32(r);
+		if (!sr_check(r, size))
+			break;
+		elem = malloc(size);
+		if (elem == NULL) {
+			logger(LOG_ERR, "handoff_read_player, malloc failed : %s.", strerror(errno));
+			r->err = 1;
+			break;
+		}
+		memcpy(elem, r->ptr, size);
+		r->ptr += size;
+		add_to_queue(pl->packets, elem, size);
+	}
+
+	ch = get_channel_by_id(s, chan_id);
+	if (reg_id != 0)
+		pl->reg = handoff_find_registration(s, reg_id);
+	if (r->err || ch == NULL || (reg_id != 0 && pl->reg == NULL)
+			|| get_player_by_public_id(s, pl->public_id) != NULL) {
+		destroy_player(pl);
+		return NULL;
+	}
+	if (!pl_hash_insert(&s->players_by_id, pl)) {
+		destroy_player(pl);
+		return NULL;
+	}
+	ar_insert(s->players, pl);
+	/* the channel is not full : the player was already in it */
+	pl_list_insert(&ch->players, pl);
+	pl->in_chan = ch;
+	return pl;
+}
+
+/**
+ * Build a server from its section.
+ *
+ * @param r the section
+ * @param c the configuration of the server
+ *
+ * @return the server, or NULL if the section is invalid
+ */
+static struct server *handoff_read_server(struct serial_reader *r, struct config *c)
+{
+	struct server *s;
+	struct channel *ch, *parent;
+	struct registration *rg;
+	struct ban *ban;
+	struct player *pl, *tgt;
+	struct player_channel_privilege *priv;
+	uint32_t nb, nb_muted, i, j, id, db_id, parent_id, ref;
+	uint16_t flags, order, maxusers;
+	uint8_t codec, reg;
+	char *name, *topic, *desc, *ip, *reason;
+
+	s = new_server();
+	if (s == NULL)
+		return NULL;
+	s->conf = c;
+	s->id = sr_u32(r);
+	s->port = sr_u32(r);
+	s->codecs = sr_u32(r);
+	sr_str(r, s->server_name, sizeof(s->server_name));
+	sr_str(r, s->password, sizeof(s->password));
+	sr_str(r, s->machine, sizeof(s->machine));
+	sr_str(r, s->welcome_msg, sizeof(s->welcome_msg));
+	for (i = 0 ; i < 4 ; i++)
+		s->version[i] = sr_u16(r);
+	if (sr_u32(r) != sizeof(s->privileges->priv) || !sr_check(r, sizeof(s->privileges->priv)))
+		goto fail;
+	memcpy(s->privileges->priv, r->ptr, sizeof(s->privileges->priv));
+	r->ptr += sizeof(s->privileges->priv);
+	s->stats->pkt_sent = sr_u64(r);
+	s->stats->pkt_rec = sr_u64(r);
+	s->stats->size_sent = sr_u64(r);
+	s->stats->size_rec = sr_u64(r);
+	s->stats->start_time = sr_u64(r);
+	s->stats->total_logins = sr_u64(r);
+
+	/* channels, the parents come first */
+	s->chan_id_bound = sr_u32(r);
+	nb = sr_u32(r);
+	for (i = 0 ; i < nb && !r->err ; i++) {
+		id = sr_u32(r);
+		db_id = sr_u32(r);
+		parent_id = sr_u32(r);
+		flags = sr_u16(r);
+		codec = sr_u8(r);
+		order = sr_u16(r);
+		maxusers = sr_u16(r);
+		name = sr_strdup(r);
+		topic = sr_strdup(r);
+		desc = sr_strdup(r);
+		parent = (parent_id == 0) ? NULL : get_channel_by_id(s, parent_id);
+		if (r->err || id == 0 || id > s->chan_id_bound || get_channel_by_id(s, id) != NULL
+				|| (parent_id != 0 && parent == NULL)) {
+			free(name); free(topic); free(desc);
+			goto fail;
+		}
+		ch = new_channel(s->arena, name, topic, desc, flags, codec, order, maxusers);
+		free(name); free(topic); free(desc);
+		if (ch == NULL)
+			goto fail;
+		ch->id = id;
+		ch->db_id = db_id;
+		sr_str(r, ch->password, sizeof(ch->password));
+		if (parent != NULL && !channel_add_subchannel(parent, ch)) {
+			destroy_channel(ch);
+			goto fail;
+		}
+		ar_insert(s->chans, ch);
+		ch->in_server = s;
+	}
+	if (s->chans->used_slots == 0)
+		goto fail;
+
+	nb = sr_u32(r);
+	for (i = 0 ; i < nb && !r->err ; i++) {
+		rg = new_registration(s->arena);
+		if (rg == NULL)
+			goto fail;
+		rg->db_id = sr_u32(r);
+		rg->global_flags = sr_u8(r);
+		sr_str(r, rg->name, sizeof(rg->name));
+		sr_str(r, rg->password, sizeof(rg->password));
+		add_registration(s, rg);
+	}
+
+	nb = sr_u32(r);
+	for (i = 0 ; i < nb && !r->err ; i++) {
+		ban = (struct ban *)arena_alloc(s->arena, sizeof(struct ban));
+		if (ban == NULL)
+			goto fail;
+		ban->arena = s->arena;
+		ban->id = sr_u16(r);
+		ban->duration = sr_u16(r);
+		ip = sr_strdup(r);
+		reason = sr_strdup(r);
+		if (ip != NULL && reason != NULL) {
+			ban->ip = arena_strdup(s->arena, ip);
+			ban->reason = arena_strdup(s->arena, reason);
+		}
+		free(ip); free(reason);
+		ar_insert(s->bans, ban);
+		if (ban->ip == NULL || ban->reason == NULL)
+			goto fail;
+	}
+
+	nb = sr_u32(r);
+	for (i = 0 ; i < nb && !r->err ; i++) {
+		if (handoff_read_player(r, s) == NULL)
+			goto fail;
+	}
+	/* the mutes of each player, who is given by his public id :
+	 * the array does not keep the order of the old process */
+	for (i = 0 ; i < nb && !r->err ; i++) {
+		pl = get_player_by_public_id(s, sr_u32(r));
+		nb_muted = sr_u32(r);
+		if (pl == NULL)
+			goto fail;
+		for (j = 0 ; j < nb_muted && !r->err ; j++) {
+			tgt = get_player_by_public_id(s, sr_u32(r));
+			if (tgt == NULL || ar_has(pl->muted, tgt))
+				goto fail;
+			ar_insert(pl->muted, tgt);
+			ar_insert(tgt->muted_by, pl);
+		}
+	}
+
+	nb = sr_u32(r);
+	for (i = 0 ; i < nb && !r->err ; i++) {
+		ch = get_channel_by_id(s, sr_u32(r));
+		db_id = sr_u32(r);
+		reg = sr_u8(r);
+		ref = sr_u32(r);
+		flags = sr_u16(r);
+		if (r->err || ch == NULL)
+			goto fail;
+		priv = new_player_channel_privilege(s->arena);
+		if (priv == NULL)
+			goto fail;
+		priv->db_id = db_id;
+		priv->flags = flags;
+		priv->ch = ch;
+		if (reg == PL_CH_PRIV_REGISTERED) {
+			priv->reg = PL_CH_PRIV_REGISTERED;
+			priv->pl_or_reg.reg = handoff_find_registration(s, ref);
+			if (priv->pl_or_reg.reg == NULL) {
+				destroy_player_channel_privilege(priv);
+				goto fail;
+			}
+		} else {
+			pl = get_player_by_public_id(s, ref);
+			if (pl == NULL) {
+				destroy_player_channel_privilege(priv);
+				goto fail;
+			}
+			pl_chan_priv_set_player(priv, pl);
+		}
+		add_player_channel_privilege(ch, priv);
+	}
+	if (r->err || r->ptr != r->end)
+		goto fail;
+	return s;
+
+fail:
+	logger(LOG_ERR, "handoff_read_server : invalid section.");
+	handoff_destroy_server(s);
+	return NULL;
+}
+
+/**
+ * Send the state and the sockets of all the servers.
+ *
+ * @param sd the connection to the new process
+ * @param ss the servers (locked)
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int handoff_send(int sd, struct array *ss)
+{
+	struct serial_buf b;
+	struct server *s;
+	int fds[HANDOFF_MAX_FDS];
+	size_t iter;
+	int i, ret = 1;
+
+	bzero(&b, sizeof(b));
+	sb_bytes(&b, HANDOFF_MAGIC, 8);
+	sb_u32(&b, HANDOFF_VERSION);
+	sb_u32(&b, ss->used_slots);
+	if (b.err || !handoff_write(sd, b.data, b.len)) {
+		free(b.data);
+		return 0;
+	}
+	ar_each(struct server *, s, iter, ss)
+		if (!ret)
+			break;
+		b.len = 0;
+		handoff_write_server(&b, s);
+		for (i = 0 ; i < s->nb_workers && i < HANDOFF_MAX_FDS ; i++)
+			fds[i] = s->workers[i].socket_desc;
+		ret = !b.err && handoff_send_fds(sd, b.len, fds, i)
+			&& handoff_write(sd, b.data, b.len);
+		if (ret)
+			logger(LOG_INFO, "Server %i handed off (%i players, %i sockets).",
+					s->id, (int)s->players->used_slots, i);
+	ar_end_each;
+	free(b.data);
+	return ret;
+}
+
+/**
+ * Hand the servers off to the new process connected to sd.
+ * Exits the process if it succeeded.
+ *
+ * @param sd the connection
+ */
+static void handoff_serve(int sd)
+{
+	struct config *c = hoff.c;
+	struct timeval tv;
+	struct server *s;
+	char hello[12], *ptr = hello + 8, ack;
+	uint32_t version;
+	size_t iter;
+
+	tv.tv_sec = HANDOFF_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (!handoff_read(sd, hello, sizeof(hello)) || memcmp(hello, HANDOFF_MAGIC, 8) != 0) {
+		logger(LOG_WARN, "handoff_serve : invalid request.");
+		return;
+	}
+	version = ru32(&ptr);
+	if (version != HANDOFF_VERSION) {
+		logger(LOG_WARN, "handoff_serve : the new process uses version %i, this one %i.",
+				version, HANDOFF_VERSION);
+		return;
+	}
+	logger(LOG_INFO, "Handing the servers off to a new process.");
+
+	/* freeze the servers and flush what they wrote, the new
+	 * process exports the metrics on the same address */
+	snapshot_stop();
+	metrics_stop();
+	ar_each(struct server *, s, iter, hoff.ss)
+		pthread_rwlock_wrlock(&s->lock);
+	ar_end_each;
+	db_writer_stop(c);
+
+	if (handoff_send(sd, hoff.ss) && handoff_read(sd, &ack, 1) && ack == 'K') {
+		logger(LOG_INFO, "The servers were handed off. Exiting.");
+		dbi_conn_close(c->conn);
+		dbi_shutdown();
+		exit(0);
+	}
+
+	logger(LOG_WARN, "The handoff failed, resuming the servers.");
+	if (!db_writer_start(c))
+		logger(LOG_ERR, "handoff_serve : could not restart the database writer.");
+	ar_each(struct server *, s, iter, hoff.ss)
+		pthread_rwlock_unlock(&s->lock);
+	ar_end_each;
+	snapshot_start(c, hoff.ss, 0);
+	metrics_start(c, hoff.ss);
+}
+
+static void *handoff_run(void *args)
+{
+	int sd;
+
+	while (1) {
+		sd = accept(hoff.sd, NULL, NULL);
+		if (sd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;	/* handoff_stop */
+		}
+		handoff_serve(sd);
+		close(sd);
+	}
+	return NULL;
+}
+
+/**
+ * Listen for a new process to hand the servers off to, if
+ * network.handoff_socket is set.
+ *
+ * @param c the configuration
+ * @param ss the running servers
+ */
+void handoff_listen(struct config *c, struct array *ss)
+{
+	struct sockaddr_un addr;
+
+	if (c->net.handoff == NULL)
+		return;
+	bzero(&addr, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(c->net.handoff) >= sizeof(addr.sun_path)) {
+		logger(LOG_WARN, "handoff_listen : the path %s is too long.", c->net.handoff);
+		return;
+	}
+	strcpy(addr.sun_path, c->net.handoff);
+
+	hoff.sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (hoff.sd == -1) {
+		logger(LOG_WARN, "handoff_listen, socket failed : %s.", strerror(errno));
+		return;
+	}
+	unlink(addr.sun_path);
+	if (bind(hoff.sd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+			|| chmod(addr.sun_path, S_IRUSR | S_IWUSR) == -1
+			|| listen(hoff.sd, 1) == -1) {
+		logger(LOG_WARN, "handoff_listen : could not listen on %s : %s.", addr.sun_path, strerror(errno));
+		close(hoff.sd);
+		return;
+	}
+	hoff.c = c;
+	hoff.ss = ss;
+	if (pthread_create(&hoff.thread, NULL, &handoff_run, NULL) != 0) {
+		logger(LOG_WARN, "handoff_listen : could not start the thread.");
+		close(hoff.sd);
+		unlink(addr.sun_path);
+		return;
+	}
+	hoff.running = 1;
+	logger(LOG_INFO, "Waiting for a new process on %s.", addr.sun_path);
+}
+
+/**
+ * Stop listening for a new process, after the handoff
+ * in progress if there is one.
+ */
+void handoff_stop(void)
+{
+	if (!hoff.running)
+		return;
+	shutdown(hoff.sd, SHUT_RDWR);
+	pthread_join(hoff.thread, NULL);
+	close(hoff.sd);
+	unlink(hoff.c->net.handoff);
+	hoff.running = 0;
+}
+
+/**
+ * Take the servers over from the process listening on
+ * network.handoff_socket. The servers are not started.
+ *
+ * @param c the configuration
+ * @param ss the array to fill with the servers
+ *
+ * @return 1 on success, 0 on failure
+ */
+int handoff_receive(struct config *c, struct array *ss)
+{
+	struct sockaddr_un addr;
+	struct serial_reader r;
+	struct timeval tv, start, end, diff;
+	struct server *s;
+	char hdr[16], *ptr, *data;
+	int fds[HANDOFF_MAX_FDS], nb_fds, sd, i, nb_players = 0;
+	uint32_t nb, len, n;
+	size_t iter;
+
+	if (c->net.handoff == NULL || strlen(c->net.handoff) >= sizeof(addr.sun_path)) {
+		logger(LOG_ERR, "handoff_receive : network.handoff_socket is not set or too long.");
+		return 0;
+	}
+	gettimeofday(&start, NULL);
+	bzero(&addr, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, c->net.handoff);
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sd == -1 || connect(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		logger(LOG_ERR, "handoff_receive : could not connect to %s : %s.", addr.sun_path, strerror(errno));
+		if (sd != -1)
+			close(sd);
+		return 0;
+	}
+	tv.tv_sec = HANDOFF_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	memcpy(hdr, HANDOFF_MAGIC, 8);
+	ptr = hdr + 8;
+	wu32(HANDOFF_VERSION, &ptr);
+	if (!handoff_write(sd, hdr, 12) || !handoff_read(sd, hdr, 16)
+			|| memcmp(hdr, HANDOFF_MAGIC, 8) != 0)
+		goto fail;
+	ptr = hdr + 8;
+	if (ru32(&ptr) != HANDOFF_VERSION)
+		goto fail;
+	nb = ru32(&ptr);
+
+	for (n = 0 ; n < nb ; n++) {
+		if (!handoff_recv_fds(sd, &len, fds, &nb_fds))
+			goto fail;
+		data = (char *)malloc(len + 1);
+		if (data == NULL || !handoff_read(sd, data, len)) {
+			free(data);
+			while (nb_fds > 0)
+				close(fds[--nb_fds]);
+			goto fail;
+		}
+		r.ptr = data;
+		r.end = data + len;
+		r.err = 0;
+		s = handoff_read_server(&r, c);
+		free(data);
+		if (s != NULL)
+			s->workers = (struct recv_worker *)calloc(nb_fds, sizeof(struct recv_worker));
+		if (s == NULL || s->workers == NULL) {
+			if (s != NULL)
+				handoff_destroy_server(s);
+			while (nb_fds > 0)
+				close(fds[--nb_fds]);
+			goto fail;
+		}
+		/* the reactor serves a single socket per server */
+		if (c->net.mode == NET_MODE_REACTOR && nb_fds > 1) {
+			logger(LOG_WARN, "Server %i : receive_threads is ignored in reactor mode, %i sockets closed.",
+					s->id, nb_fds - 1);
+			while (nb_fds > 1)
+				close(fds[--nb_fds]);
+		}
+		s->nb_workers = nb_fds;
+		for (i = 0 ; i < nb_fds ; i++)
+			s->workers[i].socket_desc = fds[i];
+		nb_players += s->players->used_slots;
+		ar_insert(ss, s);
+	}
+	hoff_peer = sd;
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	logger(LOG_INFO, "%i servers and %i players taken over in %li ms.", (int)nb, nb_players,
+			diff.tv_sec * 1000 + diff.tv_usec / 1000);
+	return 1;
+
+fail:
+	logger(LOG_ERR, "handoff_receive : the servers could not be taken over.");
+	close(sd);
+	ar_each(struct server *, s, iter, ss)
+		ar_remove(ss, s);
+		for (i = 0 ; i < s->nb_workers ; i++)
+			close(s->workers[i].socket_desc);
+		free(s->workers);
+		handoff_destroy_server(s);
+	ar_end_each;
+	return 0;
+}
+
+/**
+ * Tell the old process the servers are started, and wait
+ * for it to exit.
+ */
+void handoff_done(void)
+{
+	char ack = 'K';
+	ssize_t n;
+
+	if (hoff_peer == -1)
+		return;
+	if (handoff_write(hoff_peer, &ack, 1)) {
+		/* the connection is closed when it exits */
+		while ((n = recv(hoff_peer, &ack, 1, 0)) > 0 || (n == -1 && errno == EINTR))
+			;
+		logger(LOG_INFO, "The old process has exited.");
+	}
+	close(hoff_peer);
+	hoff_peer = -1;
+}
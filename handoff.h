@@ -0,0 +1,37 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HANDOFF_H__
+#define __HANDOFF_H__
+
+#include "configuration.h"
+#include "array.h"
+
+#define HANDOFF_MAGIC "SOLHOFF"
+#define HANDOFF_VERSION 2
+/* seconds to wait for the other process */
+#define HANDOFF_TIMEOUT 30
+/* receiving sockets of a server */
+#define HANDOFF_MAX_FDS 64
+
+void handoff_listen(struct config *c, struct array *ss);
+void handoff_stop(void);
+int handoff_receive(struct config *c, struct array *ss);
+void handoff_done(void);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Servers without socket : the datagrams are injected in memory
+ * and those the server sends are given to a function, so a test
+ * or a benchmark runs the whole protocol stack without network,
+ * threads or timing noise.
+ *
+ * An injected server has no receiving thread, no packet sender
+ * and no audio thread. The caller sends the reliable packets
+ * (acknowledged commands) with inject_sweep, as often as the
+ * packet sender would (every 50 ms). With mclock_simulate, the
+ * caller also decides the time the server sees (see mclock.c).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "inject.h"
+#include "server.h"
+#include "packet_dispatch.h"
+#include "packet_sender.h"
+#include "queue.h"
+#include "log.h"
+
+/* as received by recvfrom */
+#define INJECT_MAX_MSG 1024
+
+/* the command table, filled by main() in the server */
+static pthread_once_t callbacks_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Start a server without socket.
+ *
+ * @param s the server (loaded, not started)
+ * @param out the function receiving the datagrams sent
+ * @param arg its argument
+ */
+void inject_start(struct server *s, inject_output out, void *arg)
+{
+	pthread_once(&callbacks_once, &init_callbacks);
+	s->output = out;
+	s->output_arg = arg;
+	s->workers = NULL;
+	s->nb_workers = 0;
+	s->socket_desc = -1;
+}
+
+/**
+ * Stop a server without socket. The players leave at once, there
+ * is no packet sender to wait for. The server can then be joined
+ * like the others.
+ *
+ * @param s the server
+ */
+void inject_stop(struct server *s)
+{
+	struct player *pl;
+	size_t iter;
+	void *packet;
+
+	pthread_rwlock_wrlock(&s->lock);
+	ar_each(struct player *, pl, iter, s->players)
+		remove_player(s, pl);
+	ar_end_each;
+	ar_each(struct player *, pl, iter, s->leaving_players)
+		while ((packet = get_from_queue(pl->packets)) != NULL)
+			free(packet);
+		ar_remove(s->leaving_players, pl);
+		destroy_player(pl);
+	ar_end_each;
+	pthread_rwlock_unlock(&s->lock);
+	server_stop(s);
+}
+
+/**
+ * Handle a datagram as if it was received on the server socket.
+ *
+ * @param s the server
+ * @param data the datagram
+ * @param len its size (truncated like recvfrom would)
+ * @param from the sender
+ */
+void inject_packet(struct server *s, const void *data, size_t len, struct sockaddr_in *from)
+{
+	char buf[INJECT_MAX_MSG];
+	struct sockaddr_in cli_addr;
+
+	if (len > INJECT_MAX_MSG)
+		len = INJECT_MAX_MSG;
+	memcpy(buf, data, len);
+	/* the handlers keep the address of the new players */
+	cli_addr = *from;
+	handle_packet(buf, len, &cli_addr, sizeof(cli_addr), s);
+}
+
+/**
+ * Send the reliable packets that are due and remove the players
+ * that have timed out, like the packet sender.
+ *
+ * @param s the server
+ */
+void inject_sweep(struct server *s)
+{
+	packet_sender_sweep(s);
+}
+
+/**
+ * An inject_output keeping the datagrams in a struct inject_capture
+ * (its argument).
+ */
+void inject_capture_output(struct server *s, const void *buf, size_t len,
+		struct sockaddr_in *to, void *arg)
+{
+	struct inject_capture *c = (struct inject_capture *)arg;
+	size_t needed = sizeof(size_t) + sizeof(struct sockaddr_in) + len;
+	size_t new_size;
+	char *tmp;
+
+	if (c->used + needed > c->size) {
+		new_size = (c->size == 0) ? 4096 : c->size;
+		while (c->used + needed > new_size)
+			new_size *= 2;
+		tmp = (char *)realloc(c->buf, new_size);
+		if (tmp == NULL) {
+			logger(LOG_WARN, "inject_capture_output, realloc failed : %s.", strerror(errno));
+			return;
+		}
+		c->buf = tmp;
+		c->size = new_size;
+	}
+	memcpy(c->buf + c->used, &len, sizeof(size_t));
+	memcpy(c->buf + c->used + sizeof(size_t), to, sizeof(struct sockaddr_in));
+	memcpy(c->buf + c->used + sizeof(size_t) + sizeof(struct sockaddr_in), buf, len);
+	c->used += needed;
+	c->nb_datagrams++;
+	c->total_datagrams++;
+	c->total_bytes += len;
+}
+
+/**
+ * Read the captured datagrams, oldest first.
+ *
+ * @param c the capture
+ * @param pos the position of the next one, 0 for the first
+ * @param data the datagram (in the capture)
+ * @param len its size
+ * @param to its destination
+ *
+ * @return 1 if a datagram was read, 0 at the end
+ */
+int inject_capture_next(struct inject_capture *c, size_t *pos, char **data,
+		size_t *len, struct sockaddr_in *to)
+{
+	if (*pos >= c->used)
+		return 0;
+	memcpy(len, c->buf + *pos, sizeof(size_t));
+	memcpy(to, c->buf + *pos + sizeof(size_t), sizeof(struct sockaddr_in));
+	*data = c->buf + *pos + sizeof(size_t) + sizeof(struct sockaddr_in);
+	*pos += sizeof(size_t) + sizeof(struct sockaddr_in) + *len;
+	return 1;
+}
+
+/**
+ * Forget the captured datagrams (the totals are kept).
+ *
+ * @param c the capture
+ */
+void inject_capture_clear(struct inject_capture *c)
+{
+	c->used = 0;
+	c->nb_datagrams = 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __INJECT_H__
+#define __INJECT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+struct server;
+
+/**
+ * Called for each datagram sent by a server without socket.
+ *
+ * @param s the server
+ * @param buf the datagram
+ * @param len the size of the datagram
+ * @param to the destination
+ * @param arg the argument given to inject_start
+ */
+typedef void (*inject_output)(struct server *s, const void *buf, size_t len,
+		struct sockaddr_in *to, void *arg);
+
+/* the datagrams sent, kept in memory */
+struct inject_capture
+{
+	char *buf;		/* records : size_t len, sockaddr_in, data */
+	size_t used;
+	size_t size;
+	size_t nb_datagrams;
+	uint64_t total_datagrams;	/* since the start, cleared or not */
+	uint64_t total_bytes;
+};
+
+void inject_start(struct server *s, inject_output out, void *arg);
+void inject_stop(struct server *s);
+void inject_packet(struct server *s, const void *data, size_t len, struct sockaddr_in *from);
+void inject_sweep(struct server *s);
+
+void inject_capture_output(struct server *s, const void *buf, size_t len,
+		struct sockaddr_in *to, void *arg);
+int inject_capture_next(struct inject_capture *c, size_t *pos, char **data,
+		size_t *len, struct sockaddr_in *to);
+void inject_capture_clear(struct inject_capture *c);
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __INTRUSIVE_H__
+#define __INTRUSIVE_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Typed intrusive containers, in the spirit of BSD's sys/queue.h and
+ * sys/tree.h : the links are fields of the elements, so putting an
+ * element in a container allocates nothing, and removing it or testing
+ * its membership is constant time.
+ *
+ * A container holds one type of element through one link field :
+ *   XX_HEAD(name, type)	declares struct name, the container
+ *   XX_ENTRY(type)		is the link field, in struct type
+ *   XX_PROTOTYPE(name, type)	declares the functions name_xxx()
+ *   XX_GENERATE(name, ...)	defines them, in a single .c file
+ * An element is in at most one container per link field. A zeroed
+ * container is empty. Nothing here locks : the containers of a server
+ * are protected by its lock, like its arrays. The hash sets can also
+ * be searched without it (see IH_GENERATE).
+ */
+
+/* Lists : doubly linked, in insertion order */
+#define IL_HEAD(name, type)						\
+struct name {								\
+	struct type *first;						\
+	struct type *last;						\
+	size_t count;							\
+}
+
+#define IL_ENTRY(type)							\
+struct {								\
+	struct type *next;						\
+	struct type *prev;						\
+	const void *head;	/* the list the element is in, or NULL */\
+}
+
+#define IL_PROTOTYPE(name, type)					\
+void name##_init(struct name *h);					\
+int name##_insert(struct name *h, struct type *el);			\
+int name##_remove(struct name *h, struct type *el);			\
+int name##_has(struct name *h, struct type *el)
+
+/* The body may remove el, but no other element of the list */
+#define il_each(el_ptr, next_ptr, h, field)\
+for(el_ptr = (h)->first ; el_ptr != NULL ; el_ptr = next_ptr) {\
+	next_ptr = el_ptr->field.next;
+
+#define il_end_each }
+
+#define IL_GENERATE(name, type, field)					\
+void name##_init(struct name *h)					\
+{									\
+	h->first = NULL;						\
+	h->last = NULL;							\
+	h->count = 0;							\
+}									\
+									\
+/* @return 1 if el is in h, 0 if it is already in another list */	\
+int name##_insert(struct name *h, struct type *el)			\
+{									\
+	if (el->field.head != NULL)					\
+		return el->field.head == h;				\
+	el->field.next = NULL;						\
+	el->field.prev = h->last;					\
+	if (h->last != NULL)						\
+		h->last->field.next = el;				\
+	else								\
+		h->first = el;						\
+	h->last = el;							\
+	el->field.head = h;						\
+	h->count++;							\
+	return 1;							\
+}									\
+									\
+/* @return 1 if el was removed, 0 if it was not in h */		\
+int name##_remove(struct name *h, struct type *el)			\
+{									\
+	if (el->field.head != h)					\
+		return 0;						\
+	if (el->field.prev != NULL)					\
+		el->field.prev->field.next = el->field.next;		\
+	else								\
+		h->first = el->field.next;				\
+	if (el->field.next != NULL)					\
+		el->field.next->field.prev = el->field.prev;		\
+	else								\
+		h->last = el->field.prev;				\
+	el->field.next = NULL;						\
+	el->field.prev = NULL;						\
+	el->field.head = NULL;						\
+	h->count--;							\
+	return 1;							\
+}									\
+									\
+int name##_has(struct name *h, struct type *el)			\
+{									\
+	return el->field.head == h;					\
+}
+
+/* Hash sets : the elements are found by a uint32_t key field, which
+ * must not change while they are in the set, and is unique in it.
+ * name_find may also run without the lock while a thread modifies the
+ * set, if the removed elements and the old tables (given to the
+ * release function of IH_GENERATE) are freed once no reader can see
+ * them (see qsbr.h). It may then miss an element, when the table
+ * grows : only a miss under the lock is certain. */
+#define IH_MIN_BUCKETS 16
+#define ih_hash(key) ((key) ^ ((key) >> 16))
+
+#define IH_HEAD(name, type)						\
+struct name {								\
+	struct type **buckets;						\
+	size_t mask;		/* number of buckets - 1 */		\
+	size_t count;							\
+}
+
+#define IH_ENTRY(type)							\
+struct {								\
+	struct type *next;						\
+	const void *head;	/* the set the element is in, or NULL */\
+}
+
+#define IH_PROTOTYPE(name, type)					\
+void name##_init(struct name *h);					\
+void name##_free(struct name *h);					\
+int name##_insert(struct name *h, struct type *el);			\
+int name##_remove(struct name *h, struct type *el);			\
+int name##_has(struct name *h, struct type *el);			\
+struct type *name##_find(struct name *h, uint32_t key)
+
+/* The body may remove el, but no other element of the set */
+#define ih_each(el_ptr, next_ptr, iter, h, field)\
+for(iter = 0 ; (h)->buckets != NULL && iter <= (h)->mask ; iter++) {\
+	for(el_ptr = (h)->buckets[iter] ; el_ptr != NULL ; el_ptr = next_ptr) {\
+		next_ptr = el_ptr->field.next;
+
+#define ih_end_each }}
+
+/* The table only grows : a reader loading the mask, then the table,
+ * never indexes past the end of the table it loaded */
+#define IH_GENERATE(name, type, field, key, release)			\
+void name##_init(struct name *h)					\
+{									\
+	h->buckets = NULL;						\
+	h->mask = 0;							\
+	h->count = 0;							\
+}									\
+									\
+/* The elements are left as they are */				\
+void name##_free(struct name *h)					\
+{									\
+	free(h->buckets);						\
+	name##_init(h);							\
+}									\
+									\
+static void name##_grow(struct name *h)					\
+{									\
+	struct type **buckets, **old, *el, *next;			\
+	size_t nb, i, b;						\
+									\
+	nb = (h->buckets == NULL) ? IH_MIN_BUCKETS : (h->mask + 1) * 2;	\
+	buckets = (struct type **)calloc(nb, sizeof(struct type *));	\
+	if (buckets == NULL)						\
+		return;		/* the chains get longer */		\
+	for (i = 0 ; h->buckets != NULL && i <= h->mask ; i++) {	\
+		for (el = h->buckets[i] ; el != NULL ; el = next) {	\
+			next = el->field.next;				\
+			b = ih_hash(el->key) & (nb - 1);		\
+			__atomic_store_n(&el->field.next, buckets[b], __ATOMIC_RELEASE);\
+			buckets[b] = el;				\
+		}							\
+	}								\
+	old = h->buckets;						\
+	__atomic_store_n(&h->buckets, buckets, __ATOMIC_RELEASE);	\
+	__atomic_store_n(&h->mask, nb - 1, __ATOMIC_RELEASE);		\
+	if (old != NULL)						\
+		release(old);						\
+}									\
+									\
+/* @return 1 if el is in h, 0 if it is in another set or if the	\
+ * table could not be allocated */					\
+int name##_insert(struct name *h, struct type *el)			\
+{									\
+	size_t b;							\
+									\
+	if (el->field.head != NULL)					\
+		return el->field.head == h;				\
+	if (h->buckets == NULL || h->count > h->mask)			\
+		name##_grow(h);						\
+	if (h->buckets == NULL)						\
+		return 0;						\
+	b = ih_hash(el->key) & h->mask;					\
+	el->field.next = h->buckets[b];					\
+	el->field.head = h;						\
+	__atomic_store_n(&h->buckets[b], el, __ATOMIC_RELEASE);		\
+	h->count++;							\
+	return 1;							\
+}									\
+									\
+/* @return 1 if el was removed, 0 if it was not in h. Its next	\
+ * link is kept for the readers still on it. */			\
+int name##_remove(struct name *h, struct type *el)			\
+{									\
+	struct type **prev;						\
+									\
+	if (el->field.head != h)					\
+		return 0;						\
+	prev = &h->buckets[ih_hash(el->key) & h->mask];			\
+	while (*prev != el)						\
+		prev = &(*prev)->field.next;				\
+	__atomic_store_n(prev, el->field.next, __ATOMIC_RELEASE);	\
+	el->field.head = NULL;						\
+	h->count--;							\
+	return 1;							\
+}									\
+									\
+int name##_has(struct name *h, struct type *el)			\
+{									\
+	return el->field.head == h;					\
+}									\
+									\
+struct type *name##_find(struct name *h, uint32_t k)			\
+{									\
+	struct type **buckets, *el;					\
+	size_t mask;							\
+									\
+	mask = __atomic_load_n(&h->mask, __ATOMIC_ACQUIRE);		\
+	buckets = __atomic_load_n(&h->buckets, __ATOMIC_ACQUIRE);	\
+	if (buckets == NULL)						\
+		return NULL;						\
+	el = __atomic_load_n(&buckets[ih_hash(k) & mask], __ATOMIC_ACQUIRE);\
+	for ( ; el != NULL ; el = __atomic_load_n(&el->field.next, __ATOMIC_ACQUIRE))\
+		if (el->key == k)					\
+			return el;					\
+	return NULL;							\
+}
+
+#endif
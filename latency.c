@@ -0,0 +1,247 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Latency of the packet handlers.
+ *
+ * Each thread records the durations in its own shard (one writer, no
+ * lock, no atomic read-modify-write), with one log-linear histogram per
+ * handler, allocated the first time the thread runs it. The shards of
+ * the threads that have ended are kept, and reused by the new threads.
+ * The readers (SIGUSR2, the metrics exporter) add up the shards.
+ */
+
+#include "latency.h"
+#include "thread_registry.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#define LATENCY_SUB_MASK ((1 << LATENCY_SUB_BITS) - 1)
+
+struct latency_shard
+{
+	struct thread_record rec;
+	struct latency_histogram *slots[LATENCY_SLOTS];
+};
+
+static struct thread_registry shards = THREAD_REGISTRY_INITIALIZER(struct latency_shard, 0, NULL);
+static __thread struct latency_shard *my_shard;
+
+static const double latency_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+#define LATENCY_NB_QUANTILES (sizeof(latency_quantiles) / sizeof(latency_quantiles[0]))
+
+static int latency_bucket(uint64_t ns)
+{
+	int e;
+
+	if (ns <= LATENCY_SUB_MASK)
+		return ns;
+	e = 63 - __builtin_clzll(ns);
+	if (e >= LATENCY_MAX_BITS)
+		return LATENCY_BUCKETS - 1;
+	return ((e - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+		+ ((ns >> (e - LATENCY_SUB_BITS)) & LATENCY_SUB_MASK);
+}
+
+/* the greatest duration of a bucket */
+static uint64_t latency_bucket_max(int i)
+{
+	int e;
+
+	if (i <= LATENCY_SUB_MASK)
+		return i;
+	e = (i >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+	return ((uint64_t)((1 << LATENCY_SUB_BITS) + (i & LATENCY_SUB_MASK)) << (e - LATENCY_SUB_BITS))
+		+ ((uint64_t)1 << (e - LATENCY_SUB_BITS)) - 1;
+}
+
+static struct latency_shard *latency_get_shard(void)
+{
+	my_shard = (struct latency_shard *)thread_registry_get(&shards);
+	return my_shard;
+}
+
+/* only one thread writes to a histogram */
+#define LATENCY_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+/**
+ * Add a duration to a histogram. Only one thread may add to a
+ * histogram, the others can read it at the same time.
+ *
+ * @param h the histogram
+ * @param ns the duration in nanoseconds
+ */
+void latency_histogram_add(struct latency_histogram *h, uint64_t ns)
+{
+	LATENCY_ADD(h->counts[latency_bucket(ns)], 1);
+	LATENCY_ADD(h->count, 1);
+	LATENCY_ADD(h->sum, ns);
+	if (ns > h->max)
+		__atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * Record the duration of a handler, in the shard
+ * of the calling thread.
+ *
+ * @param slot LATENCY_COMMAND(dir, code), LATENCY_AUDIO, ...
+ * @param ns the duration in nanoseconds
+ */
+void latency_record(int slot, uint64_t ns)
+{
+	struct latency_shard *sh = my_shard;
+	struct latency_histogram *h;
+
+	if (sh == NULL && (sh = latency_get_shard()) == NULL)
+		return;
+	h = sh->slots[slot];
+	if (h == NULL) {
+		h = (struct latency_histogram *)calloc(1, sizeof(struct latency_histogram));
+		if (h == NULL)
+			return;
+		__atomic_store_n(&sh->slots[slot], h, __ATOMIC_RELEASE);
+	}
+	latency_histogram_add(h, ns);
+}
+
+/**
+ * Add up the shards of a slot.
+ *
+ * @return 0 if no thread ran this handler
+ */
+static int latency_collect(int slot, struct latency_histogram *res)
+{
+	struct latency_shard *sh;
+	struct latency_histogram *h;
+	uint64_t max;
+	int i, found = 0;
+
+	bzero(res, sizeof(struct latency_histogram));
+	thread_registry_each(struct latency_shard *, sh, &shards) {
+		h = __atomic_load_n(&sh->slots[slot], __ATOMIC_ACQUIRE);
+		if (h == NULL)
+			continue;
+		for (i = 0 ; i < LATENCY_BUCKETS ; i++)
+			res->counts[i] += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+		res->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+		max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+		if (max > res->max)
+			res->max = max;
+		found = 1;
+	}
+	/* count from the buckets, the quantiles stay consistent */
+	for (i = 0 ; i < LATENCY_BUCKETS ; i++)
+		res->count += res->counts[i];
+	return found && res->count > 0;
+}
+
+/**
+ * Estimate a quantile of a histogram (the upper bound of its
+ * bucket, 12.5% above at most).
+ *
+ * @param h the histogram, count must be the sum of the buckets
+ * @param q the quantile, between 0 and 1
+ *
+ * @return the duration under which a fraction q of the values are
+ */
+uint64_t latency_histogram_quantile(struct latency_histogram *h, double q)
+{
+	uint64_t rank, seen = 0, v;
+	int i;
+
+	rank = (uint64_t)(q * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0 ; i < LATENCY_BUCKETS - 1 ; i++) {
+		seen += h->counts[i];
+		if (seen >= rank)
+			break;
+	}
+	v = latency_bucket_max(i);
+	return (v < h->max) ? v : h->max;
+}
+
+static void latency_slot_name(int slot, char *name, size_t len)
+{
+	switch (slot) {
+	case LATENCY_AUDIO: snprintf(name, len, "audio"); break;
+	case LATENCY_ACK: snprintf(name, len, "ack"); break;
+	case LATENCY_KEEPALIVE: snprintf(name, len, "keepalive"); break;
+	case LATENCY_CONNECT: snprintf(name, len, "connect"); break;
+	default: snprintf(name, len, "0x%02x%02x", slot / 256, slot % 256);
+	}
+}
+
+/**
+ * Log the quantiles of all the handlers that were called.
+ */
+void latency_dump(void)
+{
+	struct latency_histogram *h;
+	char name[16];
+	int slot;
+
+	h = (struct latency_histogram *)malloc(sizeof(struct latency_histogram));
+	if (h == NULL)
+		return;
+	logger(LOG_INFO, "Latency of the handlers (us) :");
+	for (slot = 0 ; slot < LATENCY_SLOTS ; slot++) {
+		if (!latency_collect(slot, h))
+			continue;
+		latency_slot_name(slot, name, sizeof(name));
+		logger(LOG_INFO, "%-9s %10" PRIu64 " calls, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f",
+				name, h->count, h->sum / 1e3 / h->count,
+				latency_histogram_quantile(h, 0.5) / 1e3, latency_histogram_quantile(h, 0.9) / 1e3,
+				latency_histogram_quantile(h, 0.99) / 1e3, latency_histogram_quantile(h, 0.999) / 1e3, h->max / 1e3);
+	}
+	free(h);
+}
+
+/**
+ * Write the quantiles of the handlers as a Prometheus summary.
+ *
+ * @param out the output
+ */
+void latency_write(FILE *out)
+{
+	struct latency_histogram *h;
+	char name[16];
+	unsigned int i;
+	int slot;
+
+	h = (struct latency_histogram *)malloc(sizeof(struct latency_histogram));
+	if (h == NULL)
+		return;
+	fprintf(out, "# HELP soliloque_handler_latency_seconds Time spent handling a packet, by command code or type.\n");
+	fprintf(out, "# TYPE soliloque_handler_latency_seconds summary\n");
+	for (slot = 0 ; slot < LATENCY_SLOTS ; slot++) {
+		if (!latency_collect(slot, h))
+			continue;
+		latency_slot_name(slot, name, sizeof(name));
+		for (i = 0 ; i < LATENCY_NB_QUANTILES ; i++)
+			fprintf(out, "soliloque_handler_latency_seconds{handler=\"%s\",quantile=\"%g\"} %.9f\n",
+					name, latency_quantiles[i], latency_histogram_quantile(h, latency_quantiles[i]) / 1e9);
+		fprintf(out, "soliloque_handler_latency_seconds_sum{handler=\"%s\"} %.9f\n", name, h->sum / 1e9);
+		fprintf(out, "soliloque_handler_latency_seconds_count{handler=\"%s\"} %" PRIu64 "\n", name, h->count);
+	}
+	free(h);
+}
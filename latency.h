@@ -0,0 +1,55 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* log-linear buckets : 8 per power of two (12.5% precision),
+ * from 1 ns to 2^36 ns (68 s), the rest in the last one */
+#define LATENCY_SUB_BITS 3
+#define LATENCY_MAX_BITS 36
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+/* the handlers timed : one slot per command (like f0_callbacks),
+ * then the other packets */
+#define LATENCY_COMMAND(dir, code) ((dir) * 256 + (code))
+#define LATENCY_AUDIO 512
+#define LATENCY_ACK 513
+#define LATENCY_KEEPALIVE 514
+#define LATENCY_CONNECT 515
+#define LATENCY_SLOTS 516
+
+/* durations in nanoseconds */
+struct latency_histogram
+{
+	uint64_t counts[LATENCY_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+void latency_histogram_add(struct latency_histogram *h, uint64_t ns);
+uint64_t latency_histogram_quantile(struct latency_histogram *h, double q);
+void latency_record(int slot, uint64_t ns);
+void latency_dump(void);
+void latency_write(FILE *out);
+
+#endif
@@ -16,64 +16,275 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Asynchronous logger.
+ *
+ * The level is checked before anything else, a disabled message
+ * costs a load and a comparison. An enabled message is formatted
+ * into a record of the ring of the calling thread (one producer, the
+ * writer thread is the only consumer, no lock), a message without
+ * any argument is not even copied. The writer thread adds the header
+ * and the date, formatted once per second, and writes the records by
+ * batches with a single fflush.
+ *
+ * When a ring is full, informations and debug messages are dropped
+ * (and counted), errors and warnings wait for the writer. The lines
+ * of different threads may be interleaved within a batch. The rings
+ * are flushed on exit.
+ */
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <signal.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <sched.h>
 
 #include "log.h"
 #include "configuration.h"
+#include "thread_registry.h"
 
 #define LOG_COLOR_CANCEL "\x1b[0;37;40m"
 
+/* records per thread (power of two) and size of a message */
+#define LOG_RING_SIZE 256
+#define LOG_RECORD_SIZE 240
+/* the writer sleeps that long when there is nothing to write (ms) */
+#define LOG_WRITER_SLEEP 10
+
+struct log_record
+{
+	int level;
+	time_t t;
+	const char *fmt;	/* the message if it has no argument */
+	char text[LOG_RECORD_SIZE];
+};
+
+/* the records of one thread */
+struct log_ring
+{
+	struct thread_record rec;
+	struct log_record records[LOG_RING_SIZE];
+	/* written by the producer, read by the writer */
+	unsigned int head;
+	/* written by the writer, read by the producer */
+	unsigned int tail;
+};
+
 static struct config *c = NULL;
 static char *log_header[5] = {"", "(ERR)", "(WRN)", "(INF)", "(DBG)"};
 static char *log_color[5] = {"", "\x1b[0;31;40m", "\x1b[0;33;40m",
 	"\x1b[0;32;40m", "\x1b[0;34;40m"};
 static char *log_color_dim[5] = {"", "\x1b[2;31;40m", "\x1b[2;33;40m",
 	"\x1b[2;32;40m", "\x1b[2;34;40m"};
+/* the configuration and the consumer side of the rings */
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void logger(int loglevel, char *str, ...)
+static int log_level = LOG_INFO;
+static time_t log_clock;		/* updated by the writer */
+static struct thread_registry rings = THREAD_REGISTRY_INITIALIZER(struct log_ring, 0, NULL);
+static unsigned int log_dropped;
+static int writer_running;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static __thread struct log_ring *my_ring;
+
+/* the date, formatted once per second */
+static time_t time_cached = -1;
+static char time_fmt[26];
+
+static void log_write_record(FILE *dst, struct log_record *r)
 {
-	va_list args;
-	FILE *dst;
-	int lvl;
-	time_t t;
-	char time_fmt[26];
-	char *str2 = (char *)calloc(sizeof(char), strlen(str) + 41 + 30);
+	if (r->t != time_cached) {
+		ctime_r(&r->t, time_fmt);
+		time_fmt[24] = '\0';	/* remove the trailing \n */
+		time_cached = r->t;
+	}
+	fprintf(dst, "%s%s %s%s"LOG_COLOR_CANCEL" %s\n", log_color[r->level], log_header[r->level],
+			log_color_dim[r->level], time_fmt, (r->fmt != NULL) ? r->fmt : r->text);
+}
 
-	pthread_mutex_lock(&mutex);
-	if (c != NULL) {
-		lvl = c->log.level;
-		dst = c->log.output;
-	} else {
-		lvl = LOG_INFO;
-		dst = stderr;
+/**
+ * Write the records of all the rings. Must be called with the mutex.
+ *
+ * @return the number of records written
+ */
+static int log_drain(void)
+{
+	struct log_ring *ring;
+	struct log_record dropped;
+	unsigned int head, tail, nb;
+	FILE *dst = (c != NULL) ? c->log.output : stderr;
+	int written = 0;
+
+	thread_registry_each(struct log_ring *, ring, &rings) {
+		tail = ring->tail;
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		for ( ; tail != head ; tail++) {
+			log_write_record(dst, &ring->records[tail & (LOG_RING_SIZE - 1)]);
+			written++;
+		}
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	nb = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+	if (nb > 0) {
+		dropped.level = LOG_WARN;
+		dropped.t = time(NULL);
+		dropped.fmt = NULL;
+		snprintf(dropped.text, sizeof(dropped.text), "logger : %u messages dropped.", nb);
+		log_write_record(dst, &dropped);
+		written++;
+	}
+	if (written > 0)
+		fflush(dst);
+	return written;
+}
+
+static void *log_writer_run(void *args)
+{
+	struct timespec pause;
+
+	pause.tv_sec = 0;
+	pause.tv_nsec = LOG_WRITER_SLEEP * 1000000;
+	while (1) {
+		__atomic_store_n(&log_clock, time(NULL), __ATOMIC_RELAXED);
+		pthread_mutex_lock(&mutex);
+		if (log_drain() == 0) {
+			pthread_mutex_unlock(&mutex);
+			nanosleep(&pause, NULL);
+		} else {
+			pthread_mutex_unlock(&mutex);
+		}
+	}
+	return NULL;
+}
+
+static void log_start_writer(void)
+{
+	pthread_t thread;
+	sigset_t all, old;
+
+	log_clock = time(NULL);
+	/* the writer never handles the signals */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&thread, NULL, &log_writer_run, NULL) == 0) {
+		pthread_detach(thread);
+		writer_running = 1;
+		atexit(&log_flush);
 	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* the ring of the calling thread, NULL if there is none */
+static struct log_ring *log_get_ring(void)
+{
+	if (my_ring == NULL)
+		my_ring = (struct log_ring *)thread_registry_get(&rings);
+	return my_ring;
+}
+
+/* write a message directly, without the writer */
+static void log_sync(int loglevel, char *str, va_list args)
+{
+	struct log_record r;
+
+	r.level = loglevel;
+	r.t = time(NULL);
+	r.fmt = NULL;
+	vsnprintf(r.text, sizeof(r.text), str, args);
+	pthread_mutex_lock(&mutex);
+	log_write_record((c != NULL) ? c->log.output : stderr, &r);
+	fflush((c != NULL) ? c->log.output : stderr);
+	pthread_mutex_unlock(&mutex);
+}
+
+void logger(int loglevel, char *str, ...)
+{
+	va_list args;
+	struct log_ring *ring;
+	struct log_record *r;
+	unsigned int head;
 
 	if (loglevel > 4)
 		loglevel = 4;
+	if (loglevel > __atomic_load_n(&log_level, __ATOMIC_RELAXED))
+		return;
 
+	pthread_once(&writer_once, &log_start_writer);
+	ring = writer_running ? log_get_ring() : NULL;
 	va_start(args, str);
-	if (loglevel <= lvl) {
-		time(&t);
-		ctime_r(&t, time_fmt);
-		time_fmt[24] = '\0';	/* remove the trailing \n */
-		sprintf(str2, "%s%s %s%s"LOG_COLOR_CANCEL" %s\n", log_color[loglevel], log_header[loglevel], log_color_dim[loglevel], time_fmt, str);
-		vfprintf(dst, str2, args);
-		fflush(dst);
+	if (ring == NULL) {
+		log_sync(loglevel, str, args);
+		va_end(args);
+		return;
+	}
+	head = ring->head;
+	while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+		if (loglevel > LOG_WARN) {
+			__atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+			va_end(args);
+			return;
+		}
+		sched_yield();
+	}
+	r = &ring->records[head & (LOG_RING_SIZE - 1)];
+	r->level = loglevel;
+	r->t = __atomic_load_n(&log_clock, __ATOMIC_RELAXED);
+	/* the formats are string literals */
+	if (strchr(str, '%') == NULL) {
+		r->fmt = str;
+	} else {
+		r->fmt = NULL;
+		vsnprintf(r->text, sizeof(r->text), str, args);
 	}
 	va_end(args);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
 
-	free(str2);
+/**
+ * Write all the pending messages now.
+ */
+void log_flush(void)
+{
+	pthread_mutex_lock(&mutex);
+	log_drain();
 	pthread_mutex_unlock(&mutex);
 }
 
 void set_config(struct config *cfg)
 {
 	pthread_mutex_lock(&mutex);
+	/* the pending messages go to the previous output */
+	log_drain();
 	c = cfg;
+	__atomic_store_n(&log_level, (c != NULL) ? c->log.level : LOG_INFO, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Change the level and the output of the logs
+ * of the current configuration.
+ *
+ * @param level the new level
+ * @param output the new output
+ *
+ * @return the previous output
+ */
+FILE *set_log(int level, FILE *output)
+{
+	FILE *old = NULL;
+
+	pthread_mutex_lock(&mutex);
+	if (c != NULL) {
+		log_drain();
+		old = c->log.output;
+		c->log.level = level;
+		c->log.output = output;
+		__atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+	}
 	pthread_mutex_unlock(&mutex);
+	return old;
 }
@@ -20,6 +20,7 @@
 #define __LOG_H__
 
 #include <stdarg.h>
+#include <stdio.h>
 
 #include "configuration.h"
 
@@ -28,7 +29,10 @@
 #define LOG_INFO 3
 #define LOG_DBG 4
 
-void logger(int loglevel, char *str, ...);
+/* the format must be a string literal, it may be written after the call */
+void logger(int loglevel, char *str, ...) __attribute__((format(printf, 2, 3)));
 void set_config(struct config *cfg);
+FILE *set_log(int level, FILE *output);
+void log_flush(void);
 
 #endif
@@ -27,14 +27,11 @@
 #include <openssl/sha.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
 
-#include "main_serv.h"
+#include "packet_dispatch.h"
 #include "server.h"
-#include "connection_packet.h"
-#include "control_packet.h"
-#include "acknowledge_packet.h"
-#include "audio_packet.h"
-#include "packet_tools.h"
 #include "server_stat.h"
 #include "configuration.h"
 #include "server_privileges.h"
@@ -42,6 +39,14 @@
 #include "config.h"
 #include "log.h"
 #include "queue.h"
+#include "reactor.h"
+#include "snapshot.h"
+#include "reload.h"
+#include "handoff.h"
+#include "trace.h"
+#include "metrics.h"
+#include "latency.h"
+#include "qsbr.h"
 
 #define MAX_MSG 1024
 
@@ -51,196 +56,123 @@ struct array *ss;
 /* forced to be put as a global variable because
  * it's used in main AND a signal interrupt */
 static int reload;
+static int running;
+static struct config *conf;
+static char *conf_file;
 
-/* functions */
-typedef void *(*packet_function)(char *data, unsigned int len, struct player *pl);
-packet_function f0_callbacks[2][255];
-
+/* the servers waiting to be loaded and started */
+struct server_loader
+{
+	struct config *c;
+	size_t next;		/* index of the next server in ss */
+	pthread_mutex_t lock;
+};
 
-static void init_callbacks(void)
+static struct server *next_server_to_load(struct server_loader *sl)
 {
-	bzero(f0_callbacks[0], 255 * sizeof(packet_function));
-	bzero(f0_callbacks[1], 255 * sizeof(packet_function));
-	
-	f0_callbacks[0][0x05] = &c_req_chans;		/* request chans and player list */
-	f0_callbacks[0][0xc9] = &c_req_create_channel;	/* create a channel */
-	f0_callbacks[0][0xcb] = &c_req_change_chan_pass;
-	f0_callbacks[0][0xcd] = &c_req_change_chan_flag_codec;
-	f0_callbacks[0][0xce] = &c_req_change_chan_name;
-	f0_callbacks[0][0xcf] = &c_req_change_chan_topic;
-	f0_callbacks[0][0xd0] = &c_req_change_chan_desc;
-	f0_callbacks[0][0xd1] = &c_req_delete_channel;
-	f0_callbacks[0][0xd2] = &c_req_change_chan_max_users;
-	f0_callbacks[0][0xd4] = &c_req_change_chan_order;
-
-	f0_callbacks[1][0x2c] = &c_req_leave;		/* client wants to leave */
-	f0_callbacks[1][0x2d] = &c_req_kick_server;	/* client wants to kick someone from the server */
-	f0_callbacks[1][0x2e] = &c_req_kick_channel;	/* client wants to kick someone from the channel */
-	f0_callbacks[1][0x2f] = &c_req_switch_channel;	/* client wants to switch channels */
-	f0_callbacks[1][0x30] = &c_req_change_player_attr; /* change player attributes */
-	f0_callbacks[1][0x31] = &c_req_request_voice;	/* player requests voice */
-	f0_callbacks[1][0x32] = &c_req_change_player_ch_priv;	/* change player channel privileges */
-	f0_callbacks[1][0x33] = &c_req_change_player_sv_right;	/* change global flags */
-	f0_callbacks[1][0x34] = &c_req_register_player;	/* create a new registration and associate the player to it */
-	f0_callbacks[1][0x36] = &c_req_create_registration;	/* create a new registration */
-	f0_callbacks[1][0x40] = &c_req_mute_player;	/* mute or unmute player */
-	f0_callbacks[1][0x44] = &c_req_ip_ban;		/* client wants to ban an IP */
-	f0_callbacks[1][0x45] = &c_req_ban;		/* client wants to ban someone */
-	f0_callbacks[1][0x46] = &c_req_remove_ban;		/* client wants to unban someone */
-	f0_callbacks[1][0x4a] = &c_req_move_player;	/* move a player from a chan to another */
-	f0_callbacks[1][0x90] = &c_req_player_stats;	/* client wants connection stats for a player */
-	f0_callbacks[1][0x95] = &c_req_server_stats;	/* client wants connection stats from the server */
-	f0_callbacks[1][0x9a] = &c_req_list_bans;		/* client wants the list of bans */
-	f0_callbacks[1][0xae] = &c_req_send_message;	/* client wants the list of bans */
-	/* callbacks[0] = myfunc1; ... */
+	struct server *s = NULL;
+
+	pthread_mutex_lock(&sl->lock);
+	while (s == NULL && sl->next < ss->used_slots)
+		s = (struct server *)ss->array[sl->next++];
+	pthread_mutex_unlock(&sl->lock);
+	return s;
 }
 
-static void handle_connection_type_packet(char *data, int len, struct sockaddr_in *cli_addr, unsigned int cli_len, struct server *s)
+/**
+ * Load the servers one by one and start each of them as soon
+ * as it is loaded.
+ *
+ * @param sl the servers to load
+ * @param conn the database connection to use
+ */
+static void load_and_start_servers(struct server_loader *sl, dbi_conn conn)
 {
-	char *ptr = data + 2;
-	uint16_t code = ru16(&ptr);
-
-	logger(LOG_INFO, "Packet : Connection.");
-	switch (code) {
-	/* Client requesting a connection */
-	case 3:
-		handle_player_connect(data, len, cli_addr, cli_len, s);
-		break;
-	case 1:
-		handle_player_keepalive(data, len, s);
-		break;
-	default:
-		logger(LOG_WARN, "Unknown connection packet : 0xf4be%x.", ((uint16_t *)data)[1]);
+	struct array *one;
+	struct server *s;
+	struct timeval start, end, diff;
+
+	one = ar_new(1);
+	while ((s = next_server_to_load(sl)) != NULL) {
+		gettimeofday(&start, NULL);
+		ar_insert(one, s);
+		if (!db_create_all(conn, one))
+			logger(LOG_WARN, "Server %i could not be loaded completely.", s->id);
+		ar_remove(one, s);
+		sp_print(s->privileges);
+		server_start(s);
+		gettimeofday(&end, NULL);
+		timersub(&end, &start, &diff);
+		logger(LOG_INFO, "Server %i loaded and started in %li ms (%i channels, %i registrations).",
+				s->id, diff.tv_sec * 1000 + diff.tv_usec / 1000,
+				(int)s->chans->used_slots, (int)s->regs->used_slots);
 	}
+	ar_free(one);
 }
 
-static packet_function get_f0_function(unsigned char * code)
+static void *server_loader_run(void *args)
 {
-	/* Function packets */
-	if (code[3] == 0 || code[3] == 1) { /* 0 = server packet, 1 = client packet*/
-		return f0_callbacks[code[3]][code[2]];
-	}
+	struct server_loader *sl = (struct server_loader *)args;
+	dbi_conn conn;
+
+	/* each thread has its own connection */
+	conn = db_connect_new(sl->c);
+	if (conn == NULL)
+		return NULL;	/* the main thread loads what is left */
+	load_and_start_servers(sl, conn);
+	dbi_conn_close(conn);
 	return NULL;
 }
 
-
-
-static void handle_control_type_packet(char *data, int len, struct sockaddr_in *cli_addr, unsigned int cli_len, struct server *s)
+/**
+ * Load and start all the servers with a pool of db.load_threads
+ * threads.
+ *
+ * @param c the configuration
+ */
+static void start_servers(struct config *c)
 {
-	packet_function func;
-	uint8_t code[4] = {0,0,0,0};
-	uint32_t public_id, private_id;
-	struct player *pl;
-	char *ptr;
-
-	/* Valid code (no overflow) */
-	memcpy(code, data, MIN(4, len));
-	logger(LOG_INFO, "Packet : Control (0x%x).", *(uint32_t *)code);
-
-	func = get_f0_function(code);
-	if (func != NULL) {
-		/* Check header size */
-		if (len < 24) {
-			logger(LOG_WARN, "Control packet too small to be valid.");
-			return;
-		}
-		/* Check CRC */
-		if (!packet_check_crc_d(data, len)) {
-			logger(LOG_WARN, "Control packet (0x%x) has invalid CRC", *(uint32_t *)data);
-			return;
-		}
-		/* Check if player exists */
-		ptr = data + 4;
-		private_id = ru32(&ptr);
-		public_id = ru32(&ptr);
-		pl = get_player_by_ids(s, public_id, private_id);
-		/* Execute */
-		if (pl != NULL) {
-			pl->stats->activ_time = time(NULL);	/* update idle time */
-			(*func)(data, len, pl);
+	struct server_loader sl;
+	struct timeval start, end, diff;
+	pthread_t *threads;
+	dbi_conn conn;
+	int i, nb;
+
+	gettimeofday(&start, NULL);
+	sl.c = c;
+	sl.next = 0;
+	pthread_mutex_init(&sl.lock, NULL);
+	nb = MIN(c->db_load_threads, (int)ss->used_slots);
+	threads = (pthread_t *)calloc(nb, sizeof(pthread_t));
+	if (threads == NULL)
+		nb = 0;
+	for (i = 0 ; i < nb ; i++) {
+		if (pthread_create(&threads[i], NULL, &server_loader_run, &sl) != 0) {
+			logger(LOG_WARN, "start_servers : could not create a loading thread : %s.", strerror(errno));
+			break;
 		}
-	} else {
-		logger(LOG_WARN, "Function with code : 0x%"PRIx32" is invalid or is not implemented yet.", *(uint32_t *)code);
 	}
-}
-
-static void handle_ack_type_packet(char *data, int len, struct sockaddr_in *cli_addr, struct server *s)
-{
-	struct player *pl;
-	uint16_t sent_version, ack_version;
-	uint32_t sent_counter, ack_counter;
-	uint32_t public_id, private_id;
-	char *sent, *ptr;
-
-	logger(LOG_INFO, "Packet : ACK.");
-	/* parse ACK packet */
-	ptr = data + 2;
-	ack_version = ru16(&ptr);
-	private_id = ru32(&ptr);
-	public_id = ru32(&ptr);
-	ack_counter = ru32(&ptr);
-
-	pl = get_player_by_ids(s, public_id, private_id);
-	if (pl == NULL)
-		pl = get_leaving_player_by_ids(s, public_id, private_id);
-	if (pl != NULL) {
-		pthread_mutex_lock(&pl->packets->mutex);
-
-		sent = peek_at_queue(pl->packets);
-		if (sent != NULL) {
-			ptr = sent + 12;
-			sent_counter = ru32(&ptr);
-			sent_version = ru16(&ptr);
-
-			if (sent_counter == ack_counter && ack_version <= sent_version)
-				free(get_from_queue(pl->packets));
+	nb = i;
+	for (i = 0 ; i < nb ; i++)
+		pthread_join(threads[i], NULL);
+	/* the servers the threads could not load, with a connection of
+	 * their own : the database writer already uses the main one */
+	if (sl.next < ss->used_slots) {
+		conn = db_connect_new(c);
+		if (conn == NULL) {
+			logger(LOG_ERR, "Unable to connect to the database to load the servers. Exiting.");
+			exit(0);
 		}
-		pthread_mutex_unlock(&pl->packets->mutex);
-	}
-}
-
-static void handle_data_type_packet(char *data, int len, struct sockaddr_in *cli_addr, struct server *s)
-{
-	int res;
-	logger(LOG_INFO, "Packet : Audio data.");
-	res = audio_received(data, len, s);
-	logger(LOG_INFO, "Return value : %i.", res);
-}
-
-/* Manage an incoming packet */
-void handle_packet(char *data, int len, struct sockaddr_in *cli_addr, unsigned int cli_len, struct server *s)
-{
-	uint32_t pub, priv;
-	struct player *pl;
-
-	/* add some stats */
-	sstat_add_packet(s->stats, len, 0);
-	/* add some stats for the player if he exists */
-	priv = GUINT32_FROM_LE(*(uint32_t *)(data + 4));
-	pub = GUINT32_FROM_LE(*(uint32_t *)(data + 8));
-	pl = get_player_by_ids(s, pub, priv);
-	if (pl != NULL) {
-		pl->stats->pkt_sent++;
-		pl->stats->size_sent += len;
+		load_and_start_servers(&sl, conn);
+		dbi_conn_close(conn);
 	}
+	free(threads);
+	pthread_mutex_destroy(&sl.lock);
 
-	/* first a few tests */
-	switch (GUINT16_FROM_LE(((uint16_t *)data)[0])) {
-	case 0xbef0:		/* commands */
-		handle_control_type_packet(data, len, cli_addr, cli_len, s);
-		break;
-	case 0xbef1:		/* acknowledge */
-		handle_ack_type_packet(data, len, cli_addr, s);
-		break;
-	case 0xbef2: 		/* audio data */
-		handle_data_type_packet(data, len, cli_addr, s);
-		break;
-	case 0xbef4:		/* connection and keepalives */
-		handle_connection_type_packet(data, len, cli_addr, cli_len, s);
-		break;
-	default:
-		logger(LOG_WARN, "Unvalid packet type field : 0x%x.", ((uint16_t *)data)[0]);
-	}
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	logger(LOG_INFO, "%i servers started in %li ms by %i threads.", (int)ss->used_slots,
+			diff.tv_sec * 1000 + diff.tv_usec / 1000, nb);
 }
 
 static void print_help(char *progname)
@@ -248,6 +180,7 @@ static void print_help(char *progname)
 	printf("%s\n", progname);
 	printf("Usage : \n");
 	printf(" -c <filename> filename of the config-file\n");
+	printf(" -u take the servers over from the running process (network.handoff_socket)\n");
 	printf(" -v show version\n");
 	printf(" -h show this help\n");
 }
@@ -266,20 +199,24 @@ void cleanup()
 {
 	size_t iter;
 	struct server *s;
-	struct config *cfg;
 
+	/* after the handoff in progress, if any (it exits if it succeeds) */
+	handoff_stop();
+	metrics_stop();
+	/* a last snapshot while the servers still have their channels */
+	snapshot_stop();
 	ar_each(struct server *, s, iter, ss)
-		cfg = s->conf;
-		ar_remove(ss, s);
 		server_stop(s);
 	ar_end_each;
+	reactor_pool_stop();
 
-	/* cleanup database */
-	dbi_conn_close(cfg->conn);
+	/* cleanup database (after the pending writes) */
+	db_writer_stop(conf);
+	dbi_conn_close(conf->conn);
 	dbi_shutdown();
 
-	/* destroy config */
-	destroy_config(cfg);
+	/* main joins the servers and destroys the config */
+	running = 0;
 }
 
 /**
@@ -289,7 +226,14 @@ void sigint()
 {
 	logger(LOG_INFO, "SIGINT received - clean exit");
 	cleanup();
-	signal(SIGINT, sigint);
+}
+
+/**
+ * signal function to log the latency of the handlers
+ */
+void sigusr2()
+{
+	latency_dump();
 }
 
 /**
@@ -298,9 +242,18 @@ void sigint()
 void sigusr1()
 {
 	logger(LOG_INFO, "SIGUSR1 received - reloading configuration");
-	reload = 1;
-	cleanup();
-	signal(SIGUSR1, sigusr1);
+	/* no handoff in the middle of a reload */
+	handoff_stop();
+	/* nor any export while the servers change */
+	metrics_stop();
+	/* restart everything only if the config can not be changed in place */
+	if (!reload_config(conf, conf_file, ss)) {
+		reload = 1;
+		cleanup();
+	} else {
+		handoff_listen(conf, ss);
+		metrics_start(conf, ss);
+	}
 }
 
 
@@ -309,19 +262,24 @@ int main(int argc, char **argv)
 	struct config *c;
 	size_t iter;
 	struct server *s;
-	int i = 0;
-	int val;
+	int val, loaded;
+	int takeover = 0;
 	int terminate = 0, wrongopt = 0, helpshown = 0;
 	char *configfile = NULL;
+	sigset_t signals, unblocked;
+	struct sigaction sa;
 
 	/* do some initialization of the finite state machine */
 	init_callbacks();
 	/* parse command line arguments */
-	while ((val = getopt(argc, argv, "vhc:")) != -1) {
+	while ((val = getopt(argc, argv, "vhc:u")) != -1) {
 		switch (val) {
 			case 'c':
 				configfile = optarg;
 				break;
+			case 'u':
+				takeover = 1;
+				break;
 			case 'h':
 				print_help(argv[0]);
 				terminate = 1;
@@ -346,13 +304,31 @@ int main(int argc, char **argv)
 	if (configfile == NULL)
 		configfile = "sol-server.cfg";
 
-	signal(SIGINT, sigint);
-	signal(SIGUSR1, sigusr1);
+	conf_file = configfile;
+
+	/* the signals are blocked in all the threads, which inherit
+	 * the mask of the main thread, and only handled by the main
+	 * thread, while it waits for them, one at a time (no exit in
+	 * the middle of a reload) */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGUSR2);
+	bzero(&sa, sizeof(sa));
+	sa.sa_mask = signals;
+	sa.sa_handler = sigint;
+	sigaction(SIGINT, &sa, NULL);
+	sa.sa_handler = sigusr1;
+	sigaction(SIGUSR1, &sa, NULL);
+	sa.sa_handler = sigusr2;
+	sigaction(SIGUSR2, &sa, NULL);
 	reload = 1; /* first launch, always load */
 	while(reload) {
 		/* default is only one launch then exit
 		 * (except if sigusr1 is received) */
 		reload = 0;
+		pthread_sigmask(SIG_BLOCK, &signals, &unblocked);
+		running = 1;
 		c = config_parse(configfile);
 
 		if (c == NULL) {
@@ -360,6 +336,11 @@ int main(int argc, char **argv)
 			exit(0);
 		}
 		set_config(c);
+		conf = c;
+		if (!trace_open(c)) {
+			logger(LOG_ERR, "Unable to open the trace file. Exiting.");
+			exit(0);
+		}
 
 		init_db(c);
 		if (!connect_db(c)) {
@@ -367,27 +348,57 @@ int main(int argc, char **argv)
 			exit(0);
 		}
 		ss = ar_new(2);
-		db_create_servers(c, ss);
-
-		ar_each(struct server *, s, iter, ss)
-			db_create_channels(c, s);
-			db_create_subchannels(c, s);
-			db_create_registrations(c, s);
-			db_create_sv_privileges(c, s);
-			sp_print(s->privileges);
-			db_create_pl_ch_privileges(c, s);
-			logger(LOG_INFO, "Launching server %i", i);
-			server_start(s);
-			i++;
-		ar_end_each;
+		/* the old process flushes its database writes before
+		 * handing the servers off, the writer starts after */
+		if (takeover && !handoff_receive(c, ss)) {
+			logger(LOG_ERR, "Unable to take the servers over. Exiting.");
+			exit(0);
+		}
+		if (!db_writer_start(c)) {
+			logger(LOG_ERR, "Unable to start the database writer. Exiting.");
+			exit(0);
+		}
+		if (c->net.mode == NET_MODE_REACTOR && !reactor_pool_start(c->net.reactor_threads)) {
+			logger(LOG_ERR, "Unable to start the reactor threads. Exiting.");
+			exit(0);
+		}
+		if (takeover) {
+			ar_each(struct server *, s, iter, ss)
+				server_resume(s);
+			ar_end_each;
+			handoff_done();
+			loaded = 0;
+			/* only the first launch takes the servers over */
+			takeover = 0;
+		} else if ((loaded = snapshot_load(c, ss))) {
+			ar_each(struct server *, s, iter, ss)
+				server_start(s);
+			ar_end_each;
+		} else {
+			db_create_servers(c, c->conn, ss);
+			start_servers(c);
+		}
+		snapshot_start(c, ss, loaded);
+		handoff_listen(c, ss);
+		metrics_start(c, ss);
 		logger(LOG_INFO, "Servers initialized.");
+		while (running)
+			sigsuspend(&unblocked);
+		pthread_sigmask(SIG_SETMASK, &unblocked, NULL);
 
+		/* in reactor mode, the servers have no threads of their own */
+		if (c->net.mode == NET_MODE_REACTOR)
+			reactor_pool_join();
 		ar_each(struct server *, s, iter, ss)
-			pthread_join(s->main_thread, NULL);
-			pthread_join(s->packet_sender, NULL);
+			ar_remove(ss, s);
+			server_join(s);
 			free(s);
 		ar_end_each;
 		ar_free(ss);
+		/* what the servers retired last */
+		qsbr_reclaim();
+		trace_close();
+		destroy_config(c);
 	}
 	logger(LOG_INFO, "All server threads ended. Exiting.");
 	/* exit */
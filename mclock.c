@@ -0,0 +1,138 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * The clock of the timeouts, resends, statistics and idle times, in
+ * microseconds.
+ *
+ * It is CLOCK_MONOTONIC, read once per loop iteration (a packet
+ * handled, a sweep of the packet sender) and cached : the time
+ * does not jump when the date is set. It never goes back, even when
+ * several threads update it.
+ *
+ * mclock_ns reads it without caching, in nanoseconds, to time the
+ * handlers and the queues. It is never simulated : the durations of
+ * the handlers measured by a replay must be the real ones.
+ *
+ * It can be simulated instead : it only moves when it is set or
+ * advanced, so the timeouts and the resends of a server without
+ * socket (inject.c) follow the time of the test or of the capture
+ * that is replayed.
+ */
+
+#include "mclock.h"
+
+static uint64_t mclock;		/* the cached time */
+static int simulated;
+
+/**
+ * Read the monotonic clock and cache it (nothing if simulated).
+ *
+ * @return the time
+ */
+uint64_t mclock_update(void)
+{
+	struct timespec ts;
+	uint64_t t, old;
+
+	if (__atomic_load_n(&simulated, __ATOMIC_RELAXED))
+		return __atomic_load_n(&mclock, __ATOMIC_RELAXED);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t = (uint64_t)ts.tv_sec * MCLOCK_SECOND + ts.tv_nsec / 1000;
+	old = __atomic_load_n(&mclock, __ATOMIC_RELAXED);
+	while (t > old && !__atomic_compare_exchange_n(&mclock, &old, t, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return (t > old) ? t : old;
+}
+
+/**
+ * The time of the current loop iteration.
+ *
+ * @return the time (microseconds)
+ */
+uint64_t mclock_now(void)
+{
+	uint64_t t = __atomic_load_n(&mclock, __ATOMIC_RELAXED);
+
+	if (t == 0)
+		return mclock_update();
+	return t;
+}
+
+/**
+ * Read the monotonic clock without caching it, to measure short
+ * durations (even if simulated).
+ *
+ * @return the time (nanoseconds)
+ */
+uint64_t mclock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * The time of the current loop iteration, in seconds
+ * (for the uptimes and the idle times).
+ *
+ * @return the time (seconds)
+ */
+time_t mclock_seconds(void)
+{
+	return mclock_now() / MCLOCK_SECOND;
+}
+
+/**
+ * Stop following the monotonic clock, the time only
+ * moves with mclock_set and mclock_advance.
+ *
+ * @param start the time from now on, 0 to keep the current one
+ */
+void mclock_simulate(uint64_t start)
+{
+	if (start == 0)
+		start = mclock_update();
+	__atomic_store_n(&simulated, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&mclock, start, __ATOMIC_RELAXED);
+}
+
+/**
+ * Set the simulated time (it never goes back).
+ *
+ * @param t the new time
+ */
+void mclock_set(uint64_t t)
+{
+	uint64_t old = __atomic_load_n(&mclock, __ATOMIC_RELAXED);
+
+	while (t > old && !__atomic_compare_exchange_n(&mclock, &old, t, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Advance the simulated time.
+ *
+ * @param d the duration (microseconds)
+ */
+void mclock_advance(uint64_t d)
+{
+	__atomic_fetch_add(&mclock, d, __ATOMIC_RELAXED);
+}
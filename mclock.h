@@ -0,0 +1,40 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MCLOCK_H__
+#define __MCLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define MCLOCK_SECOND 1000000ULL
+
+/* time elapsed since t, 0 if t was set by another thread after now was read */
+#define MCLOCK_SINCE(now, t) (((now) > (t)) ? (now) - (t) : 0)
+
+uint64_t mclock_update(void);
+uint64_t mclock_now(void);
+uint64_t mclock_ns(void);
+time_t mclock_seconds(void);
+
+void mclock_simulate(uint64_t start);
+void mclock_set(uint64_t t);
+void mclock_advance(uint64_t d);
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Metrics exporter.
+ *
+ * The servers count their traffic in struct server_metrics with
+ * relaxed atomic additions, the packet sender publishes the gauges
+ * (players, channels, queued packets, memory) on each pass. A thread listening
+ * on network.metrics (a local TCP port or a unix socket) answers each
+ * HTTP GET with all of them in the Prometheus text format, along with
+ * the counters of the database writer and the latency of the
+ * handlers (see latency.c). Reading the metrics never takes the
+ * lock of a server.
+ */
+
+#include "metrics.h"
+#include "configuration.h"
+#include "server.h"
+#include "database.h"
+#include "latency.h"
+#include "array.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* upper bounds of the buckets (microseconds) */
+static const uint64_t metrics_bounds[METRICS_BUCKETS - 1] = {100, 250, 500, 1000, 2500,
+	5000, 10000, 25000, 50000, 100000, 250000};
+
+/* the counters of a server exported as they are */
+static const struct
+{
+	const char *name;
+	const char *type;
+	const char *help;
+	size_t offset;
+} metrics_fields[] = {
+	{"soliloque_players", "gauge", "Players connected.",
+		offsetof(struct server_metrics, players)},
+	{"soliloque_leaving_players", "gauge", "Players gone, waiting for their last packets to be acknowledged.",
+		offsetof(struct server_metrics, leaving_players)},
+	{"soliloque_channels", "gauge", "Channels.",
+		offsetof(struct server_metrics, channels)},
+	{"soliloque_queued_packets", "gauge", "Reliable packets waiting for an acknowledgement.",
+		offsetof(struct server_metrics, queued)},
+	{"soliloque_arena_reserved_bytes", "gauge", "Memory reserved for the channels, registrations, bans and privileges.",
+		offsetof(struct server_metrics, arena_reserved)},
+	{"soliloque_arena_used_bytes", "gauge", "Memory used by the channels, registrations, bans and privileges.",
+		offsetof(struct server_metrics, arena_used)},
+	{"soliloque_packets_received_total", "counter", "Packets received.",
+		offsetof(struct server_metrics, packets_in)},
+	{"soliloque_bytes_received_total", "counter", "Bytes received.",
+		offsetof(struct server_metrics, bytes_in)},
+	{"soliloque_packets_sent_total", "counter", "Packets sent.",
+		offsetof(struct server_metrics, packets_out)},
+	{"soliloque_bytes_sent_total", "counter", "Bytes sent.",
+		offsetof(struct server_metrics, bytes_out)},
+	{"soliloque_reliable_sent_total", "counter", "Reliable packets sent for the first time.",
+		offsetof(struct server_metrics, reliable_sent)},
+	{"soliloque_retransmits_total", "counter", "Reliable packets sent again.",
+		offsetof(struct server_metrics, retransmits)},
+	{"soliloque_timeouts_total", "counter", "Players removed because they stopped answering.",
+		offsetof(struct server_metrics, timeouts)},
+	{"soliloque_audio_received_total", "counter", "Audio packets received.",
+		offsetof(struct server_metrics, audio_in)},
+	{"soliloque_audio_forwarded_total", "counter", "Audio packets sent to the other players.",
+		offsetof(struct server_metrics, audio_forwarded)},
+	{"soliloque_unknown_commands_total", "counter", "Commands without a handler.",
+		offsetof(struct server_metrics, unknown_commands)},
+};
+
+static struct
+{
+	struct config *c;
+	struct array *ss;
+	int sd;
+	int is_unix;
+	pthread_t thread;
+	int running;
+} mx;
+
+/**
+ * Add a duration to a histogram. Several threads can
+ * add to the same histogram.
+ *
+ * @param h the histogram
+ * @param usec the duration in microseconds
+ */
+void metrics_observe(struct metrics_histogram *h, uint64_t usec)
+{
+	int i;
+
+	for (i = 0 ; i < METRICS_BUCKETS - 1 && usec > metrics_bounds[i] ; i++);
+	__atomic_fetch_add(&h->buckets[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, usec, __ATOMIC_RELAXED);
+}
+
+static void metrics_write_family(FILE *out, const char *name, const char *type, const char *help)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* labels is empty or a list of labels without the braces */
+static void metrics_write_histogram(FILE *out, const char *name, const char *labels,
+		struct metrics_histogram *h)
+{
+	const char *sep = (labels[0] != '\0') ? "," : "";
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0 ; i < METRICS_BUCKETS - 1 ; i++) {
+		total += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+		fprintf(out, "%s_bucket{%s%sle=\"%g\"} %" PRIu64 "\n", name, labels, sep,
+				metrics_bounds[i] / 1e6, total);
+	}
+	total += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+	fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep, total);
+	if (labels[0] != '\0') {
+		fprintf(out, "%s_sum{%s} %.6f\n", name, labels, __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e6);
+		fprintf(out, "%s_count{%s} %" PRIu64 "\n", name, labels, total);
+	} else {
+		fprintf(out, "%s_sum %.6f\n", name, __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e6);
+		fprintf(out, "%s_count %" PRIu64 "\n", name, total);
+	}
+}
+
+static void metrics_write_db(FILE *out, struct config *c)
+{
+	struct db_writer_stats st;
+
+	db_writer_get_stats(c, &st);
+	metrics_write_family(out, "soliloque_db_writes_total", "counter", "Database writes executed.");
+	fprintf(out, "soliloque_db_writes_total{result=\"ok\"} %" PRIu64 "\n", st.written - st.failed);
+	fprintf(out, "soliloque_db_writes_total{result=\"failed\"} %" PRIu64 "\n", st.failed);
+	metrics_write_family(out, "soliloque_db_transactions_total", "counter", "Database transactions.");
+	fprintf(out, "soliloque_db_transactions_total %" PRIu64 "\n", st.batches);
+	metrics_write_family(out, "soliloque_db_queue_depth", "gauge", "Database writes waiting.");
+	fprintf(out, "soliloque_db_queue_depth %i\n", st.depth);
+	metrics_write_family(out, "soliloque_db_queue_max_depth", "gauge", "Most database writes ever waiting.");
+	fprintf(out, "soliloque_db_queue_max_depth %i\n", st.max_depth);
+	metrics_write_family(out, "soliloque_db_queue_latency_seconds", "histogram",
+			"Time between the submission of a database write and its execution.");
+	metrics_write_histogram(out, "soliloque_db_queue_latency_seconds", "", &st.latency);
+}
+
+static void metrics_write(FILE *out, struct config *c, struct array *ss)
+{
+	struct ar_snapshot servers;
+	struct server *s;
+	size_t iter;
+	char labels[32];
+	unsigned int i, j;
+
+	/* a reload may add or remove servers meanwhile */
+	ar_snapshot(ss, &servers);
+	metrics_write_family(out, "soliloque_servers", "gauge", "Virtual servers running.");
+	fprintf(out, "soliloque_servers %zu\n", servers.nb);
+	for (i = 0 ; i < sizeof(metrics_fields) / sizeof(metrics_fields[0]) ; i++) {
+		metrics_write_family(out, metrics_fields[i].name, metrics_fields[i].type, metrics_fields[i].help);
+		ar_snapshot_each(struct server *, s, iter, &servers)
+			fprintf(out, "%s{server=\"%" PRIu32 "\"} %" PRIu64 "\n", metrics_fields[i].name, s->id,
+					__atomic_load_n((uint64_t *)((char *)&s->metrics + metrics_fields[i].offset),
+						__ATOMIC_RELAXED));
+		ar_snapshot_end_each;
+	}
+	/* only the commands that were used */
+	metrics_write_family(out, "soliloque_commands_total", "counter", "Commands handled, by code.");
+	ar_snapshot_each(struct server *, s, iter, &servers)
+		for (i = 0 ; i < 2 ; i++) {
+			for (j = 0 ; j < 256 ; j++) {
+				if (__atomic_load_n(&s->metrics.commands[i][j], __ATOMIC_RELAXED) != 0)
+					fprintf(out, "soliloque_commands_total{server=\"%" PRIu32 "\",code=\"0x%02x%02x\"} %" PRIu64 "\n",
+							s->id, i, j, __atomic_load_n(&s->metrics.commands[i][j], __ATOMIC_RELAXED));
+			}
+		}
+	ar_snapshot_end_each;
+	metrics_write_family(out, "soliloque_command_duration_seconds", "histogram", "Time spent handling a command.");
+	ar_snapshot_each(struct server *, s, iter, &servers)
+		snprintf(labels, sizeof(labels), "server=\"%" PRIu32 "\"", s->id);
+		metrics_write_histogram(out, "soliloque_command_duration_seconds", labels, &s->metrics.command_time);
+	ar_snapshot_end_each;
+	ar_snapshot_free(&servers);
+	latency_write(out);
+	metrics_write_db(out, c);
+}
+
+static int metrics_send(int sd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(sd, data, len, MSG_NOSIGNAL);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		data += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/* answer one HTTP request */
+static void metrics_serve(int sd)
+{
+	char req[1024], hdr[128];
+	char *body = NULL;
+	size_t len = 0, body_len = 0;
+	struct timeval tv;
+	FILE *out;
+	ssize_t n;
+
+	/* do not let a silent client block the exporter */
+	tv.tv_sec = 2;
+	tv.tv_usec = 0;
+	setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (len < sizeof(req) - 1) {
+		n = recv(sd, req + len, sizeof(req) - 1 - len, 0);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+			break;
+	}
+	req[len] = '\0';
+
+	if (strncmp(req, "GET /metrics ", 13) != 0 && strncmp(req, "GET / ", 6) != 0) {
+		n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n"
+				"Connection: close\r\n\r\n");
+		metrics_send(sd, hdr, n);
+		return;
+	}
+	out = open_memstream(&body, &body_len);
+	if (out == NULL) {
+		logger(LOG_WARN, "metrics_serve, open_memstream failed : %s.", strerror(errno));
+		return;
+	}
+	metrics_write(out, mx.c, mx.ss);
+	fclose(out);
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+	if (metrics_send(sd, hdr, n))
+		metrics_send(sd, body, body_len);
+	free(body);
+}
+
+static void *metrics_run(void *args)
+{
+	int sd;
+
+	while (1) {
+		sd = accept(mx.sd, NULL, NULL);
+		if (sd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;	/* metrics_stop */
+		}
+		metrics_serve(sd);
+		close(sd);
+	}
+	return NULL;
+}
+
+/* a unix socket if the address has a /, else [host:]port */
+static int metrics_bind(const char *address)
+{
+	struct sockaddr_un un;
+	struct sockaddr_in in;
+	char host[64];
+	const char *port;
+	int sd, yes = 1;
+
+	if (strchr(address, '/') != NULL) {
+		bzero(&un, sizeof(un));
+		un.sun_family = AF_UNIX;
+		if (strlen(address) >= sizeof(un.sun_path)) {
+			logger(LOG_WARN, "metrics_bind : the path %s is too long.", address);
+			return -1;
+		}
+		strcpy(un.sun_path, address);
+		sd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sd == -1) {
+			logger(LOG_WARN, "metrics_bind, socket failed : %s.", strerror(errno));
+			return -1;
+		}
+		unlink(un.sun_path);
+		if (bind(sd, (struct sockaddr *)&un, sizeof(un)) == -1
+				|| chmod(un.sun_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) == -1) {
+			logger(LOG_WARN, "metrics_bind : could not bind %s : %s.", address, strerror(errno));
+			close(sd);
+			return -1;
+		}
+		mx.is_unix = 1;
+		return sd;
+	}
+
+	/* only the local host by default */
+	bzero(&in, sizeof(in));
+	in.sin_family = AF_INET;
+	in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	port = strrchr(address, ':');
+	if (port != NULL) {
+		if ((size_t)(port - address) >= sizeof(host)) {
+			logger(LOG_WARN, "metrics_bind : invalid address %s.", address);
+			return -1;
+		}
+		strncpy(host, address, port - address);
+		host[port - address] = '\0';
+		if (inet_pton(AF_INET, host, &in.sin_addr) != 1) {
+			logger(LOG_WARN, "metrics_bind : invalid address %s.", host);
+			return -1;
+		}
+		port++;
+	} else {
+		port = address;
+	}
+	in.sin_port = htons(atoi(port));
+	sd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sd == -1) {
+		logger(LOG_WARN, "metrics_bind, socket failed : %s.", strerror(errno));
+		return -1;
+	}
+	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	if (bind(sd, (struct sockaddr *)&in, sizeof(in)) == -1) {
+		logger(LOG_WARN, "metrics_bind : could not bind %s : %s.", address, strerror(errno));
+		close(sd);
+		return -1;
+	}
+	mx.is_unix = 0;
+	return sd;
+}
+
+/**
+ * Start the exporter if network.metrics is set.
+ *
+ * @param c the configuration
+ * @param ss the running servers
+ */
+void metrics_start(struct config *c, struct array *ss)
+{
+	if (c->net.metrics == NULL || mx.running)
+		return;
+	mx.sd = metrics_bind(c->net.metrics);
+	if (mx.sd == -1)
+		return;
+	if (listen(mx.sd, 8) == -1) {
+		logger(LOG_WARN, "metrics_start, listen failed : %s.", strerror(errno));
+		close(mx.sd);
+		return;
+	}
+	mx.c = c;
+	mx.ss = ss;
+	if (pthread_create(&mx.thread, NULL, &metrics_run, NULL) != 0) {
+		logger(LOG_WARN, "metrics_start : could not start the thread.");
+		close(mx.sd);
+		if (mx.is_unix)
+			unlink(c->net.metrics);
+		return;
+	}
+	mx.running = 1;
+	logger(LOG_INFO, "Metrics exported on %s.", c->net.metrics);
+}
+
+/**
+ * Stop the exporter, after the request in progress.
+ * The servers can then be changed or destroyed.
+ */
+void metrics_stop(void)
+{
+	if (!mx.running)
+		return;
+	shutdown(mx.sd, SHUT_RDWR);
+	pthread_join(mx.thread, NULL);
+	close(mx.sd);
+	if (mx.is_unix)
+		unlink(mx.c->net.metrics);
+	mx.running = 0;
+}
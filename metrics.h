@@ -0,0 +1,72 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+
+/* the last bucket of a histogram has no upper bound */
+#define METRICS_BUCKETS 12
+
+/* durations in microseconds, the count of each bucket alone
+ * (the exposition adds them up) */
+struct metrics_histogram
+{
+	uint64_t buckets[METRICS_BUCKETS];
+	uint64_t sum;
+};
+
+/* Counters of a virtual server. The hot path only does relaxed
+ * atomic additions, the exporter reads them without any lock. */
+struct server_metrics
+{
+	uint64_t packets_in;
+	uint64_t bytes_in;
+	uint64_t packets_out;
+	uint64_t bytes_out;
+	uint64_t reliable_sent;		/* first sends of the queued packets */
+	uint64_t retransmits;		/* queued packets sent again */
+	uint64_t timeouts;		/* players that stopped answering */
+	uint64_t audio_in;		/* audio packets received */
+	uint64_t audio_forwarded;	/* audio packets sent to the receivers */
+	uint64_t unknown_commands;
+	uint64_t commands[2][256];	/* handled commands, like f0_callbacks */
+	struct metrics_histogram command_time;
+
+	/* gauges, updated by each pass of the packet sender */
+	uint64_t players;
+	uint64_t leaving_players;
+	uint64_t channels;
+	uint64_t queued;		/* packets waiting for an ack */
+	uint64_t arena_reserved;	/* bytes of the arena of the server */
+	uint64_t arena_used;		/* in use in it */
+};
+
+#define METRIC_ADD(s, field, n) __atomic_fetch_add(&(s)->metrics.field, (n), __ATOMIC_RELAXED)
+#define METRIC_INC(s, field) METRIC_ADD(s, field, 1)
+#define METRIC_SET(s, field, v) __atomic_store_n(&(s)->metrics.field, (v), __ATOMIC_RELAXED)
+
+struct config;
+struct array;
+
+void metrics_observe(struct metrics_histogram *h, uint64_t usec);
+void metrics_start(struct config *c, struct array *ss);
+void metrics_stop(void);
+
+#endif
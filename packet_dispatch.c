@@ -0,0 +1,303 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dispatch of the received packets to their handlers, by type
+ * (connection, command, ack, audio) and by command code.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "packet_dispatch.h"
+#include "server.h"
+#include "connection_packet.h"
+#include "control_packet.h"
+#include "acknowledge_packet.h"
+#include "audio_packet.h"
+#include "packet_tools.h"
+#include "server_stat.h"
+#include "log.h"
+#include "queue.h"
+#include "trace.h"
+#include "metrics.h"
+#include "latency.h"
+#include "mclock.h"
+#include "qsbr.h"
+
+/* functions */
+typedef void *(*packet_function)(char *data, unsigned int len, struct player *pl);
+static packet_function f0_callbacks[2][255];
+
+
+/**
+ * Fill the table of the command handlers.
+ * Must be called once before any packet is handled.
+ */
+void init_callbacks(void)
+{
+	bzero(f0_callbacks[0], 255 * sizeof(packet_function));
+	bzero(f0_callbacks[1], 255 * sizeof(packet_function));
+	
+	f0_callbacks[0][0x05] = &c_req_chans;		/* request chans and player list */
+	f0_callbacks[0][0xc9] = &c_req_create_channel;	/* create a channel */
+	f0_callbacks[0][0xcb] = &c_req_change_chan_pass;
+	f0_callbacks[0][0xcd] = &c_req_change_chan_flag_codec;
+	f0_callbacks[0][0xce] = &c_req_change_chan_name;
+	f0_callbacks[0][0xcf] = &c_req_change_chan_topic;
+	f0_callbacks[0][0xd0] = &c_req_change_chan_desc;
+	f0_callbacks[0][0xd1] = &c_req_delete_channel;
+	f0_callbacks[0][0xd2] = &c_req_change_chan_max_users;
+	f0_callbacks[0][0xd4] = &c_req_change_chan_order;
+
+	f0_callbacks[1][0x2c] = &c_req_leave;		/* client wants to leave */
+	f0_callbacks[1][0x2d] = &c_req_kick_server;	/* client wants to kick someone from the server */
+	f0_callbacks[1][0x2e] = &c_req_kick_channel;	/* client wants to kick someone from the channel */
+	f0_callbacks[1][0x2f] = &c_req_switch_channel;	/* client wants to switch channels */
+	f0_callbacks[1][0x30] = &c_req_change_player_attr; /* change player attributes */
+	f0_callbacks[1][0x31] = &c_req_request_voice;	/* player requests voice */
+	f0_callbacks[1][0x32] = &c_req_change_player_ch_priv;	/* change player channel privileges */
+	f0_callbacks[1][0x33] = &c_req_change_player_sv_right;	/* change global flags */
+	f0_callbacks[1][0x34] = &c_req_register_player;	/* create a new registration and associate the player to it */
+	f0_callbacks[1][0x36] = &c_req_create_registration;	/* create a new registration */
+	f0_callbacks[1][0x40] = &c_req_mute_player;	/* mute or unmute player */
+	f0_callbacks[1][0x44] = &c_req_ip_ban;		/* client wants to ban an IP */
+	f0_callbacks[1][0x45] = &c_req_ban;		/* client wants to ban someone */
+	f0_callbacks[1][0x46] = &c_req_remove_ban;		/* client wants to unban someone */
+	f0_callbacks[1][0x4a] = &c_req_move_player;	/* move a player from a chan to another */
+	f0_callbacks[1][0x90] = &c_req_player_stats;	/* client wants connection stats for a player */
+	f0_callbacks[1][0x95] = &c_req_server_stats;	/* client wants connection stats from the server */
+	f0_callbacks[1][0x9a] = &c_req_list_bans;		/* client wants the list of bans */
+	f0_callbacks[1][0xae] = &c_req_send_message;	/* client wants the list of bans */
+	/* callbacks[0] = myfunc1; ... */
+}
+
+static void handle_connection_type_packet(char *data, int len, struct sockaddr_in *cli_addr, unsigned int cli_len, struct server *s)
+{
+	char *ptr = data + 2;
+	uint16_t code = ru16(&ptr);
+	uint64_t start = mclock_ns();
+
+	logger(LOG_INFO, "Packet : Connection.");
+	switch (code) {
+	/* Client requesting a connection */
+	case 3:
+		handle_player_connect(data, len, cli_addr, cli_len, s);
+		latency_record(LATENCY_CONNECT, mclock_ns() - start);
+		break;
+	case 1:
+		handle_player_keepalive(data, len, s);
+		latency_record(LATENCY_KEEPALIVE, mclock_ns() - start);
+		break;
+	default:
+		logger(LOG_WARN, "Unknown connection packet : 0xf4be%x.", ((uint16_t *)data)[1]);
+	}
+}
+
+static packet_function get_f0_function(unsigned char * code)
+{
+	/* Function packets */
+	if (code[3] == 0 || code[3] == 1) { /* 0 = server packet, 1 = client packet*/
+		return f0_callbacks[code[3]][code[2]];
+	}
+	return NULL;
+}
+
+
+
+static void handle_control_type_packet(char *data, int len, struct sockaddr_in *cli_addr, unsigned int cli_len, struct server *s)
+{
+	packet_function func;
+	uint8_t code[4] = {0,0,0,0};
+	uint32_t public_id, private_id;
+	struct player *pl;
+	char *ptr;
+	uint64_t start;
+
+	/* Valid code (no overflow) */
+	memcpy(code, data, MIN(4, len));
+	logger(LOG_INFO, "Packet : Control (0x%x).", *(uint32_t *)code);
+
+	func = get_f0_function(code);
+	if (func != NULL) {
+		/* Check header size */
+		if (len < 24) {
+			logger(LOG_WARN, "Control packet too small to be valid.");
+			TRACE(s, TRACE_CONTROL, data, len, TRACE_BAD_SIZE, 0);
+			return;
+		}
+		/* Check CRC */
+		if (!packet_check_crc_d(data, len)) {
+			logger(LOG_WARN, "Control packet (0x%x) has invalid CRC", *(uint32_t *)data);
+			TRACE(s, TRACE_CONTROL, data, len, TRACE_BAD_CRC, 0);
+			return;
+		}
+		/* Check if player exists */
+		ptr = data + 4;
+		private_id = ru32(&ptr);
+		public_id = ru32(&ptr);
+		pl = get_player_by_ids(s, public_id, private_id);
+		/* Execute */
+		if (pl != NULL) {
+			pl->stats.activ_time = mclock_seconds();	/* update idle time */
+			start = mclock_ns();
+			(*func)(data, len, pl);
+			start = mclock_ns() - start;
+			latency_record(LATENCY_COMMAND(code[3], code[2]), start);
+			metrics_observe(&s->metrics.command_time, start / 1000);
+			METRIC_INC(s, commands[code[3]][code[2]]);
+		}
+		TRACE(s, TRACE_CONTROL, data, len, (pl != NULL) ? TRACE_OK : TRACE_NO_PLAYER, 0);
+	} else {
+		logger(LOG_WARN, "Function with code : 0x%"PRIx32" is invalid or is not implemented yet.", *(uint32_t *)code);
+		METRIC_INC(s, unknown_commands);
+		TRACE(s, TRACE_CONTROL, data, len, TRACE_UNKNOWN, 0);
+	}
+}
+
+static void handle_ack_type_packet(char *data, int len, struct sockaddr_in *cli_addr, struct server *s)
+{
+	struct player *pl;
+	uint16_t sent_version, ack_version;
+	uint32_t sent_counter, ack_counter;
+	uint32_t public_id, private_id;
+	char *sent, *ptr;
+	uint64_t start = mclock_ns();
+
+	logger(LOG_INFO, "Packet : ACK.");
+	/* parse ACK packet */
+	ptr = data + 2;
+	ack_version = ru16(&ptr);
+	private_id = ru32(&ptr);
+	public_id = ru32(&ptr);
+	ack_counter = ru32(&ptr);
+
+	pl = get_player_lockless(s, public_id, private_id, 1);
+	if (pl != NULL) {
+		pthread_mutex_lock(&pl->packets->mutex);
+
+		sent = peek_at_queue(pl->packets);
+		if (sent != NULL) {
+			ptr = sent + 12;
+			sent_counter = ru32(&ptr);
+			sent_version = ru16(&ptr);
+
+			if (sent_counter == ack_counter && ack_version <= sent_version)
+				free(get_from_queue(pl->packets));
+		}
+		pthread_mutex_unlock(&pl->packets->mutex);
+	}
+	latency_record(LATENCY_ACK, mclock_ns() - start);
+}
+
+static void handle_data_type_packet(char *data, int len, struct sockaddr_in *cli_addr, struct server *s)
+{
+	int res;
+	uint64_t start = mclock_ns();
+
+	logger(LOG_INFO, "Packet : Audio data.");
+	res = audio_received(data, len, s);
+	latency_record(LATENCY_AUDIO, mclock_ns() - start);
+	logger(LOG_INFO, "Return value : %i.", res);
+}
+
+/* Manage an incoming packet */
+void handle_packet(char *data, int len, struct sockaddr_in *cli_addr, unsigned int cli_len, struct server *s)
+{
+	uint32_t pub, priv;
+	uint16_t type, code;
+	struct player *pl;
+	int lock;
+
+	/* Commands and connections modify the server state, they are
+	 * handled alone. Audio only reads it and can be handled by
+	 * several receiving threads at once. Acks and keepalives only
+	 * look their player up : they take no lock, the players are
+	 * freed once no thread handles a packet anymore (see qsbr.h). */
+	mclock_update();
+	type = GUINT16_FROM_LE(((uint16_t *)data)[0]);
+	code = GUINT16_FROM_LE(((uint16_t *)data)[1]);
+	METRIC_INC(s, packets_in);
+	METRIC_ADD(s, bytes_in, len);
+	if (type == 0xbef2)
+		METRIC_INC(s, audio_in);
+	/* audio goes straight to the audio thread */
+	if (type == 0xbef2 && s->audio != NULL) {
+		sstat_add_packet(s->stats, len, 0);
+		TRACE(s, TRACE_RECV, data, len, TRACE_QUEUED, 0);
+		audio_path_push(s, data, len);
+		return;
+	}
+	if (type == 0xbef0 || (type == 0xbef4 && code == 3))
+		lock = 2;
+	else if (type == 0xbef1 || (type == 0xbef4 && code == 1))
+		lock = 0;
+	else
+		lock = 1;
+	/* a thread never waits for a lock in a read section : the
+	 * grace periods would wait for whoever holds the lock */
+	if (lock == 2)
+		pthread_rwlock_wrlock(&s->lock);
+	else if (lock == 1)
+		pthread_rwlock_rdlock(&s->lock);
+	qsbr_enter();
+
+	/* add some stats */
+	sstat_add_packet(s->stats, len, 0);
+	/* add some stats for the player if he exists */
+	priv = GUINT32_FROM_LE(*(uint32_t *)(data + 4));
+	pub = GUINT32_FROM_LE(*(uint32_t *)(data + 8));
+	pl = get_player_by_ids(s, pub, priv);
+	if (pl != NULL) {
+		pl->stats.pkt_sent++;
+		pl->stats.size_sent += len;
+	}
+	if (type < 0xbef0 || type > 0xbef4 || type == 0xbef3)
+		TRACE(s, TRACE_RECV, data, len, TRACE_UNKNOWN, 0);
+	else
+		TRACE(s, TRACE_RECV, data, len, (pl != NULL) ? TRACE_OK : TRACE_NO_PLAYER, 0);
+
+	/* first a few tests */
+	switch (type) {
+	case 0xbef0:		/* commands */
+		handle_control_type_packet(data, len, cli_addr, cli_len, s);
+		break;
+	case 0xbef1:		/* acknowledge */
+		handle_ack_type_packet(data, len, cli_addr, s);
+		break;
+	case 0xbef2: 		/* audio data */
+		handle_data_type_packet(data, len, cli_addr, s);
+		break;
+	case 0xbef4:		/* connection and keepalives */
+		handle_connection_type_packet(data, len, cli_addr, cli_len, s);
+		break;
+	default:
+		logger(LOG_WARN, "Unvalid packet type field : 0x%x.", ((uint16_t *)data)[0]);
+	}
+	/* publish what the commands changed in the channels, the players or the mutes */
+	if (lock == 2)
+		audio_path_update(s);
+	qsbr_leave();
+	if (lock != 0)
+		pthread_rwlock_unlock(&s->lock);
+}
@@ -16,12 +16,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef __MAIN_SERV_H__
-#define __MAIN_SERV_H__
+#ifndef __PACKET_DISPATCH_H__
+#define __PACKET_DISPATCH_H__
 
 #include "server.h"
 #include <sys/socket.h>
 
+void init_callbacks(void);
 void handle_packet(char *data, int len, struct sockaddr_in *cli_addr, unsigned int cli_len, struct server *s);
 
 #endif
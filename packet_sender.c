@@ -24,12 +24,15 @@
 #include "server_stat.h"
 #include "packet_tools.h"
 #include "control_packet.h"
+#include "audio_packet.h"
+#include "trace.h"
+#include "mclock.h"
+#include "qsbr.h"
 
 #include <pthread.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/time.h>
 
 static void send_curr_packet(struct player *p, struct server *s)
 {
@@ -43,11 +46,15 @@ static void send_curr_packet(struct player *p, struct server *s)
 
 		/* add packet to server statistics */
 		sstat_add_packet(s->stats, p_size, 1);
+		if (*(uint16_t *)(packet + 16) == 0)
+			METRIC_INC(s, reliable_sent);
+		else
+			METRIC_INC(s, retransmits);
 		logger(LOG_INFO, "Really sending packet type 0x%x", *(uint32_t *)packet);
-		ret = sendto(s->socket_desc, packet, p_size, 0,
-				(struct sockaddr *)p->cli_addr, p->cli_len);
+		ret = server_sendto(s, packet, p_size, &p->cli_addr, p->cli_len);
 		if (ret == -1)
 			logger(LOG_WARN, "send_curr_packet failed : %s", strerror(errno));
+		TRACE(s, TRACE_SEND, packet, p_size, (ret == -1) ? TRACE_ERROR : TRACE_OK, *(uint16_t *)(packet + 16));
 		/* update packet version counter */
 		(*(uint16_t *)(packet + 16))++;
 		/* update checksum */
@@ -55,80 +62,113 @@ static void send_curr_packet(struct player *p, struct server *s)
 	}
 }
 
-void *packet_sender_thread(void *args)
+static void retire_player(void *pl)
+{
+	destroy_player((struct player *)pl);
+}
+
+/**
+ * One pass of the packet sender :
+ * - resend the first packet of each player's queue every 0.5s
+ * - time out players that do not answer
+ * - destroy leaving players once their queue is empty
+ * - free what the receiving threads cannot see anymore
+ *
+ * @param s the server
+ */
+void packet_sender_sweep(struct server *s)
 {
-	struct server *s;
 	struct player *p;
-	struct timeval now, diff, *last_sent, diff2;
+	uint64_t now, *last_sent;
 	size_t iter;
 	char *packet, *packet2;
+	uint64_t queued = 0;
+	size_t reserved, used;
 
-	s = (struct server *)args;
-	while(1) {
-		gettimeofday(&now, NULL);
-		/* Can we */
-		/* sending their packet to active players */
-		ar_each(struct player *, p, iter, s->players)
-			pthread_mutex_lock(&p->packets->mutex);
-			last_sent = queue_get_time(p->packets);
-			if (last_sent != NULL) {
-				timersub(&now, last_sent, &diff);
-				timersub(&now, &p->last_ping, &diff2);
-				packet = peek_at_queue(p->packets);
-				if (diff2.tv_sec > 10 || (packet != NULL && *(uint16_t *)(packet+16) > 50)) {
-					/* player seems to have timedout */
-					logger(LOG_INFO, "Player 0x%x seems to have timed out, removing him", p);
-					/* do whateverittakes to notify that the player has left */
-					pthread_mutex_unlock(&p->packets->mutex);
-					s_notify_player_left(p);
-					pthread_mutex_lock(&p->packets->mutex);
-					/* then remove him */
-					remove_player(s, p);
-				} else {
-					/* resend a packet every 0.5s */
-					if (diff.tv_sec > 0 || diff.tv_usec > 500000) {
-						queue_update_time(p->packets);
-						send_curr_packet(p, s);
-					}
+	pthread_rwlock_wrlock(&s->lock);
+	now = mclock_update();
+	/* Can we */
+	/* sending their packet to active players */
+	ar_each(struct player *, p, iter, s->players)
+		pthread_mutex_lock(&p->packets->mutex);
+		last_sent = queue_get_time(p->packets);
+		if (last_sent != NULL) {
+			packet = peek_at_queue(p->packets);
+			if (MCLOCK_SINCE(now, __atomic_load_n(&p->last_ping, __ATOMIC_RELAXED)) > 10 * MCLOCK_SECOND || (packet != NULL && *(uint16_t *)(packet+16) > 50)) {
+				/* player seems to have timedout */
+				logger(LOG_INFO, "Player %p seems to have timed out, removing him", p);
+				METRIC_INC(s, timeouts);
+				/* do whateverittakes to notify that the player has left */
+				pthread_mutex_unlock(&p->packets->mutex);
+				s_notify_player_left(p);
+				pthread_mutex_lock(&p->packets->mutex);
+				/* then remove him */
+				remove_player(s, p);
+			} else {
+				/* resend a packet every 0.5s */
+				if (*last_sent == 0 || MCLOCK_SINCE(now, *last_sent) > MCLOCK_SECOND / 2) {
+					queue_update_time(p->packets);
+					send_curr_packet(p, s);
 				}
 			}
-			pthread_mutex_unlock(&p->packets->mutex);
-		ar_end_each;
+		}
+		queued += p->packets->nb_elem;
+		pthread_mutex_unlock(&p->packets->mutex);
+	ar_end_each;
+
+	/* give the audio thread the players that left */
+	audio_path_sweep(s);
 
-		/* sending their last packets to leaving players */
-		ar_each(struct player *, p, iter, s->leaving_players)
-			pthread_mutex_lock(&p->packets->mutex);
-			last_sent = queue_get_time(p->packets);
-			if (last_sent != NULL) {
-				timersub(&now, last_sent, &diff);
-				timersub(&now, &p->last_ping, &diff2);
-				packet = peek_at_queue(p->packets);
-				if (diff2.tv_sec > 10 || (packet != NULL && *(uint16_t *)(packet+16) > 50)) {
-					/* player seems to have timedout and is
-					 * marked as leaving - we empty his queue
-					 * so he will be removed */
-					logger(LOG_INFO, "Emptying the player 0x%x 's packet queue.", p);
-					while ((packet2 = get_from_queue(p->packets))) {
-						free(packet2);
-					}
-					logger(LOG_INFO, "Queue empty.", p);
-				} else {
-					if (diff.tv_sec > 0 || diff.tv_usec > 500000) {
-						queue_update_time(p->packets);
-						send_curr_packet(p, s);
-					}
+	/* sending their last packets to leaving players */
+	ar_each(struct player *, p, iter, s->leaving_players)
+		pthread_mutex_lock(&p->packets->mutex);
+		last_sent = queue_get_time(p->packets);
+		if (last_sent != NULL) {
+			packet = peek_at_queue(p->packets);
+			if (MCLOCK_SINCE(now, __atomic_load_n(&p->last_ping, __ATOMIC_RELAXED)) > 10 * MCLOCK_SECOND || (packet != NULL && *(uint16_t *)(packet+16) > 50)) {
+				/* player seems to have timedout and is
+				 * marked as leaving - we empty his queue
+				 * so he will be removed */
+				logger(LOG_INFO, "Emptying the player %p 's packet queue.", p);
+				while ((packet2 = get_from_queue(p->packets))) {
+					free(packet2);
+				}
+				logger(LOG_INFO, "Queue empty.");
+			} else {
+				if (*last_sent == 0 || MCLOCK_SINCE(now, *last_sent) > MCLOCK_SECOND / 2) {
+					queue_update_time(p->packets);
+					send_curr_packet(p, s);
 				}
 			}
-			pthread_mutex_unlock(&p->packets->mutex);
-			/* if there is no more packets in the queue,
-			 * we can safely destroy this player */
-			if (p->packets->first == NULL) {
-				ar_remove(s->leaving_players, p);
-				destroy_player(p);
-			}
-		ar_end_each;
+		}
+		queued += p->packets->nb_elem;
+		pthread_mutex_unlock(&p->packets->mutex);
+		/* if there is no more packets in the queue (and the
+		 * audio thread forgot him), we can safely destroy this player
+		 * once the acks being handled without the lock are done */
+		if (p->packets->first == NULL && audio_path_released(s, p)) {
+			ar_remove(s->leaving_players, p);
+			qsbr_retire(&p->retired, p, &retire_player);
+		}
+	ar_end_each;
+	METRIC_SET(s, players, s->players->used_slots);
+	METRIC_SET(s, leaving_players, s->leaving_players->used_slots);
+	METRIC_SET(s, channels, s->chans->used_slots);
+	METRIC_SET(s, queued, queued);
+	arena_usage(s->arena, &reserved, &used);
+	METRIC_SET(s, arena_reserved, reserved);
+	METRIC_SET(s, arena_used, used);
+	pthread_rwlock_unlock(&s->lock);
+	qsbr_reclaim();
+}
+
+void *packet_sender_thread(void *args)
+{
+	struct server *s;
 
+	s = (struct server *)args;
+	while(1) {
+		packet_sender_sweep(s);
 		usleep(50000);
 	}
 }
-
@@ -19,6 +19,9 @@
 #ifndef __PACKET_SENDER_H__
 #define __PACKET_SENDER_H__
 
+struct server;
+
+void packet_sender_sweep(struct server *s);
 void *packet_sender_thread(void *args);
 
 #endif
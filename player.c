@@ -19,6 +19,7 @@
 #include "player.h"
 #include "player_stat.h"
 #include "log.h"
+#include "mclock.h"
 #include "queue.h"
 #include "player_channel_privilege.h"
 
@@ -38,14 +39,12 @@
 void destroy_player(struct player *p)
 {
 	/* not always initialized */
-	if (p->cli_addr)
-		free(p->cli_addr);
-	if (p->stats)
-		free(p->stats);
 	if (p->packets)
 		destroy_queue(p->packets);
 	if (p->muted)
 		ar_free(p->muted);
+	if (p->muted_by)
+		ar_free(p->muted_by);
 	free(p);
 }
 
@@ -62,19 +61,22 @@ struct player *new_player(char *nickname, char *login, char *machine)
 {
 	struct player *p;
 	
-	p = (struct player *)calloc(1, sizeof(struct player));
-	if (p == NULL) {
-		logger(LOG_WARN, "new_player, calloc failed : %s.", strerror(errno));
+	/* the hot fields stay in one cache line */
+	errno = posix_memalign((void **)&p, PLAYER_ALIGN, sizeof(struct player));
+	if (errno != 0) {
+		logger(LOG_WARN, "new_player, posix_memalign failed : %s.", strerror(errno));
 		return NULL;
 	}
+	memset(p, 0, sizeof(struct player));
 	/* create packet queue */
 	p->packets = new_queue();
 	p->muted = ar_new(2);
-	p->stats = new_plstat();
+	p->muted_by = ar_new(2);
+	pl_priv_list_init(&p->ch_privileges);
 	strcpy(p->name, nickname);
 	strcpy(p->machine, machine);
 	strcpy(p->client, login);
-	gettimeofday(&p->last_ping, NULL);
+	p->last_ping = mclock_now();
 	p->global_flags = 0;	/* remove later */
 	p->f0_s_counter = 1;
 	p->f0_c_counter = 1;
@@ -141,21 +143,19 @@ struct player *new_player_from_data(char *data, int len, struct sockaddr_in *cli
 	
 	/* Initialize player */
 	pl = new_player(nickname, login, machine);
+	if (pl == NULL) {
+		free(client); free(machine); free(nickname); free(login); free(password);
+		return NULL;
+	}
 	pl->version[0] = version[0];
 	pl->version[1] = version[1];
 	pl->version[2] = version[2];
 	pl->version[3] = version[3];
-	pl->stats->start_time = time(NULL);
-	pl->stats->activ_time = time(NULL);
-	/* Alloc adresses */
-	pl->cli_addr = (struct sockaddr_in *)calloc(cli_len, sizeof(char));
-	if (pl->cli_addr == NULL) {
-		logger(LOG_WARN, "new_player_from_data, client address calloc failed : %s.", strerror(errno));
-		destroy_player(pl);
-		return NULL;
-	}
-	memcpy(pl->cli_addr, cli_addr, cli_len);
-	pl->cli_len = cli_len;
+	pl->stats.start_time = mclock_seconds();
+	pl->stats.activ_time = mclock_seconds();
+	/* Copy the address */
+	pl->cli_len = MIN(cli_len, sizeof(struct sockaddr_in));
+	memcpy(&pl->cli_addr, cli_addr, pl->cli_len);
 
 	logger(LOG_INFO, "machine : %s, login : %s, nickname : %s", pl->machine, pl->client, pl->name);
 	free(client); free(machine); free(nickname); free(login); free(password);
@@ -221,8 +221,7 @@ void print_player(struct player *pl)
 uint16_t player_get_channel_privileges(struct player *pl, struct channel *ch)
 {
 	uint16_t res = 0;
-	size_t iter;
-	struct player_channel_privilege *tmp_priv;
+	struct player_channel_privilege *tmp_priv, *next;
 	struct channel *tmp_ch;
 
 	/* if this is a subchannel, look in the parent channel */
@@ -231,12 +230,12 @@ uint16_t player_get_channel_privileges(struct player *pl, struct channel *ch)
 		tmp_ch = ch->parent;
 
 	/* look in the current channel */
-	ar_each(struct player_channel_privilege *, tmp_priv, iter, tmp_ch->pl_privileges)
+	il_each(tmp_priv, next, &tmp_ch->pl_privileges, ch_link)
 		if (tmp_priv->reg == PL_CH_PRIV_REGISTERED && tmp_priv->pl_or_reg.reg == pl->reg)
 			res = tmp_priv->flags;
 		else if (tmp_priv->reg == PL_CH_PRIV_UNREGISTERED && tmp_priv->pl_or_reg.pl == pl)
 			res = tmp_priv->flags;
-	ar_end_each;
+	il_end_each;
 
 	return res;
 }
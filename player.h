@@ -23,9 +23,13 @@
 #include "channel.h"
 #include "configuration.h"
 #include "player_stat.h"
+#include "player_channel_privilege.h"
+#include "intrusive.h"
+#include "qsbr.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <sys/time.h>
 
 /* Channel privileges */
@@ -50,35 +54,31 @@
 #define PL_ATTR_MUTE_SPK	32
 
 
+/*
+ * The fields used for every packet come first and fill the first two
+ * cache lines, the players being aligned on PLAYER_ALIGN : the lookup
+ * by ids and the audio fan-out, then the packet sender. The
+ * description of the player, only used by the commands, comes last.
+ */
+#define PLAYER_ALIGN 64
+
 struct player {
+	/* hot : lookup and audio fan-out */
 	uint32_t public_id;
 	uint32_t private_id;
-	
-	char client[30];
-	char machine[30];
-	char name[30];
-	char login[30];
-	char voice_request[30];
-
-	uint16_t version[4];
-	
-	uint16_t global_flags;
-	uint16_t player_attributes;
-
-	struct player_stat *stats;
-	
-	/* the channel the player is in */
-	struct channel *in_chan;
-	struct registration *reg;
+	IH_ENTRY(player) id_link;	/* in server->players_by_id */
+	IL_ENTRY(player) chan_link;	/* in in_chan->players */
 	struct array *muted;
-	struct timeval last_ping;
-
-	/* communication */
-	struct sockaddr_in *cli_addr;
 	unsigned int cli_len;
-
+	/* once he left : first audio snapshot without him */
+	uint32_t audio_gen;
+	/* hot : communication and packet sender */
+	struct sockaddr_in cli_addr;
+	/* the channel the player is in */
+	struct channel *in_chan;
 	/* packet queue */
 	struct queue *packets;
+	uint64_t last_ping;	/* mclock time of the last keepalive, atomic */
 
 	/* packet counters */
 	unsigned int f0_c_counter;
@@ -86,7 +86,27 @@ struct player {
 	uint32_t f1_c_counter;
 	uint32_t f1_s_counter;
 	unsigned int f4_c_counter;
-	unsigned int f4_s_counter;
+	unsigned int f4_s_counter;	/* atomic, the keepalives take no lock */
+
+	uint16_t global_flags;
+	uint16_t player_attributes;
+	struct registration *reg;
+	/* reverse indexes, so leaving does not scan the whole server */
+	struct array *muted_by;		/* players who muted this one */
+	struct pl_priv_list ch_privileges;	/* unregistered privileges pointing to this player */
+
+	struct player_stat stats;
+
+	/* cold : description of the player */
+	char client[30];
+	char machine[30];
+	char name[30];
+	char login[30];
+	char voice_request[30];
+
+	uint16_t version[4];
+
+	struct qsbr_node retired;	/* once removed from its server */
 };
 
 void destroy_player(struct player *p);
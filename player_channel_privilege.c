@@ -3,24 +3,72 @@
 #include "server.h"
 #include "database.h"
 #include "log.h"
+#include "arena.h"
 
 #include <stdlib.h>
 
+IL_GENERATE(priv_list, player_channel_privilege, ch_link);
+IL_GENERATE(pl_priv_list, player_channel_privilege, pl_link);
+
+/**
+ * Remove the privilege from the reverse index of the player
+ * it points to, if it points to a player.
+ *
+ * @param priv the privilege
+ */
+static void pl_chan_priv_unlink_player(struct player_channel_privilege *priv)
+{
+	if (priv->reg == PL_CH_PRIV_UNREGISTERED && priv->pl_or_reg.pl != NULL)
+		pl_priv_list_remove(&priv->pl_or_reg.pl->ch_privileges, priv);
+}
+
 void destroy_player_channel_privilege(struct player_channel_privilege *priv)
 {
-	free(priv);
+	pl_chan_priv_unlink_player(priv);
+	arena_free(priv->arena, priv, sizeof(struct player_channel_privilege));
 }
 
-struct player_channel_privilege *new_player_channel_privilege()
+struct player_channel_privilege *new_player_channel_privilege(struct arena *a)
 {
 	struct player_channel_privilege *p;
 
-	p = (struct player_channel_privilege *)calloc(1, sizeof(struct player_channel_privilege));
+	p = (struct player_channel_privilege *)arena_alloc(a, sizeof(struct player_channel_privilege));
 	if (p == NULL)
-		logger(LOG_ERR, "new_player_channel_privilege: calloc failed!");
+		logger(LOG_ERR, "new_player_channel_privilege: arena_alloc failed!");
+	else
+		p->arena = a;
 	return p;
 }
 
+/**
+ * Associate a privilege to an (unregistered) player, and
+ * keep the player's reverse index up to date.
+ *
+ * @param priv the privilege
+ * @param pl the player
+ */
+void pl_chan_priv_set_player(struct player_channel_privilege *priv, struct player *pl)
+{
+	pl_chan_priv_unlink_player(priv);
+	priv->reg = PL_CH_PRIV_UNREGISTERED;
+	priv->pl_or_reg.pl = pl;
+	pl_priv_list_insert(&pl->ch_privileges, priv);
+}
+
+/**
+ * Associate a privilege to a registration, removing it
+ * from the reverse index of the player it pointed to.
+ *
+ * @param priv the privilege
+ * @param reg the registration
+ */
+void pl_chan_priv_set_registration(struct player_channel_privilege *priv, struct registration *reg)
+{
+	pl_chan_priv_unlink_player(priv);
+	priv->reg = PL_CH_PRIV_REGISTERED;
+	priv->pl_or_reg.reg = reg;
+}
+
 void player_clr_channel_privilege(struct player *pl, struct channel *ch, uint16_t bit)
 {
 	struct player_channel_privilege *tmp_priv;
@@ -3,9 +3,18 @@
 
 #include <stdint.h>
 
+#include "intrusive.h"
+
 #define PL_CH_PRIV_UNREGISTERED 1
 #define PL_CH_PRIV_REGISTERED 2
 
+/* the privileges of a channel, linked by their ch_link */
+IL_HEAD(priv_list, player_channel_privilege);
+IL_PROTOTYPE(priv_list, player_channel_privilege);
+/* the unregistered privileges pointing to a player, by their pl_link */
+IL_HEAD(pl_priv_list, player_channel_privilege);
+IL_PROTOTYPE(pl_priv_list, player_channel_privilege);
+
 struct player_channel_privilege {
 	int db_id;
 
@@ -19,10 +28,17 @@ struct player_channel_privilege {
 	struct channel *ch;
 
 	int flags;
+
+	IL_ENTRY(player_channel_privilege) ch_link;	/* in ch->pl_privileges */
+	IL_ENTRY(player_channel_privilege) pl_link;	/* in pl->ch_privileges */
+
+	struct arena *arena;	/* of the server */
 };
 
 void destroy_player_channel_privilege(struct player_channel_privilege *priv);
-struct player_channel_privilege *new_player_channel_privilege();
+struct player_channel_privilege *new_player_channel_privilege(struct arena *a);
+void pl_chan_priv_set_player(struct player_channel_privilege *priv, struct player *pl);
+void pl_chan_priv_set_registration(struct player_channel_privilege *priv, struct registration *reg);
 void player_clr_channel_privilege(struct player *pl, struct channel *ch, uint16_t bit);
 void player_set_channel_privilege(struct player *pl, struct channel *ch, uint16_t bit);
 
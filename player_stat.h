@@ -26,10 +26,10 @@ struct player_stat
 {
 	uint16_t version[4];
 
-	time_t start_time; /* time of connection */
+	time_t start_time; /* time of connection (mclock seconds) */
 
 	int ping; /* test ping */
-	time_t activ_time; /* time of last activity (=> idle)*/
+	time_t activ_time; /* time of last activity (=> idle, mclock seconds)*/
 	/* to determine the proportion of list packets */
 	int pkt_rec;
 	int pkt_sent;
@@ -43,6 +43,4 @@ struct player_stat
 	int bytes_received;
 };
 
-struct player_stat *new_plstat(void);
-
 #endif
@@ -0,0 +1,250 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Quiescent-state based reclamation of the players, the channels
+ * and the tables the receiving threads read without the server lock.
+ *
+ * A thread reads them between qsbr_enter and qsbr_leave (handling a
+ * packet), and is quiescent the rest of the time (waiting for the
+ * next one). An object is unlinked under the lock, then given to
+ * qsbr_retire instead of being freed : the retirement increments the
+ * epoch, and the object is freed by qsbr_reclaim once every thread
+ * in a read section entered it after the retirement.
+ *
+ * The threads have a record each, in a thread registry.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "qsbr.h"
+#include "thread_registry.h"
+#include "log.h"
+
+/* the records do not share a cache line */
+#define QSBR_ALIGN 64
+
+struct qsbr_thread
+{
+	struct thread_record rec;
+	uint64_t seen;		/* epoch when it entered, 0 if quiescent */
+	int depth;		/* nested read sections */
+};
+
+/* a memory block given to qsbr_free */
+struct qsbr_block
+{
+	struct qsbr_node node;
+	void *mem;
+};
+
+static void qsbr_release_thread(struct thread_record *rec);
+
+static uint64_t epoch = 1;
+static struct thread_registry threads =
+	THREAD_REGISTRY_INITIALIZER(struct qsbr_thread, QSBR_ALIGN, &qsbr_release_thread);
+static __thread struct qsbr_thread *me;
+
+/* the retired objects, oldest (smallest epoch) first */
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct qsbr_node *retired;
+static struct qsbr_node **retired_last = &retired;
+static size_t nb_retired;
+
+/* the thread of a record has ended : it is quiescent */
+static void qsbr_release_thread(struct thread_record *rec)
+{
+	struct qsbr_thread *th = (struct qsbr_thread *)rec;
+
+	th->depth = 0;
+	__atomic_store_n(&th->seen, 0, __ATOMIC_RELEASE);
+}
+
+/* the record of the calling thread, NULL if there is none */
+static struct qsbr_thread *qsbr_get_thread(void)
+{
+	if (me != NULL)
+		return me;
+	me = (struct qsbr_thread *)thread_registry_get(&threads);
+	if (me == NULL)
+		logger(LOG_ERR, "qsbr_get_thread, could not allocate a record : %s.", strerror(errno));
+	return me;
+}
+
+/**
+ * Start reading the shared objects : the ones retired from now on
+ * are not freed before qsbr_leave. Read sections can be nested.
+ */
+void qsbr_enter(void)
+{
+	struct qsbr_thread *t = qsbr_get_thread();
+
+	if (t == NULL)
+		return;
+	if (t->depth++ > 0)
+		return;
+	__atomic_store_n(&t->seen, __atomic_load_n(&epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+	/* the epoch is published before any object is read */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * Stop reading the shared objects : the thread is quiescent.
+ */
+void qsbr_leave(void)
+{
+	struct qsbr_thread *t = me;
+
+	if (t == NULL || t->depth == 0)
+		return;
+	if (--t->depth == 0)
+		__atomic_store_n(&t->seen, 0, __ATOMIC_RELEASE);
+}
+
+/* the smallest epoch seen by a thread in a read section, but the caller's */
+static uint64_t qsbr_min_seen(struct qsbr_thread *self)
+{
+	struct qsbr_thread *t;
+	uint64_t min = UINT64_MAX, seen;
+
+	thread_registry_each(struct qsbr_thread *, t, &threads) {
+		if (t == self)
+			continue;
+		seen = __atomic_load_n(&t->seen, __ATOMIC_SEQ_CST);
+		if (seen != 0 && seen < min)
+			min = seen;
+	}
+	return min;
+}
+
+/**
+ * Wait for the threads in a read section to leave it : what was
+ * retired before is not seen by any other thread anymore.
+ */
+static void qsbr_synchronize(void)
+{
+	uint64_t e;
+
+	e = __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+	while (qsbr_min_seen(me) <= e)
+		sched_yield();
+}
+
+/**
+ * Free an object once no thread can see it anymore. It must already
+ * be unreachable for the threads entering a read section now.
+ * This never waits : it is called with the server lock held.
+ *
+ * @param n the node of the object, unused until it is freed
+ * @param ptr the object
+ * @param destroy the function freeing it
+ */
+void qsbr_retire(struct qsbr_node *n, void *ptr, void (*destroy)(void *))
+{
+	n->ptr = ptr;
+	n->destroy = destroy;
+	n->next = NULL;
+	pthread_mutex_lock(&retired_lock);
+	n->epoch = __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+	*retired_last = n;
+	retired_last = &n->next;
+	__atomic_store_n(&nb_retired, nb_retired + 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&retired_lock);
+}
+
+static void qsbr_free_block(void *b)
+{
+	free(((struct qsbr_block *)b)->mem);
+	free(b);
+}
+
+/**
+ * qsbr_retire with free, for the memory without a node.
+ *
+ * @param ptr the memory to free
+ */
+void qsbr_free(void *ptr)
+{
+	struct qsbr_block *b;
+
+	if (ptr == NULL)
+		return;
+	b = (struct qsbr_block *)malloc(sizeof(struct qsbr_block));
+	if (b == NULL) {
+		/* waiting for the readers here could deadlock */
+		logger(LOG_WARN, "qsbr_free, malloc failed, %p is leaked : %s.", ptr, strerror(errno));
+		return;
+	}
+	b->mem = ptr;
+	qsbr_retire(&b->node, b, &qsbr_free_block);
+}
+
+/*
+ * Free the retired objects older than min, with retired_lock held :
+ * an object is not freed anymore once whoever frees them has the lock.
+ */
+static void qsbr_reclaim_locked(uint64_t min)
+{
+	struct qsbr_node *n;
+
+	while (retired != NULL && retired->epoch < min) {
+		n = retired;
+		retired = n->next;
+		__atomic_store_n(&nb_retired, nb_retired - 1, __ATOMIC_RELAXED);
+		/* the node may be in the object */
+		n->destroy(n->ptr);
+	}
+	if (retired == NULL)
+		retired_last = &retired;
+}
+
+/**
+ * Free the retired objects no thread can see anymore. Called
+ * regularly, by the packet sender.
+ */
+void qsbr_reclaim(void)
+{
+	uint64_t min;
+
+	if (__atomic_load_n(&nb_retired, __ATOMIC_RELAXED) == 0)
+		return;
+	/* the caller's own read section counts too */
+	min = qsbr_min_seen(NULL);
+	pthread_mutex_lock(&retired_lock);
+	qsbr_reclaim_locked(min);
+	pthread_mutex_unlock(&retired_lock);
+}
+
+/**
+ * Free every object retired so far, waiting for the readers and
+ * for the other threads freeing them : their memory can be released
+ * afterwards (the arena of a server being stopped).
+ * Must not be called with a server lock held.
+ */
+void qsbr_drain(void)
+{
+	qsbr_synchronize();
+	pthread_mutex_lock(&retired_lock);
+	qsbr_reclaim_locked(qsbr_min_seen(me));
+	pthread_mutex_unlock(&retired_lock);
+}
@@ -0,0 +1,44 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __QSBR_H__
+#define __QSBR_H__
+
+#include <stdint.h>
+
+/* the read sections of the calling thread */
+void qsbr_enter(void);
+void qsbr_leave(void);
+
+/* an object waiting for the readers, embedded in it */
+struct qsbr_node
+{
+	void *ptr;
+	void (*destroy)(void *);
+	uint64_t epoch;		/* freed when every reader has seen a greater one */
+	struct qsbr_node *next;
+};
+
+/* freeing the objects the readers may still see */
+void qsbr_retire(struct qsbr_node *n, void *ptr, void (*destroy)(void *));
+void qsbr_free(void *ptr);
+void qsbr_reclaim(void);
+void qsbr_drain(void);
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "queue.h"
 #include "log.h"
+#include "mclock.h"
 
 #include <pthread.h>
 #include <stdlib.h>
@@ -58,7 +59,7 @@ void add_to_queue(struct queue *q, void *elem, size_t size)
 	q_e = (struct q_elem *)calloc(sizeof(struct q_elem), 1);
 	q_e->elem = elem;
 	q_e->size = size;
-	timerclear(&q_e->last_sent);
+	q_e->last_sent = 0;
 
 	pthread_mutex_lock(&q->mutex);
 	if(q->first == NULL) {
@@ -68,16 +69,17 @@ void add_to_queue(struct queue *q, void *elem, size_t size)
 		q->last->next = q_e;
 	}
 	q->last = q_e;
+	q->nb_elem++;
 	pthread_mutex_unlock(&q->mutex);
 }
 
 void queue_update_time(struct queue *q)
 {
 	if (q->first != NULL)
-		gettimeofday(&q->first->last_sent, NULL);
+		q->first->last_sent = mclock_now();
 }
 
-struct timeval * queue_get_time(struct queue *q)
+uint64_t *queue_get_time(struct queue *q)
 {
 	if (q->first != NULL)
 		return &q->first->last_sent;
@@ -116,6 +118,7 @@ void *get_from_queue(struct queue *q)
 		}
 		elem = old_first->elem;
 		free(old_first);
+		q->nb_elem--;
 	}
 
 	return elem;
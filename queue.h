@@ -20,12 +20,13 @@
 #define __QUEUE_H__
 
 #include <pthread.h>
+#include <stdint.h>
 #include <sys/time.h>
 
 struct q_elem
 {
 	size_t size;
-	struct timeval last_sent;
+	uint64_t last_sent;	/* mclock time, 0 if never sent */
 
 	void *elem;
 
@@ -43,7 +44,7 @@ struct queue
 };
 
 void queue_update_time(struct queue *q);
-struct timeval *queue_get_time(struct queue *q);
+uint64_t *queue_get_time(struct queue *q);
 struct queue *new_queue();
 void destroy_queue(struct queue *q);
 void add_to_queue(struct queue *q, void *elem, size_t size);
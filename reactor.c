@@ -0,0 +1,337 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "reactor.h"
+#include "config.h"
+#include "server.h"
+#include "packet_sender.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#ifdef HAVE_EPOLL
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define REACTOR_MAX_EVENTS 64
+/* packets read on a socket before looking at the other events */
+#define REACTOR_BATCH 32
+/* period of the packet sender (in ms) */
+#define REACTOR_TICK 50
+
+struct reactor {
+	int id;
+	int epoll_fd;
+	int wake_fd[2];		/* a pipe to wake up the reactor */
+	pthread_t thread;
+	/* held while dispatching events, so sources can be removed safely */
+	pthread_mutex_t lock;
+	unsigned long loops;	/* batches of events handled */
+	pthread_cond_t loop_done;
+	int nb_servers;
+	int stop;
+};
+
+static struct reactor *reactors = NULL;
+static int nb_reactors = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Read the pending packets of a socket.
+ *
+ * @param w the receiving socket
+ */
+static void reactor_read_socket(struct recv_worker *w)
+{
+	int i;
+
+	for (i = 0 ; i < REACTOR_BATCH ; i++) {
+		if (server_recv_packet(w, MSG_DONTWAIT) == -1)
+			break;
+	}
+}
+
+/**
+ * Run the packet sender of a server when its timer expires.
+ *
+ * @param src the timer source
+ */
+static void reactor_timer_expired(struct reactor_source *src)
+{
+	uint64_t expirations;
+
+	if (read(src->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+	packet_sender_sweep((struct server *)src->data);
+}
+
+static void *reactor_run(void *args)
+{
+	struct reactor *r = (struct reactor *)args;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	struct reactor_source *src;
+	char wake[16];
+	int i, n;
+
+	while (!r->stop) {
+		n = epoll_wait(r->epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+		if (n == -1) {
+			if (errno != EINTR)
+				logger(LOG_ERR, "reactor_run, epoll_wait : %s.", strerror(errno));
+			continue;
+		}
+		pthread_mutex_lock(&r->lock);
+		for (i = 0 ; i < n ; i++) {
+			src = (struct reactor_source *)events[i].data.ptr;
+			if (src == NULL) {	/* wake up */
+				while (read(r->wake_fd[0], &wake, sizeof(wake)) > 0);
+				continue;
+			}
+			/* the events of a batch may be older than a removal */
+			if (!src->active)
+				continue;
+			switch (src->type) {
+			case REACTOR_SRC_SOCKET:
+				reactor_read_socket((struct recv_worker *)src->data);
+				break;
+			case REACTOR_SRC_TIMER:
+				reactor_timer_expired(src);
+				break;
+			}
+		}
+		r->loops++;
+		pthread_cond_broadcast(&r->loop_done);
+		pthread_mutex_unlock(&r->lock);
+	}
+	return NULL;
+}
+
+/**
+ * Start the pool of reactor threads.
+ *
+ * @param nb the number of reactors
+ *
+ * @return 1 on success, 0 on failure
+ */
+int reactor_pool_start(int nb)
+{
+	struct epoll_event ev;
+	struct reactor *r;
+	int i;
+
+	reactors = (struct reactor *)calloc(nb, sizeof(struct reactor));
+	if (reactors == NULL) {
+		logger(LOG_ERR, "reactor_pool_start, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	nb_reactors = nb;
+	for (i = 0 ; i < nb ; i++) {
+		r = &reactors[i];
+		r->id = i;
+		r->epoll_fd = epoll_create(REACTOR_MAX_EVENTS);
+		ERROR_IF(r->epoll_fd == -1);
+		ERROR_IF(pipe(r->wake_fd) == -1);
+		ERROR_IF(fcntl(r->wake_fd[0], F_SETFL, O_NONBLOCK) == -1);
+		bzero(&ev, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		ERROR_IF(epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd[0], &ev) == -1);
+		pthread_mutex_init(&r->lock, NULL);
+		pthread_cond_init(&r->loop_done, NULL);
+		pthread_create(&r->thread, NULL, &reactor_run, (void *)r);
+	}
+	logger(LOG_INFO, "%i reactor threads started.", nb);
+	return 1;
+}
+
+/**
+ * Ask the reactor threads to stop. This does not wait for them,
+ * use reactor_pool_join.
+ */
+void reactor_pool_stop(void)
+{
+	int i;
+
+	for (i = 0 ; i < nb_reactors ; i++) {
+		reactors[i].stop = 1;
+		if (write(reactors[i].wake_fd[1], "", 1) != 1)
+			logger(LOG_WARN, "reactor_pool_stop : %s.", strerror(errno));
+	}
+}
+
+/**
+ * Wait for the reactor threads to end and destroy the pool.
+ */
+void reactor_pool_join(void)
+{
+	int i;
+
+	for (i = 0 ; i < nb_reactors ; i++) {
+		pthread_join(reactors[i].thread, NULL);
+		close(reactors[i].epoll_fd);
+		close(reactors[i].wake_fd[0]);
+		close(reactors[i].wake_fd[1]);
+		pthread_mutex_destroy(&reactors[i].lock);
+		pthread_cond_destroy(&reactors[i].loop_done);
+	}
+	free(reactors);
+	reactors = NULL;
+	nb_reactors = 0;
+}
+
+static int reactor_watch(struct reactor *r, struct reactor_source *src)
+{
+	struct epoll_event ev;
+
+	bzero(&ev, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = src;
+	src->active = 1;
+	if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, src->fd, &ev) == -1) {
+		logger(LOG_ERR, "reactor_watch, epoll_ctl : %s.", strerror(errno));
+		src->active = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Give a started server to the reactor with the fewest servers.
+ * All its sockets and its packet sender timer are handled by
+ * this reactor only.
+ *
+ * @param s the server
+ *
+ * @return 1 on success, 0 on failure
+ */
+int reactor_add_server(struct server *s)
+{
+	struct reactor *r;
+	struct itimerspec tick;
+	int i;
+
+	if (nb_reactors == 0) {
+		logger(LOG_ERR, "reactor_add_server : the reactor pool is not started.");
+		return 0;
+	}
+	pthread_mutex_lock(&pool_lock);
+	r = &reactors[0];
+	for (i = 1 ; i < nb_reactors ; i++) {
+		if (reactors[i].nb_servers < r->nb_servers)
+			r = &reactors[i];
+	}
+	r->nb_servers++;
+	pthread_mutex_unlock(&pool_lock);
+
+	/* packet sender timer */
+	s->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	ERROR_IF(s->timer.fd == -1);
+	tick.it_interval.tv_sec = 0;
+	tick.it_interval.tv_nsec = REACTOR_TICK * 1000000;
+	tick.it_value = tick.it_interval;
+	ERROR_IF(timerfd_settime(s->timer.fd, 0, &tick, NULL) == -1);
+	s->timer.type = REACTOR_SRC_TIMER;
+	s->timer.data = s;
+
+	pthread_mutex_lock(&r->lock);
+	s->reactor = r;
+	for (i = 0 ; i < s->nb_workers ; i++) {
+		s->workers[i].src.fd = s->workers[i].socket_desc;
+		s->workers[i].src.type = REACTOR_SRC_SOCKET;
+		s->workers[i].src.data = &s->workers[i];
+		reactor_watch(r, &s->workers[i].src);
+	}
+	reactor_watch(r, &s->timer);
+	pthread_mutex_unlock(&r->lock);
+	logger(LOG_INFO, "Server %i runs on reactor %i.", s->id, r->id);
+	return 1;
+}
+
+/**
+ * Stop watching the sockets and the timer of a server.
+ * When this returns, the reactor does not use the server anymore :
+ * the batch of events it was handling, that may still point to the
+ * sources of the server, is done. Not called by a reactor thread.
+ *
+ * @param s the server
+ */
+void reactor_remove_server(struct server *s)
+{
+	struct reactor *r = s->reactor;
+	unsigned long batch;
+	int i;
+
+	if (r == NULL)
+		return;
+	pthread_mutex_lock(&r->lock);
+	for (i = 0 ; i < s->nb_workers ; i++) {
+		epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, s->workers[i].src.fd, NULL);
+		s->workers[i].src.active = 0;
+	}
+	epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, s->timer.fd, NULL);
+	s->timer.active = 0;
+	close(s->timer.fd);
+	s->reactor = NULL;
+	/* wake the reactor up and wait for the end of its current batch */
+	batch = r->loops;
+	if (write(r->wake_fd[1], "", 1) != 1)
+		logger(LOG_WARN, "reactor_remove_server : %s.", strerror(errno));
+	while (r->loops == batch && !r->stop)
+		pthread_cond_wait(&r->loop_done, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+
+	pthread_mutex_lock(&pool_lock);
+	r->nb_servers--;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+#else /* HAVE_EPOLL */
+
+/* configuration.c never selects the reactor mode without epoll */
+
+int reactor_pool_start(int nb)
+{
+	logger(LOG_ERR, "reactor_pool_start : no epoll support.");
+	return 0;
+}
+
+void reactor_pool_stop(void)
+{
+}
+
+void reactor_pool_join(void)
+{
+}
+
+int reactor_add_server(struct server *s)
+{
+	return 0;
+}
+
+void reactor_remove_server(struct server *s)
+{
+}
+
+#endif /* HAVE_EPOLL */
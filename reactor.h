@@ -0,0 +1,42 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#define REACTOR_SRC_SOCKET 0
+#define REACTOR_SRC_TIMER 1
+
+struct server;
+struct reactor;
+
+/* a file descriptor watched by a reactor */
+struct reactor_source {
+	int fd;
+	int type;	/* REACTOR_SRC_SOCKET or REACTOR_SRC_TIMER */
+	void *data;	/* the recv_worker or the server */
+	int active;
+};
+
+int reactor_pool_start(int nb_reactors);
+void reactor_pool_stop(void);
+void reactor_pool_join(void);
+int reactor_add_server(struct server *s);
+void reactor_remove_server(struct server *s);
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "registration.h"
 #include "log.h"
+#include "arena.h"
 
 #include <stdlib.h>
 #include <errno.h>
@@ -28,22 +29,25 @@
  * Allocate and return a new registration structure
  * used to check credentials on login.
  *
+ * @param a the arena of the server
+ *
  * @return the allocated structure
  */
-struct registration *new_registration()
+struct registration *new_registration(struct arena *a)
 {
 	struct registration *r;
 
-	r = (struct registration *)calloc(1, sizeof(struct registration));
+	r = (struct registration *)arena_alloc(a, sizeof(struct registration));
 	if (r == NULL) {
-		logger(LOG_WARN, "new_registration, calloc failed : %s.", strerror(errno));
+		logger(LOG_WARN, "new_registration, arena_alloc failed.");
 		return NULL;
 	}
+	r->arena = a;
 
 	return r;
 }
 
 void destroy_registration(struct registration *r)
 {
-	free(r);
+	arena_free(r->arena, r, sizeof(struct registration));
 }
@@ -27,9 +27,10 @@ struct registration
 	char name[30];
 	char password[SHA256_DIGEST_LENGTH * 2 + 1];
 	int db_id;
+	struct arena *arena;	/* of its server */
 };
 
-struct registration *new_registration(void);
+struct registration *new_registration(struct arena *a);
 void destroy_registration(struct registration *r);
 
 #endif
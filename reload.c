@@ -0,0 +1,785 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reload without disconnecting the players.
+ *
+ * On SIGUSR1 the configuration file is read again. The settings used
+ * while running (logs, database batches, snapshot) are changed in
+ * place. Then the database is loaded in temporary servers and compared
+ * to the running ones, and only the differences are applied :
+ *   - a server that is not active anymore is stopped, a new active
+ *     server is started, a server whose port changed is restarted
+ *     (its players are disconnected, the other servers are untouched)
+ *   - the attributes of a server, its privileges, registrations,
+ *     channels and player channel privileges are updated, and the
+ *     players are notified of the channels created, changed or deleted.
+ *
+ * A channel that is not in the database anymore but still has players
+ * becomes unregistered instead of being deleted.
+ *
+ * If a setting that needs new sockets, threads or a new database
+ * connection changed, everything is restarted as before.
+ */
+
+#include "reload.h"
+#include "server.h"
+#include "channel.h"
+#include "registration.h"
+#include "player_channel_privilege.h"
+#include "control_packet.h"
+#include "audio_packet.h"
+#include "database.h"
+#include "snapshot.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/* attempts to read the database while the servers are modified */
+#define RELOAD_TRIES 20
+/* microseconds between two attempts */
+#define RELOAD_WAIT 100000
+
+struct reload_stats
+{
+	int server;
+	int chans_added;
+	int chans_changed;
+	int chans_removed;
+	int regs_added;
+	int regs_changed;
+	int regs_removed;
+	int privs;
+};
+
+/* the registered channels or the registrations of a server, by db id */
+struct reload_table
+{
+	void **el;
+	size_t nb;
+};
+
+static int cmp_channel(const void *a, const void *b)
+{
+	uint32_t ida = (*(struct channel **)a)->db_id;
+	uint32_t idb = (*(struct channel **)b)->db_id;
+
+	return (ida > idb) - (ida < idb);
+}
+
+static int cmp_registration(const void *a, const void *b)
+{
+	int ida = (*(struct registration **)a)->db_id;
+	int idb = (*(struct registration **)b)->db_id;
+
+	return (ida > idb) - (ida < idb);
+}
+
+static int same_str(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+/**
+ * Fill a table with the registered channels of a server.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int reload_channel_table(struct reload_table *t, struct server *s)
+{
+	struct channel *ch;
+	size_t iter;
+
+	t->el = (void **)calloc(s->chans->used_slots + 1, sizeof(void *));
+	if (t->el == NULL) {
+		logger(LOG_ERR, "reload_channel_table, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	t->nb = 0;
+	ar_each(struct channel *, ch, iter, s->chans)
+		if (!(ch->flags & CHANNEL_FLAG_UNREGISTERED))
+			t->el[t->nb++] = ch;
+	ar_end_each;
+	qsort(t->el, t->nb, sizeof(void *), &cmp_channel);
+	return 1;
+}
+
+/**
+ * Fill a table with the registrations of a server.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int reload_registration_table(struct reload_table *t, struct server *s)
+{
+	struct registration *r;
+	size_t iter;
+
+	t->el = (void **)calloc(s->regs->used_slots + 1, sizeof(void *));
+	if (t->el == NULL) {
+		logger(LOG_ERR, "reload_registration_table, calloc failed : %s.", strerror(errno));
+		return 0;
+	}
+	t->nb = 0;
+	ar_each(struct registration *, r, iter, s->regs)
+		t->el[t->nb++] = r;
+	ar_end_each;
+	qsort(t->el, t->nb, sizeof(void *), &cmp_registration);
+	return 1;
+}
+
+static struct channel *find_channel(struct reload_table *t, uint32_t db_id)
+{
+	struct channel key, *k = &key, **found;
+
+	key.db_id = db_id;
+	found = bsearch(&k, t->el, t->nb, sizeof(void *), &cmp_channel);
+	return (found == NULL) ? NULL : *found;
+}
+
+static struct registration *find_registration(struct reload_table *t, int db_id)
+{
+	struct registration key, *k = &key, **found;
+
+	key.db_id = db_id;
+	found = bsearch(&k, t->el, t->nb, sizeof(void *), &cmp_registration);
+	return (found == NULL) ? NULL : *found;
+}
+
+/* the privilege of a registration in a channel, or NULL */
+static struct player_channel_privilege *find_privilege(struct channel *ch, int reg_db_id)
+{
+	struct player_channel_privilege *priv, *next;
+
+	il_each(priv, next, &ch->pl_privileges, ch_link)
+		if (priv->reg == PL_CH_PRIV_REGISTERED && priv->pl_or_reg.reg->db_id == reg_db_id)
+			return priv;
+	il_end_each;
+	return NULL;
+}
+
+/**
+ * Copy a string of the database channel into the arena of the
+ * running one : the database server and its arena are destroyed
+ * after the reload.
+ *
+ * @return 1 on success, 0 if the running string is unchanged
+ */
+static int reload_str(struct channel *ch, char **live, const char *db)
+{
+	char *str;
+
+	str = arena_strdup(ch->arena, db);
+	if (str == NULL)
+		return 0;
+	arena_strfree(ch->arena, *live);
+	*live = str;
+	return 1;
+}
+
+/* only one channel is the default one */
+static void reload_set_default(struct server *s, struct channel *def)
+{
+	struct channel *ch;
+	size_t iter;
+
+	ar_each(struct channel *, ch, iter, s->chans)
+		if (ch != def && (ch->flags & CHANNEL_FLAG_DEFAULT)) {
+			ch->flags &= ~CHANNEL_FLAG_DEFAULT;
+			s_notify_channel_flags_codec_changed(0, ch);
+		}
+	ar_end_each;
+}
+
+/**
+ * Update the attributes of a server and its privileges.
+ */
+static void reload_server_attributes(struct server *s, struct server *db_s, struct reload_stats *st)
+{
+	if (strcmp(s->server_name, db_s->server_name) != 0
+			|| strcmp(s->password, db_s->password) != 0
+			|| strcmp(s->welcome_msg, db_s->welcome_msg) != 0
+			|| s->codecs != db_s->codecs) {
+		strcpy(s->server_name, db_s->server_name);
+		strcpy(s->password, db_s->password);
+		strcpy(s->welcome_msg, db_s->welcome_msg);
+		s->codecs = db_s->codecs;
+		st->server = 1;
+	}
+	if (memcmp(s->privileges->priv, db_s->privileges->priv, sizeof(s->privileges->priv)) != 0) {
+		memcpy(s->privileges->priv, db_s->privileges->priv, sizeof(s->privileges->priv));
+		st->server = 1;
+	}
+}
+
+/**
+ * Remove a registration : the players logged in with it keep their
+ * channel privileges as unregistered players, the other privileges
+ * of the registration are destroyed.
+ */
+static void reload_remove_registration(struct server *s, struct registration *r)
+{
+	struct player_channel_privilege *priv, *next;
+	struct channel *ch;
+	struct player *pl;
+	size_t iter, iter2;
+
+	ar_each(struct player *, pl, iter, s->players)
+		if (pl->reg == r) {
+			ar_each(struct channel *, ch, iter2, s->chans)
+				priv = find_privilege(ch, r->db_id);
+				if (priv != NULL && priv->pl_or_reg.reg == r)
+					pl_chan_priv_set_player(priv, pl);
+			ar_end_each;
+			pl->global_flags &= ~(GLOBAL_FLAG_REGISTERED | GLOBAL_FLAG_SERVERADMIN);
+			pl->reg = NULL;
+		}
+	ar_end_each;
+	ar_each(struct channel *, ch, iter, s->chans)
+		il_each(priv, next, &ch->pl_privileges, ch_link)
+			if (priv->reg == PL_CH_PRIV_REGISTERED && priv->pl_or_reg.reg == r) {
+				priv_list_remove(&ch->pl_privileges, priv);
+				destroy_player_channel_privilege(priv);
+			}
+		il_end_each;
+	ar_end_each;
+	ar_remove(s->regs, r);
+	destroy_registration(r);
+}
+
+/**
+ * Update, add and remove the registrations. The new ones are
+ * copied from the database server to the running one.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int reload_registrations(struct server *s, struct server *db_s, struct reload_stats *st)
+{
+	struct reload_table live, db;
+	struct registration *r, *db_r;
+	struct player *pl;
+	size_t i, iter;
+
+	if (!reload_registration_table(&live, s))
+		return 0;
+	if (!reload_registration_table(&db, db_s)) {
+		free(live.el);
+		return 0;
+	}
+	for (i = 0 ; i < db.nb ; i++) {
+		db_r = (struct registration *)db.el[i];
+		r = find_registration(&live, db_r->db_id);
+		if (r == NULL) {
+			r = new_registration(s->arena);
+			if (r == NULL)
+				continue;
+			r->global_flags = db_r->global_flags;
+			strcpy(r->name, db_r->name);
+			strcpy(r->password, db_r->password);
+			r->db_id = db_r->db_id;
+			add_registration(s, r);
+			st->regs_added++;
+		} else if (r->global_flags != db_r->global_flags || strcmp(r->name, db_r->name) != 0
+				|| strcmp(r->password, db_r->password) != 0) {
+			r->global_flags = db_r->global_flags;
+			strcpy(r->name, db_r->name);
+			strcpy(r->password, db_r->password);
+			ar_each(struct player *, pl, iter, s->players)
+				if (pl->reg == r)
+					pl->global_flags = (pl->global_flags & ~GLOBAL_FLAG_SERVERADMIN)
+						| (r->global_flags & GLOBAL_FLAG_SERVERADMIN);
+			ar_end_each;
+			st->regs_changed++;
+		}
+	}
+	for (i = 0 ; i < live.nb ; i++) {
+		r = (struct registration *)live.el[i];
+		if (find_registration(&db, r->db_id) == NULL) {
+			reload_remove_registration(s, r);
+			st->regs_removed++;
+		}
+	}
+	free(live.el);
+	free(db.el);
+	return 1;
+}
+
+/**
+ * Update a running channel from the database and notify the players.
+ *
+ * @return 1 if the channel changed
+ */
+static int reload_channel(struct server *s, struct channel *ch, struct channel *db_ch)
+{
+	uint16_t flags = ch->flags;
+	int changed = 0;
+
+	if (strcmp(ch->name, db_ch->name) != 0 && reload_str(ch, &ch->name, db_ch->name)) {
+		s_resp_chan_name_changed(0, ch, ch->name);
+		changed = 1;
+	}
+	if (strcmp(ch->topic, db_ch->topic) != 0 && reload_str(ch, &ch->topic, db_ch->topic)) {
+		s_resp_chan_topic_changed(0, ch, ch->topic);
+		changed = 1;
+	}
+	if (strcmp(ch->desc, db_ch->desc) != 0 && reload_str(ch, &ch->desc, db_ch->desc)) {
+		s_resp_chan_desc_changed(0, ch, ch->desc);
+		changed = 1;
+	}
+	/* the database has no flags for the subchannels */
+	if (ch->parent == NULL)
+		flags = (ch->flags & ~DB_CHANNEL_FLAGS) | (db_ch->flags & DB_CHANNEL_FLAGS);
+	if (flags != ch->flags || ch->codec != db_ch->codec) {
+		if ((flags & CHANNEL_FLAG_DEFAULT) && !(ch->flags & CHANNEL_FLAG_DEFAULT))
+			reload_set_default(s, ch);
+		ch->flags = flags;
+		ch->codec = db_ch->codec;
+		audio_path_changed(s);
+		s_notify_channel_flags_codec_changed(0, ch);
+		changed = 1;
+	}
+	if (ch->sort_order != db_ch->sort_order) {
+		ch->sort_order = db_ch->sort_order;
+		s_notify_channel_order_changed(0, ch);
+		changed = 1;
+	}
+	if (ch->max_users != db_ch->max_users) {
+		ch->max_users = db_ch->max_users;
+		s_notify_channel_max_users_changed(0, ch);
+		changed = 1;
+	}
+	if (ch->parent != NULL && db_ch->parent != NULL && ch->parent->db_id != db_ch->parent->db_id)
+		logger(LOG_WARN, "reload_channel : channel %s moved to another channel in the database, "
+				"it will be moved on the next restart.", ch->name);
+	return changed;
+}
+
+/**
+ * Create a channel of the database in the running server.
+ *
+ * @return the channel, or NULL
+ */
+static struct channel *reload_add_channel(struct server *s, struct channel *db_ch)
+{
+	struct channel *ch, *parent = NULL;
+
+	if (db_ch->parent != NULL) {
+		parent = get_channel_by_db_id(s, db_ch->parent->db_id);
+		if (parent == NULL || parent->parent != NULL) {
+			logger(LOG_WARN, "reload_add_channel : no parent for the subchannel %s.", db_ch->name);
+			return NULL;
+		}
+	}
+	ch = new_channel(s->arena, db_ch->name, db_ch->topic, db_ch->desc, db_ch->flags, db_ch->codec,
+			db_ch->sort_order, db_ch->max_users);
+	if (ch == NULL)
+		return NULL;
+	ch->db_id = db_ch->db_id;
+	if (ch->flags & CHANNEL_FLAG_DEFAULT)
+		reload_set_default(s, ch);
+	add_channel(s, ch);
+	if (parent != NULL)
+		channel_add_subchannel(parent, ch);
+	s_notify_channel_created(ch, 0);
+	return ch;
+}
+
+/**
+ * Remove a channel that is not in the database anymore. A channel
+ * with players or subchannels stays, unregistered.
+ */
+static void reload_remove_channel(struct server *s, struct channel *ch, struct reload_stats *st)
+{
+	if (ch->players.count > 0 || ch->subchannels.count > 0) {
+		ch->flags |= CHANNEL_FLAG_UNREGISTERED;
+		ch->db_id = 0;
+		s_notify_channel_flags_codec_changed(0, ch);
+		logger(LOG_INFO, "Channel %s is not in the database anymore but is not empty, it is now unregistered.",
+				ch->name);
+		st->chans_changed++;
+		return;
+	}
+	s_notify_channel_deleted(s, ch->id);
+	if (ch->parent != NULL)
+		channel_remove_subchannel(ch->parent, ch);
+	destroy_channel_by_id(s, ch->id);
+	st->chans_removed++;
+}
+
+/**
+ * Make the privileges of the registrations in a channel
+ * the same as in the database.
+ *
+ * @return the number of privileges changed
+ */
+static int reload_privileges(struct channel *ch, struct channel *db_ch, struct reload_table *regs)
+{
+	struct player_channel_privilege *priv, *db_priv, *next;
+	struct registration *r;
+	int changed = 0;
+
+	il_each(priv, next, &ch->pl_privileges, ch_link)
+		if (priv->reg != PL_CH_PRIV_REGISTERED)
+			continue;
+		db_priv = find_privilege(db_ch, priv->pl_or_reg.reg->db_id);
+		if (db_priv == NULL) {
+			priv_list_remove(&ch->pl_privileges, priv);
+			destroy_player_channel_privilege(priv);
+			changed++;
+		} else if ((priv->flags & DB_PRIV_FLAGS) != (db_priv->flags & DB_PRIV_FLAGS)) {
+			priv->flags = (priv->flags & ~DB_PRIV_FLAGS) | (db_priv->flags & DB_PRIV_FLAGS);
+			changed++;
+		}
+	il_end_each;
+	il_each(db_priv, next, &db_ch->pl_privileges, ch_link)
+		if (find_privilege(ch, db_priv->pl_or_reg.reg->db_id) != NULL)
+			continue;
+		r = find_registration(regs, db_priv->pl_or_reg.reg->db_id);
+		priv = new_player_channel_privilege(ch->arena);
+		if (r == NULL || priv == NULL) {
+			if (priv != NULL)
+				destroy_player_channel_privilege(priv);
+			continue;
+		}
+		priv->db_id = db_priv->db_id;
+		priv->ch = ch;
+		priv->flags = db_priv->flags;
+		pl_chan_priv_set_registration(priv, r);
+		add_player_channel_privilege(ch, priv);
+		changed++;
+	il_end_each;
+	return changed;
+}
+
+/**
+ * Update, add and remove the channels and the privileges
+ * of the registrations in these channels.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int reload_channels(struct server *s, struct server *db_s, struct reload_stats *st)
+{
+	struct reload_table live, db, regs;
+	struct channel *ch, *db_ch;
+	size_t i;
+	int pass;
+
+	if (!reload_channel_table(&live, s))
+		return 0;
+	if (!reload_channel_table(&db, db_s)) {
+		free(live.el);
+		return 0;
+	}
+	/* the channels, then the subchannels (their parent may be new) */
+	for (pass = 0 ; pass < 2 ; pass++) {
+		for (i = 0 ; i < db.nb ; i++) {
+			db_ch = (struct channel *)db.el[i];
+			if ((db_ch->parent != NULL) != pass)
+				continue;
+			ch = find_channel(&live, db_ch->db_id);
+			if (ch == NULL) {
+				if (reload_add_channel(s, db_ch) != NULL)
+					st->chans_added++;
+			} else if (reload_channel(s, ch, db_ch)) {
+				st->chans_changed++;
+			}
+		}
+	}
+	free(live.el);
+
+	/* the privileges, once the channels and registrations are there */
+	if (!reload_channel_table(&live, s)) {
+		free(db.el);
+		return 0;
+	}
+	if (!reload_registration_table(&regs, s)) {
+		free(live.el);
+		free(db.el);
+		return 0;
+	}
+	for (i = 0 ; i < live.nb ; i++) {
+		ch = (struct channel *)live.el[i];
+		db_ch = find_channel(&db, ch->db_id);
+		if (db_ch != NULL)
+			st->privs += reload_privileges(ch, db_ch, &regs);
+	}
+	free(regs.el);
+
+	/* the subchannels before their parent */
+	for (pass = 1 ; pass >= 0 ; pass--) {
+		for (i = 0 ; i < live.nb ; i++) {
+			ch = (struct channel *)live.el[i];
+			if (ch == NULL || (ch->parent != NULL) != pass)
+				continue;
+			if (find_channel(&db, ch->db_id) == NULL)
+				reload_remove_channel(s, ch, st);
+			/* may be destroyed */
+			live.el[i] = NULL;
+		}
+	}
+	free(live.el);
+	free(db.el);
+	return 1;
+}
+
+/**
+ * Apply the differences between a running server and the same
+ * server loaded from the database. The server must be locked.
+ */
+static void reload_server(struct server *s, struct server *db_s)
+{
+	struct reload_stats st;
+
+	bzero(&st, sizeof(st));
+	reload_server_attributes(s, db_s, &st);
+	if (!reload_registrations(s, db_s, &st) || !reload_channels(s, db_s, &st))
+		logger(LOG_WARN, "reload_server : server %i was only partially reloaded.", s->id);
+	audio_path_update(s);
+
+	if (st.server || st.chans_added || st.chans_changed || st.chans_removed
+			|| st.regs_added || st.regs_changed || st.regs_removed || st.privs)
+		logger(LOG_INFO, "Server %i reloaded : %s%i channels added, %i changed, %i removed, "
+				"%i registrations added, %i changed, %i removed, %i privileges changed.",
+				s->id, st.server ? "settings changed, " : "",
+				st.chans_added, st.chans_changed, st.chans_removed,
+				st.regs_added, st.regs_changed, st.regs_removed, st.privs);
+}
+
+/**
+ * Stop a running server and free it. No server may be locked : its
+ * reactor may be waiting for the lock of another server.
+ */
+static void reload_retire_server(struct config *c, struct server *s)
+{
+	server_stop(s);
+	server_join(s);
+	free(s);
+	/* server_stop resets the logger */
+	set_config(c);
+}
+
+static struct server *find_server(struct array *ss, uint32_t id)
+{
+	struct server *s;
+	size_t iter;
+
+	ar_each(struct server *, s, iter, ss)
+		if (s->id == id)
+			return s;
+	ar_end_each;
+	return NULL;
+}
+
+/**
+ * Apply the database to the running servers. They are all locked,
+ * and all unlocked on return.
+ */
+static void reload_apply(struct config *c, struct array *ss, struct array *db_ss)
+{
+	struct server *s, *db_s;
+	size_t iter;
+
+	ar_each(struct server *, s, iter, ss)
+		db_s = find_server(db_ss, s->id);
+		if (db_s != NULL && db_s->port == s->port)
+			reload_server(s, db_s);
+		pthread_rwlock_unlock(&s->lock);
+	ar_end_each;
+	/* the servers to stop, once the others are unlocked */
+	ar_each(struct server *, s, iter, ss)
+		db_s = find_server(db_ss, s->id);
+		if (db_s == NULL) {
+			logger(LOG_INFO, "Server %i is not active anymore, stopping it.", s->id);
+		} else if (db_s->port != s->port) {
+			logger(LOG_INFO, "Server %i moved from port %i to %i, restarting it.",
+					s->id, s->port, db_s->port);
+		} else {
+			continue;
+		}
+		ar_remove(ss, s);
+		reload_retire_server(c, s);
+	ar_end_each;
+
+	/* the new servers, and the ones that changed port */
+	ar_each(struct server *, db_s, iter, db_ss)
+		if (find_server(ss, db_s->id) == NULL) {
+			ar_remove(db_ss, db_s);
+			ar_insert(ss, db_s);
+			server_start(db_s);
+			logger(LOG_INFO, "Server %i started on port %i.", db_s->id, db_s->port);
+		}
+	ar_end_each;
+}
+
+/**
+ * Load the database and apply it to the running servers. The database
+ * must be read when it has all the writes made so far, and no write
+ * must be made before the servers are locked, it is retried otherwise.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int reload_servers(struct config *c, struct array *ss)
+{
+	struct db_writer_stats before, after;
+	struct array *db_ss;
+	struct server *s;
+	size_t iter;
+	dbi_conn conn;
+	int tries, done = 0;
+
+	conn = db_connect_new(c);
+	if (conn == NULL) {
+		logger(LOG_WARN, "reload_servers : no database connection.");
+		return 0;
+	}
+	for (tries = 0 ; tries < RELOAD_TRIES && !done ; tries++) {
+		if (tries > 0)
+			usleep(RELOAD_WAIT);
+		db_writer_get_stats(c, &before);
+		if (before.written != before.submitted)
+			continue;
+		db_ss = ar_new(4);
+		db_create_servers(c, conn, db_ss);
+		if (db_ss->used_slots == 0 || db_create_all(conn, db_ss)) {
+			ar_each(struct server *, s, iter, ss)
+				pthread_rwlock_wrlock(&s->lock);
+			ar_end_each;
+			db_writer_get_stats(c, &after);
+			if (after.submitted == before.submitted) {
+				reload_apply(c, ss, db_ss);
+				done = 1;
+			} else {
+				/* modified meanwhile */
+				ar_each(struct server *, s, iter, ss)
+					pthread_rwlock_unlock(&s->lock);
+				ar_end_each;
+			}
+		} else {
+			tries = RELOAD_TRIES;
+		}
+		ar_each(struct server *, s, iter, db_ss)
+			ar_remove(db_ss, s);
+			destroy_server(s);
+		ar_end_each;
+		ar_free(db_ss);
+	}
+	dbi_conn_close(conn);
+	return done;
+}
+
+/**
+ * Tell if a setting that can not be changed while running differs.
+ *
+ * @return the name of the setting, or NULL
+ */
+static char *reload_needs_restart(struct config *c, struct config *new)
+{
+	if (!same_str(c->db_type, new->db_type))
+		return "db.type";
+	if (strcmp(c->db_type, "sqlite") == 0 || strcmp(c->db_type, "sqlite3") == 0) {
+		if (!same_str(c->db.file.path, new->db.file.path) || !same_str(c->db.file.db, new->db.file.db))
+			return "db.dir/db.db";
+	} else if (!same_str(c->db.connection.host, new->db.connection.host)
+			|| c->db.connection.port != new->db.connection.port
+			|| !same_str(c->db.connection.user, new->db.connection.user)
+			|| !same_str(c->db.connection.pass, new->db.connection.pass)
+			|| !same_str(c->db.connection.db, new->db.connection.db)) {
+		return "db connection";
+	}
+	if (c->db_async != new->db_async)
+		return "db.async";
+	if (c->net.mode != new->net.mode)
+		return "net.mode";
+	if (c->net.io != new->net.io)
+		return "net.io";
+	if (c->net.recv_threads != new->net.recv_threads)
+		return "net.receive_threads";
+	if (c->net.reactor_threads != new->net.reactor_threads)
+		return "net.reactor_threads";
+	if (c->net.audio_thread != new->net.audio_thread)
+		return "net.audio_thread";
+	if (!same_str(c->net.handoff, new->net.handoff))
+		return "net.handoff_socket";
+	if (!same_str(c->log.trace, new->log.trace) || c->log.trace_records != new->log.trace_records)
+		return "log.trace";
+	return NULL;
+}
+
+/**
+ * Reload the configuration file and the servers without stopping
+ * them. The snapshot threads are stopped meanwhile.
+ *
+ * @param c the running configuration
+ * @param filename the configuration file
+ * @param ss the running servers
+ *
+ * @return 1 if the reload is done, 0 if everything must be restarted
+ */
+int reload_config(struct config *c, char *filename, struct array *ss)
+{
+	struct timeval start, end, diff;
+	struct config *new;
+	char *setting;
+	FILE *old;
+
+	gettimeofday(&start, NULL);
+	new = config_parse(filename);
+	if (new == NULL) {
+		logger(LOG_WARN, "reload_config : could not read %s, the configuration is unchanged.", filename);
+		return 1;
+	}
+	setting = reload_needs_restart(c, new);
+	if (setting != NULL) {
+		logger(LOG_INFO, "%s changed, restarting the servers.", setting);
+		if (new->log.output != stdout && new->log.output != stderr)
+			fclose(new->log.output);
+		destroy_config(new);
+		return 0;
+	}
+
+	snapshot_stop();
+	old = set_log(new->log.level, new->log.output);
+	if (old != NULL && old != stdout && old != stderr && old != new->log.output)
+		fclose(old);
+	c->db_batch = new->db_batch;
+	c->db_load_threads = new->db_load_threads;
+	free(c->db_snapshot);
+	c->db_snapshot = new->db_snapshot;
+	new->db_snapshot = NULL;
+	c->db_snapshot_interval = new->db_snapshot_interval;
+	/* the exporter is restarted by the caller */
+	free(c->net.metrics);
+	c->net.metrics = new->net.metrics;
+	new->net.metrics = NULL;
+	destroy_config(new);
+
+	if (!reload_servers(c, ss))
+		logger(LOG_WARN, "reload_config : the servers could not be reloaded from the database.");
+	snapshot_start(c, ss, 0);
+
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	logger(LOG_INFO, "Configuration reloaded in %li ms.", diff.tv_sec * 1000 + diff.tv_usec / 1000);
+	return 1;
+}
@@ -16,25 +16,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "player_stat.h"
-#include "log.h"
+#ifndef __RELOAD_H__
+#define __RELOAD_H__
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <errno.h>
-#include <string.h>
+#include "configuration.h"
+#include "array.h"
 
-/**
- * Allocate a new player stat structure
- */
-struct player_stat *new_plstat()
-{
-	struct player_stat *ps;
+int reload_config(struct config *c, char *filename, struct array *ss);
 
-	ps = (struct player_stat *)calloc(1, sizeof(struct player_stat));
-	if (ps == NULL) {
-		logger(LOG_WARN, "new_plstat, calloc failed : %s.", strerror(errno));
-		return NULL;
-	}
-	return ps;
-}
+#endif
@@ -0,0 +1,191 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary serialization : a growing buffer written in little endian,
+ * and a reader checking every read against the end of the data. An
+ * error (allocation, truncated data) is remembered in err and the
+ * following calls do nothing.
+ */
+
+#include "serial.h"
+#include "compat.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Make room for len more bytes in the buffer.
+ *
+ * @param b the buffer
+ * @param len the number of bytes
+ *
+ * @return 1 on success, 0 on failure
+ */
+int sb_reserve(struct serial_buf *b, size_t len)
+{
+	size_t size;
+	char *data;
+
+	if (b->err)
+		return 0;
+	if (b->len + len <= b->size)
+		return 1;
+	size = (b->size == 0) ? 4096 : b->size;
+	while (size < b->len + len)
+		size *= 2;
+	data = (char *)realloc(b->data, size);
+	if (data == NULL) {
+		logger(LOG_ERR, "sb_reserve, realloc failed : %s.", strerror(errno));
+		b->err = 1;
+		return 0;
+	}
+	b->data = data;
+	b->size = size;
+	return 1;
+}
+
+void sb_u32(struct serial_buf *b, uint32_t val)
+{
+	char *ptr;
+
+	if (sb_reserve(b, 4)) {
+		ptr = b->data + b->len;
+		wu32(val, &ptr);
+		b->len += 4;
+	}
+}
+
+void sb_u64(struct serial_buf *b, uint64_t val)
+{
+	char *ptr;
+
+	if (sb_reserve(b, 8)) {
+		ptr = b->data + b->len;
+		wu64(val, &ptr);
+		b->len += 8;
+	}
+}
+
+void sb_u16(struct serial_buf *b, uint16_t val)
+{
+	char *ptr;
+
+	if (sb_reserve(b, 2)) {
+		ptr = b->data + b->len;
+		wu16(val, &ptr);
+		b->len += 2;
+	}
+}
+
+void sb_u8(struct serial_buf *b, uint8_t val)
+{
+	char *ptr;
+
+	if (sb_reserve(b, 1)) {
+		ptr = b->data + b->len;
+		wu8(val, &ptr);
+		b->len += 1;
+	}
+}
+
+void sb_bytes(struct serial_buf *b, const void *data, size_t len)
+{
+	if (sb_reserve(b, len)) {
+		memcpy(b->data + b->len, data, len);
+		b->len += len;
+	}
+}
+
+void sb_str(struct serial_buf *b, const char *str)
+{
+	size_t len = (str == NULL) ? 0 : MIN(strlen(str), 0xFFFF);
+
+	sb_u16(b, len);
+	sb_bytes(b, str, len);
+}
+
+/**
+ * Check that len bytes are left to read.
+ *
+ * @param r the reader
+ * @param len the number of bytes
+ *
+ * @return 1 if they are, 0 otherwise
+ */
+int sr_check(struct serial_reader *r, size_t len)
+{
+	if (r->err || (size_t)(r->end - r->ptr) < len) {
+		r->err = 1;
+		return 0;
+	}
+	return 1;
+}
+
+uint32_t sr_u32(struct serial_reader *r)
+{
+	return sr_check(r, 4) ? ru32(&r->ptr) : 0;
+}
+
+uint64_t sr_u64(struct serial_reader *r)
+{
+	return sr_check(r, 8) ? ru64(&r->ptr) : 0;
+}
+
+uint16_t sr_u16(struct serial_reader *r)
+{
+	return sr_check(r, 2) ? ru16(&r->ptr) : 0;
+}
+
+uint8_t sr_u8(struct serial_reader *r)
+{
+	return sr_check(r, 1) ? ru8(&r->ptr) : 0;
+}
+
+/* copy a string to a buffer of size bytes (truncated if needed) */
+void sr_str(struct serial_reader *r, char *dst, size_t size)
+{
+	uint16_t len = sr_u16(r);
+
+	dst[0] = '\0';
+	if (!sr_check(r, len))
+		return;
+	memcpy(dst, r->ptr, MIN(len, size - 1));
+	dst[MIN(len, size - 1)] = '\0';
+	r->ptr += len;
+}
+
+/* copy a string to a new buffer */
+char *sr_strdup(struct serial_reader *r)
+{
+	uint16_t len = sr_u16(r);
+	char *str;
+
+	if (!sr_check(r, len))
+		return NULL;
+	str = strndup(r->ptr, len);
+	if (str == NULL) {
+		logger(LOG_ERR, "sr_strdup, strndup failed : %s.", strerror(errno));
+		r->err = 1;
+		return NULL;
+	}
+	r->ptr += len;
+	return str;
+}
@@ -0,0 +1,58 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* a growing buffer */
+struct serial_buf
+{
+	char *data;
+	size_t len;
+	size_t size;
+	int err;
+};
+
+/* reads a part of a buffer */
+struct serial_reader
+{
+	char *ptr;
+	char *end;
+	int err;
+};
+
+int sb_reserve(struct serial_buf *b, size_t len);
+void sb_u64(struct serial_buf *b, uint64_t val);
+void sb_u32(struct serial_buf *b, uint32_t val);
+void sb_u16(struct serial_buf *b, uint16_t val);
+void sb_u8(struct serial_buf *b, uint8_t val);
+void sb_bytes(struct serial_buf *b, const void *data, size_t len);
+void sb_str(struct serial_buf *b, const char *str);
+
+int sr_check(struct serial_reader *r, size_t len);
+uint64_t sr_u64(struct serial_reader *r);
+uint32_t sr_u32(struct serial_reader *r);
+uint16_t sr_u16(struct serial_reader *r);
+uint8_t sr_u8(struct serial_reader *r);
+void sr_str(struct serial_reader *r, char *dst, size_t size);
+char *sr_strdup(struct serial_reader *r);
+
+#endif
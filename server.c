@@ -19,12 +19,14 @@
 #include "server.h"
 #include "server_stat.h"
 #include "channel.h"
-#include "main_serv.h"
+#include "packet_dispatch.h"
 #include "registration.h"
 #include "log.h"
 #include "packet_sender.h"
 #include "queue.h"
 #include "control_packet.h"
+#include "audio_packet.h"
+#include "qsbr.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +42,9 @@
 #include <openssl/sha.h>
 #include <unistd.h>
 #include <dbi/dbi.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #ifdef HAVE_LIBBSD
 #include <bsd/bsd.h>
@@ -47,6 +52,9 @@
 
 #define MAX_MSG 1024
 
+/* the receiving threads look the players up without the lock */
+IH_GENERATE(pl_hash, player, id_link, public_id, qsbr_free);
+
 static void get_machine_name(struct server *s)
 {
 	struct utsname mc;
@@ -91,9 +99,15 @@ struct server *new_server()
 		logger(LOG_WARN, "new_server, calloc failed : %s.", strerror(errno));
 		return NULL;
 	}
+	serv->arena = arena_new();
+	if (serv->arena == NULL) {
+		free(serv);
+		return NULL;
+	}
 
 	serv->chans = ar_new(4);
 	serv->players = ar_new(8);
+	pl_hash_init(&serv->players_by_id);
 	serv->bans = ar_new(4);
 	serv->regs = ar_new(8);
 	serv->leaving_players = ar_new(8);
@@ -104,10 +118,37 @@ struct server *new_server()
 
 	/* Initialize the semaphore for packets that have to be sent */
 	sem_init(&serv->send_packets, 0, 0);
+	pthread_rwlock_init(&serv->lock, NULL);
 
 	return serv;
 }
 
+/**
+ * Free a server that was never started. The state of a started
+ * server is freed by server_stop and server_join. Its channels,
+ * registrations, bans and privileges go with its arena.
+ *
+ * @param s the server
+ */
+void destroy_server(struct server *s)
+{
+	ar_clear(s->chans);
+	ar_free(s->chans);
+	ar_clear(s->regs);
+	ar_free(s->regs);
+	ar_free(s->players);
+	pl_hash_free(&s->players_by_id);
+	ar_free(s->leaving_players);
+	ar_clear(s->bans);
+	ar_free(s->bans);
+	arena_destroy(s->arena);
+	destroy_sstat(s->stats);
+	destroy_sp(s->privileges);
+	sem_destroy(&s->send_packets);
+	pthread_rwlock_destroy(&s->lock);
+	free(s);
+}
+
 /**
  * Add a channel to the channel list
  *
@@ -122,13 +163,17 @@ int add_channel(struct server *serv, struct channel *chan)
 {
 	uint32_t new_id;
 	struct channel *tmp_chan;
-	char *used_ids;
+	char *used_ids = NULL;
 	size_t iter;
 	
-	used_ids = (char *)calloc(serv->chans->total_slots, sizeof(char));
-	if (used_ids == NULL) {
-		logger(LOG_WARN, "add_channel, used_ids allocation failed : %s.", strerror(errno));
-		return 0;
+	/* The channels use all the ids up to the bound : the next one is free.
+	 * This is always the case when the servers are loaded. */
+	if (serv->chan_id_bound != serv->chans->used_slots) {
+		used_ids = (char *)calloc(serv->chans->used_slots + 1, sizeof(char));
+		if (used_ids == NULL) {
+			logger(LOG_WARN, "add_channel, used_ids allocation failed : %s.", strerror(errno));
+			return 0;
+		}
 	}
 
 	/* If there is no channel, make this channel the default one */
@@ -144,14 +189,25 @@ int add_channel(struct server *serv, struct channel *chan)
 	}
 	
 	/* Find the next available ID */
-	ar_each(struct channel *, tmp_chan, iter, serv->chans)
-		used_ids[tmp_chan->id - 1] = 1;	/* id -1  -> ID start at 1 */
-	ar_end_each;
+	if (used_ids == NULL) {
+		new_id = serv->chan_id_bound + 1;
+	} else {
+		serv->chan_id_bound = 0;
+		/* one of the used_slots + 1 first ids is free */
+		ar_each(struct channel *, tmp_chan, iter, serv->chans)
+			if (tmp_chan->id <= serv->chans->used_slots + 1)
+				used_ids[tmp_chan->id - 1] = 1;	/* id -1  -> ID start at 1 */
+			if (tmp_chan->id > serv->chan_id_bound)
+				serv->chan_id_bound = tmp_chan->id;
+		ar_end_each;
 
-	new_id = 0;
-	while(new_id < serv->chans->total_slots && used_ids[new_id] == 1)
-		new_id++;
-	new_id += 1;	/* ID start at 1 */
+		new_id = 0;
+		while(used_ids[new_id] == 1)
+			new_id++;
+		new_id += 1;	/* ID start at 1 */
+	}
+	if (new_id > serv->chan_id_bound)
+		serv->chan_id_bound = new_id;
 	
 	/* set ID and insert into that slot */
 	chan->id = new_id;
@@ -186,6 +242,11 @@ struct channel *get_channel_by_id(struct server *serv, uint32_t id)
 	return NULL;
 }
 
+static void retire_channel(void *ch)
+{
+	destroy_channel((struct channel *)ch);
+}
+
 /**
  * Destroys a channel given it's ID
  *
@@ -201,8 +262,11 @@ int destroy_channel_by_id(struct server *serv, uint32_t id)
 	
 	ar_each(struct channel *, tmp_chan, iter, serv->chans)
 		if(tmp_chan->id == id) {
-			destroy_channel(tmp_chan);
 			ar_remove(serv->chans, tmp_chan);
+			channel_unlink(tmp_chan);
+			audio_path_changed(serv);
+			/* a player handled without the lock may still be in it */
+			qsbr_retire(&tmp_chan->retired, tmp_chan, &retire_channel);
 			return 1;
 		}
 	ar_end_each;
@@ -229,7 +293,7 @@ struct channel *get_default_channel(struct server *serv)
 	ar_end_each;
 
 	/* If no default channel exists, we create one ! */
-	new_chan =  new_channel("Default", "Default channel", "This is the default channel", 
+	new_chan =  new_channel(serv->arena, "Default", "Default channel", "This is the default channel", 
 		CHANNEL_FLAG_DEFAULT | (0 & ~CHANNEL_FLAG_UNREGISTERED), CODEC_SPEEX_16_3, 0, 16);
 	add_channel(serv, new_chan);
 	return new_chan;
@@ -265,15 +329,21 @@ int add_player(struct server *serv, struct player *pl)
 	size_t iter;
 	
 	def_chan = get_default_channel(serv);
-	
-	/* Find the next available public ID */
-	used_ids = (char *)calloc(serv->players->total_slots, sizeof(char));
+	if (def_chan == NULL) {
+		logger(LOG_WARN, "add_player : the server has no default channel.");
+		return 0;
+	}
+
+	/* Find the next available public ID (one of the
+	 * used_slots + 1 first is free) */
+	used_ids = (char *)calloc(serv->players->used_slots + 1, sizeof(char));
 	if (used_ids == NULL) {
 		logger(LOG_WARN, "add_player, used_ids allocation failed : %s.", strerror(errno));
 		return 0;
 	}
 	ar_each(struct player *, tmp_pl, iter, serv->players)
-		used_ids[tmp_pl->public_id - 1] = 1;	/* ID start at 1 */
+		if (tmp_pl->public_id <= serv->players->used_slots + 1)
+			used_ids[tmp_pl->public_id - 1] = 1;	/* ID start at 1 */
 	ar_end_each;
 
 	new_id = 0;
@@ -287,13 +357,29 @@ int add_player(struct server *serv, struct player *pl)
 #else
 	pl->private_id = random();
 #endif
+	free(used_ids);
+
+	/* The channel first : a player that is not in the pool is
+	 * not seen by the other threads if the insertion fails */
+	if (!add_player_to_channel(def_chan, pl)) {
+		logger(LOG_INFO, "add_player : the default channel is full.");
+		return 0;
+	}
 	/* Find next slot in the array */
-	ar_insert(serv->players, pl);
+	if (ar_insert(serv->players, pl) != AR_OK) {
+		pl_list_remove(&def_chan->players, pl);
+		pl->in_chan = NULL;
+		return 0;
+	}
+	if (!pl_hash_insert(&serv->players_by_id, pl)) {
+		ar_remove(serv->players, pl);
+		pl_list_remove(&def_chan->players, pl);
+		pl->in_chan = NULL;
+		return 0;
+	}
 
 	serv->stats->total_logins++;
-
-	free(used_ids);
-	return add_player_to_channel(def_chan, pl);
+	return 1;
 }
 
 /**
@@ -308,13 +394,10 @@ int add_player(struct server *serv, struct player *pl)
 struct player *get_player_by_ids(struct server *s, uint32_t pub_id, uint32_t priv_id)
 {
 	struct player *pl;
-	size_t iter;
 
-	ar_each(struct player *, pl, iter, s->players)
-		if (pl->public_id == pub_id && pl->private_id == priv_id) {
-			return pl;
-		}
-	ar_end_each;
+	pl = pl_hash_find(&s->players_by_id, pub_id);
+	if (pl != NULL && pl->private_id == priv_id)
+		return pl;
 
 	return NULL;
 }
@@ -334,25 +417,49 @@ struct player *get_leaving_player_by_ids(struct server *s, uint32_t pub_id, uint
 }
 
 /**
- * Retrieve a player with its public id.
+ * Retrieve a player with its ids, without holding the server lock.
+ * The lookup is done without lock first, then again with the read
+ * lock if it missed (the table may have been growing). The caller
+ * is in a read section (see qsbr.h), the player stays valid until
+ * its qsbr_leave.
  *
  * @param s the server
  * @param pub_id the public id of the player
+ * @param priv_id the private id of the player
+ * @param leaving also look in the players that are leaving
  *
  * @return the player if it was found, a NULL pointer if it failed.
  */
-struct player *get_player_by_public_id(struct server *s, uint32_t pub_id)
+struct player *get_player_lockless(struct server *s, uint32_t pub_id, uint32_t priv_id, int leaving)
 {
 	struct player *pl;
-	size_t iter;
 
-	ar_each(struct player *, pl, iter, s->players)
-		if (pl->public_id == pub_id) {
-			return pl;
-		}
-	ar_end_each;
+	pl = get_player_by_ids(s, pub_id, priv_id);
+	if (pl != NULL)
+		return pl;
+	/* not in the read section while waiting for the lock, and
+	 * nothing is retired while it is held */
+	qsbr_leave();
+	pthread_rwlock_rdlock(&s->lock);
+	pl = get_player_by_ids(s, pub_id, priv_id);
+	if (pl == NULL && leaving)
+		pl = get_leaving_player_by_ids(s, pub_id, priv_id);
+	qsbr_enter();
+	pthread_rwlock_unlock(&s->lock);
+	return pl;
+}
 
-	return NULL;
+/**
+ * Retrieve a player with its public id.
+ *
+ * @param s the server
+ * @param pub_id the public id of the player
+ *
+ * @return the player if it was found, a NULL pointer if it failed.
+ */
+struct player *get_player_by_public_id(struct server *s, uint32_t pub_id)
+{
+	return pl_hash_find(&s->players_by_id, pub_id);
 }
 
 /**
@@ -363,39 +470,35 @@ struct player *get_player_by_public_id(struct server *s, uint32_t pub_id)
  */
 void remove_player(struct server *s, struct player *p)
 {
-	size_t iter, iter2;
-	struct player_channel_privilege *priv;
-	struct channel *ch;
+	size_t iter;
+	struct player_channel_privilege *priv, *next;
 	struct player *tmp_pl;
 
 	/* remove from the server */
 	ar_remove(s->players, (void *)p);
+	pl_hash_remove(&s->players_by_id, p);
 	/* add to a temporary "leaving" list */
 	ar_insert(s->leaving_players, (void *)p);
 	/* remove from the channel */
-	ar_remove(p->in_chan->players, (void *)p);
+	pl_list_remove(&p->in_chan->players, p);
 	p->in_chan = NULL;
-	/* remove the channel privileges */
-	ar_each(struct channel *, ch, iter, s->chans)
-		if (ch->flags & CHANNEL_FLAG_UNREGISTERED
-				|| !(p->global_flags & GLOBAL_FLAG_REGISTERED)) {
-			ar_each(struct player_channel_privilege *, priv, iter2, ch->pl_privileges)
-				if (priv->reg == PL_CH_PRIV_UNREGISTERED && priv->ch == ch && priv->pl_or_reg.pl == p) {
-					ar_remove(ch->pl_privileges, priv);
-					free(priv);
-				}
-			ar_end_each;
-		}
-	ar_end_each;
+	audio_path_changed(s);
+	/* remove the channel privileges that point to him
+	 * (destroying them also drops them from p->ch_privileges) */
+	il_each(priv, next, &p->ch_privileges, pl_link)
+		priv_list_remove(&priv->ch->pl_privileges, priv);
+		destroy_player_channel_privilege(priv);
+	il_end_each;
 
 	/* remove from all the people who muted him */
-	ar_each(struct player *, tmp_pl, iter, s->players)
-		if (ar_has(tmp_pl->muted, p))
-			ar_remove(tmp_pl->muted, p);
+	ar_each(struct player *, tmp_pl, iter, p->muted_by)
+		ar_remove(tmp_pl->muted, p);
+		ar_remove(p->muted_by, tmp_pl);
 	ar_end_each;
 
 	/* remove from him all the people he muted */
 	ar_each(struct player *, tmp_pl, iter, p->muted)
+		ar_remove(tmp_pl->muted_by, p);
 		ar_remove(p->muted, tmp_pl);
 	ar_end_each;
 
@@ -423,14 +526,12 @@ int move_player(struct player *p, struct channel *to)
 		return add_player_to_channel(to, p);
 	}
 
+	/* a player is in one list of players at a time */
 	old = p->in_chan;
-	if (ar_insert(to->players, (void *)p) == AR_OK) {
-		ar_remove(old->players, (void *)p);
-		p->in_chan = to;
-		return 1;
-	}
-
-	/* put inside the new channel */
+	pl_list_remove(&old->players, p);
+	pl_list_insert(&to->players, p);
+	p->in_chan = to;
+	audio_path_changed(to->in_server);
 	return 1;
 }
 
@@ -450,13 +551,14 @@ int add_ban(struct server *s, struct ban *b)
 	size_t iter;
 
 	/* Find the next available public ID */
-	used_ids = (char *)calloc(s->bans->total_slots, sizeof(char));
+	used_ids = (char *)calloc(s->bans->used_slots + 1, sizeof(char));
 	if (used_ids == NULL) {
-		logger(LOG_WARN, "add_player, used_ids allocation failed : %s.", strerror(errno));
+		logger(LOG_WARN, "add_ban, used_ids allocation failed : %s.", strerror(errno));
 		return 0;
 	}
 	ar_each(struct ban *, tmp_b, iter, s->bans)
-		used_ids[tmp_b->id - 1] = 1;	/* ID start at 1 */
+		if (tmp_b->id <= s->bans->used_slots + 1)
+			used_ids[tmp_b->id - 1] = 1;	/* ID start at 1 */
 	ar_end_each;
 
 	new_id = 0;
@@ -571,16 +673,80 @@ void print_server(struct server *s)
 	ar_end_each;
 }
 
-static void *server_run(void *args)
+/**
+ * Receive one packet on a socket of the server and handle it.
+ *
+ * @param w the receiving socket
+ * @param flags the flags given to recvfrom (MSG_DONTWAIT...)
+ *
+ * @return the size of the packet, -1 if nothing was received
+ */
+int server_recv_packet(struct recv_worker *w, int flags)
 {
-	struct server *s = (struct server *)args;
 	struct sockaddr_in cli_addr;
-	int n, pollres;
 	unsigned int cli_len;
 	char data[MAX_MSG];
+	int n;
+
+	cli_len = sizeof(cli_addr);
+	n = recvfrom(w->socket_desc, data, MAX_MSG, flags,
+			(struct sockaddr *) &cli_addr, &cli_len);
+	if (n == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			logger(LOG_ERR, "%s", strerror(errno));
+	} else {
+		logger(LOG_INFO, "%i bytes received.", n);
+		handle_packet(data, n, &cli_addr, cli_len, w->s);
+	}
+	return n;
+}
 
+/**
+ * Send a packet from the server. From a receiving thread using
+ * io_uring, the packet is queued and sent with the next batch.
+ * A server without socket gives it to its output.
+ *
+ * @param s the server
+ * @param buf the packet
+ * @param len the size of the packet
+ * @param addr the destination
+ * @param addr_len the size of the destination address
+ *
+ * @return the number of bytes sent (or queued), -1 on failure
+ */
+ssize_t server_sendto(struct server *s, const void *buf, size_t len,
+		struct sockaddr_in *addr, unsigned int addr_len)
+{
+	ssize_t ret;
+
+	if (s->output != NULL) {
+		s->output(s, buf, len, addr, s->output_arg);
+		ret = len;
+	} else if (uring_queue_send(buf, len, addr, addr_len) == 0) {
+		ret = len;
+	} else {
+		ret = sendto(s->socket_desc, buf, len, 0, (struct sockaddr *)addr, addr_len);
+		if (ret == -1)
+			return -1;
+	}
+	METRIC_INC(s, packets_out);
+	METRIC_ADD(s, bytes_out, ret);
+	return ret;
+}
+
+static void *server_run(void *args)
+{
+	struct recv_worker *w = (struct recv_worker *)args;
+	int pollres;
+
+	if (w->ring != NULL) {
+		uring_run(w);
+		/* io_uring failed, back to poll */
+		uring_destroy(w->ring);
+		w->ring = NULL;
+	}
 	while (1) {
-		pollres = poll(&s->socket_poll, 1, -1);
+		pollres = poll(&w->socket_poll, 1, -1);
 		switch(pollres) {
 		case 0:
 			logger(LOG_ERR, "Time limit expired");
@@ -589,53 +755,164 @@ static void *server_run(void *args)
 			logger(LOG_ERR, "Error occured while polling : %s", strerror(errno));
 			break;
 		default:
-			cli_len = sizeof(cli_addr);
-			n = recvfrom(s->socket_desc, data, MAX_MSG, 0,
-					(struct sockaddr *) &cli_addr, &cli_len);
-			if (n == -1) {
-				logger(LOG_ERR, "%s", strerror(errno));
-			} else {
-				logger(LOG_INFO, "%i bytes received.", n);
-				handle_packet(data, n, &cli_addr, cli_len, s);
-			}
+			server_recv_packet(w, 0);
 		}
 	}
 	return NULL;
 }
 
-void server_start(struct server *s)
+/**
+ * Open and bind a socket on the server port.
+ *
+ * @param s the server
+ * @param reuseport share the port with the other sockets of the server
+ *
+ * @return the socket
+ */
+static int server_open_socket(struct server *s, int reuseport)
 {
 	struct sockaddr_in serv_addr;
-	int rc, on;
+	int sd, rc, on;
 
 	/* socket creation */
-	s->socket_desc = socket(AF_INET, SOCK_DGRAM, 0);
-	ERROR_IF(s->socket_desc < 0);
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	ERROR_IF(sd < 0);
 	/* make the socket reusable */
 	on = 1;
-	setsockopt(s->socket_desc, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+	if (reuseport) {
+		rc = setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+		ERROR_IF(rc < 0);
+	}
+#endif
 	/* bind local server port */
+	memset(&serv_addr, 0, sizeof(serv_addr));
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
 	serv_addr.sin_port = htons(s->port);
-	rc = bind(s->socket_desc, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+	rc = bind(sd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
 	ERROR_IF(rc < 0);
 
-	/* initialize for polling */
-	s->socket_poll.fd = s->socket_desc;
-	s->socket_poll.events = POLLIN;
-	s->socket_poll.revents = 0;
+	return sd;
+}
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+/**
+ * Make the kernel always deliver the packets of a client to the
+ * same socket : socket index = (source address ^ source port) % sockets.
+ * The offsets are relative to the IPv4 header (without options).
+ *
+ * @param s the server
+ */
+static void server_attach_steering(struct server *s)
+{
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 12 },	/* A = source address */
+		{ BPF_ST, 0, 0, 0 },					/* M[0] = A */
+		{ BPF_LD | BPF_H | BPF_ABS, 0, 0, SKF_NET_OFF + 20 },	/* A = source port */
+		{ BPF_LDX | BPF_MEM, 0, 0, 0 },				/* X = M[0] */
+		{ BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },			/* A ^= X */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, s->nb_workers },	/* A %= number of sockets */
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (setsockopt(s->workers[0].socket_desc, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+				&prog, sizeof(prog)) < 0)
+		logger(LOG_WARN, "server_attach_steering : %s, using the kernel hash instead.", strerror(errno));
+}
+#endif
 
+/**
+ * Start the threads of a server (or give it to a reactor) once
+ * its sockets are open.
+ *
+ * @param s the server
+ */
+static void server_start_workers(struct server *s)
+{
+	int i;
 
-	pthread_create(&s->main_thread, NULL, &server_run, (void *)s);
+	s->socket_desc = s->workers[0].socket_desc;
+	if (s->conf->net.audio_thread && !audio_path_start(s))
+		logger(LOG_WARN, "Could not start the audio thread, audio is handled by the receiving threads.");
+
+	if (s->conf->net.mode == NET_MODE_REACTOR) {
+		ERROR_IF(reactor_add_server(s) == 0);
+		return;
+	}
+	for (i = 0 ; i < s->nb_workers ; i++) {
+		if (s->conf->net.io == NET_IO_URING)
+			s->workers[i].ring = uring_new(s->workers[i].socket_desc);
+		pthread_create(&s->workers[i].thread, NULL, &server_run, (void *)&s->workers[i]);
+	}
 	pthread_create(&s->packet_sender, NULL, &packet_sender_thread, (void *)s);
 }
 
+void server_start(struct server *s)
+{
+	int i;
+	struct recv_worker *w;
+
+	s->nb_workers = s->conf->net.recv_threads;
+	if (s->conf->net.mode == NET_MODE_REACTOR && s->nb_workers > 1) {
+		logger(LOG_WARN, "receive_threads is ignored in reactor mode.");
+		s->nb_workers = 1;
+	}
+#ifndef SO_REUSEPORT
+	if (s->nb_workers > 1) {
+		logger(LOG_WARN, "SO_REUSEPORT is not supported, using a single receiving thread.");
+		s->nb_workers = 1;
+	}
+#endif
+	s->workers = (struct recv_worker *)calloc(s->nb_workers, sizeof(struct recv_worker));
+	ERROR_IF(s->workers == NULL);
+
+	for (i = 0 ; i < s->nb_workers ; i++) {
+		w = &s->workers[i];
+		w->s = s;
+		w->socket_desc = server_open_socket(s, s->nb_workers > 1);
+		/* initialize for polling */
+		w->socket_poll.fd = w->socket_desc;
+		w->socket_poll.events = POLLIN;
+		w->socket_poll.revents = 0;
+	}
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	if (s->nb_workers > 1)
+		server_attach_steering(s);
+#endif
+	server_start_workers(s);
+}
+
+/**
+ * Start a server whose workers already have their sockets, handed
+ * off by the process that ran the server before.
+ *
+ * @param s the server
+ */
+void server_resume(struct server *s)
+{
+	int i;
+
+	for (i = 0 ; i < s->nb_workers ; i++) {
+		s->workers[i].s = s;
+		s->workers[i].socket_poll.fd = s->workers[i].socket_desc;
+		s->workers[i].socket_poll.events = POLLIN;
+		s->workers[i].socket_poll.revents = 0;
+	}
+	server_start_workers(s);
+}
+
+
 void server_stop(struct server *s)
 {
+	int i;
 	size_t iter;
 	struct player *tmp_pl;
-	void *el;
+	size_t reserved, used;
 
 	/* send exit requests to players */
 	//send_message_to_all(NULL, 0x00FF0000, "Server is stopping.");
@@ -646,43 +923,69 @@ void server_stop(struct server *s)
 	/* wait for all players to have been destroyed */
 	while(s->leaving_players->used_slots != 0);
 
-	/* cancel the main thread */
-	pthread_cancel(s->main_thread);
-	/* cancel the packet sender thread */
-	pthread_cancel(s->packet_sender);
+	if (s->workers == NULL) {
+		/* packets injected, no thread */
+	} else if (s->conf->net.mode == NET_MODE_REACTOR) {
+		/* the reactor stops serving this server */
+		reactor_remove_server(s);
+	} else {
+		/* cancel the receiving threads */
+		for (i = 0 ; i < s->nb_workers ; i++)
+			pthread_cancel(s->workers[i].thread);
+		/* cancel the packet sender thread */
+		pthread_cancel(s->packet_sender);
+	}
+	audio_path_stop(s);
+	/* the channels retired while a thread was reading
+	 * them go back to the arena before it is released */
+	qsbr_drain();
 
 	set_config(NULL);
 
-	/* destroy channels and channel list */
-	ar_each(void *, el, iter, s->chans)
-		ar_remove(s->chans, el);
-		destroy_channel(el);
-	ar_end_each;
+	/* destroy the lists, the channels, bans and
+	 * registrations are in the arena */
+	ar_clear(s->chans);
 	ar_free(s->chans);
-
-	/* destroy player list */
 	ar_free(s->players);
-	/* destroy leaving player list */
+	pl_hash_free(&s->players_by_id);
 	ar_free(s->leaving_players);
-	/* destroy bans and ban list */
-	ar_each(void *, el, iter, s->bans)
-		ar_remove(s->bans, el);
-		destroy_ban(el);
-	ar_end_each;
+	ar_clear(s->bans);
 	ar_free(s->bans);
-
-	/* destroy registrations and registration list */
-	ar_each(void *, el, iter, s->regs)
-		ar_remove(s->regs, el);
-		destroy_registration(el);
-	ar_end_each;
+	ar_clear(s->regs);
 	ar_free(s->regs);
 
+	arena_usage(s->arena, &reserved, &used);
+	logger(LOG_INFO, "Server %i : %zu bytes of persistent state in %zu bytes of arena.",
+			s->id, used, reserved);
+	arena_destroy(s->arena);
+
 	/* destroy server stats */
 	destroy_sstat(s->stats);
 	/* destroy server privileges */
 	destroy_sp(s->privileges);
 
-	/* close the socket */
-	close(s->socket_desc);
+	/* close the sockets */
+	for (i = 0 ; i < s->nb_workers ; i++)
+		close(s->workers[i].socket_desc);
+}
+
+/**
+ * Wait for the threads of a stopped server to end.
+ *
+ * @param s the server
+ */
+void server_join(struct server *s)
+{
+	int i;
+
+	if (s->conf->net.mode == NET_MODE_THREADS && s->workers != NULL) {
+		for (i = 0 ; i < s->nb_workers ; i++) {
+			pthread_join(s->workers[i].thread, NULL);
+			if (s->workers[i].ring != NULL)
+				uring_destroy(s->workers[i].ring);
+		}
+		pthread_join(s->packet_sender, NULL);
+	}
+	free(s->workers);
+	pthread_rwlock_destroy(&s->lock);
 }
@@ -24,6 +24,12 @@
 #include "player.h"
 #include "array.h"
 #include "server_privileges.h"
+#include "reactor.h"
+#include "uring.h"
+#include "metrics.h"
+#include "inject.h"
+#include "intrusive.h"
+#include "arena.h"
 
 #include <pthread.h>
 #include <poll.h>
@@ -40,15 +46,36 @@
 		printf("(WW) %s", strerror(errno)); \
 	}
 
+struct server;
+struct audio_path;
+
+/* a receiving socket and the thread polling it */
+struct recv_worker {
+	struct server *s;
+	int socket_desc;
+	struct pollfd socket_poll;
+	pthread_t thread;
+	struct reactor_source src;	/* reactor mode */
+	struct uring *ring;		/* io_uring backend, or NULL */
+};
+
+/* the players of a server by public id, linked by their id_link */
+IH_HEAD(pl_hash, player);
+IH_PROTOTYPE(pl_hash, player);
+
 struct server {
 	uint32_t id;
 
 	struct array *chans;
+	uint32_t chan_id_bound;		/* no channel has a greater id */
 	struct array *players;
+	struct pl_hash players_by_id;	/* the same players */
 	struct array *leaving_players;
 	struct array *bans;
 	struct array *regs;
 	struct server_stat *stats;
+	/* the channels, registrations, bans and privileges */
+	struct arena *arena;
 
 	char password[30];
 	char server_name[30];
@@ -62,17 +89,40 @@ struct server {
 
 	struct server_privileges *privileges;
 
-	struct pollfd socket_poll;
-	pthread_t main_thread;
+	/* receiving sockets (SO_REUSEPORT shards), the first
+	 * one is also socket_desc, used to send packets */
+	struct recv_worker *workers;
+	int nb_workers;
+	/* players and channels : packets that only read them (audio)
+	 * share it, commands, connections and timeouts take it
+	 * exclusively. Acks and keepalives do without (see qsbr.h) */
+	pthread_rwlock_t lock;
 
 	struct config *conf;
 
 	sem_t send_packets;
 	pthread_t packet_sender;
+
+	/* reactor mode : the reactor serving this server
+	 * and the timer running the packet sender */
+	struct reactor *reactor;
+	struct reactor_source timer;
+
+	/* the audio thread, NULL if audio is handled by the receiving threads */
+	struct audio_path *audio;
+
+	/* read by the metrics exporter */
+	struct server_metrics metrics;
+
+	/* a server without socket (inject.c) : the packets are
+	 * injected and the datagrams sent are given to output */
+	inject_output output;
+	void *output_arg;
 };
 
 
 struct server *new_server(void);
+void destroy_server(struct server *s);
 
 /* Server - channel functions */
 struct channel *get_channel_by_id(struct server *serv, uint32_t id);
@@ -84,6 +134,7 @@ struct channel *get_default_channel(struct server *serv);
 /* Server - player functions */
 struct player *get_player_by_ids(struct server *s, uint32_t pub_id, uint32_t priv_id);
 struct player *get_leaving_player_by_ids(struct server *s, uint32_t pub_id, uint32_t priv_id);
+struct player *get_player_lockless(struct server *s, uint32_t pub_id, uint32_t priv_id, int leaving);
 struct player *get_player_by_public_id(struct server *s, uint32_t pub_id);
 int add_player(struct server *serv, struct player *pl);
 void remove_player(struct server *s, struct player *p);
@@ -101,6 +152,11 @@ int add_registration(struct server *s, struct registration *r);
 
 void print_server(struct server *s);
 
+int server_recv_packet(struct recv_worker *w, int flags);
+ssize_t server_sendto(struct server *s, const void *buf, size_t len,
+		struct sockaddr_in *addr, unsigned int addr_len);
 void server_start(struct server *s);
+void server_resume(struct server *s);
 void server_stop(struct server *s);
+void server_join(struct server *s);
 #endif
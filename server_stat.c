@@ -22,6 +22,7 @@
 #include "log.h"
 #include "compat.h"
 #include "queue.h"
+#include "mclock.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -60,6 +61,7 @@ ssize_t send_to(struct server *s, const void *buf, size_t len, int flags,
 
 void destroy_sstat(struct server_stat *st)
 {
+	pthread_mutex_destroy(&st->lock);
 	free(st->pkt_sizes);
 	free(st->pkt_timestamps);
 	free(st->pkt_io);
@@ -82,9 +84,9 @@ struct server_stat *new_sstat()
 	}
 	st->pkt_max = 10000;
 	st->pkt_sizes = (size_t *)calloc(st->pkt_max, sizeof(size_t));
-	st->pkt_timestamps = (struct timeval *)calloc(st->pkt_max, sizeof(struct timeval));
+	st->pkt_timestamps = (uint64_t *)calloc(st->pkt_max, sizeof(uint64_t));
 	st->pkt_io = (char *)calloc(st->pkt_max, sizeof(char));
-	st->start_time = time(NULL);
+	st->start_time = mclock_seconds();
 
 	if (st->pkt_sizes == NULL || st->pkt_timestamps == NULL || st->pkt_io == NULL) {
 		logger(LOG_WARN, "new_sstat, calloc failed : %s.", strerror(errno));
@@ -97,6 +99,7 @@ struct server_stat *new_sstat()
 		free(st);
 		return NULL;
 	}
+	pthread_mutex_init(&st->lock, NULL);
 	return st;
 }
 
@@ -110,12 +113,12 @@ struct server_stat *new_sstat()
  * @param size the size of the packet
  * @param in_out 0 if input packet, 1 if output packet
  */
-void sstat_add_packet(struct server_stat *st, size_t size, char in_out)
+static void sstat_add_packet_unlocked(struct server_stat *st, size_t size, char in_out)
 {
-	struct timeval now, res;
+	uint64_t now;
 	size_t *tmp_sizes;
 	char *tmp_io;
-	struct timeval *tmp_timestamps;
+	uint64_t *tmp_timestamps;
 	int i;
 
 	if (in_out == 1) {
@@ -126,14 +129,13 @@ void sstat_add_packet(struct server_stat *st, size_t size, char in_out)
 		st->size_rec += size;
 	}
 
-	gettimeofday(&now, NULL);
+	now = mclock_now();
 
 	/* Insert in the table if possible */
 	for (i = 0 ; i < st->pkt_max ; i++) {
-		timersub(&now, &st->pkt_timestamps[i], &res);
-		if (st->pkt_sizes[i] == 0 || res.tv_sec > 60) {
+		if (st->pkt_sizes[i] == 0 || MCLOCK_SINCE(now, st->pkt_timestamps[i]) > 60 * MCLOCK_SECOND) {
 			st->pkt_sizes[i] = size;
-			gettimeofday(&st->pkt_timestamps[i], NULL);
+			st->pkt_timestamps[i] = now;
 			st->pkt_io[i] = in_out;
 			return;
 		}
@@ -150,7 +152,7 @@ void sstat_add_packet(struct server_stat *st, size_t size, char in_out)
 	bzero(st->pkt_sizes + (st->pkt_max / 2), sizeof(size_t) * st->pkt_max / 2); /* realloc does not set to zero! */
 
 	/* reallocate */
-	tmp_timestamps = (struct timeval *)realloc(st->pkt_timestamps, sizeof(struct timeval) * st->pkt_max);
+	tmp_timestamps = (uint64_t *)realloc(st->pkt_timestamps, sizeof(uint64_t) * st->pkt_max);
 	if (tmp_timestamps == NULL) {
 		logger(LOG_WARN, "sstat_add_packet, pkt_timestamps realloc failed : %s.", strerror(errno));
 		st->pkt_max /= 2;
@@ -168,10 +170,25 @@ void sstat_add_packet(struct server_stat *st, size_t size, char in_out)
 
 	/* insert */
 	st->pkt_sizes[(st->pkt_max / 2) + 1] = size;
-	gettimeofday(&st->pkt_timestamps[(st->pkt_max / 2) + 1], NULL);
+	st->pkt_timestamps[(st->pkt_max / 2) + 1] = now;
 	st->pkt_io[i] = in_out;
 }
 
+/**
+ * Add a packet to the statistics, the statistics may be
+ * shared by several receiving threads.
+ *
+ * @param st the server statistics
+ * @param size the size of the packet
+ * @param in_out 0 if input packet, 1 if output packet
+ */
+void sstat_add_packet(struct server_stat *st, size_t size, char in_out)
+{
+	pthread_mutex_lock(&st->lock);
+	sstat_add_packet_unlocked(st, size, in_out);
+	pthread_mutex_unlock(&st->lock);
+}
+
 /**
  * Compute time relative statistics (bytes/sec or bytes/min)
  *
@@ -180,19 +197,20 @@ void sstat_add_packet(struct server_stat *st, size_t size, char in_out)
  */
 void compute_timed_stats(struct server_stat *st, uint32_t *stats)
 {
-	struct timeval now, res;
+	uint64_t now, age;
 	int i;
 
-	gettimeofday(&now, NULL);
+	pthread_mutex_lock(&st->lock);
+	now = mclock_now();
 	/* res[0] = Rx / sec
 	 * res[1] = Tx / sec
 	 * res[2] = Rx / min
 	 * res[3] = Tx / sec */
 	for (i = 0 ; i < st->pkt_max ; i++) {
-		timersub(&now, &st->pkt_timestamps[i], &res);
-		if (res.tv_sec < 60) {
+		age = MCLOCK_SINCE(now, st->pkt_timestamps[i]);
+		if (age < 60 * MCLOCK_SECOND) {
 			stats[2 + st->pkt_io[i]] += st->pkt_sizes[i];
-			if (res.tv_sec < 1) {
+			if (age < MCLOCK_SECOND) {
 				stats[0 + st->pkt_io[i]] += st->pkt_sizes[i];
 			}
 		} else {
@@ -200,4 +218,5 @@ void compute_timed_stats(struct server_stat *st, uint32_t *stats)
 			st->pkt_sizes[i] = 0;
 		}
 	}
+	pthread_mutex_unlock(&st->lock);
 }
@@ -23,13 +23,14 @@
 #include <sys/socket.h>
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 #include "server.h"
 
 struct server_stat
 {
 	/* array */
 	size_t *pkt_sizes;
-	struct timeval *pkt_timestamps;
+	uint64_t *pkt_timestamps;	/* mclock time */
 	char *pkt_io;
 	long pkt_max;
 
@@ -39,9 +40,12 @@ struct server_stat
 	uint64_t size_sent;
 	uint64_t size_rec;
 
-	time_t start_time;
+	time_t start_time;	/* mclock seconds */
 
 	uint64_t total_logins;
+
+	/* packets are counted by several receiving threads */
+	pthread_mutex_t lock;
 };
 
 
@@ -0,0 +1,770 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Snapshot of the persistent state.
+ *
+ * The servers, their channels, registrations and privileges are
+ * written to a binary file on exit and every db.snapshot_interval
+ * seconds. At startup the file is mapped and the servers are built
+ * from it, without any query. The database stays the reference : once
+ * the servers are started, a thread loads it and compares it to what
+ * the servers use. If they differ, the snapshot is removed and the
+ * servers are reloaded from the database (see reload.c).
+ *
+ * File format (little endian) :
+ *   header : magic (8 bytes), version (u32), number of servers (u32),
+ *            date (u64), size of the body (u32), crc32 of the body (u32)
+ *   body : for each server, the size of its section (u32), then
+ *     - id, port, codecs (u32), name, password, welcome message (str)
+ *     - server privileges : size (u32), then the bytes
+ *     - number of channels and of subchannels (u32), then for each
+ *       channel : db id (u32), index of the parent (u32), flags (u16),
+ *       codec (u8), sort order (u16), max users (u16), name, topic,
+ *       description (str)
+ *     - number of registrations (u32), then for each : db id (u32),
+ *       global flags (u8), name, password (str)
+ *     - number of player channel privileges (u32), then for each :
+ *       index of the channel (u32), of the registration (u32), flags (u16)
+ *   a str is its length (u16) followed by its characters.
+ *
+ * Only what the database stores is written, in the order the database
+ * loader creates it (channels then subchannels, by id). A server loaded
+ * from the snapshot is the same as one loaded from the database, and
+ * two servers are compared by comparing their sections.
+ */
+
+#include "snapshot.h"
+#include "server.h"
+#include "channel.h"
+#include "registration.h"
+#include "player_channel_privilege.h"
+#include "database.h"
+#include "compat.h"
+#include "crc.h"
+#include "serial.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define SNAPSHOT_HEADER_SIZE 32
+#define SNAPSHOT_NO_PARENT 0xFFFFFFFF
+/* attempts to check the snapshot while the servers are modified */
+#define SNAPSHOT_CHECK_TRIES 10
+
+struct snap_priv
+{
+	uint32_t ch;
+	uint32_t reg;
+	uint16_t flags;
+};
+
+/* the snapshot of the running servers */
+static struct
+{
+	struct config *c;
+	struct array *ss;
+	pthread_t periodic;
+	pthread_t check;
+	int periodic_running;
+	int check_running;
+	int stop;
+	int stale;		/* differs from the database, do not write it */
+} snap;
+
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snap_cond = PTHREAD_COND_INITIALIZER;
+
+static int cmp_channel(const void *a, const void *b)
+{
+	uint32_t ida = (*(struct channel **)a)->db_id;
+	uint32_t idb = (*(struct channel **)b)->db_id;
+
+	return (ida > idb) - (ida < idb);
+}
+
+static int cmp_registration(const void *a, const void *b)
+{
+	int ida = (*(struct registration **)a)->db_id;
+	int idb = (*(struct registration **)b)->db_id;
+
+	return (ida > idb) - (ida < idb);
+}
+
+static int cmp_priv(const void *a, const void *b)
+{
+	const struct snap_priv *pa = (const struct snap_priv *)a;
+	const struct snap_priv *pb = (const struct snap_priv *)b;
+
+	if (pa->ch != pb->ch)
+		return (pa->ch > pb->ch) - (pa->ch < pb->ch);
+	return (pa->reg > pb->reg) - (pa->reg < pb->reg);
+}
+
+/* index of a channel in a table sorted by db id, or -1 */
+static int find_channel(struct channel **tab, size_t nb, struct channel *ch)
+{
+	struct channel **found = bsearch(&ch, tab, nb, sizeof(struct channel *), &cmp_channel);
+
+	return (found == NULL || *found != ch) ? -1 : found - tab;
+}
+
+/* index of a registration in a table sorted by db id, or -1 */
+static int find_registration(struct registration **tab, size_t nb, struct registration *r)
+{
+	struct registration **found = bsearch(&r, tab, nb, sizeof(struct registration *), &cmp_registration);
+
+	return (found == NULL || *found != r) ? -1 : found - tab;
+}
+
+/**
+ * Write the section of a server.
+ *
+ * @param b the buffer to write to
+ * @param s the server (must not be modified meanwhile)
+ */
+static void snapshot_write_server(struct serial_buf *b, struct server *s)
+{
+	struct channel **chans, *ch;
+	struct registration **regs, *r;
+	struct player_channel_privilege *priv, *next;
+	struct snap_priv *privs;
+	size_t nb_tops = 0, nb_chans, nb_regs = 0, nb_privs = 0, start, iter, i;
+	int reg;
+	char *ptr;
+
+	chans = (struct channel **)calloc(s->chans->used_slots + 1, sizeof(struct channel *));
+	regs = (struct registration **)calloc(s->regs->used_slots + 1, sizeof(struct registration *));
+	if (chans == NULL || regs == NULL) {
+		logger(LOG_ERR, "snapshot_write_server, calloc failed : %s.", strerror(errno));
+		free(chans);
+		free(regs);
+		b->err = 1;
+		return;
+	}
+	/* the registered channels, then the subchannels the
+	 * database loader would accept, each sorted by id */
+	ar_each(struct channel *, ch, iter, s->chans)
+		if (!(ch->flags & CHANNEL_FLAG_UNREGISTERED) && ch->parent == NULL)
+			chans[nb_tops++] = ch;
+	ar_end_each;
+	qsort(chans, nb_tops, sizeof(struct channel *), &cmp_channel);
+	nb_chans = nb_tops;
+	ar_each(struct channel *, ch, iter, s->chans)
+		if (!(ch->flags & CHANNEL_FLAG_UNREGISTERED) && ch->parent != NULL
+				&& (ch->parent->flags & CHANNEL_FLAG_SUBCHANNELS)
+				&& find_channel(chans, nb_tops, ch->parent) != -1)
+			chans[nb_chans++] = ch;
+	ar_end_each;
+	qsort(chans + nb_tops, nb_chans - nb_tops, sizeof(struct channel *), &cmp_channel);
+
+	ar_each(struct registration *, r, iter, s->regs)
+		regs[nb_regs++] = r;
+	ar_end_each;
+	qsort(regs, nb_regs, sizeof(struct registration *), &cmp_registration);
+
+	/* the privileges of the registrations in these channels */
+	for (i = 0 ; i < nb_chans ; i++)
+		nb_privs += chans[i]->pl_privileges.count;
+	privs = (struct snap_priv *)calloc(nb_privs + 1, sizeof(struct snap_priv));
+	if (privs == NULL) {
+		logger(LOG_ERR, "snapshot_write_server, calloc failed : %s.", strerror(errno));
+		free(chans);
+		free(regs);
+		b->err = 1;
+		return;
+	}
+	nb_privs = 0;
+	for (i = 0 ; i < nb_chans ; i++) {
+		il_each(priv, next, &chans[i]->pl_privileges, ch_link)
+			if (priv->reg != PL_CH_PRIV_REGISTERED)
+				continue;
+			reg = find_registration(regs, nb_regs, priv->pl_or_reg.reg);
+			if (reg == -1)
+				continue;
+			privs[nb_privs].ch = i;
+			privs[nb_privs].reg = reg;
+			privs[nb_privs].flags = priv->flags & DB_PRIV_FLAGS;
+			nb_privs++;
+		il_end_each;
+	}
+	qsort(privs, nb_privs, sizeof(struct snap_priv), &cmp_priv);
+
+	start = b->len;
+	sb_u32(b, 0);	/* size of the section, known at the end */
+	sb_u32(b, s->id);
+	sb_u32(b, s->port);
+	sb_u32(b, s->codecs);
+	sb_str(b, s->server_name);
+	sb_str(b, s->password);
+	sb_str(b, s->welcome_msg);
+	sb_u32(b, sizeof(s->privileges->priv));
+	sb_bytes(b, s->privileges->priv, sizeof(s->privileges->priv));
+
+	sb_u32(b, nb_tops);
+	sb_u32(b, nb_chans - nb_tops);
+	for (i = 0 ; i < nb_chans ; i++) {
+		ch = chans[i];
+		sb_u32(b, ch->db_id);
+		if (i < nb_tops) {
+			sb_u32(b, SNAPSHOT_NO_PARENT);
+			sb_u16(b, ch->flags & DB_CHANNEL_FLAGS);
+		} else {
+			/* the database does not store the flags of subchannels */
+			sb_u32(b, find_channel(chans, nb_tops, ch->parent));
+			sb_u16(b, 0);
+		}
+		sb_u8(b, ch->codec);
+		sb_u16(b, ch->sort_order);
+		sb_u16(b, ch->max_users);
+		sb_str(b, ch->name);
+		sb_str(b, ch->topic);
+		sb_str(b, ch->desc);
+	}
+
+	sb_u32(b, nb_regs);
+	for (i = 0 ; i < nb_regs ; i++) {
+		sb_u32(b, regs[i]->db_id);
+		sb_u8(b, regs[i]->global_flags);
+		sb_str(b, regs[i]->name);
+		sb_str(b, regs[i]->password);
+	}
+
+	sb_u32(b, nb_privs);
+	for (i = 0 ; i < nb_privs ; i++) {
+		sb_u32(b, privs[i].ch);
+		sb_u32(b, privs[i].reg);
+		sb_u16(b, privs[i].flags);
+	}
+
+	if (!b->err) {
+		ptr = b->data + start;
+		wu32(b->len - start - 4, &ptr);
+	}
+	free(privs);
+	free(regs);
+	free(chans);
+}
+
+/**
+ * Build a server from its section.
+ *
+ * @param r the section
+ * @param c the configuration of the server
+ *
+ * @return the server, or NULL if the section is invalid
+ */
+static struct server *snapshot_read_server(struct serial_reader *r, struct config *c)
+{
+	struct server *s;
+	struct channel **chans = NULL, *ch;
+	struct registration **regs = NULL, *reg;
+	struct player_channel_privilege *priv;
+	uint32_t nb_tops, nb_chans, nb_regs, nb_privs, i, parent, ch_i, reg_i, db_id;
+	uint16_t flags, order, maxusers;
+	uint8_t codec;
+	char *name, *topic, *desc;
+
+	s = new_server();
+	if (s == NULL)
+		return NULL;
+	s->conf = c;
+	s->id = sr_u32(r);
+	s->port = sr_u32(r);
+	s->codecs = sr_u32(r);
+	sr_str(r, s->server_name, sizeof(s->server_name));
+	sr_str(r, s->password, sizeof(s->password));
+	sr_str(r, s->welcome_msg, sizeof(s->welcome_msg));
+	if (sr_u32(r) != sizeof(s->privileges->priv) || !sr_check(r, sizeof(s->privileges->priv)))
+		goto fail;
+	memcpy(s->privileges->priv, r->ptr, sizeof(s->privileges->priv));
+	r->ptr += sizeof(s->privileges->priv);
+
+	/* channels, then subchannels */
+	nb_tops = sr_u32(r);
+	nb_chans = nb_tops + sr_u32(r);
+	if (r->err || nb_chans < nb_tops || nb_chans > (size_t)(r->end - r->ptr))
+		goto fail;
+	chans = (struct channel **)calloc(nb_chans + 1, sizeof(struct channel *));
+	if (chans == NULL) {
+		logger(LOG_ERR, "snapshot_read_server, calloc failed : %s.", strerror(errno));
+		goto fail;
+	}
+	for (i = 0 ; i < nb_chans ; i++) {
+		db_id = sr_u32(r);
+		parent = sr_u32(r);
+		flags = sr_u16(r);
+		codec = sr_u8(r);
+		order = sr_u16(r);
+		maxusers = sr_u16(r);
+		name = sr_strdup(r);
+		topic = sr_strdup(r);
+		desc = sr_strdup(r);
+		if (r->err || (i >= nb_tops && parent >= nb_tops)) {
+			free(name); free(topic); free(desc);
+			goto fail;
+		}
+		ch = new_channel(s->arena, name, topic, desc, flags, codec, order, maxusers);
+		ch->db_id = db_id;
+		free(name); free(topic); free(desc);
+		if (i < nb_tops) {
+			add_channel(s, ch);
+			chans[i] = ch;
+		} else if (db_link_subchannel(s, chans[parent], chans[parent]->db_id, ch)) {
+			chans[i] = ch;
+		}
+	}
+	/* a server always has a channel */
+	if (nb_tops == 0) {
+		ch = new_channel(s->arena, "Default", "", "", CHANNEL_FLAG_DEFAULT | CHANNEL_FLAG_UNREGISTERED,
+				CODEC_SPEEX_12_3, 0, 128);
+		add_channel(s, ch);
+	}
+
+	nb_regs = sr_u32(r);
+	if (r->err || nb_regs > (size_t)(r->end - r->ptr))
+		goto fail;
+	regs = (struct registration **)calloc(nb_regs + 1, sizeof(struct registration *));
+	if (regs == NULL) {
+		logger(LOG_ERR, "snapshot_read_server, calloc failed : %s.", strerror(errno));
+		goto fail;
+	}
+	for (i = 0 ; i < nb_regs ; i++) {
+		reg = new_registration(s->arena);
+		if (reg == NULL)
+			goto fail;
+		reg->db_id = sr_u32(r);
+		reg->global_flags = sr_u8(r);
+		sr_str(r, reg->name, sizeof(reg->name));
+		sr_str(r, reg->password, sizeof(reg->password));
+		add_registration(s, reg);
+		regs[i] = reg;
+	}
+
+	nb_privs = sr_u32(r);
+	for (i = 0 ; i < nb_privs && !r->err ; i++) {
+		ch_i = sr_u32(r);
+		reg_i = sr_u32(r);
+		flags = sr_u16(r);
+		if (r->err || ch_i >= nb_chans || reg_i >= nb_regs)
+			goto fail;
+		if (chans[ch_i] == NULL)	/* subchannel refused */
+			continue;
+		priv = new_player_channel_privilege(s->arena);
+		if (priv == NULL)
+			goto fail;
+		priv->flags = flags;
+		priv->reg = PL_CH_PRIV_REGISTERED;
+		priv->ch = chans[ch_i];
+		priv->pl_or_reg.reg = regs[reg_i];
+		add_player_channel_privilege(chans[ch_i], priv);
+	}
+	if (r->err || r->ptr != r->end)
+		goto fail;
+	free(chans);
+	free(regs);
+	return s;
+
+fail:
+	free(chans);
+	free(regs);
+	destroy_server(s);
+	return NULL;
+}
+
+/**
+ * Load the servers from the snapshot file.
+ *
+ * @param c the configuration
+ * @param ss the array the servers are added to
+ *
+ * @return 1 if the servers were loaded, 0 if they must be
+ *         loaded from the database
+ */
+int snapshot_load(struct config *c, struct array *ss)
+{
+	struct serial_reader r, section;
+	struct timeval start, end, diff;
+	struct server *s;
+	struct stat st;
+	uint32_t version, nb_servers, body_size, crc, size, i;
+	uint64_t date;
+	size_t iter;
+	char *map, *ptr;
+	int fd;
+
+	if (c->db_snapshot == NULL)
+		return 0;
+	gettimeofday(&start, NULL);
+	fd = open(c->db_snapshot, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			logger(LOG_INFO, "No snapshot %s, loading the servers from the database.", c->db_snapshot);
+		else
+			logger(LOG_WARN, "snapshot_load, could not open %s : %s.", c->db_snapshot, strerror(errno));
+		return 0;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size < SNAPSHOT_HEADER_SIZE) {
+		logger(LOG_WARN, "Snapshot %s is too small, loading the servers from the database.", c->db_snapshot);
+		close(fd);
+		return 0;
+	}
+	map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		logger(LOG_WARN, "snapshot_load, could not map %s : %s.", c->db_snapshot, strerror(errno));
+		return 0;
+	}
+
+	ptr = map + 8;
+	version = ru32(&ptr);
+	nb_servers = ru32(&ptr);
+	date = ru64(&ptr);
+	body_size = ru32(&ptr);
+	crc = ru32(&ptr);
+	if (memcmp(map, SNAPSHOT_MAGIC, 8) != 0 || version != SNAPSHOT_VERSION
+			|| body_size != st.st_size - SNAPSHOT_HEADER_SIZE
+			|| crc != crc_32(map + SNAPSHOT_HEADER_SIZE, body_size, 0xEDB88320)) {
+		logger(LOG_WARN, "Snapshot %s is invalid, loading the servers from the database.", c->db_snapshot);
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	r.ptr = map + SNAPSHOT_HEADER_SIZE;
+	r.end = map + st.st_size;
+	r.err = 0;
+	for (i = 0 ; i < nb_servers ; i++) {
+		size = sr_u32(&r);
+		if (!sr_check(&r, size))
+			break;
+		section.ptr = r.ptr;
+		section.end = r.ptr + size;
+		section.err = 0;
+		r.ptr += size;
+		s = snapshot_read_server(&section, c);
+		if (s == NULL) {
+			r.err = 1;
+			break;
+		}
+		ar_insert(ss, s);
+	}
+	munmap(map, st.st_size);
+	if (r.err || r.ptr != r.end) {
+		logger(LOG_WARN, "Snapshot %s is corrupted, loading the servers from the database.", c->db_snapshot);
+		ar_each(struct server *, s, iter, ss)
+			ar_remove(ss, s);
+			destroy_server(s);
+		ar_end_each;
+		return 0;
+	}
+
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	logger(LOG_INFO, "%i servers loaded from the snapshot %s (%li seconds old) in %li ms.",
+			nb_servers, c->db_snapshot, (long)(time(NULL) - date),
+			diff.tv_sec * 1000 + diff.tv_usec / 1000);
+	return 1;
+}
+
+/**
+ * Write the snapshot of some servers, unless it was found
+ * to differ from the database.
+ *
+ * @param c the configuration
+ * @param ss the servers
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int snapshot_write(struct config *c, struct array *ss)
+{
+	struct serial_buf b;
+	struct server *s;
+	struct timeval start, end, diff;
+	size_t iter, done;
+	ssize_t written;
+	uint32_t nb = 0;
+	char *tmp, *ptr;
+	int fd, ret;
+
+	if (__atomic_load_n(&snap.stale, __ATOMIC_ACQUIRE))
+		return 0;
+	gettimeofday(&start, NULL);
+	bzero(&b, sizeof(b));
+	if (!sb_reserve(&b, SNAPSHOT_HEADER_SIZE))
+		return 0;
+	b.len = SNAPSHOT_HEADER_SIZE;
+	ar_each(struct server *, s, iter, ss)
+		pthread_rwlock_rdlock(&s->lock);
+		snapshot_write_server(&b, s);
+		pthread_rwlock_unlock(&s->lock);
+		nb++;
+	ar_end_each;
+	if (b.err) {
+		free(b.data);
+		return 0;
+	}
+	memcpy(b.data, SNAPSHOT_MAGIC, 8);
+	ptr = b.data + 8;
+	wu32(SNAPSHOT_VERSION, &ptr);
+	wu32(nb, &ptr);
+	wu64(time(NULL), &ptr);
+	wu32(b.len - SNAPSHOT_HEADER_SIZE, &ptr);
+	wu32(crc_32(b.data + SNAPSHOT_HEADER_SIZE, b.len - SNAPSHOT_HEADER_SIZE, 0xEDB88320), &ptr);
+
+	/* write a temporary file, then replace the snapshot */
+	if (asprintf(&tmp, "%s.tmp", c->db_snapshot) == -1) {
+		logger(LOG_ERR, "snapshot_write, asprintf failed.");
+		free(b.data);
+		return 0;
+	}
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		logger(LOG_ERR, "snapshot_write, could not open %s : %s.", tmp, strerror(errno));
+		free(tmp);
+		free(b.data);
+		return 0;
+	}
+	for (done = 0 ; done < b.len ; done += written) {
+		written = write(fd, b.data + done, b.len - done);
+		if (written == -1 && errno != EINTR)
+			break;
+		if (written == -1)
+			written = 0;
+	}
+	ret = (done == b.len && fsync(fd) == 0);
+	if (close(fd) == -1)
+		ret = 0;
+	if (!ret || rename(tmp, c->db_snapshot) == -1) {
+		logger(LOG_ERR, "snapshot_write, could not write %s : %s.", tmp, strerror(errno));
+		unlink(tmp);
+		free(tmp);
+		free(b.data);
+		return 0;
+	}
+	free(tmp);
+	free(b.data);
+
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	logger(LOG_INFO, "Snapshot %s written (%i servers, %i bytes) in %li ms.", c->db_snapshot,
+			nb, (int)b.len, diff.tv_sec * 1000 + diff.tv_usec / 1000);
+	return 1;
+}
+
+/**
+ * Wait for some time, or until the snapshot is stopped.
+ *
+ * @param seconds the time to wait
+ *
+ * @return 0 if the snapshot is stopped, 1 otherwise
+ */
+static int snapshot_wait(int seconds)
+{
+	struct timespec ts;
+	int stop;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += seconds;
+	pthread_mutex_lock(&snap_lock);
+	while (!snap.stop && pthread_cond_timedwait(&snap_cond, &snap_lock, &ts) != ETIMEDOUT)
+		;
+	stop = snap.stop;
+	pthread_mutex_unlock(&snap_lock);
+	return !stop;
+}
+
+static void *snapshot_periodic_run(void *args)
+{
+	while (snapshot_wait(snap.c->db_snapshot_interval))
+		snapshot_write(snap.c, snap.ss);
+	return NULL;
+}
+
+/**
+ * Compare the servers to the ones loaded from the database.
+ *
+ * @param ss the running servers
+ * @param db_ss the servers loaded from the database
+ *
+ * @return the number of servers that differ
+ */
+static int snapshot_compare(struct array *ss, struct array *db_ss)
+{
+	struct serial_buf live, db;
+	struct server *s, *db_s, *tmp;
+	size_t iter, iter2;
+	int differ = 0, found = 0;
+
+	bzero(&live, sizeof(live));
+	bzero(&db, sizeof(db));
+	ar_each(struct server *, s, iter, ss)
+		db_s = NULL;
+		ar_each(struct server *, tmp, iter2, db_ss)
+			if (tmp->id == s->id)
+				db_s = tmp;
+		ar_end_each;
+		if (db_s == NULL) {
+			logger(LOG_WARN, "Server %i of the snapshot is not active in the database.", s->id);
+			differ++;
+			continue;
+		}
+		found++;
+		live.len = 0;
+		db.len = 0;
+		pthread_rwlock_rdlock(&s->lock);
+		snapshot_write_server(&live, s);
+		pthread_rwlock_unlock(&s->lock);
+		snapshot_write_server(&db, db_s);
+		if (live.err || db.err)
+			break;
+		if (live.len != db.len || memcmp(live.data, db.data, live.len) != 0) {
+			logger(LOG_WARN, "Server %i of the snapshot differs from the database.", s->id);
+			differ++;
+		}
+	ar_end_each;
+	if ((size_t)found != db_ss->used_slots) {
+		logger(LOG_WARN, "%i active servers of the database are not in the snapshot.",
+				(int)db_ss->used_slots - found);
+		differ += db_ss->used_slots - found;
+	}
+	if (live.err || db.err)
+		differ = -1;
+	free(live.data);
+	free(db.data);
+	return differ;
+}
+
+/**
+ * Check the servers loaded from the snapshot against the database.
+ * The check is only valid if no write was made while the database
+ * was read, it is retried otherwise.
+ */
+static void *snapshot_check_run(void *args)
+{
+	struct db_writer_stats before, after;
+	struct timeval start, end, diff;
+	struct array *db_ss;
+	struct server *s;
+	size_t iter;
+	dbi_conn conn;
+	int tries, differ = -1;
+
+	gettimeofday(&start, NULL);
+	conn = db_connect_new(snap.c);
+	if (conn == NULL) {
+		logger(LOG_WARN, "snapshot_check : no database connection, the snapshot is not checked.");
+		return NULL;
+	}
+	for (tries = 0 ; tries < SNAPSHOT_CHECK_TRIES ; tries++) {
+		if (tries > 0 && !snapshot_wait(1))
+			break;
+		/* the database must have all the writes made so far */
+		db_writer_get_stats(snap.c, &before);
+		if (before.written != before.submitted)
+			continue;
+		db_ss = ar_new(4);
+		db_create_servers(snap.c, conn, db_ss);
+		if (db_ss->used_slots == 0 || db_create_all(conn, db_ss))
+			differ = snapshot_compare(snap.ss, db_ss);
+		ar_each(struct server *, s, iter, db_ss)
+			ar_remove(db_ss, s);
+			destroy_server(s);
+		ar_end_each;
+		ar_free(db_ss);
+		db_writer_get_stats(snap.c, &after);
+		if (after.submitted == before.submitted)
+			break;
+		/* modified meanwhile */
+		differ = -1;
+	}
+	dbi_conn_close(conn);
+
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	if (differ == 0) {
+		logger(LOG_INFO, "Snapshot checked against the database in %li ms.",
+				diff.tv_sec * 1000 + diff.tv_usec / 1000);
+	} else if (differ == -1) {
+		logger(LOG_WARN, "The snapshot could not be checked against the database.");
+	} else {
+		logger(LOG_WARN, "The snapshot is out of date, reloading the servers from the database.");
+		__atomic_store_n(&snap.stale, 1, __ATOMIC_RELEASE);
+		unlink(snap.c->db_snapshot);
+		kill(getpid(), SIGUSR1);
+	}
+	return NULL;
+}
+
+/**
+ * Start writing the snapshot periodically and, if the servers were
+ * loaded from it, check it against the database.
+ *
+ * @param c the configuration
+ * @param ss the running servers
+ * @param loaded 1 if the servers were loaded from the snapshot
+ */
+void snapshot_start(struct config *c, struct array *ss, int loaded)
+{
+	if (c->db_snapshot == NULL)
+		return;
+	bzero(&snap, sizeof(snap));
+	snap.c = c;
+	snap.ss = ss;
+	if (c->db_snapshot_interval > 0) {
+		if (pthread_create(&snap.periodic, NULL, &snapshot_periodic_run, NULL) == 0)
+			snap.periodic_running = 1;
+		else
+			logger(LOG_WARN, "snapshot_start : could not start the snapshot thread.");
+	}
+	if (loaded) {
+		if (pthread_create(&snap.check, NULL, &snapshot_check_run, NULL) == 0)
+			snap.check_running = 1;
+		else
+			logger(LOG_WARN, "snapshot_start : could not start the thread checking the snapshot.");
+	}
+}
+
+/**
+ * Stop the snapshot threads and write a last snapshot. This
+ * is done before the servers are stopped.
+ */
+void snapshot_stop(void)
+{
+	if (snap.c == NULL)
+		return;
+	pthread_mutex_lock(&snap_lock);
+	snap.stop = 1;
+	pthread_cond_broadcast(&snap_cond);
+	pthread_mutex_unlock(&snap_lock);
+	if (snap.periodic_running)
+		pthread_join(snap.periodic, NULL);
+	if (snap.check_running)
+		pthread_join(snap.check, NULL);
+	snapshot_write(snap.c, snap.ss);
+	snap.c = NULL;
+}
@@ -0,0 +1,90 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "thread_registry.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* the creation of the keys */
+static pthread_mutex_t keys_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the thread of a record has ended, another one can use it */
+static void thread_registry_release(void *r)
+{
+	struct thread_record *rec = (struct thread_record *)r;
+
+	if (rec->reg->release != NULL)
+		rec->reg->release(rec);
+	__atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static int thread_registry_key(struct thread_registry *reg)
+{
+	if (__atomic_load_n(&reg->key_ready, __ATOMIC_ACQUIRE))
+		return 1;
+	pthread_mutex_lock(&keys_lock);
+	if (!reg->key_ready && pthread_key_create(&reg->key, &thread_registry_release) == 0)
+		__atomic_store_n(&reg->key_ready, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&keys_lock);
+	return reg->key_ready;
+}
+
+/**
+ * Give a record to the calling thread : the one of a thread that has
+ * ended, or a new zeroed one. The callers keep it in a thread-local
+ * variable, this is only called once per thread. It does not log,
+ * the logger uses it.
+ *
+ * @param reg the registry
+ *
+ * @return the record, NULL on failure (errno is set)
+ */
+struct thread_record *thread_registry_get(struct thread_registry *reg)
+{
+	struct thread_record *rec;
+	int unused = 0;
+
+	if (!thread_registry_key(reg))
+		return NULL;
+	thread_registry_each(struct thread_record *, rec, reg) {
+		if (__atomic_compare_exchange_n(&rec->in_use, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		unused = 0;
+	}
+	if (rec == NULL) {
+		if (reg->align == 0) {
+			rec = (struct thread_record *)malloc(reg->size);
+		} else {
+			errno = posix_memalign((void **)&rec, reg->align, reg->size);
+			if (errno != 0)
+				rec = NULL;
+		}
+		if (rec == NULL)
+			return NULL;
+		memset(rec, 0, reg->size);
+		rec->in_use = 1;
+		rec->reg = reg;
+		rec->next = __atomic_load_n(&reg->first, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&reg->first, &rec->next, rec, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	pthread_setspecific(reg->key, rec);
+	return rec;
+}
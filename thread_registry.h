@@ -0,0 +1,60 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __THREAD_REGISTRY_H__
+#define __THREAD_REGISTRY_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * A record per thread (log ring, latency shard, qsbr state), in a
+ * lock-free list that only grows : the readers walk it without a lock,
+ * and the record of a thread that has ended is reused by a new one.
+ *
+ * The struct thread_record is the first field of the records.
+ */
+struct thread_record
+{
+	int in_use;		/* 0 once its thread has ended */
+	struct thread_registry *reg;
+	struct thread_record *next;
+};
+
+struct thread_registry
+{
+	struct thread_record *first;
+	size_t size;		/* of the records */
+	size_t align;		/* of the records, 0 for malloc's */
+	/* called when the thread of a record ends, before it is reused */
+	void (*release)(struct thread_record *);
+	pthread_key_t key;
+	int key_ready;
+};
+
+#define THREAD_REGISTRY_INITIALIZER(type, align, release) {NULL, sizeof(type), align, release}
+
+/* walk the records, the ones of the threads that have ended included */
+#define thread_registry_each(type, el_ptr, reg)\
+for (el_ptr = (type)__atomic_load_n(&(reg)->first, __ATOMIC_ACQUIRE) ; el_ptr != NULL ;\
+		el_ptr = (type)((struct thread_record *)(el_ptr))->next)
+
+struct thread_record *thread_registry_get(struct thread_registry *reg);
+
+#endif
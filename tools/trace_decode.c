@@ -0,0 +1,132 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Print a packet trace (log.trace) as text, oldest record first :
+ *   date server event type opcode player counter size arg outcome
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+static const char *event_names[] = {"?", "recv", "control", "audio", "send"};
+static const char *outcome_names[] = {"ok", "no-player", "bad-crc", "bad-size",
+	"unknown", "bad-codec", "error", "queued"};
+
+static void print_help(char *progname)
+{
+	printf("Usage : %s [-n last] [-s server] [-p player] [-e event] trace_file\n", progname);
+	printf(" -n <nb> only print the last nb records\n");
+	printf(" -s <id> only print the records of a server\n");
+	printf(" -p <id> only print the records of a player (public id)\n");
+	printf(" -e <event> only print recv, control, audio or send records\n");
+}
+
+static void print_record(struct trace_record *r)
+{
+	char date[32];
+	time_t t = r->time / 1000000;
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%06u srv %-4u %-7s 0x%04x 0x%04x pl %-5u cnt %-6u size %-4u arg %-3u %s\n",
+			date, (unsigned int)(r->time % 1000000), r->server,
+			event_names[r->event < 5 ? r->event : 0], r->type, r->opcode,
+			r->player, r->counter, r->size, r->arg,
+			r->outcome < 8 ? outcome_names[r->outcome] : "?");
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_header *hdr;
+	struct trace_record *ring, *r;
+	struct stat st;
+	uint64_t first, i, last = 0;
+	long server = -1, player = -1;
+	int opt, fd, event = 0;
+
+	while ((opt = getopt(argc, argv, "n:s:p:e:")) != -1) {
+		switch (opt) {
+		case 'n': last = strtoull(optarg, NULL, 10); break;
+		case 's': server = atol(optarg); break;
+		case 'p': player = atol(optarg); break;
+		case 'e':
+			for (event = 1 ; event < 5 && strcmp(optarg, event_names[event]) != 0 ; event++);
+			if (event == 5) {
+				print_help(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			print_help(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if ((size_t)st.st_size < sizeof(struct trace_header)) {
+		fprintf(stderr, "%s : not a trace file.\n", argv[optind]);
+		return 1;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	if (memcmp(hdr->magic, TRACE_MAGIC, 8) != 0 || hdr->version != TRACE_VERSION
+			|| hdr->record_size != sizeof(struct trace_record)
+			|| (size_t)st.st_size != sizeof(struct trace_header) + hdr->nb_records * sizeof(struct trace_record)) {
+		fprintf(stderr, "%s : not a trace file, or another version.\n", argv[optind]);
+		return 1;
+	}
+	ring = (struct trace_record *)(hdr + 1);
+
+	/* the ring only holds the last nb_records records */
+	first = (hdr->next > hdr->nb_records) ? hdr->next - hdr->nb_records : 0;
+	if (last != 0 && hdr->next - first > last)
+		first = hdr->next - last;
+	for (i = first ; i < hdr->next ; i++) {
+		r = &ring[i & (hdr->nb_records - 1)];
+		if (r->time == 0 || (server != -1 && r->server != server)
+				|| (player != -1 && r->player != player)
+				|| (event != 0 && r->event != event))
+			continue;
+		print_record(r);
+	}
+	munmap(hdr, st.st_size);
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary packet trace.
+ *
+ * Each packet received, command handled, audio packet forwarded and
+ * reliable packet sent is recorded in a ring of fixed size records,
+ * in a file mapped in memory (log.trace). Writing a record takes an
+ * atomic increment and a few stores, no formatting and no system call.
+ * The ring keeps the last log.trace_records records, and is kept when
+ * the server restarts. tools/trace_decode prints it as text.
+ */
+
+#include "trace.h"
+#include "server.h"
+#include "compat.h"
+#include "log.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct trace_record *trace_ring = NULL;
+static struct trace_header *trace_hdr = NULL;
+static size_t trace_size;
+
+/**
+ * Map the trace file of the configuration, if there is one. A file
+ * with the same number of records is continued.
+ *
+ * @param c the configuration
+ *
+ * @return 1 on success or if tracing is disabled, 0 on failure
+ */
+int trace_open(struct config *c)
+{
+	struct trace_header *hdr;
+	struct stat st;
+	uint64_t nb = 1;
+	int fd;
+
+	if (c->log.trace == NULL)
+		return 1;
+	while (nb < (uint64_t)c->log.trace_records)
+		nb *= 2;
+	trace_size = sizeof(struct trace_header) + nb * sizeof(struct trace_record);
+
+	fd = open(c->log.trace, O_RDWR | O_CREAT, 0600);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		logger(LOG_ERR, "trace_open : could not open %s : %s.", c->log.trace, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return 0;
+	}
+	if ((size_t)st.st_size != trace_size && (ftruncate(fd, 0) == -1 || ftruncate(fd, trace_size) == -1)) {
+		logger(LOG_ERR, "trace_open : could not resize %s : %s.", c->log.trace, strerror(errno));
+		close(fd);
+		return 0;
+	}
+	hdr = mmap(NULL, trace_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		logger(LOG_ERR, "trace_open, mmap failed : %s.", strerror(errno));
+		return 0;
+	}
+	if (memcmp(hdr->magic, TRACE_MAGIC, 8) != 0 || hdr->version != TRACE_VERSION
+			|| hdr->record_size != sizeof(struct trace_record) || hdr->nb_records != nb) {
+		bzero(hdr, trace_size);
+		memcpy(hdr->magic, TRACE_MAGIC, 8);
+		hdr->version = TRACE_VERSION;
+		hdr->record_size = sizeof(struct trace_record);
+		hdr->nb_records = nb;
+	}
+	trace_hdr = hdr;
+	trace_ring = (struct trace_record *)(hdr + 1);
+	logger(LOG_INFO, "Tracing the packets to %s (%" PRIu64 " records).", c->log.trace, nb);
+	return 1;
+}
+
+/**
+ * Stop tracing, once the servers are stopped.
+ */
+void trace_close(void)
+{
+	if (trace_hdr == NULL)
+		return;
+	trace_ring = NULL;
+	munmap(trace_hdr, trace_size);
+	trace_hdr = NULL;
+}
+
+/**
+ * Record a packet (use the TRACE macro).
+ *
+ * @param s the server
+ * @param event TRACE_RECV, TRACE_CONTROL, TRACE_AUDIO or TRACE_SEND
+ * @param data the packet
+ * @param len the size of the packet
+ * @param outcome TRACE_OK or the reason it was refused
+ * @param arg the receivers of an audio packet, the times a packet was sent
+ */
+void trace_packet(struct server *s, int event, const char *data, size_t len, int outcome, int arg)
+{
+	struct trace_record *r;
+	struct timespec now;
+	uint64_t i;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	i = __atomic_fetch_add(&trace_hdr->next, 1, __ATOMIC_RELAXED);
+	r = &trace_ring[i & (trace_hdr->nb_records - 1)];
+	r->server = s->id;
+	r->type = (len >= 2) ? GUINT16_FROM_LE(*(uint16_t *)data) : 0;
+	r->opcode = (len >= 4) ? GUINT16_FROM_LE(*(uint16_t *)(data + 2)) : 0;
+	r->player = (len >= 12) ? GUINT32_FROM_LE(*(uint32_t *)(data + 8)) : 0;
+	if (r->type == 0xbef2) {
+		/* audio : the codec is the fourth byte, the counter
+		 * follows the conversation counter (16 bits each) */
+		r->opcode = (len >= 4) ? (uint8_t)data[3] : 0;
+		r->counter = (len >= 16) ? GUINT16_FROM_LE(*(uint16_t *)(data + 14)) : 0;
+	} else {
+		r->counter = (len >= 16) ? GUINT32_FROM_LE(*(uint32_t *)(data + 12)) : 0;
+	}
+	r->size = (len > 0xFFFF) ? 0xFFFF : len;
+	r->arg = arg;
+	r->event = event;
+	r->outcome = outcome;
+	r->time = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
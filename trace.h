@@ -0,0 +1,86 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC "SOLTRACE"
+#define TRACE_VERSION 1
+
+/* events */
+#define TRACE_RECV 1		/* packet received (handle_packet) */
+#define TRACE_CONTROL 2		/* command handled */
+#define TRACE_AUDIO 3		/* audio forwarded */
+#define TRACE_SEND 4		/* reliable packet sent from a player's queue */
+
+/* outcomes */
+#define TRACE_OK 0
+#define TRACE_NO_PLAYER 1	/* unknown public/private ids */
+#define TRACE_BAD_CRC 2
+#define TRACE_BAD_SIZE 3
+#define TRACE_UNKNOWN 4		/* no handler for this type or code */
+#define TRACE_BAD_CODEC 5
+#define TRACE_ERROR 6		/* allocation or socket error */
+#define TRACE_QUEUED 7		/* audio given to the audio thread */
+
+/* the file : a header, then a ring of records */
+struct trace_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t nb_records;	/* power of two */
+	uint64_t next;		/* index of the next record, never wraps */
+	char reserved[32];
+};
+
+/* 32 bytes, host byte order */
+struct trace_record
+{
+	uint64_t time;		/* microseconds since the epoch, 0 if never written */
+	uint32_t server;	/* id of the virtual server */
+	uint32_t player;	/* public id in the packet */
+	uint32_t counter;	/* counter of the packet */
+	uint16_t type;		/* 0xbef0 command, 0xbef1 ack, 0xbef2 audio, 0xbef4 connection */
+	uint16_t opcode;	/* code of the command or connection packet, codec of audio */
+	uint16_t size;
+	uint16_t arg;		/* TRACE_AUDIO : receivers, TRACE_SEND : times sent before */
+	uint8_t event;
+	uint8_t outcome;
+	uint16_t reserved;
+};
+
+struct server;
+struct config;
+
+extern struct trace_record *trace_ring;
+
+/* nothing but a test when tracing is disabled */
+#define TRACE(s, event, data, len, outcome, arg) do {\
+	if (trace_ring != NULL)\
+		trace_packet(s, event, data, len, outcome, arg);\
+} while (0)
+
+int trace_open(struct config *c);
+void trace_close(void);
+void trace_packet(struct server *s, int event, const char *data, size_t len, int outcome, int arg);
+
+#endif
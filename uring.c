@@ -0,0 +1,533 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * io_uring network backend (linux >= 6.0) : a receiving thread arms one
+ * multishot recvmsg fed by a provided buffer ring, and the packets it
+ * sends while handling them (audio, acks) are queued as sendmsg requests
+ * submitted all at once with the next io_uring_enter.
+ * There is no liburing dependency, the rings are mapped by hand.
+ */
+
+#include "uring.h"
+#include "config.h"
+#include "server.h"
+#include "packet_dispatch.h"
+#include "compat.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef HAVE_IO_URING
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 256
+/* buffers of the provided buffer ring, must be a power of 2 */
+#define URING_NB_BUFS 256
+#define URING_BGID 0
+#define URING_MAX_MSG 1024
+#define URING_BUF_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + URING_MAX_MSG)
+/* packets being sent at the same time */
+#define URING_NB_SENDS 256
+
+#define URING_TAG_RECV 0xFFFFFFFFULL
+#define URING_TAG_CANCEL 0xFFFFFFFEULL
+/* io_uring_enter calls waiting for the requests in flight, at most */
+#define URING_DRAIN_TRIES 50
+
+struct uring_send {
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_in addr;
+	char data[URING_MAX_MSG];
+	int next_free;
+};
+
+struct uring {
+	int fd;
+
+	/* submission queue */
+	void *sq_ptr;
+	size_t sq_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned sq_local_tail;
+	unsigned to_submit;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	/* completion queue */
+	void *cq_ptr;
+	size_t cq_size;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* provided buffers */
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_size;
+	char *bufs;
+	unsigned short buf_tail;
+
+	/* multishot recvmsg */
+	int socket_desc;
+	struct msghdr recv_msg;
+	int recv_armed;
+
+	struct uring_send *sends;
+	int free_send;
+	int nb_sending;		/* sends not completed yet */
+};
+
+/* the ring of the current receiving thread, used by uring_queue_send */
+static __thread struct uring *thread_ring = NULL;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	unsigned idx;
+
+	if (r->sq_local_tail - head >= URING_ENTRIES)
+		return NULL;
+	idx = r->sq_local_tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	r->sq_array[idx] = idx;
+	r->sq_local_tail++;
+	r->to_submit++;
+	return sqe;
+}
+
+/**
+ * Submit the queued requests and wait for at least
+ * one completion, or 100ms.
+ *
+ * @param r the ring
+ * @param wait 1 to wait for a completion, 0 to only submit
+ *
+ * @return the result of io_uring_enter
+ */
+static int uring_submit(struct uring *r, int wait)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	int ret;
+
+	__atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+	bzero(&arg, sizeof(arg));
+	ts.tv_sec = 0;
+	ts.tv_nsec = 100000000;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+	ret = sys_io_uring_enter(r->fd, r->to_submit, wait ? 1 : 0,
+			(wait ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG,
+			&arg, sizeof(arg));
+	if (ret >= 0)
+		r->to_submit -= MIN((unsigned)ret, r->to_submit);
+	return ret;
+}
+
+static void uring_recycle_buf(struct uring *r, unsigned short bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &r->buf_ring->bufs[r->buf_tail & (URING_NB_BUFS - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(r->bufs + bid * URING_BUF_SIZE);
+	buf->len = URING_BUF_SIZE;
+	buf->bid = bid;
+	r->buf_tail++;
+	__atomic_store_n(&r->buf_ring->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_arm_recv(struct uring *r)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	if (sqe == NULL)
+		return 0;
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = r->socket_desc;
+	sqe->addr = (uint64_t)(uintptr_t)&r->recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = URING_TAG_RECV;
+	r->recv_armed = 1;
+	return 1;
+}
+
+static void uring_unmap(struct uring *r)
+{
+	if (r->sqes != NULL)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	if (r->sq_ptr != NULL)
+		munmap(r->sq_ptr, r->sq_size);
+}
+
+/**
+ * Create the ring of a receiving socket.
+ *
+ * @param socket_desc the socket
+ *
+ * @return the ring, or NULL if io_uring (with multishot
+ * receive and buffer rings) is not available.
+ */
+struct uring *uring_new(int socket_desc)
+{
+	struct uring *r;
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	int i;
+
+	r = (struct uring *)calloc(1, sizeof(struct uring));
+	if (r == NULL) {
+		logger(LOG_WARN, "uring_new, calloc failed : %s.", strerror(errno));
+		return NULL;
+	}
+	bzero(&p, sizeof(p));
+	r->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+	if (r->fd < 0) {
+		logger(LOG_WARN, "uring_new, io_uring_setup : %s.", strerror(errno));
+		free(r);
+		return NULL;
+	}
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		logger(LOG_WARN, "uring_new : kernel too old.");
+		goto fail;
+	}
+
+	/* map the rings */
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_size = r->cq_size = (r->sq_size > r->cq_size) ? r->sq_size : r->cq_size;
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		r->sq_ptr = NULL;
+		goto fail;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			r->cq_ptr = NULL;
+			goto fail;
+		}
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+	r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->sq_local_tail = *r->sq_tail;
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+	/* provided buffer ring (5.19+) */
+	r->buf_ring_size = URING_NB_BUFS * sizeof(struct io_uring_buf);
+	r->buf_ring = mmap(NULL, r->buf_ring_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r->buf_ring == MAP_FAILED) {
+		r->buf_ring = NULL;
+		goto fail;
+	}
+	bzero(&reg, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)r->buf_ring;
+	reg.ring_entries = URING_NB_BUFS;
+	reg.bgid = URING_BGID;
+	if (sys_io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		logger(LOG_WARN, "uring_new, buffer ring : %s.", strerror(errno));
+		goto fail;
+	}
+	r->bufs = (char *)calloc(URING_NB_BUFS, URING_BUF_SIZE);
+	r->sends = (struct uring_send *)calloc(URING_NB_SENDS, sizeof(struct uring_send));
+	if (r->bufs == NULL || r->sends == NULL) {
+		logger(LOG_WARN, "uring_new, calloc failed : %s.", strerror(errno));
+		goto fail;
+	}
+	for (i = 0 ; i < URING_NB_BUFS ; i++)
+		uring_recycle_buf(r, i);
+	for (i = 0 ; i < URING_NB_SENDS ; i++)
+		r->sends[i].next_free = i + 1;
+	r->sends[URING_NB_SENDS - 1].next_free = -1;
+	r->free_send = 0;
+
+	r->socket_desc = socket_desc;
+	r->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+	return r;
+
+fail:
+	logger(LOG_WARN, "io_uring is not usable, using poll.");
+	uring_destroy(r);
+	return NULL;
+}
+
+/**
+ * Queue a packet to send from the current receiving thread,
+ * it is submitted with the next batch.
+ *
+ * @param buf the packet (it is copied)
+ * @param len the size of the packet
+ * @param addr the destination
+ * @param addr_len the size of the destination address
+ *
+ * @return 0 if the packet was queued, -1 if it must be sent directly
+ */
+int uring_queue_send(const void *buf, size_t len, struct sockaddr_in *addr, unsigned int addr_len)
+{
+	struct uring *r = thread_ring;
+	struct uring_send *snd;
+	struct io_uring_sqe *sqe;
+	int idx;
+
+	if (r == NULL || r->free_send == -1 || len > URING_MAX_MSG
+			|| addr_len > sizeof(struct sockaddr_in))
+		return -1;
+	sqe = uring_get_sqe(r);
+	if (sqe == NULL) {
+		/* the submission queue is full, push it to the kernel */
+		uring_submit(r, 0);
+		sqe = uring_get_sqe(r);
+		if (sqe == NULL)
+			return -1;
+	}
+	idx = r->free_send;
+	snd = &r->sends[idx];
+	r->free_send = snd->next_free;
+
+	memcpy(snd->data, buf, len);
+	memcpy(&snd->addr, addr, addr_len);
+	snd->iov.iov_base = snd->data;
+	snd->iov.iov_len = len;
+	bzero(&snd->msg, sizeof(snd->msg));
+	snd->msg.msg_name = &snd->addr;
+	snd->msg.msg_namelen = addr_len;
+	snd->msg.msg_iov = &snd->iov;
+	snd->msg.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = r->socket_desc;
+	sqe->addr = (uint64_t)(uintptr_t)&snd->msg;
+	sqe->len = 1;
+	sqe->user_data = idx;
+	r->nb_sending++;
+	return 0;
+}
+
+/* a NULL worker drops the packets */
+static void uring_handle_recv(struct recv_worker *w, struct uring *r, struct io_uring_cqe *cqe)
+{
+	struct io_uring_recvmsg_out *out;
+	struct sockaddr_in *cli_addr;
+	unsigned short bid;
+	char *buf;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		r->recv_armed = 0;
+	if (cqe->res < 0) {
+		if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+			logger(LOG_ERR, "uring recvmsg : %s", strerror(-cqe->res));
+		return;
+	}
+	if (!(cqe->flags & IORING_CQE_F_BUFFER))
+		return;
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	buf = r->bufs + bid * URING_BUF_SIZE;
+	out = (struct io_uring_recvmsg_out *)buf;
+	cli_addr = (struct sockaddr_in *)(buf + sizeof(struct io_uring_recvmsg_out));
+	if (w != NULL && !(out->flags & MSG_TRUNC) && out->namelen <= sizeof(struct sockaddr_in)) {
+		logger(LOG_INFO, "%i bytes received.", out->payloadlen);
+		handle_packet(buf + sizeof(struct io_uring_recvmsg_out) + r->recv_msg.msg_namelen,
+				out->payloadlen, cli_addr, out->namelen, w->s);
+	}
+	uring_recycle_buf(r, bid);
+}
+
+/**
+ * Handle the completed requests.
+ *
+ * @param w the receiving socket, NULL to drop the packets received
+ * @param r the ring
+ *
+ * @return 0, or -1 if the kernel has no multishot recvmsg
+ */
+static int uring_reap(struct recv_worker *w, struct uring *r)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	int ret = 0;
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for ( ; head != tail ; head++) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		if (cqe->user_data == URING_TAG_RECV) {
+			if (cqe->res == -EINVAL) {
+				/* no multishot recvmsg on this kernel */
+				r->recv_armed = 0;
+				ret = -1;
+				continue;
+			}
+			uring_handle_recv(w, r, cqe);
+		} else if (cqe->user_data != URING_TAG_CANCEL) {
+			if (cqe->res < 0)
+				logger(LOG_WARN, "uring sendmsg : %s", strerror(-cqe->res));
+			r->sends[cqe->user_data].next_free = r->free_send;
+			r->free_send = cqe->user_data;
+			r->nb_sending--;
+		}
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	return ret;
+}
+
+static void uring_cleanup(void *args)
+{
+	thread_ring = NULL;
+}
+
+/**
+ * Receive and handle the packets of a socket with its ring.
+ * This only returns if io_uring stops working, the caller can
+ * then fall back to poll.
+ *
+ * @param w the receiving socket (with its ring)
+ */
+void uring_run(struct recv_worker *w)
+{
+	struct uring *r = w->ring;
+	int ret, errors = 0;
+
+	thread_ring = r;
+	pthread_cleanup_push(uring_cleanup, NULL);
+	while (errors < 10) {
+		pthread_testcancel();
+		if (!r->recv_armed)
+			uring_arm_recv(r);
+		ret = uring_submit(r, 1);
+		if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+			logger(LOG_ERR, "uring_run, io_uring_enter : %s.", strerror(errno));
+			errors++;
+			continue;
+		}
+		if (uring_reap(w, r) == -1)
+			errors = 10;
+	}
+	logger(LOG_WARN, "io_uring backend stopped working, using poll.");
+	/* the next packets are sent directly, uring_destroy
+	 * waits for the ones queued on the ring */
+	pthread_cleanup_pop(1);
+}
+
+/**
+ * Destroy a ring. The receive is cancelled and the packets being sent
+ * are waited for first : the kernel uses the buffers until they
+ * complete. If they do not, the buffers are leaked.
+ * No packet is queued on the ring anymore (its thread has left
+ * uring_run or was cancelled).
+ *
+ * @param r the ring
+ */
+void uring_destroy(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	int tries;
+
+	if (r->recv_armed && (sqe = uring_get_sqe(r)) != NULL) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = URING_TAG_RECV;
+		sqe->user_data = URING_TAG_CANCEL;
+	}
+	for (tries = 0 ; (r->nb_sending > 0 || r->recv_armed) && tries < URING_DRAIN_TRIES ; tries++) {
+		uring_submit(r, 1);
+		uring_reap(NULL, r);
+	}
+	uring_unmap(r);
+	close(r->fd);
+	if (r->nb_sending > 0 || r->recv_armed) {
+		logger(LOG_WARN, "uring_destroy : %i packets still being sent, their buffers are leaked.",
+				r->nb_sending);
+		free(r);
+		return;
+	}
+	if (r->buf_ring != NULL)
+		munmap(r->buf_ring, r->buf_ring_size);
+	free(r->bufs);
+	free(r->sends);
+	free(r);
+}
+
+#else /* HAVE_IO_URING */
+
+struct uring *uring_new(int socket_desc)
+{
+	logger(LOG_WARN, "io_uring support not compiled in, using poll.");
+	return NULL;
+}
+
+void uring_destroy(struct uring *r)
+{
+}
+
+void uring_run(struct recv_worker *w)
+{
+}
+
+int uring_queue_send(const void *buf, size_t len, struct sockaddr_in *addr, unsigned int addr_len)
+{
+	return -1;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,33 @@
+/*
+ * soliloque-server, an open source implementation of the TeamSpeak protocol.
+ * Copyright (C) 2009 Hugo Camboulive <hugo.camboulive AT gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+struct uring;
+struct recv_worker;
+
+struct uring *uring_new(int socket_desc);
+void uring_destroy(struct uring *r);
+void uring_run(struct recv_worker *w);
+int uring_queue_send(const void *buf, size_t len, struct sockaddr_in *addr, unsigned int addr_len);
+
+#endif